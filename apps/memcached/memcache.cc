@@ -1253,15 +1253,18 @@ class udp_server {
         {}
 
         future<> respond(udp_channel& chan) {
+            std::vector<std::pair<ipv4_addr, packet>> datagrams;
+            datagrams.reserve(_out_bufs.size());
             int i = 0;
-            return do_for_each(_out_bufs.begin(), _out_bufs.end(), [this, i, &chan] (packet& p) mutable {
+            for (auto&& p : _out_bufs) {
                 header* out_hdr = p.prepend_header<header>(0);
                 out_hdr->_request_id = _request_id;
                 out_hdr->_sequence_number = i++;
                 out_hdr->_n = _out_bufs.size();
                 *out_hdr = hton(*out_hdr);
-                return chan.send(_src, std::move(p));
-            });
+                datagrams.emplace_back(_src, std::move(p));
+            }
+            return chan.send_batch(std::move(datagrams));
         }
     };
 
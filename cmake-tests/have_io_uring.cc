@@ -0,0 +1,29 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 Scylladb, Ltd.
+ */
+
+extern "C" {
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+}
+
+int main() {
+    int x = __NR_io_uring_setup + IORING_OP_READ + IORING_FEAT_NODROP + IORING_REGISTER_PROBE;
+}
@@ -161,6 +161,14 @@ def detect_membarrier(compiler, flags):
         int x = MEMBARRIER_CMD_PRIVATE_EXPEDITED | MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED;
         '''))
 
+def detect_io_uring(compiler, flags):
+    return try_compile(compiler=compiler, flags=flags, source=textwrap.dedent('''\
+        #include <linux/io_uring.h>
+        #include <sys/syscall.h>
+
+        int x = __NR_io_uring_setup + IORING_OP_READ + IORING_FEAT_NODROP + IORING_REGISTER_PROBE;
+        '''))
+
 def sanitize_vptr_flag(compiler, flags):
     # https://gcc.gnu.org/bugzilla/show_bug.cgi?id=67258
     if (not try_compile(compiler, flags=flags + ['-fsanitize=vptr'])
@@ -254,8 +262,10 @@ tests = [
     'tests/echotest',
     'tests/l3_test',
     'tests/ip_test',
+    'tests/ipv4_frag_test',
     'tests/timer_test',
     'tests/tcp_test',
+    'tests/loopback_test',
     'tests/futures_test',
     'tests/alloc_test',
     'tests/foreign_ptr_test',
@@ -285,6 +295,8 @@ tests = [
     'tests/semaphore_test',
     'tests/expiring_fifo_test',
     'tests/packet_test',
+    'tests/offload_test',
+    'tests/tcp_congestion_test',
     'tests/tls_test',
     'tests/fair_queue_test',
     'tests/rpc_test',
@@ -427,6 +439,8 @@ if args.cmake:
 libnet = [
     'net/proxy.cc',
     'net/virtio.cc',
+    'net/loopback.cc',
+    'net/offload.cc',
     'net/dpdk.cc',
     'net/ip.cc',
     'net/ethernet.cc',
@@ -435,6 +449,7 @@ libnet = [
     'net/ip_checksum.cc',
     'net/udp.cc',
     'net/tcp.cc',
+    'net/tcp-congestion.cc',
     'net/dhcp.cc',
     'net/tls.cc',
     'net/dns.cc',
@@ -447,6 +462,7 @@ core = [
     'core/execution_stage.cc',
     'core/systemwide_memory_barrier.cc',
     'core/fstream.cc',
+    'core/cached_file.cc',
     'core/posix.cc',
     'core/memory.cc',
     'core/resource.cc',
@@ -457,6 +473,7 @@ core = [
     'core/dpdk_rte.cc',
     'core/fsqual.cc',
     'core/linux-aio.cc',
+    'core/linux-uring.cc',
     'util/conversions.cc',
     'util/program-options.cc',
     'util/log.cc',
@@ -557,7 +574,9 @@ deps = {
     'tests/echotest': ['tests/echotest.cc'] + core + libnet,
     'tests/l3_test': ['tests/l3_test.cc'] + core + libnet,
     'tests/ip_test': ['tests/ip_test.cc'] + core + libnet,
+    'tests/ipv4_frag_test': ['tests/ipv4_frag_test.cc'] + core + libnet,
     'tests/tcp_test': ['tests/tcp_test.cc'] + core + libnet,
+    'tests/loopback_test': ['tests/loopback_test.cc'] + core + libnet,
     'tests/timer_test': ['tests/timertest.cc'] + core,
     'tests/futures_test': ['tests/futures_test.cc'] + core,
     'tests/alloc_test': ['tests/alloc_test.cc'] + core,
@@ -593,6 +612,8 @@ deps = {
     'tests/rpc': ['tests/rpc.cc'] + core + libnet,
     'tests/rpc_test': ['tests/rpc_test.cc'] + core + libnet,
     'tests/packet_test': ['tests/packet_test.cc'] + core + libnet,
+    'tests/offload_test': ['tests/offload_test.cc'] + core + libnet,
+    'tests/tcp_congestion_test': ['tests/tcp_congestion_test.cc'] + core + libnet,
     'tests/connect_test': ['tests/connect_test.cc'] + core + libnet,
     'tests/chunked_fifo_test': ['tests/chunked_fifo_test.cc'] + core,
     'tests/circular_buffer_test': ['tests/circular_buffer_test.cc'] + core,
@@ -634,6 +655,7 @@ boost_tests = [
     'tests/execution_stage_test',
     'tests/lowres_clock_test',
     'tests/abort_source_test',
+    'tests/ipv4_frag_test',
     ]
 
 for bt in boost_tests:
@@ -794,6 +816,9 @@ if apply_tristate(args.hwloc, test = have_hwloc,
 if detect_membarrier(compiler=args.cxx, flags=args.user_cflags.split()):
     defines.append('SEASTAR_HAS_MEMBARRIER')
 
+if detect_io_uring(compiler=args.cxx, flags=args.user_cflags.split()):
+    defines.append('SEASTAR_HAVE_IO_URING')
+
 if try_compile(args.cxx, source = textwrap.dedent('''\
         #include <lz4.h>
 
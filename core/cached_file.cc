@@ -0,0 +1,392 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "cached_file.hh"
+#include "align.hh"
+#include "future-util.hh"
+#include "memory.hh"
+#include "metrics.hh"
+#include "shared_future.hh"
+#include <boost/intrusive/list.hpp>
+#include <experimental/optional>
+#include <map>
+#include <tuple>
+#include <cstring>
+
+namespace seastar {
+
+namespace bi = boost::intrusive;
+
+namespace {
+
+class block_cache {
+public:
+    struct key {
+        dev_t dev;
+        ino_t ino;
+        uint64_t pos;
+        bool operator<(const key& o) const {
+            return std::tie(dev, ino, pos) < std::tie(o.dev, o.ino, o.pos);
+        }
+    };
+    struct block {
+        key k;
+        temporary_buffer<uint8_t> data;
+        // Engaged while the block is being read from disk
+        std::experimental::optional<shared_promise<>> loading;
+        bi::list_member_hook<bi::link_mode<bi::auto_unlink>> lru_link;
+
+        explicit block(key k) : k(k), loading(shared_promise<>()) {}
+        future<> ready() const {
+            return loading ? loading->get_shared_future() : make_ready_future<>();
+        }
+    };
+private:
+    using lru_list = bi::list<block,
+        bi::member_hook<block, bi::list_member_hook<bi::link_mode<bi::auto_unlink>>, &block::lru_link>,
+        bi::constant_time_size<false>>;
+
+    // Blocks being read are in _blocks but not in _lru, and are not accounted
+    // in _stats.size.
+    std::map<key, lw_shared_ptr<block>> _blocks;
+    lru_list _lru;
+    block_cache_stats _stats;
+    memory::reclaimer _reclaimer;
+    metrics::metric_groups _metrics;
+private:
+    void evict_one() {
+        auto& b = _lru.front();
+        _lru.pop_front();
+        _stats.size -= b.data.size();
+        _stats.evictions++;
+        _blocks.erase(b.k);
+    }
+    void evict_to(size_t size) {
+        while (_stats.size > size && !_lru.empty()) {
+            evict_one();
+        }
+    }
+    memory::reclaiming_result reclaim() {
+        if (_lru.empty()) {
+            return memory::reclaiming_result::reclaimed_nothing;
+        }
+        // Give back a good chunk at once, so we aren't asked again right away.
+        evict_to(_stats.size - std::min(_stats.size, size_t(1) << 20));
+        return memory::reclaiming_result::reclaimed_something;
+    }
+public:
+    block_cache()
+        : _reclaimer([this] { return reclaim(); }) {
+        _stats.capacity = memory::stats().total_memory() / 20;
+        namespace sm = seastar::metrics;
+        _metrics.add_group("block_cache", {
+            sm::make_derive("hits", _stats.hits, sm::description("Total blocks served from the block cache")),
+            sm::make_derive("misses", _stats.misses, sm::description("Total blocks read from disk through the block cache")),
+            sm::make_derive("joins", _stats.joins, sm::description("Total blocks served by a read already in flight")),
+            sm::make_derive("evictions", _stats.evictions, sm::description("Total blocks evicted from the block cache")),
+            sm::make_gauge("bytes", [this] { return _stats.size; }, sm::description("Bytes held by the block cache")),
+        });
+    }
+    static block_cache& local() {
+        // Intentionally leaked: it must outlive every cached file of the shard.
+        static thread_local block_cache* cache = new block_cache;
+        return *cache;
+    }
+
+    // Returns the block if it is cached or being read, or nullptr.
+    lw_shared_ptr<block> find(const key& k) {
+        auto i = _blocks.find(k);
+        if (i == _blocks.end()) {
+            return nullptr;
+        }
+        auto& b = i->second;
+        if (b->loading) {
+            _stats.joins++;
+        } else {
+            _stats.hits++;
+            b->lru_link.unlink();
+            _lru.push_back(*b);
+        }
+        return b;
+    }
+
+    bool contains(const key& k) const {
+        return _blocks.count(k);
+    }
+
+    // Registers a block about to be read, so that concurrent readers wait for it.
+    lw_shared_ptr<block> start_load(const key& k) {
+        _stats.misses++;
+        auto b = make_lw_shared<block>(k);
+        _blocks.emplace(k, b);
+        return b;
+    }
+
+    // Completes a read started by start_load(); the block stays cached unless
+    // it was invalidated while being read, or is the short block at EOF.
+    void finish_load(const lw_shared_ptr<block>& b, temporary_buffer<uint8_t> data, size_t block_size) {
+        auto loading = std::move(*b->loading);
+        b->loading = {};
+        b->data = std::move(data);
+        auto i = _blocks.find(b->k);
+        if (i != _blocks.end() && i->second == b) {
+            if (b->data.size() == block_size) {
+                _lru.push_back(*b);
+                _stats.size += b->data.size();
+                evict_to(_stats.capacity);
+            } else {
+                _blocks.erase(i);
+            }
+        }
+        loading.set_value();
+    }
+
+    void fail_load(const lw_shared_ptr<block>& b, std::exception_ptr ex) {
+        auto loading = std::move(*b->loading);
+        b->loading = {};
+        auto i = _blocks.find(b->k);
+        if (i != _blocks.end() && i->second == b) {
+            _blocks.erase(i);
+        }
+        loading.set_exception(std::move(ex));
+    }
+
+    // Drops the blocks of a file that start in [from, to).
+    void invalidate(dev_t dev, ino_t ino, uint64_t from, uint64_t to) {
+        auto i = _blocks.lower_bound(key{dev, ino, from});
+        auto end = _blocks.lower_bound(key{dev, ino, to});
+        while (i != end) {
+            auto& b = *i->second;
+            if (!b.loading) {
+                b.lru_link.unlink();
+                _stats.size -= b.data.size();
+            }
+            i = _blocks.erase(i);
+        }
+    }
+
+    void set_capacity(size_t bytes) {
+        _stats.capacity = bytes;
+        evict_to(bytes);
+    }
+
+    const block_cache_stats& stats() const {
+        return _stats;
+    }
+};
+
+class cached_file_impl : public file_impl {
+    file _file;
+    dev_t _dev;
+    ino_t _ino;
+    uint64_t _block_size;
+    block_cache& _cache = block_cache::local();
+private:
+    block_cache::key key_of(uint64_t pos) const {
+        return block_cache::key{_dev, _ino, pos};
+    }
+    // Reads blocks [from, to) from disk with a single request.
+    void load(uint64_t from, uint64_t to, const io_priority_class& pc, std::vector<lw_shared_ptr<block_cache::block>>& blocks) {
+        std::vector<lw_shared_ptr<block_cache::block>> loading;
+        for (auto pos = from; pos < to; pos += _block_size) {
+            loading.push_back(_cache.start_load(key_of(pos)));
+        }
+        blocks.insert(blocks.end(), loading.begin(), loading.end());
+        _file.dma_read_bulk<uint8_t>(from, to - from, pc).then_wrapped(
+                [&cache = _cache, block_size = _block_size, loading = std::move(loading)] (future<temporary_buffer<uint8_t>> f) {
+            if (f.failed()) {
+                auto ex = f.get_exception();
+                for (auto& b : loading) {
+                    cache.fail_load(b, ex);
+                }
+                return;
+            }
+            auto buf = f.get0();
+            size_t pos = 0;
+            for (auto& b : loading) {
+                // Copy, so that each block can be evicted on its own.
+                auto len = std::min(block_size, buf.size() - std::min(pos, buf.size()));
+                auto data = len ? temporary_buffer<uint8_t>(buf.get() + pos, len) : temporary_buffer<uint8_t>();
+                cache.finish_load(b, std::move(data), block_size);
+                pos += block_size;
+            }
+        });
+    }
+    void invalidate(uint64_t pos, uint64_t len) {
+        auto from = align_down(pos, _block_size);
+        auto to = len == std::numeric_limits<uint64_t>::max() ? len : align_up(pos + len, _block_size);
+        _cache.invalidate(_dev, _ino, from, to);
+    }
+    // Invalidates before a write, and again once the kernel applied it,
+    // in case a read of the old data raced with it.
+    template <typename Func>
+    future<size_t> write_and_invalidate(uint64_t pos, size_t len, Func&& write) {
+        invalidate(pos, len);
+        return write().finally([this, pos, len] {
+            invalidate(pos, len);
+        });
+    }
+public:
+    cached_file_impl(file f, dev_t dev, ino_t ino)
+        : _file(std::move(f)), _dev(dev), _ino(ino) {
+        auto impl = get_file_impl(_file);
+        _memory_dma_alignment = impl->_memory_dma_alignment;
+        _disk_read_dma_alignment = impl->_disk_read_dma_alignment;
+        _disk_write_dma_alignment = impl->_disk_write_dma_alignment;
+        _disk_read_max_length = impl->_disk_read_max_length;
+        _block_size = std::max<uint64_t>(_disk_read_dma_alignment, 4096);
+    }
+
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc) override {
+        if (!range_size) {
+            return make_ready_future<temporary_buffer<uint8_t>>();
+        }
+        auto first = align_down(offset, _block_size);
+        auto last = align_up(offset + range_size, _block_size);
+        std::vector<lw_shared_ptr<block_cache::block>> blocks;
+        blocks.reserve((last - first) / _block_size);
+        for (auto pos = first; pos < last;) {
+            if (auto b = _cache.find(key_of(pos))) {
+                blocks.push_back(std::move(b));
+                pos += _block_size;
+                continue;
+            }
+            auto end = pos + _block_size;
+            while (end < last && !_cache.contains(key_of(end))) {
+                end += _block_size;
+            }
+            load(pos, end, pc, blocks);
+            pos = end;
+        }
+        return do_with(std::move(blocks), [offset, range_size, first, this] (auto& blocks) {
+            return parallel_for_each(blocks, [] (auto& b) {
+                return b->ready();
+            }).then([&blocks, offset, range_size, first, this] {
+                auto skip = offset - first;
+                if (blocks.size() == 1) {
+                    auto& data = blocks[0]->data;
+                    if (skip >= data.size()) {
+                        return temporary_buffer<uint8_t>();
+                    }
+                    return data.share(skip, std::min(range_size, data.size() - skip));
+                }
+                auto ret = temporary_buffer<uint8_t>::aligned(_memory_dma_alignment, range_size);
+                size_t done = 0;
+                for (auto& b : blocks) {
+                    auto& data = b->data;
+                    if (skip >= data.size()) {
+                        break;
+                    }
+                    auto n = std::min(data.size() - skip, range_size - done);
+                    std::memcpy(ret.get_write() + done, data.get() + skip, n);
+                    done += n;
+                    // A short block is the end of the file.
+                    if (data.size() < _block_size) {
+                        break;
+                    }
+                    skip = 0;
+                }
+                ret.trim(done);
+                return ret;
+            });
+        });
+    }
+    virtual future<size_t> read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& pc) override {
+        return dma_read_bulk(pos, len, pc).then([buffer] (temporary_buffer<uint8_t> buf) {
+            std::memcpy(buffer, buf.get(), buf.size());
+            return buf.size();
+        });
+    }
+    virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        size_t len = 0;
+        for (auto& v : iov) {
+            len += v.iov_len;
+        }
+        return dma_read_bulk(pos, len, pc).then([iov = std::move(iov)] (temporary_buffer<uint8_t> buf) {
+            size_t done = 0;
+            for (auto& v : iov) {
+                auto n = std::min(v.iov_len, buf.size() - done);
+                std::memcpy(v.iov_base, buf.get() + done, n);
+                done += n;
+            }
+            return done;
+        });
+    }
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& pc) override {
+        return write_and_invalidate(pos, len, [this, pos, buffer, len, &pc] {
+            return get_file_impl(_file)->write_dma(pos, buffer, len, pc);
+        });
+    }
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class& pc) override {
+        size_t len = 0;
+        for (auto& v : iov) {
+            len += v.iov_len;
+        }
+        return write_and_invalidate(pos, len, [this, pos, iov = std::move(iov), &pc] () mutable {
+            return get_file_impl(_file)->write_dma(pos, std::move(iov), pc);
+        });
+    }
+    virtual future<> flush() override {
+        return _file.flush();
+    }
+    virtual future<struct stat> stat() override {
+        return _file.stat();
+    }
+    virtual future<> truncate(uint64_t length) override {
+        invalidate(length, std::numeric_limits<uint64_t>::max());
+        return _file.truncate(length);
+    }
+    virtual future<> discard(uint64_t offset, uint64_t length) override {
+        invalidate(offset, length);
+        return _file.discard(offset, length);
+    }
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        return _file.allocate(position, length);
+    }
+    virtual future<uint64_t> size() override {
+        return _file.size();
+    }
+    virtual future<> close() override {
+        return _file.close();
+    }
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override {
+        return _file.list_directory(std::move(next));
+    }
+};
+
+}
+
+future<file> make_cached_file(file f) {
+    return f.stat().then([f] (struct stat st) mutable {
+        return file(make_shared<cached_file_impl>(std::move(f), st.st_dev, st.st_ino));
+    });
+}
+
+void set_block_cache_capacity(size_t bytes) {
+    block_cache::local().set_capacity(bytes);
+}
+
+block_cache_stats get_block_cache_stats() {
+    return block_cache::local().stats();
+}
+
+}
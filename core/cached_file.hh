@@ -0,0 +1,73 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include "file.hh"
+
+namespace seastar {
+
+/// \addtogroup fileio-module
+/// @{
+
+/// Counters of the calling shard's block cache.
+struct block_cache_stats {
+    uint64_t hits = 0;       ///< blocks served from the cache
+    uint64_t misses = 0;     ///< blocks read from disk
+    uint64_t joins = 0;      ///< blocks served by another reader's in-flight read
+    uint64_t evictions = 0;  ///< blocks evicted to respect the capacity, or to free memory
+    size_t size = 0;         ///< bytes held by cached blocks
+    size_t capacity = 0;     ///< maximum bytes held by cached blocks
+};
+
+/// Wraps a file so that its reads go through the shard's block cache.
+///
+/// Each shard has one cache of \ref file::disk_read_dma_alignment -sized
+/// blocks (at least 4096 bytes), shared by all cached files of that shard and
+/// keyed by device and inode, so that several cached \c file objects opened on
+/// the same file share their blocks. Concurrent reads of a block that is not
+/// cached issue a single disk read. Blocks are evicted least recently used
+/// first, when the cache reaches its capacity or when the shard runs low on
+/// memory.
+///
+/// The underlying reads still bypass the kernel page cache, so what is cached
+/// and for how long stays under the application's control.
+///
+/// Writes, truncations and discards through the returned file invalidate the
+/// blocks they touch. Modifications through other \c file objects (or other
+/// processes) are not seen until the blocks are evicted. The partial block at
+/// the end of the file is never cached.
+///
+/// \param f file to wrap; it is closed when the returned file is closed
+/// \return a file that serves reads from the cache
+future<file> make_cached_file(file f);
+
+/// Sets the capacity of the calling shard's block cache, evicting blocks
+/// if it is already larger. Defaults to 5% of the shard's memory.
+void set_block_cache_capacity(size_t bytes);
+
+/// Returns the counters of the calling shard's block cache.
+block_cache_stats get_block_cache_stats();
+
+/// @}
+
+}
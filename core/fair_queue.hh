@@ -28,11 +28,14 @@
 #include "circular_buffer.hh"
 #include "util/noncopyable_function.hh"
 #include <queue>
+#include <algorithm>
 #include <type_traits>
 #include <experimental/optional>
 #include <chrono>
 #include <unordered_set>
 #include <cmath>
+#include <atomic>
+#include <memory>
 
 namespace seastar {
 
@@ -42,25 +45,103 @@ namespace seastar {
 struct fair_queue_request_descriptor {
     unsigned weight = 1; ///< the weight of this request for capacity purposes (IOPS).
     unsigned size = 1;        ///< the effective size of this request
+    size_t bytes = 0;         ///< the actual size of this request, for bandwidth limits
 };
 
 /// \addtogroup io-module
 /// @{
 
 /// \cond internal
+/// Token buckets enforcing the rate limits of a priority class, in bytes and in
+/// requests per second (0 if unlimited). They may be shared by classes of several
+/// fair queues, see \ref fair_group.
+///
+/// Each bucket is kept as the time at which it runs out of tokens. Consuming tokens
+/// pushes it forward by the time they take to earn, and it never lags the current
+/// time by more than the burst, which is how many tokens a full bucket holds. A
+/// request may be dispatched while that time is not in the future, taking the bucket
+/// into debt if it is large, so that over time the rate is exact. Being a single
+/// atomic, a bucket is shared without locks.
+class fair_rate_limit {
+    using time_point = std::chrono::steady_clock::time_point;
+    using duration = std::chrono::steady_clock::duration;
+
+    struct bucket {
+        std::atomic<uint64_t> per_second = { 0 };
+        std::atomic<duration::rep> empty_at = { 0 };
+
+        time_point available_at() const {
+            return time_point(duration(empty_at.load(std::memory_order_relaxed)));
+        }
+        void set(uint64_t rate, time_point now, duration burst) {
+            if (per_second.exchange(rate, std::memory_order_relaxed) != rate) {
+                // Start full.
+                empty_at.store((now - burst).time_since_epoch().count(), std::memory_order_relaxed);
+            }
+        }
+        void consume(uint64_t amount, time_point now, duration burst) {
+            auto rate = per_second.load(std::memory_order_relaxed);
+            if (!rate) {
+                return;
+            }
+            auto cost = duration::rep(amount * uint64_t(duration::period::den) / (uint64_t(duration::period::num) * rate));
+            auto full_at = (now - burst).time_since_epoch().count();
+            auto cur = empty_at.load(std::memory_order_relaxed);
+            while (!empty_at.compare_exchange_weak(cur, std::max(cur, full_at) + cost, std::memory_order_relaxed)) {
+            }
+        }
+    };
+    bucket _bytes;
+    bucket _ops;
+public:
+    uint64_t bytes_per_second() const {
+        return _bytes.per_second.load(std::memory_order_relaxed);
+    }
+    uint64_t ops_per_second() const {
+        return _ops.per_second.load(std::memory_order_relaxed);
+    }
+    // Changing a limit refills its bucket.
+    void set(uint64_t bytes_per_second, uint64_t ops_per_second, time_point now, duration burst) {
+        _bytes.set(bytes_per_second, now, burst);
+        _ops.set(ops_per_second, now, burst);
+    }
+    // When the buckets are out of debt, if no more tokens are consumed.
+    time_point available_at() const {
+        return std::max(_bytes.available_at(), _ops.available_at());
+    }
+    bool throttled(time_point now) const {
+        return available_at() > now;
+    }
+    void consume(const fair_queue_request_descriptor& desc, time_point now, duration burst) {
+        _bytes.consume(desc.bytes, now, burst);
+        _ops.consume(1, now, burst);
+    }
+};
+
 class priority_class {
     struct request {
         noncopyable_function<void()> func;
         fair_queue_request_descriptor desc;
+        std::chrono::steady_clock::time_point queued_at; // only set for classes with a latency target
     };
     friend class fair_queue;
     uint32_t _shares = 0;
     float _accumulated = 0;
+    // Cost of requests dispatched ahead of share order, charged to _accumulated
+    // the next time this class is (re)inserted into or removed from the heap.
+    float _deadline_debt = 0;
+    std::chrono::microseconds _latency_target{0};
+    uint64_t _deadline_dispatches = 0;
+    // The class' own rate limits, unless it shares those of a fair_group.
+    fair_rate_limit _own_rate_limit;
+    fair_rate_limit* _rate_limit = &_own_rate_limit;
+    uint64_t _throttled_dispatches = 0;
     circular_buffer<request> _queue;
     bool _queued = false;
 
     friend struct shared_ptr_no_esft<priority_class>;
-    explicit priority_class(uint32_t shares) : _shares(std::max(shares, 1u)) {}
+    explicit priority_class(uint32_t shares, std::chrono::microseconds latency_target = {})
+        : _shares(std::max(shares, 1u)), _latency_target(latency_target) {}
 
     void update_shares(uint32_t shares) {
         _shares = (std::max(shares, 1u));
@@ -70,6 +151,33 @@ class priority_class {
     uint32_t shares() const {
         return _shares;
     }
+
+    /// \brief return the latency target of this priority class, or zero if it has none
+    std::chrono::microseconds latency_target() const {
+        return _latency_target;
+    }
+
+    /// \brief return how many requests of this class were dispatched ahead of share order
+    /// to meet the latency target
+    uint64_t deadline_dispatches() const {
+        return _deadline_dispatches;
+    }
+
+    /// \brief return the bandwidth limit of this priority class in bytes per second, or zero if it has none
+    uint64_t bytes_per_second() const {
+        return _rate_limit->bytes_per_second();
+    }
+
+    /// \brief return the IOPS limit of this priority class, or zero if it has none
+    uint64_t ops_per_second() const {
+        return _rate_limit->ops_per_second();
+    }
+
+    /// \brief return how many times this class had requests to dispatch, but had
+    /// to wait because of its rate limits
+    uint64_t throttled_dispatches() const {
+        return _throttled_dispatches;
+    }
 };
 /// \endcond
 
@@ -83,6 +191,87 @@ class priority_class {
 /// \related fair_queue
 using priority_class_ptr = lw_shared_ptr<priority_class>;
 
+/// \brief Capacity shared by several fair queues
+///
+/// The fair queues of different shards that serve the same device share its capacity
+/// through a fair_group. Dispatching a request claims its part of the group's limits
+/// with atomic operations, without locks or cross-shard messages, and finishing it
+/// gives it back. Each queue still orders its own classes; when the group runs out
+/// of capacity, the queue tries again on its next dispatch.
+///
+/// The group also holds rate limits that classes of its queues may share (see
+/// \ref fair_queue::share_rate_limits), so that a limit applies to the requests of
+/// all shards together, whichever shards use it.
+///
+/// \related fair_queue
+class fair_group {
+public:
+    struct config {
+        unsigned capacity = std::numeric_limits<unsigned>::max();
+        unsigned max_req_count = std::numeric_limits<unsigned>::max();
+        unsigned max_bytes_count = std::numeric_limits<unsigned>::max();
+        /// How many shared rate limits the group holds, indexed from 0.
+        unsigned shared_rate_limits = 0;
+    };
+private:
+    config _config;
+    std::unique_ptr<fair_rate_limit[]> _rate_limits;
+    std::atomic<uint64_t> _requests_executing = { 0 };
+    std::atomic<uint64_t> _req_count_executing = { 0 };
+    std::atomic<uint64_t> _bytes_count_executing = { 0 };
+
+    // Adds amount to counter, unless it already reached limit.
+    static bool try_add(std::atomic<uint64_t>& counter, uint64_t amount, uint64_t limit) {
+        auto cur = counter.load(std::memory_order_relaxed);
+        do {
+            if (cur >= limit) {
+                return false;
+            }
+        } while (!counter.compare_exchange_weak(cur, cur + amount, std::memory_order_relaxed));
+        return true;
+    }
+public:
+    explicit fair_group(config cfg) : _config(cfg), _rate_limits(new fair_rate_limit[cfg.shared_rate_limits]) {}
+    fair_group(const fair_group&) = delete;
+
+    /// Claims the capacity needed by a request, if the group has any left.
+    ///
+    /// \return whether the request may be dispatched
+    bool try_claim(const fair_queue_request_descriptor& desc) {
+        if (!try_add(_requests_executing, 1, _config.capacity)) {
+            return false;
+        }
+        if (!try_add(_req_count_executing, desc.weight, _config.max_req_count)) {
+            _requests_executing.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (!try_add(_bytes_count_executing, desc.size, _config.max_bytes_count)) {
+            _req_count_executing.fetch_sub(desc.weight, std::memory_order_relaxed);
+            _requests_executing.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /// Gives back the capacity claimed by a request that finished.
+    void release(const fair_queue_request_descriptor& desc) {
+        _bytes_count_executing.fetch_sub(desc.size, std::memory_order_relaxed);
+        _req_count_executing.fetch_sub(desc.weight, std::memory_order_relaxed);
+        _requests_executing.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    /// \return the number of requests executing in all queues of the group
+    uint64_t requests_currently_executing() const {
+        return _requests_executing.load(std::memory_order_relaxed);
+    }
+
+    /// \return the id-th of the rate limits shared by the group's queues
+    fair_rate_limit& rate_limit(unsigned id) {
+        assert(id < _config.shared_rate_limits);
+        return _rate_limits[id];
+    }
+};
+
 /// \brief Fair queuing class
 ///
 /// This is a fair queue, allowing multiple request producers to queue requests
@@ -102,6 +291,18 @@ using priority_class_ptr = lw_shared_ptr<priority_class>;
 /// When the classes that lag behind start seeing requests, the fair queue will serve
 /// them first, until balance is restored. This balancing is expected to happen within
 /// a certain time window that obeys an exponential decay.
+///
+/// A class may also be given a latency target. Once the request at the head of such a
+/// class has waited for half of its target, it is dispatched ahead of share order (the
+/// most urgent such request first). It is still charged for it, so over time the class
+/// gets no more than its shares unless the other classes leave capacity unused.
+///
+/// Finally, a class may be rate limited, in bytes and/or requests per second. Those are
+/// hard caps, enforced with token buckets regardless of shares, latency targets and unused
+/// capacity: a class that is within its limits competes for the capacity as usual, while a
+/// class that exceeds them waits, leaving the capacity to the others. A class that stayed
+/// below its limits may use the unused tokens in a burst of up to \c config::rate_limit_burst
+/// worth of its rate.
 class fair_queue {
 public:
     /// \brief Fair Queue configuration structure.
@@ -113,6 +314,9 @@ class fair_queue {
         std::chrono::microseconds tau = std::chrono::milliseconds(100);
         unsigned max_req_count = std::numeric_limits<unsigned>::max();
         unsigned max_bytes_count = std::numeric_limits<unsigned>::max();
+        std::chrono::microseconds rate_limit_burst = std::chrono::milliseconds(10);
+        /// If set, requests must also fit in the group's capacity, shared with other queues.
+        fair_group* group = nullptr;
     };
 private:
     friend priority_class;
@@ -133,9 +337,20 @@ class fair_queue {
     using prioq = std::priority_queue<priority_class_ptr, std::vector<priority_class_ptr>, class_compare>;
     prioq _handles;
     std::unordered_set<priority_class_ptr> _all_classes;
+    std::vector<priority_class_ptr> _deadline_classes;
+    // Classes taken out of the heap during a dispatch because of their rate limits.
+    std::vector<priority_class_ptr> _throttled_classes;
+
+    // _accumulated can't change while a class sits in the heap, so this is where
+    // deadline dispatches are finally paid for.
+    static void settle_deadline_debt(priority_class& pc) {
+        pc._accumulated += pc._deadline_debt;
+        pc._deadline_debt = 0;
+    }
 
     void push_priority_class(priority_class_ptr pc) {
         if (!pc->_queued) {
+            settle_deadline_debt(*pc);
             _handles.push(pc);
             pc->_queued = true;
         }
@@ -147,9 +362,50 @@ class fair_queue {
         _handles.pop();
         assert(h->_queued);
         h->_queued = false;
+        settle_deadline_debt(*h);
         return h;
     }
 
+    // Returns the class whose head request is closest to missing its latency
+    // target, if it has already waited for at least half of it.
+    priority_class_ptr urgent_priority_class(std::chrono::steady_clock::time_point now) const {
+        if (_deadline_classes.empty()) {
+            return {};
+        }
+        priority_class_ptr ret;
+        auto ret_deadline = std::chrono::steady_clock::time_point::max();
+        for (auto& pc : _deadline_classes) {
+            if (pc->_queue.empty() || pc->_rate_limit->throttled(now)) {
+                continue;
+            }
+            auto queued_at = pc->_queue.front().queued_at;
+            if (now - queued_at < pc->_latency_target / 2) {
+                continue;
+            }
+            auto deadline = queued_at + pc->_latency_target;
+            if (deadline < ret_deadline) {
+                ret = pc;
+                ret_deadline = deadline;
+            }
+        }
+        return ret;
+    }
+
+    // Returns the cost of a request of class pc, to be added to \c charged_to (one of
+    // pc's accumulators), renormalizing all classes first if the sum would overflow.
+    float request_cost(const priority_class& pc, const fair_queue_request_descriptor& desc, const float& charged_to) {
+        auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+        auto req_cost  = (float(desc.weight) / _config.max_req_count + float(desc.size) / _config.max_bytes_count) / pc._shares;
+        auto cost  = expf(1.0f/_config.tau.count() * delta.count()) * req_cost;
+        while (std::isinf(charged_to + cost)) {
+            normalize_stats();
+            // If we have renormalized, our time base will have changed. This should happen very infrequently
+            delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
+            cost  = expf(1.0f/_config.tau.count() * delta.count()) * req_cost;
+        }
+        return cost;
+    }
+
     float normalize_factor() const {
         return std::numeric_limits<float>::min();
     }
@@ -160,9 +416,22 @@ class fair_queue {
         _base -= std::chrono::duration_cast<clock_type::duration>(time_delta);
         for (auto& pc: _all_classes) {
             pc->_accumulated *= normalize_factor();
+            pc->_deadline_debt *= normalize_factor();
         }
     }
 
+    bool claim_capacity(const fair_queue_request_descriptor& desc) {
+        return !_config.group || _config.group->try_claim(desc);
+    }
+
+    void start_request(priority_class& pc, const fair_queue_request_descriptor& desc, std::chrono::steady_clock::time_point now) {
+        pc._rate_limit->consume(desc, now, _config.rate_limit_burst);
+        _requests_executing++;
+        _req_count_executing += desc.weight;
+        _bytes_count_executing += desc.size;
+        _requests_queued--;
+    }
+
     bool can_dispatch() const {
         return _requests_queued &&
                (_requests_executing < _config.capacity) &&
@@ -188,9 +457,15 @@ class fair_queue {
     /// Registers a priority class against this fair queue.
     ///
     /// \param shares, how many shares to create this class with
-    priority_class_ptr register_priority_class(uint32_t shares) {
-        priority_class_ptr pclass = make_lw_shared<priority_class>(shares);
+    /// \param latency_target, if nonzero, how long requests of this class should wait
+    ///        in the queue at most; they are dispatched ahead of share order as they
+    ///        approach it.
+    priority_class_ptr register_priority_class(uint32_t shares, std::chrono::microseconds latency_target = {}) {
+        priority_class_ptr pclass = make_lw_shared<priority_class>(shares, latency_target);
         _all_classes.insert(pclass);
+        if (latency_target.count()) {
+            _deadline_classes.push_back(pclass);
+        }
         return pclass;
     }
 
@@ -200,6 +475,44 @@ class fair_queue {
     void unregister_priority_class(priority_class_ptr pclass) {
         assert(pclass->_queue.empty());
         _all_classes.erase(pclass);
+        _deadline_classes.erase(std::remove(_deadline_classes.begin(), _deadline_classes.end(), pclass), _deadline_classes.end());
+    }
+
+    /// Sets the rate limits of a priority class registered against this fair queue.
+    ///
+    /// If the class shares the rate limits of the group, this sets the shared ones.
+    /// Changing a limit gives the class a full burst of it.
+    ///
+    /// \param bytes_per_second the bandwidth the class' requests may use at most, or 0 for no limit
+    /// \param ops_per_second how many of the class' requests may be dispatched per second at most, or 0 for no limit
+    /// \param now the current time, from which the class earns tokens
+    void set_rate_limits(priority_class_ptr pc, uint64_t bytes_per_second, uint64_t ops_per_second,
+                         std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
+        pc->_rate_limit->set(bytes_per_second, ops_per_second, now, _config.rate_limit_burst);
+    }
+
+    /// Makes a priority class registered against this fair queue use the \c id-th rate
+    /// limits of the queue's group, which the classes of the group's other queues may
+    /// use too. Their requests together then stay within those limits.
+    void share_rate_limits(priority_class_ptr pc, unsigned id) {
+        assert(_config.group);
+        pc->_rate_limit = &_config.group->rate_limit(id);
+    }
+
+    /// \return when the first class held back by its rate limits may dispatch again, or
+    /// \c time_point::max() if no queued request is waiting for tokens.
+    std::chrono::steady_clock::time_point next_refill() const {
+        auto ret = std::chrono::steady_clock::time_point::max();
+        auto now = std::chrono::steady_clock::now();
+        for (auto& pc : _all_classes) {
+            if (!pc->_queue.empty()) {
+                auto available_at = pc->_rate_limit->available_at();
+                if (available_at > now) {
+                    ret = std::min(ret, available_at);
+                }
+            }
+        }
+        return ret;
     }
 
     /// \return how many waiters are currently queued for all classes.
@@ -224,51 +537,78 @@ class fair_queue {
         // Since we don't know which queue we will use to execute the next request - if ours or
         // someone else's, we need a separate promise at this point.
         push_priority_class(pc);
-        pc->_queue.push_back(priority_class::request{std::move(func), std::move(desc)});
+        auto queued_at = pc->_latency_target.count() ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        pc->_queue.push_back(priority_class::request{std::move(func), std::move(desc), queued_at});
         _requests_queued++;
     }
 
     /// Notifies that ont request finished
     /// \param desc an instance of \c fair_queue_request_descriptor structure describing the request that just finished.
     void notify_requests_finished(fair_queue_request_descriptor& desc) {
+        if (_config.group) {
+            _config.group->release(desc);
+        }
         _requests_executing--;
         _req_count_executing -= desc.weight;
         _bytes_count_executing -= desc.size;
     }
 
     /// Try to execute new requests if there is capacity left in the queue.
-    void dispatch_requests() {
+    ///
+    /// Requests held back by their class' rate limits are only dispatched by a later
+    /// call, so with rate limited classes this must be called again by \ref next_refill,
+    /// even if no requests finish.
+    ///
+    /// \param now the current time, up to which rate limited classes earn tokens
+    void dispatch_requests(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now()) {
         while (can_dispatch()) {
-            priority_class_ptr h;
-            do {
-                h = pop_priority_class();
-            } while (h->_queue.empty());
+            if (auto h = urgent_priority_class(now)) {
+                if (!claim_capacity(h->_queue.front().desc)) {
+                    break;
+                }
+                // The class may still be in the heap, so charge it later.
+                auto req = std::move(h->_queue.front());
+                h->_queue.pop_front();
+                start_request(*h, req.desc, now);
+                h->_deadline_debt += request_cost(*h, req.desc, h->_deadline_debt);
+                h->_deadline_dispatches++;
+                req.func();
+                continue;
+            }
+
+            if (_handles.empty()) {
+                // Everything that is queued is over its rate limits.
+                break;
+            }
+            auto h = pop_priority_class();
+            if (h->_queue.empty()) {
+                continue;
+            }
+            if (h->_rate_limit->throttled(now)) {
+                h->_throttled_dispatches++;
+                _throttled_classes.push_back(std::move(h));
+                continue;
+            }
+            if (!claim_capacity(h->_queue.front().desc)) {
+                // The other queues of the group use it all; retry on the next dispatch.
+                push_priority_class(std::move(h));
+                break;
+            }
 
             auto req = std::move(h->_queue.front());
             h->_queue.pop_front();
-            _requests_executing++;
-            _req_count_executing += req.desc.weight;
-            _bytes_count_executing += req.desc.size;
-            _requests_queued--;
-
-            auto delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-            auto req_cost  = (float(req.desc.weight) / _config.max_req_count + float(req.desc.size) / _config.max_bytes_count) / h->_shares;
-            auto cost  = expf(1.0f/_config.tau.count() * delta.count()) * req_cost;
-            float next_accumulated = h->_accumulated + cost;
-            while (std::isinf(next_accumulated)) {
-                normalize_stats();
-                // If we have renormalized, our time base will have changed. This should happen very infrequently
-                delta = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _base);
-                cost  = expf(1.0f/_config.tau.count() * delta.count()) * req_cost;
-                next_accumulated = h->_accumulated + cost;
-            }
-            h->_accumulated = next_accumulated;
+            start_request(*h, req.desc, now);
+            h->_accumulated += request_cost(*h, req.desc, h->_accumulated);
 
             if (!h->_queue.empty()) {
                 push_priority_class(h);
             }
             req.func();
         }
+        for (auto& h : _throttled_classes) {
+            push_priority_class(std::move(h));
+        }
+        _throttled_classes.clear();
     }
 
     /// Updates the current shares of this priority class
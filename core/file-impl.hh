@@ -45,6 +45,7 @@ class posix_file_handle_impl : public seastar::file_handle_impl {
 
 class posix_file_impl : public file_impl {
     std::atomic<unsigned>* _refcount = nullptr;
+    dev_t _device_id = 0; // selects the I/O queue
 public:
     int _fd;
     posix_file_impl(int fd, file_open_options options);
@@ -64,8 +65,13 @@ class posix_file_impl : public file_impl {
     virtual std::unique_ptr<seastar::file_handle_impl> dup() override;
     virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)> next) override;
     virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t offset, size_t range_size, const io_priority_class& pc);
+
+    // Returns the implementation of \c f if it is backed by a file
+    // descriptor, or nullptr otherwise.
+    static posix_file_impl* from_file(const file& f);
 private:
     void query_dma_alignment();
+    void query_device_id();
 
     /**
      * Try to read from the given position where the previous short read has
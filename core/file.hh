@@ -83,6 +83,7 @@ struct file_open_options {
     uint64_t extent_allocation_size_hint = 1 << 20; ///< Allocate this much disk space when extending the file
     bool sloppy_size = false; ///< Allow the file size not to track the amount of data written until a flush
     uint64_t sloppy_size_hint = 1 << 20; ///< Hint as to what the eventual file size will be
+    bool buffered = false; ///< Open without O_DIRECT, so the file can be handed to sendfile(2); reads and writes may then block
 };
 
 /// \cond internal
@@ -98,6 +99,12 @@ class io_priority_class {
 
 const io_priority_class& default_priority_class();
 
+/// A range of bytes in a file, for \ref file::dma_read_ranges().
+struct file_read_range {
+    uint64_t pos;   ///< offset of the first byte; no alignment is required
+    size_t len;     ///< number of bytes; no alignment is required
+};
+
 class file;
 class file_impl;
 
@@ -119,6 +126,9 @@ class file_impl {
     unsigned _memory_dma_alignment = 4096;
     unsigned _disk_read_dma_alignment = 4096;
     unsigned _disk_write_dma_alignment = 4096;
+    // Larger reads are split up by the block layer anyway (see
+    // max_sectors_kb), so merging ranges beyond it saves nothing.
+    size_t _disk_read_max_length = 128 << 10;
 public:
     virtual ~file_impl() {}
 
@@ -218,6 +228,11 @@ class file {
         return _file_impl->_memory_dma_alignment;
     }
 
+    /// Length of the longest read \ref dma_read_ranges() merges ranges into
+    size_t disk_read_max_length() const {
+        return _file_impl->_disk_read_max_length;
+    }
+
 
     /**
      * Perform a single DMA read operation.
@@ -420,6 +435,41 @@ class file {
         });
     }
 
+    /**
+     * Read several ranges of bytes with as few requests as possible.
+     *
+     * The ranges are sorted, and those at most \c max_gap bytes apart
+     * (or overlapping) are fetched with a single aligned read, which makes
+     * many small nearby reads (such as index lookups) cost one I/O operation.
+     * A read grows no longer than \ref disk_read_max_length(), except to
+     * fit a single range.
+     * The returned buffers share the memory of these reads, without copying,
+     * so a buffer keeps the whole read it came from alive.
+     *
+     * @param ranges the ranges to read, in any order; they may overlap
+     * @param max_gap the largest number of unrequested bytes to read in order to
+     *        merge two neighbouring ranges into one request
+     * @param pc the IO priority class under which to queue the reads
+     *
+     * @return one buffer per range, in the order of \c ranges. A buffer is
+     *         shorter than its range (possibly empty) if the range reaches
+     *         beyond the end of the file.
+     * @throw system_error exception in case of I/O error
+     */
+    template <typename CharType>
+    future<std::vector<temporary_buffer<CharType>>>
+    dma_read_ranges(std::vector<file_read_range> ranges, size_t max_gap = 16 * 1024,
+            const io_priority_class& pc = default_priority_class()) {
+        return read_ranges(std::move(ranges), max_gap, pc).then([] (std::vector<temporary_buffer<uint8_t>> bufs) {
+            std::vector<temporary_buffer<CharType>> ret;
+            ret.reserve(bufs.size());
+            for (auto& t : bufs) {
+                ret.emplace_back(reinterpret_cast<CharType*>(t.get_write()), t.size(), t.release());
+            }
+            return ret;
+        });
+    }
+
     /// \brief Creates a handle that can be transported across shards.
     ///
     /// Creates a handle that can be transported across shards, and then
@@ -433,6 +483,9 @@ class file {
     template <typename CharType>
     struct read_state;
 private:
+    future<std::vector<temporary_buffer<uint8_t>>>
+    read_ranges(std::vector<file_read_range> ranges, size_t max_gap, const io_priority_class& pc);
+
     friend class reactor;
     friend class file_impl;
 };
@@ -23,6 +23,7 @@
 #include "align.hh"
 #include "circular_buffer.hh"
 #include "semaphore.hh"
+#include "shared_future.hh"
 #include "reactor.hh"
 #include <malloc.h>
 #include <string.h>
@@ -44,7 +45,21 @@ class file_data_source_impl : public data_source_impl {
     file_input_stream_options _options;
     uint64_t _pos;
     uint64_t _remain;
+    uint64_t _consumer_pos; // position of the next byte get() returns
     circular_buffer<issued_read> _read_buffers;
+    // Read issued by a previous stream, predicting this one would start at its pos
+    std::experimental::optional<file_input_stream_history::prefetch> _prefetched;
+    // Access pattern detection: the consumer got _last_run bytes since it last
+    // skipped; before that, it got _observed_run bytes and then moved forward by
+    // a total of _observed_period bytes.
+    uint64_t _last_run = 0;
+    uint64_t _observed_run = 0;
+    uint64_t _observed_period = 0;
+    // If _stride_period is set, read ahead only the first _stride_run bytes of every
+    // _stride_period bytes; _run_left bytes of the current run have yet to be issued.
+    uint64_t _stride_run = 0;
+    uint64_t _stride_period = 0;
+    uint64_t _run_left = 0;
     unsigned _reads_in_progress = 0;
     unsigned _current_read_ahead;
     future<> _dropped_reads = make_ready_future<>();
@@ -67,6 +82,9 @@ class file_data_source_impl : public data_source_impl {
                 auto& h = *_options.dynamic_adjustments;
                 h.read_ahead = std::max(h.read_ahead, _current_read_ahead);
             }
+        } else if (!_in_slow_start && (_current_read_ahead + 1) * _current_buffer_size * 2 <= _options.read_ahead_budget) {
+            // Out of depth but not out of budget: make each read larger instead.
+            _current_buffer_size *= 2;
         }
     }
     unsigned get_initial_read_ahead() const {
@@ -149,6 +167,121 @@ class file_data_source_impl : public data_source_impl {
         update_history(bytes, bytes);
         set_new_buffer_size(after_skip::yes);
     }
+    void start_strided(uint64_t run, uint64_t period) {
+        _stride_run = run;
+        _stride_period = period;
+        _run_left = run;
+        if (_options.dynamic_adjustments) {
+            _options.dynamic_adjustments->stride_run = run;
+            _options.dynamic_adjustments->stride_period = period;
+        }
+    }
+    void stop_strided() {
+        _stride_run = _stride_period = _run_left = 0;
+        if (_options.dynamic_adjustments) {
+            _options.dynamic_adjustments->stride_run = 0;
+            _options.dynamic_adjustments->stride_period = 0;
+        }
+    }
+    // Looks for a consumer that repeatedly reads a run of bytes and skips
+    // ahead by a constant period. The runs may differ by up to a buffer, since
+    // the consumer gets whole buffers, so read the largest one seen.
+    void note_skip(uint64_t n) {
+        auto period = _last_run + n;
+        if (_stride_period && period != _stride_period) {
+            stop_strided();
+        } else if (!_stride_period && _last_run && period == _observed_period && _options.adaptive_read_ahead && _options.read_ahead) {
+            auto run = std::max(_last_run, _observed_run);
+            // Reading the small gaps along with the runs is cheaper than more requests.
+            if (period - run >= minimal_buffer_size()) {
+                start_strided(run, period);
+            }
+        }
+        _observed_run = _last_run;
+        _observed_period = period;
+        _last_run = 0;
+    }
+    // Drops all read-aheads and continues reading at pos. Returns the number of
+    // bytes dropped.
+    uint64_t reset_read_aheads(uint64_t pos) {
+        uint64_t dropped = 0;
+        while (!_read_buffers.empty()) {
+            auto& c = _read_buffers.front();
+            _reactor._io_stats.fstream_read_aheads_discarded += 1;
+            _reactor._io_stats.fstream_read_ahead_discarded_bytes += c._size;
+            dropped += c._size;
+            ignore_read_future(std::move(c._ready));
+            _read_buffers.pop_front();
+        }
+        discard_prefetch();
+        auto end = _pos + _remain;
+        assert(pos <= end);
+        _pos = pos;
+        _remain = end - pos;
+        _run_left = _stride_run;
+        return dropped;
+    }
+    void discard_prefetch() {
+        if (_prefetched) {
+            _reactor._io_stats.fstream_prefetches_discarded += 1;
+            ignore_read_future(std::move(_prefetched->ready));
+            _prefetched = {};
+        }
+    }
+    // Takes over the read the previous stream issued for us, if it guessed our
+    // offset right, and guesses the offset of the next stream.
+    void note_stream_start(uint64_t offset) {
+        auto& h = *_options.dynamic_adjustments;
+        if (h.prefetched) {
+            if (h.prefetched->pos == offset) {
+                _reactor._io_stats.fstream_prefetch_hits += 1;
+                _prefetched = std::move(h.prefetched);
+            } else {
+                _reactor._io_stats.fstream_prefetches_discarded += 1;
+                ignore_read_future(std::move(h.prefetched->ready));
+            }
+            h.prefetched = {};
+        }
+        if (h.streams) {
+            int64_t delta = offset - h.last_start;
+            // Streams opened at a constant distance from each other, forwards
+            // (a strided scan) or backwards (a reverse scan).
+            if (h.streams > 1 && delta && delta == h.last_start_delta && _options.read_ahead
+                    && (delta > 0 || uint64_t(-delta) <= offset)) {
+                prefetch(offset + delta);
+            }
+            h.last_start_delta = delta;
+        }
+        h.last_start = offset;
+        h.streams++;
+    }
+    void prefetch(uint64_t pos) {
+        auto& h = *_options.dynamic_adjustments;
+        if (h.prefetches.is_closed()) {
+            return;
+        }
+        uint64_t align = _file.disk_read_dma_alignment();
+        auto start = align_down(pos, align);
+        auto len = align_up(start + _current_buffer_size, align) - start;
+        // Nobody may be waiting for it, so the history's gate keeps the file open until it is done.
+        auto ready = with_gate(h.prefetches, [&] {
+            return _file.dma_read_bulk<char>(start, len, _options.io_priority_class);
+        }).handle_exception([file = _file] (std::exception_ptr) {
+            // The stream that takes it over will read again, and see the error.
+            return temporary_buffer<char>();
+        });
+        _reactor._io_stats.fstream_prefetches += 1;
+        h.prefetched = file_input_stream_history::prefetch{pos, start, len, std::move(ready)};
+    }
+    future<temporary_buffer<char>> adopt_prefetch(file_input_stream_history::prefetch p) {
+        return std::move(p.ready).then([file = _file, start = p.start, len = p.len, pc = _options.io_priority_class] (temporary_buffer<char> buf) mutable {
+            if (buf.size() == len) {
+                return make_ready_future<temporary_buffer<char>>(std::move(buf));
+            }
+            // Failed, or short because of EOF: read again to get the error or the right size.
+            return file.dma_read_bulk<char>(start, len, pc);
+        });
+    }
     // Safely ignores read future even if it is not resolved yet.
     void ignore_read_future(future<temporary_buffer<char>> read_future) {
         if (read_future.available()) {
@@ -160,19 +293,34 @@ class file_data_source_impl : public data_source_impl {
     }
 public:
     file_data_source_impl(file f, uint64_t offset, uint64_t len, file_input_stream_options options)
-            : _file(std::move(f)), _options(options), _pos(offset), _remain(len), _current_read_ahead(get_initial_read_ahead())
+            : _file(std::move(f)), _options(options), _pos(offset), _remain(len), _consumer_pos(offset)
+            , _current_read_ahead(get_initial_read_ahead())
             , _current_buffer_size(_options.buffer_size) {
         // prevent wraparounds
         set_new_buffer_size(after_skip::no);
         _remain = std::min(std::numeric_limits<uint64_t>::max() - _pos, _remain);
+        if (_options.dynamic_adjustments && _options.adaptive_read_ahead) {
+            auto& h = *_options.dynamic_adjustments;
+            if (h.stride_period && _options.read_ahead) {
+                start_strided(h.stride_run, h.stride_period);
+            }
+            note_stream_start(offset);
+        }
     }
     virtual future<temporary_buffer<char>> get() override {
+        if ((_read_buffers.empty() ? _pos : _read_buffers.front()._pos) != _consumer_pos) {
+            // The consumer wants data we predicted it would skip.
+            stop_strided();
+            update_history_unused(reset_read_aheads(_consumer_pos));
+        }
         if (!_read_buffers.empty() && !_read_buffers.front()._ready.available()) {
             try_increase_read_ahead();
         }
         issue_read_aheads(1);
         auto ret = std::move(_read_buffers.front());
         _read_buffers.pop_front();
+        _consumer_pos += ret._size;
+        _last_run += ret._size;
         update_history_consumed(ret._size);
         _reactor._io_stats.fstream_reads += 1;
         _reactor._io_stats.fstream_read_bytes += ret._size;
@@ -183,32 +331,44 @@ class file_data_source_impl : public data_source_impl {
         return std::move(ret._ready);
     }
     virtual future<temporary_buffer<char>> skip(uint64_t n) override {
+        if (!n) {
+            return make_ready_future<temporary_buffer<char>>();
+        }
+        auto target = _consumer_pos + n;
+        _consumer_pos = target;
+        bool was_strided = _stride_period;
+        note_skip(n);
         uint64_t dropped = 0;
-        while (n) {
-            if (_read_buffers.empty()) {
-                assert(n <= _remain);
-                _pos += n;
-                _remain -= n;
-                break;
-            }
+        while (!_read_buffers.empty() && _read_buffers.front()._size
+                && _read_buffers.front()._pos + _read_buffers.front()._size <= target) {
             auto& front = _read_buffers.front();
-            if (n < front._size) {
-                front._size -= n;
-                front._pos += n;
-                front._ready = front._ready.then([n] (temporary_buffer<char> buf) {
-                    buf.trim_front(n);
+            ignore_read_future(std::move(front._ready));
+            dropped += front._size;
+            _reactor._io_stats.fstream_read_aheads_discarded += 1;
+            _reactor._io_stats.fstream_read_ahead_discarded_bytes += front._size;
+            _read_buffers.pop_front();
+        }
+        auto next = _read_buffers.empty() ? _pos : _read_buffers.front()._pos;
+        // Either the read-aheads don't follow the access pattern (any more),
+        // or the consumer didn't skip as far as we expected.
+        bool reset = was_strided != bool(_stride_period) || next > target;
+        if (!reset && next < target) {
+            if (_read_buffers.empty() || !_read_buffers.front()._size) {
+                reset = true;
+            } else {
+                auto& front = _read_buffers.front();
+                auto trim = target - next;
+                front._size -= trim;
+                front._pos += trim;
+                front._ready = front._ready.then([trim] (temporary_buffer<char> buf) {
+                    buf.trim_front(trim);
                     return buf;
                 });
-                break;
-            } else {
-                ignore_read_future(std::move(front._ready));
-                n -= front._size;
-                dropped += front._size;
-                _reactor._io_stats.fstream_read_aheads_discarded += 1;
-                _reactor._io_stats.fstream_read_ahead_discarded_bytes += front._size;
-                _read_buffers.pop_front();
             }
         }
+        if (reset) {
+            dropped += reset_read_aheads(target);
+        }
         update_history_unused(dropped);
         return make_ready_future<temporary_buffer<char>>();
     }
@@ -218,6 +378,7 @@ class file_data_source_impl : public data_source_impl {
             _done->set_value();
         }
         return _done->get_future().then([this] {
+            discard_prefetch();
             uint64_t dropped = 0;
             for (auto&& c : _read_buffers) {
                 _reactor._io_stats.fstream_read_aheads_discarded += 1;
@@ -237,6 +398,13 @@ class file_data_source_impl : public data_source_impl {
         auto ra = _current_read_ahead + additional;
         _read_buffers.reserve(ra); // prevent push_back() failure
         while (_read_buffers.size() < ra) {
+            if (_stride_period && !_run_left) {
+                // Jump over the part of the period the consumer is expected to skip.
+                auto gap = std::min(_stride_period - _stride_run, _remain);
+                _pos += gap;
+                _remain -= gap;
+                _run_left = _stride_run;
+            }
             if (!_remain) {
                 if (_read_buffers.size() >= additional) {
                     return;
@@ -249,13 +417,31 @@ class file_data_source_impl : public data_source_impl {
             // Also avoid reading beyond _remain.
             uint64_t align = _file.disk_read_dma_alignment();
             auto start = align_down(_pos, align);
-            auto end = std::min(align_up(start + _current_buffer_size, align), _pos + _remain);
-            auto len = end - start;
-            auto actual_size = std::min(end - _pos, _remain);
-            _read_buffers.emplace_back(_pos, actual_size, futurize<future<temporary_buffer<char>>>::apply([&] {
+            uint64_t end;
+            auto read = make_ready_future<temporary_buffer<char>>();
+            if (_prefetched && _prefetched->pos == _pos) {
+                end = std::min(_prefetched->start + _prefetched->len, _pos + _remain);
+                read = adopt_prefetch(std::move(*_prefetched));
+                _prefetched = {};
+            } else {
+                if (_stride_period) {
+                    // Don't read beyond the run; dma_read_bulk() takes care of alignment.
+                    end = std::min(_pos + std::min<uint64_t>(_current_buffer_size, _run_left), _pos + _remain);
+                    _reactor._io_stats.fstream_strided_read_aheads += 1;
+                } else {
+                    end = std::min(align_up(start + _current_buffer_size, align), _pos + _remain);
+                }
+                auto len = end - start;
+                read = futurize<future<temporary_buffer<char>>>::apply([&] {
                     return _file.dma_read_bulk<char>(start, len, _options.io_priority_class);
-            }).then_wrapped(
-                    [this, start, pos = _pos, remain = _remain] (future<temporary_buffer<char>> ret) {
+                });
+            }
+            if (_stride_period) {
+                _run_left -= std::min(_run_left, end - _pos);
+            }
+            auto actual_size = end - _pos;
+            _read_buffers.emplace_back(_pos, actual_size, read.then_wrapped(
+                    [this, start, pos = _pos, end] (future<temporary_buffer<char>> ret) {
                 --_reads_in_progress;
                 if (_done && !_reads_in_progress) {
                     _done->set_value();
@@ -270,8 +456,8 @@ class file_data_source_impl : public data_source_impl {
                     if (real_end <= pos) {
                         return make_ready_future<temporary_buffer<char>>();
                     }
-                    if (real_end > pos + remain) {
-                        tmp.trim(pos + remain - start);
+                    if (real_end > end) {
+                        tmp.trim(end - start);
                     }
                     if (start < pos) {
                         tmp.trim_front(pos - start);
@@ -316,10 +502,25 @@ class file_data_sink_impl : public data_sink_impl {
     semaphore _write_behind_sem = { _options.write_behind };
     future<> _background_writes_done = make_ready_future<>();
     bool _failed = false;
+    // Buffers gathered for a single write starting at _pending_pos, while
+    // the write-behind slots are busy.
+    std::vector<temporary_buffer<char>> _pending;
+    uint64_t _pending_pos = 0;
+    size_t _pending_size = 0;
+    // Preallocation was requested up to _preallocating, and completed up
+    // to _preallocated.  It starts at the size the file had, since
+    // allocate() zeroes the range.
+    uint64_t _preallocating = 0;
+    uint64_t _preallocated = 0;
+    std::experimental::optional<uint64_t> _initial_size;
+    shared_future<> _preallocation = make_ready_future<>();
+    // The file size was set by truncate() since the last flush, which
+    // O_DSYNC writes do not make durable.
+    bool _truncated = false;
 public:
     file_data_sink_impl(file f, file_output_stream_options options)
             : _file(std::move(f)), _options(options) {
-        _write_behind_sem.ensure_space_for_waiters(1); // So that wait() doesn't throw
+        _write_behind_sem.ensure_space_for_waiters(2); // So that wait() doesn't throw
     }
     future<> put(net::packet data) { abort(); }
     virtual temporary_buffer<char> allocate_buffer(size_t size) override {
@@ -331,19 +532,29 @@ class file_data_sink_impl : public data_sink_impl {
         if (!_options.write_behind) {
             return do_put(pos, std::move(buf));
         }
-        // Write behind strategy:
-        //
-        // 1. Issue N writes in parallel, using a semaphore to limit to N
-        // 2. Collect results in _background_writes_done, merging exception futures
-        // 3. If we've already seen a failure, don't issue more writes.
-        return _write_behind_sem.wait().then([this, pos, buf = std::move(buf)] () mutable {
+        if (_options.max_write_size) {
+            return coalesce(pos, std::move(buf));
+        }
+        return write_behind([this, pos, buf = std::move(buf)] () mutable {
+            return do_put(pos, std::move(buf));
+        });
+    }
+private:
+    // Write behind strategy:
+    //
+    // 1. Issue N writes in parallel, using a semaphore to limit to N
+    // 2. Collect results in _background_writes_done, merging exception futures
+    // 3. If we've already seen a failure, don't issue more writes.
+    template <typename Write>
+    future<> write_behind(Write write) {
+        return _write_behind_sem.wait().then([this, write = std::move(write)] () mutable {
             if (_failed) {
                 _write_behind_sem.signal();
                 auto ret = std::move(_background_writes_done);
                 _background_writes_done = make_ready_future<>();
                 return ret;
             }
-            auto this_write_done = do_put(pos, std::move(buf)).finally([this] {
+            auto this_write_done = write().finally([this] {
                 _write_behind_sem.signal();
             });
             _background_writes_done = when_all(std::move(_background_writes_done), std::move(this_write_done))
@@ -364,6 +575,73 @@ class file_data_sink_impl : public data_sink_impl {
             return make_ready_future<>();
         });
     }
+    // Adds buf to the pending write. As long as all write-behind slots are
+    // busy there is no point in issuing it, so buffers keep accumulating
+    // until a slot frees up or the write reaches max_write_size.
+    future<> coalesce(uint64_t pos, temporary_buffer<char> buf) {
+        if (_pending.empty()) {
+            _pending_pos = pos;
+        }
+        bool unaligned = buf.size() & (_file.disk_write_dma_alignment() - 1);
+        _pending_size += buf.size();
+        _pending.push_back(std::move(buf));
+        if (unaligned
+                || _pending_size + _options.buffer_size > _options.max_write_size
+                || _write_behind_sem.available_units() > 0) {
+            return put_pending();
+        }
+        return make_ready_future<>();
+    }
+    future<> put_pending() {
+        if (_pending.empty()) {
+            return make_ready_future<>();
+        }
+        auto pos = _pending_pos;
+        auto bufs = std::exchange(_pending, {});
+        _pending_size = 0;
+        return write_behind([this, pos, bufs = std::move(bufs)] () mutable {
+            return do_put(pos, std::move(bufs));
+        });
+    }
+    // Preallocates the file in preallocation_size chunks, starting on the
+    // next chunk once writes are halfway through the current one, so that
+    // the allocation overlaps the writes instead of delaying them. Resolves
+    // when the file is preallocated up to end.
+    future<> preallocate(uint64_t end) {
+        uint64_t chunk = _options.preallocation_size;
+        if (!chunk) {
+            return make_ready_future<>();
+        }
+        if (end + chunk / 2 > _preallocating) {
+            auto from = _preallocating;
+            auto to = align_up(end + chunk / 2, chunk);
+            _preallocating = to;
+            _preallocation = _preallocation.get_future().then([this] {
+                if (_initial_size) {
+                    return make_ready_future<>();
+                }
+                return _file.size().then([this] (uint64_t size) {
+                    _initial_size = size;
+                });
+            }).then([this, from, to] {
+                auto start = std::max(from, *_initial_size);
+                if (start >= to) {
+                    _preallocated = to;
+                    return make_ready_future<>();
+                }
+                return _file.allocate(start, to - start).then([this, to] {
+                    _preallocated = to;
+                });
+            }).handle_exception([] (std::exception_ptr) {
+                // Preallocation is only an optimization; if the file system
+                // can't do it, the writes will allocate as they go.
+            });
+        }
+        if (end <= _preallocated) {
+            return make_ready_future<>();
+        }
+        return _preallocation.get_future();
+    }
 public:
     future<> do_put(uint64_t pos, temporary_buffer<char> buf) noexcept {
       try {
@@ -386,20 +664,21 @@ class file_data_sink_impl : public data_sink_impl {
             truncate = true;
         }
 
-        return _file.dma_write(pos, p, buf_size, _options.io_priority_class).then(
-                [this, pos, buf = std::move(buf), truncate, buf_size] (size_t size) mutable {
+        return preallocate(pos + buf_size).then([this, pos, p, buf_size] {
+            return _file.dma_write(pos, p, buf_size, _options.io_priority_class);
+        }).then([this, pos, buf = std::move(buf), truncate, buf_size] (size_t size) mutable {
             // short write handling
             if (size < buf_size) {
                 buf.trim_front(size);
                 return do_put(pos + size, std::move(buf)).then([this, truncate] {
                     if (truncate) {
-                        return _file.truncate(_pos);
+                        return do_truncate();
                     }
                     return make_ready_future<>();
                 });
             }
             if (truncate) {
-                return _file.truncate(_pos);
+                return do_truncate();
             }
             return make_ready_future<>();
         });
@@ -407,26 +686,119 @@ class file_data_sink_impl : public data_sink_impl {
           return make_exception_future<>(std::current_exception());
       }
     }
+    // Writes consecutive buffers with a single iovec write.
+    future<> do_put(uint64_t pos, std::vector<temporary_buffer<char>> bufs) noexcept {
+      try {
+        if (bufs.size() == 1) {
+            return do_put(pos, std::move(bufs.front()));
+        }
+        assert(!(pos & (_file.disk_write_dma_alignment() - 1)));
+        bool truncate = false;
+        auto& last = bufs.back();
+        if ((last.size() & (_file.disk_write_dma_alignment() - 1)) != 0) {
+            // Only the last buffer can be unaligned; see do_put() above.
+            auto tmp = allocate_buffer(align_up(last.size(), _file.disk_write_dma_alignment()));
+            ::memcpy(tmp.get_write(), last.get(), last.size());
+            last = std::move(tmp);
+            truncate = true;
+        }
+        std::vector<iovec> iov;
+        iov.reserve(bufs.size());
+        size_t len = 0;
+        for (auto& buf : bufs) {
+            iov.push_back(iovec{const_cast<char*>(buf.get()), buf.size()});
+            len += buf.size();
+        }
+
+        return preallocate(pos + len).then([this, pos, iov = std::move(iov)] () mutable {
+            return _file.dma_write(pos, std::move(iov), _options.io_priority_class);
+        }).then([this, pos, bufs = std::move(bufs), truncate, len] (size_t size) mutable {
+            // short write handling
+            if (size < len) {
+                auto written = size;
+                auto i = bufs.begin();
+                while (written >= i->size()) {
+                    written -= i->size();
+                    ++i;
+                }
+                i->trim_front(written);
+                bufs.erase(bufs.begin(), i);
+                return do_put(pos + size, std::move(bufs)).then([this, truncate] {
+                    if (truncate) {
+                        return do_truncate();
+                    }
+                    return make_ready_future<>();
+                });
+            }
+            if (truncate) {
+                return do_truncate();
+            }
+            return make_ready_future<>();
+        });
+      } catch (...) {
+          return make_exception_future<>(std::current_exception());
+      }
+    }
+    future<> do_truncate() {
+        _truncated = true;
+        return _file.truncate(_pos);
+    }
     future<> wait() noexcept {
         // restore to pristine state; for flush() + close() sequence
         // (we allow either flush, or close, or both)
-        return _write_behind_sem.wait(_options.write_behind).then([this] {
-            return std::exchange(_background_writes_done, make_ready_future<>());
+        auto pending = put_pending();
+        return _write_behind_sem.wait(_options.write_behind).then([this, pending = std::move(pending)] () mutable {
+            auto background = std::exchange(_background_writes_done, make_ready_future<>());
+            return when_all(std::move(pending), std::move(background)).then([] (std::tuple<future<>, future<>> possible_errors) {
+                auto& e1 = std::get<0>(possible_errors);
+                auto& e2 = std::get<1>(possible_errors);
+                if (e1.failed()) {
+                    e2.ignore_ready_future();
+                    return std::move(e1);
+                }
+                return std::move(e2);
+            });
         }).finally([this] {
             _write_behind_sem.signal(_options.write_behind);
+            // No write is waiting for it anymore, but it still uses this sink.
+            return _preallocation.get_future();
         });
     }
 public:
     virtual future<> flush() override {
         return wait().then([this] {
-            return _file.flush();
+            if (_options.dsync && !_truncated) {
+                // Each write was durable when it completed.
+                return make_ready_future<>();
+            }
+            return _file.flush().then([this] {
+                _truncated = false;
+            });
         });
     }
     virtual future<> close() noexcept {
-        return wait().finally([this] {
+        return wait().then([this] {
+            return release_preallocation();
+        }).finally([this] {
             return _file.close();
         });
     }
+private:
+    // allocate() keeps the file size, so what was preallocated past the
+    // final end of the file would stay allocated after close.
+    future<> release_preallocation() {
+        if (_preallocated <= _initial_size.value_or(0)) {
+            return make_ready_future<>();
+        }
+        return _file.size().then([this] (uint64_t size) {
+            if (size >= _preallocated) {
+                return make_ready_future<>();
+            }
+            return _file.discard(size, _preallocated - size);
+        }).handle_exception([] (std::exception_ptr) {
+            // Only wasted space, like a failed preallocation
+        });
+    }
 };
 
 class file_data_sink : public data_sink {
@@ -33,9 +33,20 @@
 #include "file.hh"
 #include "iostream.hh"
 #include "shared_ptr.hh"
+#include "gate.hh"
+#include <experimental/optional>
 
 namespace seastar {
 
+/// History of the streams opened on a file, used to adapt their read-ahead.
+///
+/// Besides the amount of read-ahead that turned out to be useful, it records
+/// the access pattern: consumers that repeatedly read a run of bytes and skip
+/// a constant distance (a strided scan), and streams opened at offsets a
+/// constant distance apart (a strided or reverse scan across streams). In the
+/// latter case the first buffer of the next stream is read before that stream
+/// is even opened. Share one history between all the streams of a file to
+/// benefit from this, and \ref close() it before closing the file.
 class file_input_stream_history {
     static constexpr uint64_t window_size = 4 * 1024 * 1024;
     struct window {
@@ -45,14 +56,49 @@ class file_input_stream_history {
     window current_window;
     window previous_window;
     unsigned read_ahead = 1;
+    // Strided pattern within streams: read stride_run bytes every stride_period bytes.
+    uint64_t stride_run = 0;
+    uint64_t stride_period = 0;
+    // Offsets at which streams were opened.
+    unsigned streams = 0;
+    uint64_t last_start = 0;
+    int64_t last_start_delta = 0;
+    // The first buffer of the stream we expect to be opened next.
+    struct prefetch {
+        uint64_t pos;
+        uint64_t start;
+        uint64_t len;
+        future<temporary_buffer<char>> ready;
+    };
+    std::experimental::optional<prefetch> prefetched;
+    // Holds the prefetches, until they complete.
+    gate prefetches;
 
     friend class file_data_source_impl;
+public:
+    /// Stops prefetching for the streams of the file, and waits for the reads
+    /// already issued for streams that were not opened.
+    ///
+    /// \return a future that becomes ready when the file is no longer read
+    ///         on behalf of this history
+    future<> close() {
+        prefetched = {};
+        return prefetches.close();
+    }
 };
 
 /// Data structure describing options for opening a file input stream
 struct file_input_stream_options {
     size_t buffer_size = 8192;    ///< I/O buffer size
     unsigned read_ahead = 0;      ///< Maximum number of extra read-ahead operations
+    /// Maximum number of bytes to read ahead. If larger than what \c read_ahead
+    /// buffers of \c buffer_size hold, buffers are enlarged while the consumer
+    /// keeps waiting for them. 0 to never go beyond \c buffer_size.
+    uint64_t read_ahead_budget = 0;
+    /// Detect strided access patterns, and read ahead only what they are expected
+    /// to consume. With \c dynamic_adjustments, also detect streams opened at
+    /// regular (forward or backward) intervals and prefetch the next one.
+    bool adaptive_read_ahead = false;
     ::seastar::io_priority_class io_priority_class = default_priority_class();
     lw_shared_ptr<file_input_stream_history> dynamic_adjustments = { }; ///< Input stream history, if null dynamic adjustments are disabled
 };
@@ -83,8 +129,19 @@ input_stream<char> make_file_input_stream(
 
 struct file_output_stream_options {
     unsigned buffer_size = 8192;
-    unsigned preallocation_size = 1024*1024; // 1MB
+    /// When non-zero, the file is preallocated in chunks of this size ahead
+    /// of the writes, in the background.  Only the part past the end of the
+    /// file is preallocated, and what is left unwritten is released on
+    /// close().
+    unsigned preallocation_size = 0;
     unsigned write_behind = 1; ///< Number of buffers to write in parallel
+    /// When non-zero, consecutive buffers queued while all \c write_behind
+    /// writes are in flight are gathered into a single write of up to this
+    /// many bytes.
+    unsigned max_write_size = 0;
+    /// The file was opened with \ref open_flags::dsync, so each write is
+    /// durable once it completes and flush() does not need to sync the file.
+    bool dsync = false;
     ::seastar::io_priority_class io_priority_class = default_priority_class();
 };
 
@@ -422,6 +422,31 @@ output_stream<CharType>::put(temporary_buffer<CharType> buf) {
     }
 }
 
+template <typename CharType>
+future<>
+output_stream<CharType>::send_file(const file& f, uint64_t pos, size_t len) {
+    // What is buffered goes first.
+    auto buffered = make_ready_future<>();
+    if (_end) {
+        _buf.trim(_end);
+        _end = 0;
+        buffered = put(std::move(_buf));
+    } else if (_zc_bufs) {
+        buffered = zero_copy_put(std::move(_zc_bufs));
+    }
+    return buffered.then([this, &f, pos, len] {
+        // if flush is scheduled, disable it, so it will not try to write in parallel
+        _flush = false;
+        if (_flushing) {
+            // flush in progress, wait for it to end before continuing
+            return _in_batch.value().get_future().then([this, &f, pos, len] {
+                return _fd.send_file(f, pos, len);
+            });
+        }
+        return _fd.send_file(f, pos, len);
+    });
+}
+
 template <typename CharType>
 void
 output_stream<CharType>::poll_flush() {
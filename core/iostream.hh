@@ -47,6 +47,8 @@ namespace stdx = std::experimental;
 
 namespace net { class packet; }
 
+class file;
+
 class data_source_impl {
 public:
     virtual ~data_source_impl() {}
@@ -90,6 +92,16 @@ class data_sink_impl {
     virtual future<> flush() {
         return make_ready_future<>();
     }
+    // Whether send_file() can transmit f's content without copying it through
+    // userspace.
+    virtual bool can_send_file(const file& f) const {
+        return false;
+    }
+    // Transmits len bytes of f starting at pos; only valid if can_send_file(f).
+    // f must stay alive until the returned future resolves.
+    virtual future<> send_file(const file& f, uint64_t pos, size_t len) {
+        return make_exception_future<>(std::logic_error("send_file() not supported by this sink"));
+    }
     virtual future<> close() = 0;
 };
 
@@ -115,6 +127,12 @@ class data_sink {
     future<> flush() {
         return _dsi->flush();
     }
+    bool can_send_file(const file& f) const {
+        return _dsi->can_send_file(f);
+    }
+    future<> send_file(const file& f, uint64_t pos, size_t len) {
+        return _dsi->send_file(f, pos, len);
+    }
     future<> close() { return _dsi->close(); }
 };
 
@@ -313,6 +331,20 @@ class output_stream final {
     future<> flush();
     future<> close();
 
+    /// Whether send_file() can transmit the content of \c f without copying it
+    /// through userspace, e.g. with sendfile(2) on a socket.
+    bool can_send_file(const file& f) const {
+        return _fd.can_send_file(f);
+    }
+
+    /// Writes \c len bytes of \c f starting at \c pos, after whatever was
+    /// written before, straight from the file to the underlying sink.
+    ///
+    /// Only valid if \ref can_send_file() returns true for \c f, which must be
+    /// kept alive until the returned future resolves. Like \ref write(), this
+    /// does not flush the sink.
+    future<> send_file(const file& f, uint64_t pos, size_t len);
+
     /// Detaches the underlying \c data_sink from the \c output_stream.
     ///
     /// The intended usage is custom \c data_sink_impl implementations
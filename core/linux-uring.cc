@@ -0,0 +1,210 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#ifdef SEASTAR_HAVE_IO_URING
+
+#include "linux-uring.hh"
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include <memory>
+
+namespace seastar {
+
+namespace internal {
+
+static int io_uring_setup(unsigned entries, ::io_uring_params* p) {
+    return ::syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const sigset_t* sig) {
+    return ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, sig, _NSIG / 8);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void* map_ring(int fd, size_t size, off_t offset) {
+    auto p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (p == MAP_FAILED) {
+        throw std::system_error(errno, std::system_category(), "io_uring mmap");
+    }
+    return p;
+}
+
+template <typename T>
+static T* ring_field(void* ring, uint32_t offset) {
+    return reinterpret_cast<T*>(reinterpret_cast<char*>(ring) + offset);
+}
+
+linux_uring::linux_uring(unsigned entries) {
+    ::io_uring_params p{};
+    // Completions for polled file descriptors are not bounded by the number
+    // of in-flight submissions, so leave the kernel some slack.
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    _fd = io_uring_setup(entries, &p);
+    if (_fd == -1) {
+        throw std::system_error(errno, std::system_category(), "io_uring_setup");
+    }
+    _features = p.features;
+    try {
+        _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(::io_uring_cqe);
+        if (_features & IORING_FEAT_SINGLE_MMAP) {
+            _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+        }
+        _sq_ring = map_ring(_fd, _sq_ring_size, IORING_OFF_SQ_RING);
+        if (_features & IORING_FEAT_SINGLE_MMAP) {
+            _cq_ring = _sq_ring;
+        } else {
+            _cq_ring = map_ring(_fd, _cq_ring_size, IORING_OFF_CQ_RING);
+        }
+        _sqes_size = p.sq_entries * sizeof(::io_uring_sqe);
+        _sqes = static_cast<::io_uring_sqe*>(map_ring(_fd, _sqes_size, IORING_OFF_SQES));
+    } catch (...) {
+        release();
+        throw;
+    }
+    _sq_khead = ring_field<std::atomic<unsigned>>(_sq_ring, p.sq_off.head);
+    _sq_ktail = ring_field<std::atomic<unsigned>>(_sq_ring, p.sq_off.tail);
+    _sq_mask = *ring_field<unsigned>(_sq_ring, p.sq_off.ring_mask);
+    _sq_entries = *ring_field<unsigned>(_sq_ring, p.sq_off.ring_entries);
+    _sq_array = ring_field<unsigned>(_sq_ring, p.sq_off.array);
+    _sq_head = _sq_tail = _sq_ktail->load(std::memory_order_relaxed);
+    _cq_khead = ring_field<std::atomic<unsigned>>(_cq_ring, p.cq_off.head);
+    _cq_ktail = ring_field<std::atomic<unsigned>>(_cq_ring, p.cq_off.tail);
+    _cq_mask = *ring_field<unsigned>(_cq_ring, p.cq_off.ring_mask);
+    _cqes = ring_field<::io_uring_cqe>(_cq_ring, p.cq_off.cqes);
+}
+
+linux_uring::~linux_uring() {
+    release();
+}
+
+void linux_uring::release() {
+    if (_sqes) {
+        ::munmap(_sqes, _sqes_size);
+    }
+    if (_cq_ring && _cq_ring != _sq_ring) {
+        ::munmap(_cq_ring, _cq_ring_size);
+    }
+    if (_sq_ring) {
+        ::munmap(_sq_ring, _sq_ring_size);
+    }
+    if (_fd != -1) {
+        ::close(_fd);
+    }
+    _sqes = nullptr;
+    _cq_ring = _sq_ring = nullptr;
+    _fd = -1;
+}
+
+::io_uring_sqe* linux_uring::get_sqe() {
+    // Without SQPOLL the kernel only consumes entries inside enter(), so the
+    // published head is always _sq_head; we check against the kernel's view
+    // anyway, it is cheap.
+    auto khead = _sq_khead->load(std::memory_order_acquire);
+    if (_sq_tail - khead >= _sq_entries) {
+        return nullptr;
+    }
+    auto idx = _sq_tail & _sq_mask;
+    _sq_array[idx] = idx;
+    auto sqe = &_sqes[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    ++_sq_tail;
+    return sqe;
+}
+
+int linux_uring::enter(unsigned min_complete, const sigset_t* active_sigmask) {
+    auto to_submit = pending_submissions();
+    // Publish the prepared entries; the release store makes their contents
+    // visible to the kernel before it observes the new tail.
+    _sq_ktail->store(_sq_tail, std::memory_order_release);
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    auto r = io_uring_enter(_fd, to_submit, min_complete, flags, active_sigmask);
+    if (r > 0) {
+        _sq_head += r;
+    }
+    return r;
+}
+
+bool linux_uring::supported() {
+    try {
+        linux_uring ring(4);
+        constexpr unsigned nr_ops = 256;
+        auto probe_size = sizeof(::io_uring_probe) + nr_ops * sizeof(::io_uring_probe_op);
+        auto buf = std::make_unique<char[]>(probe_size);
+        std::memset(buf.get(), 0, probe_size);
+        auto probe = reinterpret_cast<::io_uring_probe*>(buf.get());
+        if (io_uring_register(ring._fd, IORING_REGISTER_PROBE, probe, nr_ops) == -1) {
+            return false;
+        }
+        for (auto op : { IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_TIMEOUT,
+                IORING_OP_TIMEOUT_REMOVE, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READV, IORING_OP_WRITEV }) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return ring._features & IORING_FEAT_NODROP;
+    } catch (std::system_error&) {
+        return false;
+    }
+}
+
+void prepare_sqe_from_iocb(::io_uring_sqe& sqe, const ::iocb& iocb) {
+    switch (iocb.aio_lio_opcode) {
+    case IOCB_CMD_PREAD:
+        sqe.opcode = IORING_OP_READ;
+        break;
+    case IOCB_CMD_PWRITE:
+        sqe.opcode = IORING_OP_WRITE;
+        break;
+    case IOCB_CMD_PREADV:
+        sqe.opcode = IORING_OP_READV;
+        break;
+    case IOCB_CMD_PWRITEV:
+        sqe.opcode = IORING_OP_WRITEV;
+        break;
+    default:
+        abort();
+    }
+    sqe.fd = iocb.aio_fildes;
+    sqe.off = iocb.aio_offset;
+    sqe.addr = iocb.aio_buf;
+    sqe.len = iocb.aio_nbytes;
+#ifdef RWF_NOWAIT
+    sqe.rw_flags = iocb.aio_rw_flags & ~RWF_NOWAIT;
+#else
+    sqe.rw_flags = iocb.aio_rw_flags;
+#endif
+}
+
+}
+
+}
+
+#endif
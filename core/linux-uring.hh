@@ -0,0 +1,133 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#ifdef SEASTAR_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <linux/aio_abi.h>
+#include <signal.h>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace seastar {
+
+namespace internal {
+
+// A thin wrapper around an io_uring instance.
+//
+// Both the submission and the completion rings are mapped into our address
+// space, so preparing a request (get_sqe()) and reaping completions (reap())
+// are plain memory accesses. Only enter() issues a system call, and it both
+// hands all prepared requests to the kernel and, optionally, waits for
+// completions.
+//
+// Not thread safe: each reactor owns its own ring.
+class linux_uring {
+    int _fd = -1;
+    unsigned _features = 0;
+
+    void* _sq_ring = nullptr;
+    size_t _sq_ring_size = 0;
+    void* _cq_ring = nullptr;
+    size_t _cq_ring_size = 0;
+    ::io_uring_sqe* _sqes = nullptr;
+    size_t _sqes_size = 0;
+
+    std::atomic<unsigned>* _sq_khead;
+    std::atomic<unsigned>* _sq_ktail;
+    unsigned* _sq_array;
+    unsigned _sq_mask;
+    unsigned _sq_entries;
+    // Requests prepared by get_sqe() but not yet published to the kernel
+    // are in the range [_sq_head, _sq_tail).
+    unsigned _sq_head = 0;
+    unsigned _sq_tail = 0;
+
+    std::atomic<unsigned>* _cq_khead;
+    std::atomic<unsigned>* _cq_ktail;
+    ::io_uring_cqe* _cqes;
+    unsigned _cq_mask;
+private:
+    void release();
+public:
+    // Throws std::system_error if the kernel does not support io_uring.
+    explicit linux_uring(unsigned entries);
+    ~linux_uring();
+    linux_uring(const linux_uring&) = delete;
+    void operator=(const linux_uring&) = delete;
+
+    // Returns a zeroed submission queue entry, or nullptr if the submission
+    // queue is full and enter() must be called first.
+    ::io_uring_sqe* get_sqe();
+
+    unsigned pending_submissions() const {
+        return _sq_tail - _sq_head;
+    }
+
+    bool has_completions() const {
+        return _cq_khead->load(std::memory_order_relaxed) != _cq_ktail->load(std::memory_order_acquire);
+    }
+
+    // Submits all prepared requests and waits for at least min_complete
+    // completions, with active_sigmask (if non-null) installed while waiting.
+    //
+    // Returns the number of requests submitted, or -1 with errno set.
+    int enter(unsigned min_complete, const sigset_t* active_sigmask = nullptr);
+
+    // Calls func(const io_uring_cqe&) for every available completion and
+    // returns how many were processed. Each entry is released to the kernel
+    // before func() sees it, so func() may itself submit or reap.
+    template <typename Func>
+    unsigned reap(Func&& func) {
+        unsigned n = 0;
+        for (;;) {
+            // We're the only writer to the head, so a relaxed load is enough;
+            // the kernel publishes completions with a release store to the tail.
+            auto head = _cq_khead->load(std::memory_order_relaxed);
+            if (head == _cq_ktail->load(std::memory_order_acquire)) {
+                return n;
+            }
+            auto cqe = _cqes[head & _cq_mask];
+            _cq_khead->store(head + 1, std::memory_order_release);
+            func(const_cast<const ::io_uring_cqe&>(cqe));
+            ++n;
+        }
+    }
+
+    // Checks whether this kernel supports io_uring and every operation the
+    // reactor backend needs.
+    static bool supported();
+};
+
+// Translates a linux-aio request prepared by make_{read,write}{,v}_iocb()
+// into an io_uring submission, leaving user_data to the caller. RWF_NOWAIT
+// is dropped since io_uring punts blocking requests to its own workers
+// instead of failing them.
+void prepare_sqe_from_iocb(::io_uring_sqe& sqe, const ::iocb& iocb);
+
+}
+
+}
+
+#endif
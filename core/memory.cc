@@ -91,6 +91,13 @@ disable_abort_on_alloc_failure_temporarily::~disable_abort_on_alloc_failure_temp
 #include <experimental/optional>
 #include <functional>
 #include <cstring>
+#include <cinttypes>
+#include <fstream>
+#include <random>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
 #include <boost/intrusive/list.hpp>
 #include <sys/mman.h>
 #include "util/defer.hh"
@@ -212,7 +219,8 @@ struct free_object {
 };
 
 struct page {
-    bool free;
+    bool free : 1;
+    bool sampled : 1; // may hold objects tracked by the heap sampler
     uint8_t offset_in_span;
     uint16_t nr_small_alloc;
     uint32_t span_size; // in pages, if we're the head or the tail
@@ -262,6 +270,12 @@ class page_list {
         }
         _front = ary[_front].link._next;
     }
+    template <typename Func>
+    void for_each(page* ary, Func func) {
+        for (auto i = _front; i; i = ary[i].link._next) {
+            func(ary[i]);
+        }
+    }
     friend void on_allocation_failure(size_t);
 };
 
@@ -277,6 +291,8 @@ class small_pool {
     unsigned _min_free;
     unsigned _max_free;
     unsigned _pages_in_use = 0;
+    size_t _nr_objects = 0; // carved out of our spans, free or not
+    size_t _span_free_count = 0; // free objects in span freelists, not in _free
     page_list _span_list;
     static constexpr unsigned idx_frac_bits = 2;
 public:
@@ -289,6 +305,7 @@ class small_pool {
     static constexpr unsigned size_to_idx(unsigned size);
     static constexpr unsigned idx_to_size(unsigned idx);
     allocation_site_ptr& alloc_site_holder(void* ptr);
+    small_pool_statistics statistics() const;
 private:
     void add_more_objects();
     void trim_free_list();
@@ -362,6 +379,22 @@ struct cross_cpu_free_item {
     cross_cpu_free_item* next;
 };
 
+// Live allocations recorded by the sampling heap profiler.
+struct heap_sampler {
+    struct sampled_object {
+        allocation_site_ptr site;
+        size_t size;
+    };
+    size_t interval = 0;
+    std::minstd_rand rng;
+    std::unordered_set<allocation_site> sites;
+    std::unordered_map<void*, sampled_object> objects;
+    size_t next_interval() {
+        // Poisson process: exponentially distributed gaps, mean interval.
+        return std::exponential_distribution<double>(1.0 / interval)(rng) + 1;
+    }
+};
+
 struct cpu_pages {
     uint32_t min_free_pages = 20000000 / page_size;
     char* memory;
@@ -375,6 +408,7 @@ struct cpu_pages {
     std::vector<reclaimer*> reclaimers;
     static constexpr unsigned nr_span_lists = 32;
     page_list free_spans[nr_span_lists];  // contains aligned spans with span_size == 2^idx
+    uint32_t nr_free_spans[nr_span_lists] = {}; // length of each free_spans list
     small_pool_array small_pools;
     alignas(seastar::cache_line_size) std::atomic<cross_cpu_free_item*> xcpu_freelist;
     alignas(seastar::cache_line_size) std::vector<physical_address> virt_to_phys_map;
@@ -389,6 +423,12 @@ struct cpu_pages {
     } asu;
     allocation_site_ptr alloc_site_list_head = nullptr; // For easy traversal of asu.alloc_sites from scylla-gdb.py
     bool collect_backtrace = false;
+    // Counts down as we allocate; the allocation that takes it below zero
+    // is sampled (if sampling is enabled).
+    int64_t bytes_until_sample = std::numeric_limits<int64_t>::max();
+    heap_sampler* sampler = nullptr; // lives forever, like alloc_sites
+    size_t nr_sampled_objects = 0;
+    bool in_sampler = false; // the sampler's own allocations are not sampled
     char* mem() { return memory; }
 
     void link(page_list& list, page* span);
@@ -414,8 +454,21 @@ struct cpu_pages {
     bool try_cross_cpu_free(void* ptr);
     void shrink(void* ptr, size_t new_size);
     void free_cross_cpu(unsigned cpu_id, void* ptr);
+    void free_cross_cpu(unsigned cpu_id, cross_cpu_free_item* first, cross_cpu_free_item* last, size_t count);
+    template <typename Free>
+    void free_batch(void** ptrs, size_t n, Free free_local);
     bool drain_cross_cpu_freelist();
     size_t object_size(void* ptr);
+    fragmentation_report get_fragmentation_report();
+    void set_heap_sampling_interval(size_t interval);
+    void sample_allocation(void* ptr, size_t size);
+    void forget_sample(void* ptr);
+    void maybe_forget_sample(void* ptr) {
+        if (__builtin_expect(nr_sampled_objects != 0, false) && to_page(ptr)->sampled) {
+            forget_sample(ptr);
+        }
+    }
+    std::vector<heap_sample_site> get_heap_samples();
     page* to_page(void* p) {
         return &pages[(reinterpret_cast<char*>(p) - mem()) / page_size];
     }
@@ -430,6 +483,7 @@ struct cpu_pages {
     void do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem);
     void replace_memory_backing(allocate_system_memory_fn alloc_sys_mem);
     void init_virt_to_phys_map();
+    void prefault();
     void check_large_allocation(size_t size);
     void warn_large_allocation(size_t size);
     memory::memory_layout memory_layout();
@@ -467,11 +521,13 @@ unsigned index_of(unsigned pages) {
 void
 cpu_pages::unlink(page_list& list, page* span) {
     list.erase(pages, *span);
+    --nr_free_spans[&list - free_spans];
 }
 
 void
 cpu_pages::link(page_list& list, page* span) {
     list.push_front(pages, *span);
+    ++nr_free_spans[&list - free_spans];
 }
 
 void cpu_pages::free_span_no_merge(uint32_t span_start, uint32_t nr_pages) {
@@ -588,6 +644,7 @@ cpu_pages::allocate_large_and_trim(unsigned n_pages) {
     }
     auto span_end = &pages[span_idx + span_size - 1];
     span->free = span_end->free = false;
+    span->sampled = false;
     span->span_size = span_end->span_size = span_size;
     span->pool = nullptr;
 #ifdef SEASTAR_HEAPPROF
@@ -710,6 +767,9 @@ cpu_pages::allocate_small(unsigned size) {
 void cpu_pages::free_large(void* ptr) {
     pageidx idx = (reinterpret_cast<char*>(ptr) - mem()) / page_size;
     page* span = &pages[idx];
+    if (__builtin_expect(span->sampled, false)) {
+        forget_sample(ptr);
+    }
 #ifdef SEASTAR_HEAPPROF
     auto alloc_site = span->alloc_site;
     if (alloc_site) {
@@ -738,18 +798,64 @@ size_t cpu_pages::object_size(void* ptr) {
 }
 
 void cpu_pages::free_cross_cpu(unsigned cpu_id, void* ptr) {
+    auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
+    free_cross_cpu(cpu_id, p, p, 1);
+}
+
+// Pushes a chain of objects, linked from first to last, in one go.
+void cpu_pages::free_cross_cpu(unsigned cpu_id, cross_cpu_free_item* first, cross_cpu_free_item* last, size_t count) {
     if (!live_cpus[cpu_id].load(std::memory_order_relaxed)) {
         // Thread was destroyed; leak object
         // should only happen for boost unit-tests.
         return;
     }
-    auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
     auto& list = all_cpus[cpu_id]->xcpu_freelist;
     auto old = list.load(std::memory_order_relaxed);
     do {
-        p->next = old;
-    } while (!list.compare_exchange_weak(old, p, std::memory_order_release, std::memory_order_relaxed));
-    ++g_cross_cpu_frees;
+        last->next = old;
+    } while (!list.compare_exchange_weak(old, first, std::memory_order_release, std::memory_order_relaxed));
+    g_cross_cpu_frees += count;
+}
+
+template <typename Free>
+void cpu_pages::free_batch(void** ptrs, size_t n, Free free_local) {
+    // Foreign objects are chained per owning cpu as we go, and each chain
+    // is handed over at the end.
+    struct chain {
+        cross_cpu_free_item* first;
+        cross_cpu_free_item* last;
+        size_t count;
+    };
+    std::array<chain, max_cpus> chains;
+    std::array<uint8_t, max_cpus> owners;
+    unsigned nr_owners = 0;
+    for (size_t i = 0; i != n; ++i) {
+        auto ptr = ptrs[i];
+        if (!ptr) {
+            continue;
+        }
+        auto obj_cpu = object_cpu_id(ptr);
+        if (obj_cpu == cpu_id) {
+            ++g_frees;
+            free_local(ptr);
+            continue;
+        }
+        auto p = reinterpret_cast<cross_cpu_free_item*>(ptr);
+        auto& c = chains[obj_cpu];
+        if (std::find(owners.begin(), owners.begin() + nr_owners, obj_cpu) == owners.begin() + nr_owners) {
+            owners[nr_owners++] = obj_cpu;
+            c.first = c.last = p;
+            c.count = 1;
+        } else {
+            p->next = c.first;
+            c.first = p;
+            ++c.count;
+        }
+    }
+    for (unsigned i = 0; i != nr_owners; ++i) {
+        auto& c = chains[owners[i]];
+        free_cross_cpu(owners[i], c.first, c.last, c.count);
+    }
 }
 
 bool cpu_pages::drain_cross_cpu_freelist() {
@@ -770,6 +876,9 @@ void cpu_pages::free(void* ptr) {
     page* span = to_page(ptr);
     if (span->pool) {
         small_pool& pool = *span->pool;
+        if (__builtin_expect(span->sampled, false)) {
+            forget_sample(ptr);
+        }
 #ifdef SEASTAR_HEAPPROF
         allocation_site_ptr alloc_site = pool.alloc_site_holder(ptr);
         if (alloc_site) {
@@ -791,6 +900,7 @@ void cpu_pages::free(void* ptr, size_t size) {
     if (size <= max_small_allocation) {
         size = object_size_with_alloc_site(size);
         auto pool = &small_pools[small_pool::size_to_idx(size)];
+        maybe_forget_sample(ptr);
 #ifdef SEASTAR_HEAPPROF
         allocation_site_ptr alloc_site = pool->alloc_site_holder(ptr);
         if (alloc_site) {
@@ -951,6 +1061,35 @@ cpu_pages::translate(const void* addr, size_t size) {
     return translation{phys, size};
 }
 
+// Not yet in all libc headers
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+
+void cpu_pages::prefault() {
+    auto bytes = size_t(nr_pages) * page_size;
+    // Populating does not modify the contents of pages already present.
+    if (::madvise(mem(), bytes, MADV_POPULATE_WRITE) != 0) {
+        // Older kernels: write to every free page instead. Their contents
+        // do not matter, and the page structures live elsewhere.
+        for (auto& list : free_spans) {
+            list.for_each(pages, [this] (page& span) {
+                auto start = mem() + (&span - pages) * page_size;
+                for (size_t off = 0; off < size_t(span.span_size) * page_size; off += page_size) {
+                    *reinterpret_cast<volatile char*>(start + off) = 0;
+                }
+            });
+        }
+    }
+    // Huge pages may not have been available when faulting; have the kernel
+    // compact and collapse what it can now, rather than later in khugepaged.
+    // Failure is fine (older kernel, or THP disabled).
+    ::madvise(mem(), bytes, MADV_COLLAPSE);
+}
+
 void cpu_pages::do_resize(size_t new_size, allocate_system_memory_fn alloc_sys_mem) {
     auto new_pages = new_size / page_size;
     if (new_pages <= nr_pages) {
@@ -1120,6 +1259,7 @@ small_pool::add_more_objects() {
             obj->next = _free;
             _free = obj;
             ++_free_count;
+            --_span_free_count;
             ++span.nr_small_alloc;
         }
     }
@@ -1139,6 +1279,7 @@ small_pool::add_more_objects() {
         for (unsigned i = 0; i < span_size; ++i) {
             span[i].offset_in_span = i;
             span[i].pool = this;
+            span[i].sampled = false;
         }
         span->nr_small_alloc = 0;
         span->freelist = nullptr;
@@ -1147,6 +1288,7 @@ small_pool::add_more_objects() {
             h->next = _free;
             _free = h;
             ++_free_count;
+            ++_nr_objects;
             ++span->nr_small_alloc;
         }
     }
@@ -1167,7 +1309,11 @@ small_pool::trim_free_list() {
         }
         obj->next = span->freelist;
         span->freelist = obj;
+        ++_span_free_count;
         if (--span->nr_small_alloc == 0) {
+            auto nr_objects = span->span_size * page_size / _object_size;
+            _nr_objects -= nr_objects;
+            _span_free_count -= nr_objects;
             _pages_in_use -= span->span_size;
             _span_list.erase(cpu_mem.pages, *span);
             cpu_mem.free_span(span - cpu_mem.pages, span->span_size);
@@ -1175,6 +1321,119 @@ small_pool::trim_free_list() {
     }
 }
 
+small_pool_statistics
+small_pool::statistics() const {
+    small_pool_statistics ret;
+    ret.object_size = _object_size;
+    ret.memory = size_t(_pages_in_use) * page_size;
+    ret.free_objects = _free_count + _span_free_count;
+    ret.used_objects = _nr_objects - ret.free_objects;
+    return ret;
+}
+
+fragmentation_report
+cpu_pages::get_fragmentation_report() {
+    fragmentation_report ret;
+    ret.total_memory = size_t(nr_pages) * page_size;
+    ret.free_memory = size_t(nr_free_pages) * page_size;
+    // Spans can be no larger than the whole pool.
+    auto nr_lists = nr_pages ? std::min(index_of(nr_pages) + 1, unsigned(nr_span_lists)) : 0u;
+    ret.free_spans.assign(nr_free_spans, nr_free_spans + nr_lists);
+    ret.small_pools.reserve(small_pool_array::nr_small_pools);
+    for (unsigned i = 0; i < small_pool_array::nr_small_pools; ++i) {
+        ret.small_pools.push_back(small_pools[i].statistics());
+        ret.small_pool_memory += ret.small_pools.back().memory;
+    }
+    // Other cpus only push to the front, and only we take items off,
+    // so the list below the front is stable.
+    for (auto p = xcpu_freelist.load(std::memory_order_acquire); p; p = p->next) {
+        ++ret.cross_cpu_free_backlog;
+    }
+    return ret;
+}
+
+void cpu_pages::set_heap_sampling_interval(size_t interval) {
+    if (interval && !sampler) {
+        in_sampler = true;
+        auto restore = defer([this] { in_sampler = false; });
+        sampler = new heap_sampler;
+        sampler->rng.seed(cpu_id + 1);
+    }
+    if (sampler) {
+        sampler->interval = interval;
+    }
+    bytes_until_sample = interval ? sampler->next_interval() : std::numeric_limits<int64_t>::max();
+}
+
+void cpu_pages::sample_allocation(void* ptr, size_t size) {
+    if (in_sampler) {
+        // One of our own allocations; sample the next one instead.
+        return;
+    }
+    if (!sampler || !sampler->interval) {
+        bytes_until_sample = std::numeric_limits<int64_t>::max();
+        return;
+    }
+    in_sampler = true;
+    auto restore = defer([this] { in_sampler = false; });
+    bytes_until_sample = sampler->next_interval();
+    try {
+        allocation_site site;
+        site.backtrace = current_backtrace();
+        auto s = &*sampler->sites.insert(std::move(site)).first;
+        if (sampler->objects.emplace(ptr, heap_sampler::sampled_object{s, size}).second) {
+            ++s->count;
+            s->size += size;
+            ++nr_sampled_objects;
+            to_page(ptr)->sampled = true;
+        }
+    } catch (...) {
+        // Out of memory; lose the sample rather than the allocation.
+    }
+}
+
+void cpu_pages::forget_sample(void* ptr) {
+    // Nothing we free while sampling was itself sampled.
+    if (in_sampler || !sampler) {
+        return;
+    }
+    auto i = sampler->objects.find(ptr);
+    if (i == sampler->objects.end()) {
+        return;
+    }
+    in_sampler = true;
+    auto restore = defer([this] { in_sampler = false; });
+    auto s = i->second.site;
+    --s->count;
+    s->size -= i->second.size;
+    sampler->objects.erase(i);
+    --nr_sampled_objects;
+    if (!s->count) {
+        sampler->sites.erase(*s);
+    }
+}
+
+std::vector<heap_sample_site> cpu_pages::get_heap_samples() {
+    std::vector<heap_sample_site> ret;
+    if (!sampler) {
+        return ret;
+    }
+    // Don't let sampling modify the tables while we walk them.
+    in_sampler = true;
+    auto restore = defer([this] { in_sampler = false; });
+    ret.reserve(sampler->sites.size());
+    for (auto& s : sampler->sites) {
+        heap_sample_site hs;
+        for (auto& f : s.backtrace.frames()) {
+            hs.backtrace.push_back(f.so->begin + f.addr);
+        }
+        hs.count = s.count;
+        hs.size = s.size;
+        ret.push_back(std::move(hs));
+    }
+    return ret;
+}
+
 void
 abort_on_underflow(size_t size) {
     if (std::make_signed_t<size_t>(size) < 0) {
@@ -1230,6 +1489,15 @@ static inline cpu_pages& get_cpu_mem()
     return *cpu_mem_ptr;
 }
 
+static inline
+void maybe_sample(void* ptr, size_t size) {
+    auto& cm = get_cpu_mem();
+    cm.bytes_until_sample -= size;
+    if (__builtin_expect(cm.bytes_until_sample < 0, false)) {
+        cm.sample_allocation(ptr, size);
+    }
+}
+
 void* allocate(size_t size) {
     if (size <= sizeof(free_object)) {
         size = sizeof(free_object);
@@ -1243,6 +1511,8 @@ void* allocate(size_t size) {
     }
     if (!ptr) {
         on_allocation_failure(size);
+    } else {
+        maybe_sample(ptr, size);
     }
     ++g_allocs;
     return ptr;
@@ -1263,6 +1533,8 @@ void* allocate_aligned(size_t align, size_t size) {
     }
     if (!ptr) {
         on_allocation_failure(size);
+    } else {
+        maybe_sample(ptr, size);
     }
     ++g_allocs;
     return ptr;
@@ -1284,6 +1556,37 @@ void free(void* obj, size_t size) {
     get_cpu_mem().free(obj, size);
 }
 
+void free_batch(void** ptrs, size_t n) {
+    auto& cm = get_cpu_mem();
+    cm.free_batch(ptrs, n, [&cm] (void* obj) {
+        cm.free(obj);
+    });
+}
+
+void free_batch(void** ptrs, size_t n, size_t size) {
+    auto& cm = get_cpu_mem();
+    // match action on allocate() so we hit the right pool
+    size = std::max(size, sizeof(free_object));
+    if (size > max_small_allocation) {
+        cm.free_batch(ptrs, n, [&cm] (void* obj) {
+            cm.free_large(obj);
+        });
+        return;
+    }
+    auto& pool = cm.small_pools[small_pool::size_to_idx(object_size_with_alloc_site(size))];
+    cm.free_batch(ptrs, n, [&cm, &pool] (void* obj) {
+        cm.maybe_forget_sample(obj);
+#ifdef SEASTAR_HEAPPROF
+        allocation_site_ptr alloc_site = pool.alloc_site_holder(obj);
+        if (alloc_site) {
+            --alloc_site->count;
+            alloc_site->size -= pool.object_size();
+        }
+#endif
+        pool.deallocate(obj);
+    });
+}
+
 void free_aligned(void* obj, size_t align, size_t size) {
     if (size <= sizeof(free_object)) {
         size = sizeof(free_object);
@@ -1375,6 +1678,51 @@ bool drain_cross_cpu_freelist() {
     return cpu_mem.drain_cross_cpu_freelist();
 }
 
+fragmentation_report get_fragmentation_report() {
+    return cpu_mem.get_fragmentation_report();
+}
+
+void prefault() {
+    cpu_mem.prefault();
+}
+
+void set_heap_sampling_interval(size_t interval) {
+    cpu_mem.set_heap_sampling_interval(interval);
+}
+
+size_t get_heap_sampling_interval() {
+    return cpu_mem.sampler ? cpu_mem.sampler->interval : 0;
+}
+
+std::vector<heap_sample_site> get_heap_samples() {
+    return cpu_mem.get_heap_samples();
+}
+
+std::vector<huge_page_usage> get_huge_page_usage(const std::vector<memory_layout>& ranges) {
+    std::vector<huge_page_usage> ret(ranges.size());
+    std::ifstream smaps("/proc/self/smaps");
+    std::string line;
+    huge_page_usage* usage = nullptr;
+    while (std::getline(smaps, line)) {
+        uintptr_t vma_start, vma_end;
+        size_t kb;
+        if (std::sscanf(line.c_str(), "%" SCNxPTR "-%" SCNxPTR " ", &vma_start, &vma_end) == 2) {
+            // mbind() may have split a range into several areas
+            auto i = std::find_if(ranges.begin(), ranges.end(), [vma_start] (const memory_layout& r) {
+                return vma_start >= r.start && vma_start < r.end;
+            });
+            usage = i != ranges.end() ? &ret[i - ranges.begin()] : nullptr;
+        } else if (!usage) {
+            continue;
+        } else if (std::sscanf(line.c_str(), "Rss: %zu kB", &kb) == 1) {
+            usage->resident += kb * 1024;
+        } else if (std::sscanf(line.c_str(), "AnonHugePages: %zu kB", &kb) == 1) {
+            usage->huge += kb * 1024;
+        }
+    }
+    return ret;
+}
+
 translation
 translate(const void* addr, size_t size) {
     auto cpu_id = object_cpu_id(addr);
@@ -1858,10 +2206,48 @@ statistics stats() {
     return statistics{0, 0, 0, 1 << 30, 1 << 30, 0};
 }
 
+void free_batch(void** ptrs, size_t n) {
+    for (size_t i = 0; i != n; ++i) {
+        ::free(ptrs[i]);
+    }
+}
+
+void free_batch(void** ptrs, size_t n, size_t size) {
+    free_batch(ptrs, n);
+}
+
 bool drain_cross_cpu_freelist() {
     return false;
 }
 
+fragmentation_report get_fragmentation_report() {
+    fragmentation_report ret;
+    ret.total_memory = ret.free_memory = 1 << 30;
+    return ret;
+}
+
+void prefault() {
+    // Ignore, not supported for default allocator.
+}
+
+void set_heap_sampling_interval(size_t interval) {
+    if (interval) {
+        seastar_logger.warn("Seastar compiled with default allocator, heap sampling not supported");
+    }
+}
+
+size_t get_heap_sampling_interval() {
+    return 0;
+}
+
+std::vector<heap_sample_site> get_heap_samples() {
+    return {};
+}
+
+std::vector<huge_page_usage> get_huge_page_usage(const std::vector<memory_layout>& ranges) {
+    return std::vector<huge_page_usage>(ranges.size());
+}
+
 translation
 translate(const void* addr, size_t size) {
     return {};
@@ -1924,6 +2310,69 @@ namespace seastar {
 
 #endif
 
+namespace memory {
+
+size_t fragmentation_report::largest_free_span() const {
+    for (auto i = free_spans.size(); i > 0; --i) {
+        if (free_spans[i - 1]) {
+            return (size_t(1) << (i - 1)) * page_size;
+        }
+    }
+    return 0;
+}
+
+void write_heap_profile(std::ostream& os, const std::vector<heap_sample_site>& samples, size_t interval) {
+    std::map<std::vector<uintptr_t>, std::pair<size_t, size_t>> sites;
+    size_t total_count = 0;
+    size_t total_size = 0;
+    for (auto& s : samples) {
+        auto& site = sites[s.backtrace];
+        site.first += s.count;
+        site.second += s.size;
+        total_count += s.count;
+        total_size += s.size;
+    }
+    // We only track live objects, so report them as allocated objects too.
+    os << "heap profile: " << total_count << ": " << total_size << " [" << total_count << ": " << total_size
+       << "] @ heap_v2/" << interval << "\n";
+    for (auto& site : sites) {
+        auto count = site.second.first;
+        auto size = site.second.second;
+        os << count << ": " << size << " [" << count << ": " << size << "] @";
+        for (auto addr : site.first) {
+            os << " 0x" << std::hex << addr << std::dec;
+        }
+        os << "\n";
+    }
+    os << "\nMAPPED_LIBRARIES:\n";
+    std::ifstream maps("/proc/self/maps");
+    os << maps.rdbuf();
+}
+
+std::ostream& operator<<(std::ostream& os, const fragmentation_report& r) {
+    os << "Total memory: " << r.total_memory << " Free memory: " << r.free_memory
+       << " Small pools: " << r.small_pool_memory
+       << " Cross-cpu free backlog: " << r.cross_cpu_free_backlog << " objects\n";
+    os << "Free spans:\n";
+    os << "index size [B] count free [B]\n";
+    for (unsigned i = 0; i < r.free_spans.size(); ++i) {
+        auto size = (size_t(1) << i) * page_size;
+        os << i << " " << size << " " << r.free_spans[i] << " " << r.free_spans[i] * size << "\n";
+    }
+    os << "Small pools:\n";
+    os << "objsz memory usedobj freeobj wst%\n";
+    for (auto& sp : r.small_pools) {
+        if (!sp.memory) {
+            continue;
+        }
+        os << sp.object_size << " " << sp.memory << " " << sp.used_objects << " " << sp.free_objects
+           << " " << sp.wasted_memory() * 100.0 / sp.memory << "\n";
+    }
+    return os;
+}
+
+}
+
 /// \endcond
 
 }
@@ -27,6 +27,7 @@
 #include <new>
 #include <functional>
 #include <vector>
+#include <iosfwd>
 
 namespace seastar {
 
@@ -87,6 +88,52 @@ class disable_abort_on_alloc_failure_temporarily {
 
 void set_heap_profiling_enabled(bool);
 
+/// \endcond
+
+/// Live allocations recorded by the heap sampler, grouped by call site.
+struct heap_sample_site {
+    /// Return addresses of the allocating call stack, innermost first.
+    std::vector<uintptr_t> backtrace;
+    /// Number of sampled objects allocated here and not yet freed.
+    size_t count = 0;
+    /// Total size of those objects, in bytes.
+    size_t size = 0;
+};
+
+/// Starts (or stops) sampling allocations on this lcore for heap profiling.
+///
+/// On average one allocation is sampled for every \c interval bytes
+/// allocated; the distance between samples is drawn from an exponential
+/// distribution, so that large objects are proportionally more likely to
+/// be sampled. A sampled allocation costs a backtrace; the others cost one
+/// subtraction, so sampling can be left on in production with an interval
+/// of several hundred kilobytes.
+///
+/// Unlike \c --heapprof, this does not need a special build.
+///
+/// \param interval mean number of bytes allocated between samples; 0
+///        stops sampling (objects sampled so far are still tracked until
+///        they are freed).
+void set_heap_sampling_interval(size_t interval);
+
+/// Returns the interval set by set_heap_sampling_interval().
+size_t get_heap_sampling_interval();
+
+/// Returns this lcore's live sampled allocations, grouped by call site.
+std::vector<heap_sample_site> get_heap_samples();
+
+/// Writes heap samples in the legacy text heap profile format read by
+/// pprof, followed by the process' memory mappings for symbolization.
+/// Samples of identical call sites (for example, from different lcores)
+/// are merged.
+///
+/// \param os stream to write the profile to
+/// \param samples samples, as returned by get_heap_samples()
+/// \param interval the sampling interval the samples were taken with
+void write_heap_profile(std::ostream& os, const std::vector<heap_sample_site>& samples, size_t interval);
+
+/// \cond internal
+
 enum class reclaiming_result {
     reclaimed_nothing,
     reclaimed_something
@@ -126,6 +173,31 @@ class reclaimer {
     reclaimer_scope scope() const { return _scope; }
 };
 
+/// \endcond
+
+/// Frees a batch of objects, as if by calling \c free() on each.
+///
+/// Objects allocated on other lcores are handed back to each owning lcore
+/// with a single atomic operation, rather than one per object, so this is
+/// much cheaper than individual frees when tearing down many foreign
+/// objects (such as the fragments of a packet received on another lcore).
+///
+/// \param ptrs objects to free; null pointers are ignored.
+/// \param n number of entries in \c ptrs
+void free_batch(void** ptrs, size_t n);
+
+/// Frees a batch of objects that were all allocated with the same size.
+///
+/// Like free_batch(void**, size_t), but the size class is looked up
+/// once for the whole batch instead of from each object's page.
+///
+/// \param ptrs objects to free; null pointers are ignored.
+/// \param n number of entries in \c ptrs
+/// \param size the size every object in \c ptrs was allocated with
+void free_batch(void** ptrs, size_t n, size_t size);
+
+/// \cond internal
+
 // Call periodically to recycle objects that were freed
 // on cpu other than the one they were allocated on.
 //
@@ -199,11 +271,80 @@ class statistics {
     friend statistics stats();
 };
 
+/// Usage of one small object pool. Allocations of up to a few pages are
+/// served from spans carved into objects of a single size.
+struct small_pool_statistics {
+    /// Size of the objects in the pool, in bytes.
+    size_t object_size;
+    /// Memory held by the pool's spans, in bytes.
+    size_t memory;
+    /// Number of objects allocated from the pool and not yet freed.
+    size_t used_objects;
+    /// Number of free objects, either cached by the pool or left in
+    /// partially used spans.
+    size_t free_objects;
+    /// Memory held by the pool but not by live objects (free objects and
+    /// the slack at the end of each span), in bytes.
+    size_t wasted_memory() const { return memory - used_objects * object_size; }
+};
+
+/// How this lcore's memory is broken up, for telling apart large span
+/// fragmentation from memory stranded in small object pools.
+struct fragmentation_report {
+    /// free_spans[i] is the number of free spans of 2^i pages.
+    std::vector<size_t> free_spans;
+    /// One entry per small pool, by increasing object size.
+    std::vector<small_pool_statistics> small_pools;
+    /// Total memory (in bytes)
+    size_t total_memory = 0;
+    /// Free memory, not counting free objects in small pools (in bytes)
+    size_t free_memory = 0;
+    /// Memory held by small pools, including their free objects (in bytes)
+    size_t small_pool_memory = 0;
+    /// Number of objects freed on other lcores and not yet returned
+    /// to this one.
+    size_t cross_cpu_free_backlog = 0;
+    /// Size of the largest free span, which bounds the largest allocation
+    /// that can succeed without reclaiming (in bytes).
+    size_t largest_free_span() const;
+};
+
+/// Capture a fragmentation report for this lcore.
+fragmentation_report get_fragmentation_report();
+
+/// Dumps a fragmentation report in human readable form.
+std::ostream& operator<<(std::ostream& os, const fragmentation_report& r);
+
+/// Faults in all of this lcore's free memory, so that first touches do not
+/// happen on the serving path, and asks the kernel to back it with
+/// transparent huge pages where possible. Memory in use is left unmodified.
+///
+/// Meant to be called once at startup, from the lcore's own (pinned)
+/// thread, so that the memory is faulted in on the lcore's NUMA node.
+void prefault();
+
+/// Transparent huge page coverage of this lcore's memory.
+struct huge_page_usage {
+    /// Memory resident in RAM (in bytes)
+    size_t resident = 0;
+    /// Resident memory backed by transparent huge pages (in bytes)
+    size_t huge = 0;
+};
+
 struct memory_layout {
     uintptr_t start;
     uintptr_t end;
 };
 
+/// Measures huge page coverage of the given address ranges (typically the
+/// lcores' \ref memory_layout), from /proc/self/smaps.
+///
+/// This reads and parses a procfs file covering the whole process, which
+/// takes time proportional to its number of mappings, so it should not be
+/// called often nor from a reactor thread.  It does not use the calling
+/// thread's lcore state.
+std::vector<huge_page_usage> get_huge_page_usage(const std::vector<memory_layout>& ranges);
+
 // Discover virtual address range used by the allocator on current shard.
 // Supported only when seastar allocator is enabled.
 memory::memory_layout get_memory_layout();
@@ -131,6 +131,15 @@ class file_desc {
         throw_system_error_on(ret == -1, "accept4");
         return file_desc(ret);
     }
+    // Like accept(), but returns nothing if no connection is pending.
+    boost::optional<file_desc> try_accept(sockaddr& sa, socklen_t& sl, int flags = 0) {
+        auto ret = ::accept4(_fd, &sa, &sl, flags);
+        if (ret == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(ret == -1, "accept4");
+        return file_desc(ret);
+    }
     void shutdown(int how) {
         auto ret = ::shutdown(_fd, how);
         if (ret == -1 && errno != ENOTCONN) {
@@ -221,6 +230,14 @@ class file_desc {
         throw_system_error_on(r == -1, "recvmsg");
         return { size_t(r) };
     }
+    boost::optional<size_t> recvmmsg(mmsghdr* msgvec, unsigned vlen, int flags) {
+        auto r = ::recvmmsg(_fd, msgvec, vlen, flags, nullptr);
+        if (r == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(r == -1, "recvmmsg");
+        return { size_t(r) };
+    }
     boost::optional<size_t> send(const void* buffer, size_t len, int flags) {
         auto r = ::send(_fd, buffer, len, flags);
         if (r == -1 && errno == EAGAIN) {
@@ -245,6 +262,14 @@ class file_desc {
         throw_system_error_on(r == -1, "sendmsg");
         return { size_t(r) };
     }
+    boost::optional<size_t> sendmmsg(mmsghdr* msgvec, unsigned vlen, int flags) {
+        auto r = ::sendmmsg(_fd, msgvec, vlen, flags);
+        if (r == -1 && errno == EAGAIN) {
+            return {};
+        }
+        throw_system_error_on(r == -1, "sendmmsg");
+        return { size_t(r) };
+    }
     void bind(sockaddr& sa, socklen_t sl) {
         auto r = ::bind(_fd, &sa, sl);
         throw_system_error_on(r == -1, "bind");
@@ -24,6 +24,7 @@
 #include <google/protobuf/io/zero_copy_stream_impl_lite.h>
 #include "proto/metrics2.pb.h"
 #include <sstream>
+#include "memory.hh"
 
 #include "scollectd_api.hh"
 #include "scollectd-impl.hh"
@@ -675,7 +676,30 @@ class metrics_handler : public handler_base  {
     }
 };
 
-
+/*!
+ * \brief serves the sampled live heap of all shards in the pprof text format
+ */
+class heap_profile_handler : public handler_base {
+public:
+    future<std::unique_ptr<httpd::reply>> handle(const sstring& path,
+        std::unique_ptr<httpd::request> req, std::unique_ptr<httpd::reply> rep) override {
+        auto cpus = smp::all_cpus();
+        return map_reduce(cpus.begin(), cpus.end(), [] (unsigned cpu) {
+            return smp::submit_to(cpu, [] {
+                return memory::get_heap_samples();
+            });
+        }, std::vector<memory::heap_sample_site>(), [] (std::vector<memory::heap_sample_site> all, std::vector<memory::heap_sample_site> shard) {
+            std::move(shard.begin(), shard.end(), std::back_inserter(all));
+            return all;
+        }).then([rep = std::move(rep)] (std::vector<memory::heap_sample_site> samples) mutable {
+            std::ostringstream os;
+            memory::write_heap_profile(os, samples, memory::get_heap_sampling_interval());
+            rep->_content = os.str();
+            rep->done("txt");
+            return std::move(rep);
+        });
+    }
+};
 
 future<> add_prometheus_routes(http_server& server, config ctx) {
     if (ctx.hostname == "") {
@@ -683,6 +707,7 @@ future<> add_prometheus_routes(http_server& server, config ctx) {
     }
     server._routes.put(GET, "/metrics", new metrics_handler(ctx));
     server._routes.add(GET, url("/metrics").remainder("name"), new metrics_handler(ctx));
+    server._routes.put(GET, "/heap_profile", new heap_profile_handler());
     return make_ready_future<>();
 }
 
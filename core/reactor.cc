@@ -49,6 +49,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/eventfd.h>
+#include <sys/sendfile.h>
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/thread/barrier.hpp>
@@ -473,6 +474,9 @@ reactor::task_queue::task_queue(unsigned id, sstring name, float shares)
         sm::make_gauge("shares", [this] { return _shares; },
                 sm::description("Shares allocated to this queue"),
                 {group_label}),
+        sm::make_counter("tasks_stolen", _tasks_stolen,
+                sm::description("Count of stealable tasks this shard took from other shards' queues for this group"),
+                {group_label}),
     });
 }
 
@@ -508,8 +512,8 @@ struct reactor::task_queue::indirect_compare {
     }
 };
 
-reactor::reactor(unsigned id)
-    : _backend()
+reactor::reactor(unsigned id, reactor_backend_selector rbs)
+    : _backend(rbs.create())
     , _id(id)
 #ifdef HAVE_OSV
     , _timer_thread(
@@ -529,8 +533,11 @@ reactor::reactor(unsigned id)
     for (unsigned i = 0; i != max_aio; ++i) {
         _free_iocbs.push(&_iocb_pool[i]);
     }
-    auto r = io_setup(max_aio, &_io_context);
-    assert(r >= 0);
+    int r;
+    if (!_backend->handles_disk_io()) {
+        r = io_setup(max_aio, &_io_context);
+        assert(r >= 0);
+    }
 #ifdef HAVE_OSV
     _timer_thread.start();
 #else
@@ -576,7 +583,9 @@ reactor::~reactor() {
     eraser(_expired_timers);
     eraser(_expired_lowres_timers);
     eraser(_expired_manual_timers);
-    io_destroy(_io_context);
+    if (_io_context) {
+        io_destroy(_io_context);
+    }
 }
 
 // Add to an atomic integral non-atomically and returns the previous value
@@ -818,11 +827,69 @@ void reactor::configure(boost::program_options::variables_map vm) {
         _max_poll_time = 0us;
     }
     set_strict_dma(!vm.count("relaxed-dma"));
-    if (!vm["poll-aio"].as<bool>()
-            || (vm["poll-aio"].defaulted() && vm.count("overprovisioned"))) {
+    // A backend that carries disk I/O wakes up on its completions by itself.
+    if (!_backend->handles_disk_io() && (!vm["poll-aio"].as<bool>()
+            || (vm["poll-aio"].defaulted() && vm.count("overprovisioned")))) {
         _aio_eventfd = pollable_fd(file_desc::eventfd(0, 0));
     }
     set_bypass_fsync(vm["unsafe-bypass-fsync"].as<bool>());
+    _check_huge_pages = vm["prefault-memory"].as<bool>();
+}
+
+void reactor::check_huge_pages() {
+    // Reading /proc/self/smaps takes time proportional to the number of
+    // mappings, so one shard reads it for all, from the syscall thread.
+    if (_huge_page_check_in_progress) {
+        return;
+    }
+    _huge_page_check_in_progress = true;
+    auto layouts = make_lw_shared<std::vector<memory::memory_layout>>(smp::count);
+    parallel_for_each(boost::irange(0u, smp::count), [layouts] (unsigned shard) {
+        return smp::submit_to(shard, [] {
+            return memory::get_memory_layout();
+        }).then([layouts, shard] (memory::memory_layout layout) {
+            (*layouts)[shard] = layout;
+        });
+    }).then([this, layouts] {
+        return _thread_pool.submit<std::vector<memory::huge_page_usage>>([layouts = *layouts] {
+            return memory::get_huge_page_usage(layouts);
+        });
+    }).then([] (std::vector<memory::huge_page_usage> usage) {
+        return do_with(std::move(usage), [] (std::vector<memory::huge_page_usage>& usage) {
+            return parallel_for_each(boost::irange(0u, smp::count), [&usage] (unsigned shard) {
+                return smp::submit_to(shard, [usage = usage[shard]] {
+                    engine().update_huge_page_usage(usage);
+                });
+            });
+        });
+    }).handle_exception([] (std::exception_ptr ep) {
+        seastar_logger.debug("Huge page check failed: {}", ep);
+    }).finally([this] {
+        _huge_page_check_in_progress = false;
+    });
+}
+
+// Capturing a report walks the free lists and all small pools, and the
+// memory metrics need several of its fields. A scrape reads all metrics in
+// one task, during which the reactor does not poll, so the report is taken
+// once per scrape rather than once per metric.
+const memory::fragmentation_report& reactor::fragmentation_report() {
+    auto polls = _polls.load(std::memory_order_relaxed);
+    if (polls != _fragmentation_report_polls) {
+        _fragmentation_report = memory::get_fragmentation_report();
+        _fragmentation_report_polls = polls;
+    }
+    return _fragmentation_report;
+}
+
+void reactor::update_huge_page_usage(memory::huge_page_usage usage) {
+    // khugepaged, compaction or memory pressure can split huge pages after
+    // we faulted them in.
+    if (usage.huge + memory::huge_page_size <= _huge_page_usage.huge) {
+        seastar_logger.warn("Huge page coverage of shard memory dropped from {} to {} bytes ({} bytes resident)",
+                _huge_page_usage.huge, usage.huge, usage.resident);
+    }
+    _huge_page_usage = usage;
 }
 
 future<> reactor_backend_epoll::get_epoll_future(pollable_fd_state& pfd,
@@ -872,6 +939,12 @@ future<> reactor_backend_epoll::writeable(pollable_fd_state& fd) {
     return get_epoll_future(fd, &pollable_fd_state::pollout, EPOLLOUT);
 }
 
+future<> reactor_backend_epoll::readable_errqueue(pollable_fd_state& fd) {
+    // EPOLLERR is always reported, but asking for it keeps the fd
+    // registered while nothing else is waited for.
+    return get_epoll_future(fd, &pollable_fd_state::pollerr, EPOLLERR);
+}
+
 void reactor_backend_epoll::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
     abort_fd(fd, std::move(ex), &pollable_fd_state::pollin, EPOLLIN);
 }
@@ -880,6 +953,10 @@ void reactor_backend_epoll::abort_writer(pollable_fd_state& fd, std::exception_p
     abort_fd(fd, std::move(ex), &pollable_fd_state::pollout, EPOLLOUT);
 }
 
+void reactor_backend_epoll::abort_errqueue_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollerr, EPOLLERR);
+}
+
 void reactor_backend_epoll::forget(pollable_fd_state& fd) {
     if (fd.events_epoll) {
         ::epoll_ctl(_epollfd.get(), EPOLL_CTL_DEL, fd.fd.get(), nullptr);
@@ -971,7 +1048,8 @@ static bool aio_nowait_supported = true;
 struct io_desc {
     promise<io_event> pr;
     fair_queue_request_descriptor fq_desc;
-    io_desc(unsigned weight, unsigned size) : fq_desc(fair_queue_request_descriptor{weight, size}) {}
+    io_queue* queue;
+    io_desc(unsigned weight, unsigned size, size_t bytes, io_queue* queue) : fq_desc(fair_queue_request_descriptor{weight, size, bytes}), queue(queue) {}
 };
 
 template <typename Func>
@@ -980,6 +1058,11 @@ reactor::submit_io(io_desc* desc, Func prepare_io) {
     iocb& io = *_free_iocbs.top();
     _free_iocbs.pop();
     prepare_io(io);
+    if (_backend->handles_disk_io()) {
+        set_user_data(io, desc);
+        _backend->submit_disk_io(io);
+        return;
+    }
     if (_aio_eventfd) {
         set_eventfd_notification(io, _aio_eventfd->get_fd());
     }
@@ -1009,7 +1092,7 @@ reactor::handle_aio_error(::iocb* iocb, int ec) {
             } catch (...) {
                 desc->pr.set_exception(std::current_exception());
             }
-            my_io_queue->notify_requests_finished(desc->fq_desc);
+            desc->queue->notify_requests_finished(desc->fq_desc);
             delete desc;
             // if EBADF, it means that the first request has a bad fd, so
             // we will only remove it from _pending_aio and try again.
@@ -1023,7 +1106,9 @@ reactor::handle_aio_error(::iocb* iocb, int ec) {
 
 bool
 reactor::flush_pending_aio() {
-    my_io_queue->poll_io_queue();
+    for (auto& q : my_io_queues) {
+        q->poll_io_queue();
+    }
 
     bool did_work = false;
     while (!_pending_aio.empty()) {
@@ -1064,6 +1149,27 @@ reactor::flush_pending_aio() {
     return did_work;
 }
 
+future<size_t>
+reactor::sendfile(pollable_fd_state& fd, int in_fd, uint64_t pos, size_t len) {
+    return writeable(fd).then([this, &fd, in_fd, pos, len] {
+        // Reading the file may block on the disk, so leave it to the syscall thread.
+        // The socket is non-blocking, so that thread never waits for the peer.
+        return _thread_pool.submit<syscall_result<ssize_t>>([out_fd = fd.fd.get(), in_fd, pos, len] {
+            off_t off = pos;
+            return wrap_syscall<ssize_t>(::sendfile(out_fd, in_fd, &off, len));
+        });
+    }).then([this, &fd, in_fd, pos, len] (syscall_result<ssize_t> sr) {
+        if (sr.result == -1 && (sr.error == EAGAIN || sr.error == EWOULDBLOCK)) {
+            return sendfile(fd, in_fd, pos, len);
+        }
+        sr.throw_if_error();
+        if (size_t(sr.result) == len) {
+            fd.speculate_epoll(EPOLLOUT);
+        }
+        return make_ready_future<size_t>(sr.result);
+    });
+}
+
 const io_priority_class& default_priority_class() {
     static thread_local auto shard_default_class = [] {
         return engine().register_one_priority_class("default", 1);
@@ -1073,18 +1179,18 @@ const io_priority_class& default_priority_class() {
 
 template <typename Func>
 future<io_event>
-reactor::submit_io_read(const io_priority_class& pc, size_t len, Func prepare_io) {
+reactor::submit_io_read(dev_t devid, const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_io_stats.aio_reads;
     _io_stats.aio_read_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, io_queue::request_type::read, std::move(prepare_io));
+    return io_queue_for(devid).queue_request(pc, len, io_queue::request_type::read, std::move(prepare_io));
 }
 
 template <typename Func>
 future<io_event>
-reactor::submit_io_write(const io_priority_class& pc, size_t len, Func prepare_io) {
+reactor::submit_io_write(dev_t devid, const io_priority_class& pc, size_t len, Func prepare_io) {
     ++_io_stats.aio_writes;
     _io_stats.aio_write_bytes += len;
-    return io_queue::queue_request(_io_coordinator, pc, len, io_queue::request_type::write, std::move(prepare_io));
+    return io_queue_for(devid).queue_request(pc, len, io_queue::request_type::write, std::move(prepare_io));
 }
 
 bool reactor::process_io()
@@ -1102,20 +1208,29 @@ bool reactor::process_io()
             _pending_aio_retry.push_back(iocb);
             continue;
         }
-        _free_iocbs.push(iocb);
-        auto desc = reinterpret_cast<io_desc*>(ev[i].data);
-        desc->pr.set_value(ev[i]);
-        my_io_queue->notify_requests_finished(desc->fq_desc);
-        delete desc;
+        complete_io(ev[i]);
     }
     return n;
 }
 
+void reactor::complete_io(const io_event& ev) {
+    _free_iocbs.push(get_iocb(ev));
+    auto desc = reinterpret_cast<io_desc*>(ev.data);
+    desc->pr.set_value(ev);
+    desc->queue->notify_requests_finished(desc->fq_desc);
+    delete desc;
+}
+
 fair_queue::config io_queue::make_fair_queue_config(config iocfg) {
     fair_queue::config cfg;
     cfg.capacity = std::min(iocfg.capacity, reactor::max_aio);
-    cfg.max_req_count = iocfg.max_req_count;
-    cfg.max_bytes_count = iocfg.max_bytes_count;
+    if (iocfg.group) {
+        // The device-wide limits are enforced by the group.
+        cfg.group = iocfg.group.get();
+    } else {
+        cfg.max_req_count = iocfg.max_req_count;
+        cfg.max_bytes_count = iocfg.max_bytes_count;
+    }
     return cfg;
 }
 
@@ -1142,6 +1257,9 @@ std::array<std::atomic<uint32_t>, io_queue::_max_classes> io_queue::_registered_
 // structure is passed along all the time - and sometimes we can't help but copy it, better keep
 // it lean. The name won't really be used for anything other than monitoring.
 std::array<sstring, io_queue::_max_classes> io_queue::_registered_names;
+std::array<std::chrono::microseconds, io_queue::_max_classes> io_queue::_registered_latency_targets;
+std::array<std::atomic<uint64_t>, io_queue::_max_classes> io_queue::_registered_bytes_per_second;
+std::array<std::atomic<uint64_t>, io_queue::_max_classes> io_queue::_registered_ops_per_second;
 
 void io_queue::fill_shares_array() {
     for (unsigned i = 0; i < _max_classes; ++i) {
@@ -1149,13 +1267,16 @@ void io_queue::fill_shares_array() {
     }
 }
 
-io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares) {
+io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t shares, std::chrono::microseconds latency_target) {
     for (unsigned i = 0; i < _max_classes; ++i) {
         uint32_t unused = 0;
         auto s = _registered_shares[i].compare_exchange_strong(unused, shares, std::memory_order_acq_rel);
         if (s) {
             io_priority_class p;
             _registered_names[i] = name;
+            _registered_latency_targets[i] = latency_target;
+            _registered_bytes_per_second[i].store(0, std::memory_order_relaxed);
+            _registered_ops_per_second[i].store(0, std::memory_order_relaxed);
             p.val = i;
             return p;
         };
@@ -1164,8 +1285,9 @@ io_priority_class io_queue::register_one_priority_class(sstring name, uint32_t s
 }
 
 seastar::metrics::label io_queue_shard("ioshard");
+seastar::metrics::label io_queue_mountpoint("mountpoint");
 
-io_queue::priority_class_data::priority_class_data(sstring name, priority_class_ptr ptr, shard_id owner)
+io_queue::priority_class_data::priority_class_data(sstring name, sstring mountpoint, priority_class_ptr ptr, shard_id owner)
     : ptr(ptr)
     , bytes(0)
     , ops(0)
@@ -1175,8 +1297,8 @@ io_queue::priority_class_data::priority_class_data(sstring name, priority_class_
     namespace sm = seastar::metrics;
     auto shard = sm::impl::shard();
     _metric_groups.add_group("io_queue", {
-            sm::make_derive(name + sstring("_total_bytes"), bytes, sm::description("Total bytes passed in the queue"), {io_queue_shard(shard), sm::shard_label(owner)}),
-            sm::make_derive(name + sstring("_total_operations"), ops, sm::description("Total bytes passed in the queue"), {io_queue_shard(shard), sm::shard_label(owner)}),
+            sm::make_derive(name + sstring("_total_bytes"), bytes, sm::description("Total bytes passed in the queue"), {io_queue_shard(shard), sm::shard_label(owner), io_queue_mountpoint(mountpoint)}),
+            sm::make_derive(name + sstring("_total_operations"), ops, sm::description("Total bytes passed in the queue"), {io_queue_shard(shard), sm::shard_label(owner), io_queue_mountpoint(mountpoint)}),
             // Note: The counter below is not the same as reactor's queued-io-requests
             // queued-io-requests shows us how many requests in total exist in this I/O Queue.
             //
@@ -1186,13 +1308,19 @@ io_queue::priority_class_data::priority_class_data(sstring name, priority_class_
             // In other words: the new counter tells you how busy a class is, and the
             // old counter tells you how busy the system is.
 
-            sm::make_queue_length(name + sstring("_queue_length"), nr_queued, sm::description("Number of requests in the queue"), {io_queue_shard(shard), sm::shard_label(owner)}),
+            sm::make_queue_length(name + sstring("_queue_length"), nr_queued, sm::description("Number of requests in the queue"), {io_queue_shard(shard), sm::shard_label(owner), io_queue_mountpoint(mountpoint)}),
             sm::make_gauge(name + sstring("_delay"), [this] {
                 return queue_time.count();
-            }, sm::description("total delay time in the queue"), {io_queue_shard(shard), sm::shard_label(owner)}),
+            }, sm::description("total delay time in the queue"), {io_queue_shard(shard), sm::shard_label(owner), io_queue_mountpoint(mountpoint)}),
             sm::make_gauge(name + sstring("_shares"), [this] {
                 return this->ptr->shares();
-            }, sm::description("current amount of shares"), {io_queue_shard(shard), sm::shard_label(owner)})
+            }, sm::description("current amount of shares"), {io_queue_shard(shard), sm::shard_label(owner), io_queue_mountpoint(mountpoint)}),
+            sm::make_derive(name + sstring("_deadline_dispatches"), [this] {
+                return this->ptr->deadline_dispatches();
+            }, sm::description("Total requests dispatched ahead of share order to meet the class' latency target"), {io_queue_shard(shard), sm::shard_label(owner), io_queue_mountpoint(mountpoint)}),
+            sm::make_derive(name + sstring("_throttled"), [this] {
+                return this->ptr->throttled_dispatches();
+            }, sm::description("Total times requests of the class were held back by its rate limits"), {io_queue_shard(shard), sm::shard_label(owner), io_queue_mountpoint(mountpoint)})
     });
 }
 
@@ -1201,6 +1329,7 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
     if (it_pclass == _priority_classes.end()) {
         auto shares = _registered_shares.at(pc.id()).load(std::memory_order_acquire);
         auto name = _registered_names.at(pc.id());
+        auto latency_target = _registered_latency_targets.at(pc.id());
         // A note on naming:
         //
         // We could just add the owner as the instance id and have something like:
@@ -1216,20 +1345,23 @@ io_queue::priority_class_data& io_queue::find_or_create_class(const io_priority_
         // This conveys all the information we need and allows one to easily group all classes from
         // the same I/O queue (by filtering by shard)
 
-        auto ret = _priority_classes.emplace(pc.id(), make_lw_shared<priority_class_data>(name, _fq.register_priority_class(shares), owner));
+        auto ret = _priority_classes.emplace(pc.id(), make_lw_shared<priority_class_data>(name, _config.mountpoint, _fq.register_priority_class(shares, latency_target), owner));
         it_pclass = ret.first;
+        if (_config.group) {
+            _fq.share_rate_limits(it_pclass->second->ptr, pc.id());
+        }
+        apply_rate_limits(it_pclass->second->ptr, pc.id());
     }
     return *(it_pclass->second);
 }
 
 template <typename Func>
 future<io_event>
-io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, io_queue::request_type req_type, Func prepare_io) {
+io_queue::queue_request(const io_priority_class& pc, size_t len, io_queue::request_type req_type, Func prepare_io) {
     auto start = std::chrono::steady_clock::now();
-    return smp::submit_to(coordinator, [start, &pc, len, req_type, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] {
-        auto& queue = *(engine()._io_queue);
-        // First time will hit here, and then we create the class. It is important
-        // that we create the shared pointer in the same shard it will be used at later.
+    return futurize_apply([this, start, &pc, len, req_type, prepare_io = std::move(prepare_io), owner = engine().cpu_id()] () mutable {
+        auto& queue = *this;
+        // First time will hit here, and then we create the class.
         auto& pclass = queue.find_or_create_class(pc, owner);
         pclass.bytes += len;
         pclass.ops++;
@@ -1243,7 +1375,7 @@ io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, size_
             weight = io_queue::read_request_base_count;
             size = io_queue::read_request_base_count * len;
         }
-        auto desc = std::make_unique<io_desc>(weight, size);
+        auto desc = std::make_unique<io_desc>(weight, size, len, &queue);
         auto fq_desc = desc->fq_desc;
         auto fut = desc->pr.get_future();
         queue._fq.queue(pclass.ptr, std::move(fq_desc), [&pclass, &queue, start, prepare_io = std::move(prepare_io), desc = std::move(desc)] () mutable noexcept {
@@ -1263,10 +1395,34 @@ io_queue::queue_request(shard_id coordinator, const io_priority_class& pc, size_
 
 future<>
 io_queue::update_shares_for_class(const io_priority_class pc, size_t new_shares) {
-    return smp::submit_to(coordinator(), [pc, owner = engine().cpu_id(), new_shares] {
-        auto& queue = *(engine()._io_queue);
-        auto& pclass = queue.find_or_create_class(pc, owner);
-        queue._fq.update_shares(pclass.ptr, new_shares);
+    return futurize_apply([this, pc, owner = engine().cpu_id(), new_shares] {
+        auto& pclass = find_or_create_class(pc, owner);
+        _fq.update_shares(pclass.ptr, new_shares);
+    });
+}
+
+// The registered limits are for the whole device. The classes of all shards' queues
+// share them through the group, so that each shard may use what the others leave.
+void io_queue::apply_rate_limits(priority_class_ptr pclass, unsigned id) {
+    auto bytes_per_second = _registered_bytes_per_second.at(id).load(std::memory_order_relaxed);
+    auto ops_per_second = _registered_ops_per_second.at(id).load(std::memory_order_relaxed);
+    _fq.set_rate_limits(pclass, bytes_per_second, ops_per_second);
+}
+
+void io_queue::update_rate_limits_for_class(io_priority_class pc) {
+    auto it = _priority_classes.find(pc.id());
+    if (it != _priority_classes.end()) {
+        apply_rate_limits(it->second->ptr, pc.id());
+    }
+}
+
+future<> reactor::update_rate_limits_for_class(io_priority_class pc, uint64_t bytes_per_second, uint64_t ops_per_second) {
+    io_queue::_registered_bytes_per_second.at(pc.id()).store(bytes_per_second, std::memory_order_relaxed);
+    io_queue::_registered_ops_per_second.at(pc.id()).store(ops_per_second, std::memory_order_relaxed);
+    return smp::invoke_on_all([pc] {
+        for (auto& q : engine().my_io_queues) {
+            q->update_rate_limits_for_class(pc);
+        }
     });
 }
 
@@ -1274,9 +1430,14 @@ file_impl* file_impl::get_file_impl(file& f) {
     return f._file_impl.get();
 }
 
+posix_file_impl* posix_file_impl::from_file(const file& f) {
+    return dynamic_cast<posix_file_impl*>(get_file_impl(const_cast<file&>(f)));
+}
+
 posix_file_impl::posix_file_impl(int fd, file_open_options options)
         : _fd(fd) {
     query_dma_alignment();
+    query_device_id();
 }
 
 posix_file_impl::~posix_file_impl() {
@@ -1290,6 +1451,14 @@ posix_file_impl::~posix_file_impl() {
     }
 }
 
+void
+posix_file_impl::query_device_id() {
+    struct stat st;
+    if (::fstat(_fd, &st) == 0) {
+        _device_id = st.st_dev;
+    }
+}
+
 void
 posix_file_impl::query_dma_alignment() {
     dioattr da;
@@ -1305,7 +1474,7 @@ posix_file_impl::query_dma_alignment() {
 
 future<size_t>
 posix_file_impl::write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class& io_priority_class) {
-    return engine().submit_io_write(io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
+    return engine().submit_io_write(_device_id, io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
         io = make_write_iocb(fd, pos, const_cast<void*>(buffer), len);
     }).then([] (io_event ev) {
         throw_kernel_error(long(ev.res));
@@ -1319,7 +1488,7 @@ posix_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priori
     auto iov_ptr = std::make_unique<std::vector<iovec>>(std::move(iov));
     auto size = iov_ptr->size();
     auto data = iov_ptr->data();
-    return engine().submit_io_write(io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
+    return engine().submit_io_write(_device_id, io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
         io = make_writev_iocb(fd, pos, data, size);
     }).then([iov_ptr = std::move(iov_ptr)] (io_event ev) {
         throw_kernel_error(long(ev.res));
@@ -1329,7 +1498,7 @@ posix_file_impl::write_dma(uint64_t pos, std::vector<iovec> iov, const io_priori
 
 future<size_t>
 posix_file_impl::read_dma(uint64_t pos, void* buffer, size_t len, const io_priority_class& io_priority_class) {
-    return engine().submit_io_read(io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
+    return engine().submit_io_read(_device_id, io_priority_class, len, [fd = _fd, pos, buffer, len] (iocb& io) {
         io = make_read_iocb(fd, pos, buffer, len);
     }).then([] (io_event ev) {
         throw_kernel_error(long(ev.res));
@@ -1343,7 +1512,7 @@ posix_file_impl::read_dma(uint64_t pos, std::vector<iovec> iov, const io_priorit
     auto iov_ptr = std::make_unique<std::vector<iovec>>(std::move(iov));
     auto size = iov_ptr->size();
     auto data = iov_ptr->data();
-    return engine().submit_io_read(io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
+    return engine().submit_io_read(_device_id, io_priority_class, len, [fd = _fd, pos, data, size] (iocb& io) {
         io = make_read_iocb(fd, pos, data, size);
     }).then([iov_ptr = std::move(iov_ptr)] (io_event ev) {
         throw_kernel_error(long(ev.res));
@@ -1902,6 +2071,9 @@ reactor::open_file_dma(sstring name, open_flags flags, file_open_options options
         if (fd == -1) {
             return wrap_syscall<int>(fd);
         }
+        if (options.buffered) {
+            return wrap_syscall<int>(fd);
+        }
         int r = ::fcntl(fd, F_SETFL, open_flags | O_DIRECT);
         auto maybe_ret = wrap_syscall<int>(r);  // capture errno (should be EINVAL)
         if (r == -1  && strict_o_direct && !is_tmpfs(fd)) {
@@ -2110,6 +2282,56 @@ file::dup() {
     return seastar::file_handle(_file_impl->dup());
 }
 
+future<std::vector<temporary_buffer<uint8_t>>>
+file::read_ranges(std::vector<file_read_range> ranges, size_t max_gap, const io_priority_class& pc) {
+    struct request {
+        uint64_t pos;
+        uint64_t end;
+        std::vector<size_t> members; // indexes into ranges
+        temporary_buffer<uint8_t> buf;
+    };
+    std::vector<size_t> order;
+    order.reserve(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (ranges[i].len) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&ranges] (size_t a, size_t b) {
+        return ranges[a].pos < ranges[b].pos;
+    });
+    std::vector<request> requests;
+    auto max_length = _file_impl->_disk_read_max_length;
+    for (auto i : order) {
+        auto& r = ranges[i];
+        if (requests.empty() || r.pos > requests.back().end + max_gap
+                || r.pos + r.len - requests.back().pos > max_length) {
+            requests.push_back(request{r.pos, r.pos, {}, {}});
+        }
+        auto& req = requests.back();
+        req.end = std::max(req.end, r.pos + r.len);
+        req.members.push_back(i);
+    }
+    return do_with(std::move(ranges), std::move(requests), [this, &pc] (auto& ranges, auto& requests) {
+        return parallel_for_each(requests, [this, &pc] (request& req) {
+            return _file_impl->dma_read_bulk(req.pos, req.end - req.pos, pc).then([&req] (temporary_buffer<uint8_t> buf) {
+                req.buf = std::move(buf);
+            });
+        }).then([&ranges, &requests] {
+            std::vector<temporary_buffer<uint8_t>> ret(ranges.size());
+            for (auto& req : requests) {
+                for (auto i : req.members) {
+                    auto off = ranges[i].pos - req.pos;
+                    if (off < req.buf.size()) {
+                        ret[i] = req.buf.share(off, std::min(ranges[i].len, req.buf.size() - off));
+                    }
+                }
+            }
+            return ret;
+        });
+    });
+}
+
 std::unique_ptr<seastar::file_handle_impl>
 file_impl::dup() {
     throw std::runtime_error("this file type cannot be duplicated");
@@ -2127,6 +2349,7 @@ posix_file_impl::dup() {
 
 posix_file_impl::posix_file_impl(int fd, std::atomic<unsigned>* refcount)
         : _refcount(refcount), _fd(fd) {
+    query_device_id();
 }
 
 posix_file_handle_impl::~posix_file_handle_impl() {
@@ -2553,18 +2776,49 @@ void reactor::register_metrics() {
             sm::make_current_bytes("free_memory", [] { return memory::stats().free_memory(); }, sm::description("Free memeory size in bytes")),
             sm::make_current_bytes("total_memory", [] { return memory::stats().total_memory(); }, sm::description("Total memeory size in bytes")),
             sm::make_current_bytes("allocated_memory", [] { return memory::stats().allocated_memory(); }, sm::description("Allocated memeory size in bytes")),
-            sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations"))
+            sm::make_derive("reclaims_operations", [] { return memory::stats().reclaims(); }, sm::description("Total reclaims operations")),
+            sm::make_current_bytes("largest_free_span", [this] { return fragmentation_report().largest_free_span(); },
+                    sm::description("Size of the largest free span in bytes; bounds the largest allocation that can succeed without reclaiming")),
+            sm::make_current_bytes("small_pools_memory", [this] { return fragmentation_report().small_pool_memory; },
+                    sm::description("Memory held by small object pools in bytes, including their free objects")),
+            sm::make_current_bytes("small_pools_wasted_memory", [this] {
+                auto& r = fragmentation_report();
+                return boost::accumulate(r.small_pools | boost::adaptors::transformed(std::mem_fn(&memory::small_pool_statistics::wasted_memory)), size_t(0));
+            }, sm::description("Memory held by small object pools but not by live objects, in bytes")),
+            sm::make_gauge("cross_cpu_free_backlog", [this] { return fragmentation_report().cross_cpu_free_backlog; },
+                    sm::description("Number of objects freed on other shards and not yet returned to this one")),
     });
 
+    static auto span_pages_label = sm::label("span_pages");
+    auto nr_span_sizes = fragmentation_report().free_spans.size();
+    for (unsigned i = 0; i < nr_span_sizes; ++i) {
+        _metric_groups.add_group("memory", {
+                sm::make_gauge("free_spans", [this, i] {
+                    auto& r = fragmentation_report();
+                    return i < r.free_spans.size() ? r.free_spans[i] : 0;
+                }, sm::description("Number of free spans of a given size, in pages"), {span_pages_label(1u << i)}),
+        });
+    }
+
+    if (_check_huge_pages) {
+        _metric_groups.add_group("memory", {
+                sm::make_current_bytes("resident_memory", [this] { return _huge_page_usage.resident; },
+                        sm::description("Shard memory resident in RAM, in bytes, as of the last huge page check")),
+                sm::make_current_bytes("huge_page_memory", [this] { return _huge_page_usage.huge; },
+                        sm::description("Shard memory backed by transparent huge pages, in bytes, as of the last huge page check")),
+        });
+    }
+
     _metric_groups.add_group("reactor", {
             sm::make_derive("logging_failures", [] { return logging_failures; }, sm::description("Total number of logging failures")),
             // total_operations value:DERIVE:0:U
             sm::make_derive("cpp_exceptions", _cxx_exceptions, sm::description("Total number of C++ exceptions")),
     });
 
-    if (my_io_queue) {
+    for (auto& q : my_io_queues) {
         _metric_groups.add_group("reactor", {
-                sm::make_gauge("io_queue_requests", [this] { return my_io_queue->queued_requests(); } , sm::description("Number of requests in the io queue")),
+                sm::make_gauge("io_queue_requests", [q = q.get()] { return q->queued_requests(); } , sm::description("Number of requests in the io queue"),
+                        {io_queue_mountpoint(q->mountpoint())}),
         });
     }
 
@@ -2594,6 +2848,27 @@ void reactor::register_metrics() {
                 description(
                         "Counts the number of buffered bytes that were read ahead of time and were discarded because they were not needed, wasting disk bandwidth."
                         " Indicates over-eager read ahead configuration.")),
+        make_counter("fstream_strided_read_aheads", _io_stats.fstream_strided_read_aheads,
+                description(
+                        "Counts read-ahead operations issued for a strided access pattern, reading only the parts of the file the consumer is expected to use.")),
+        make_counter("fstream_prefetches", _io_stats.fstream_prefetches,
+                description(
+                        "Counts reads issued for a stream that was predicted to be opened next, from the offsets of the previous streams on the same file.")),
+        make_counter("fstream_prefetch_hits", _io_stats.fstream_prefetch_hits,
+                description(
+                        "Counts streams that were opened where predicted, and could use the data prefetched for them.")),
+        make_counter("fstream_prefetches_discarded", _io_stats.fstream_prefetches_discarded,
+                description(
+                        "Counts prefetched reads that were discarded because no stream was opened where predicted, wasting disk bandwidth.")),
+        make_counter("zero_copy_sends", _io_stats.zero_copy_sends,
+                description(
+                        "Counts socket writes made with MSG_ZEROCOPY, whose buffers are held until the kernel reports it is done with them.")),
+        make_counter("zero_copy_completions", _io_stats.zero_copy_completions,
+                description(
+                        "Counts MSG_ZEROCOPY writes the kernel reported done with; their buffers were released.")),
+        make_counter("zero_copy_copied", _io_stats.zero_copy_copied,
+                description(
+                        "Counts MSG_ZEROCOPY writes the kernel copied anyway (e.g. over loopback). A high share of zero_copy_sends means zero-copy only adds overhead.")),
     });
 }
 
@@ -2704,7 +2979,9 @@ class reactor::io_pollfn final : public reactor::pollfn {
         // is only possible if there are no in-flight aios. If there are, we need to keep polling.
         //
         // Alternatively, if we enabled _aio_eventfd, we can always enter
-        return _r.my_io_queue->requests_currently_executing() == 0 || _r._aio_eventfd;
+        return _r._aio_eventfd || std::all_of(_r.my_io_queues.begin(), _r.my_io_queues.end(), [] (auto& q) {
+            return q->requests_currently_executing() == 0;
+        });
     }
     virtual void exit_interrupt_mode() override {
         // nothing to do
@@ -2763,8 +3040,12 @@ class reactor::batch_flush_pollfn final : public reactor::pollfn {
 
 class reactor::aio_batch_submit_pollfn final : public reactor::pollfn {
     reactor& _r;
+    // Wakes us up when requests held back by rate limits may be dispatched, or
+    // to retry those held back by the other shards using the device's capacity.
+    timer<> _refill_timer;
+    static constexpr std::chrono::microseconds group_retry_period{100};
 public:
-    aio_batch_submit_pollfn(reactor& r) : _r(r) {}
+    aio_batch_submit_pollfn(reactor& r) : _r(r), _refill_timer([this] { _r.flush_pending_aio(); }) {}
     virtual bool poll() final override {
         return _r.flush_pending_aio();
     }
@@ -2773,13 +3054,36 @@ class reactor::aio_batch_submit_pollfn final : public reactor::pollfn {
     }
     virtual bool try_enter_interrupt_mode() override {
         // This is a passive poller, so if a previous poll
-        // returned false (idle), there's no more work to do.
+        // returned false (idle), there's no more work to do,
+        // unless requests are held back and no completion of
+        // ours will wake us up to dispatch them. Then we sleep
+        // until they have tokens again, or for a while if they
+        // wait for other shards to free the device's capacity.
+        auto now = steady_clock_type::now();
+        auto wakeup = steady_clock_type::time_point::max();
+        for (auto& q : _r.my_io_queues) {
+            if (q->queued_requests() && !q->requests_currently_executing()) {
+                auto refill = q->next_refill();
+                wakeup = std::min(wakeup, refill != steady_clock_type::time_point::max() ? refill : now + group_retry_period);
+            }
+        }
+        if (wakeup == steady_clock_type::time_point::max()) {
+            return true;
+        }
+        if (wakeup <= now) {
+            return false;
+        }
+        _refill_timer.rearm(wakeup);
         return true;
     }
     virtual void exit_interrupt_mode() override final {
+        _refill_timer.cancel();
     }
 };
 
+constexpr std::chrono::microseconds reactor::aio_batch_submit_pollfn::group_retry_period;
+constexpr unsigned reactor::max_accept_batch;
+
 class reactor::drain_cross_cpu_freelist_pollfn final : public reactor::pollfn {
 public:
     virtual bool poll() final override {
@@ -2872,6 +3176,55 @@ class reactor::smp_pollfn final : public reactor::pollfn {
     }
 };
 
+class reactor::work_stealing_pollfn final : public reactor::pollfn {
+    reactor& _r;
+    // Stealable work queues of the other shards, nearest first.
+    std::vector<internal::work_stealing_deque<internal::stealable_work_item, 1024>*> _victims;
+public:
+    work_stealing_pollfn(reactor& r) : _r(r) {
+        std::vector<unsigned> shards;
+        for (auto c : smp::all_cpus()) {
+            if (c != r._id) {
+                shards.push_back(c);
+            }
+        }
+        std::stable_sort(shards.begin(), shards.end(), [&r] (unsigned a, unsigned b) {
+            return smp::distance(r._id, a) < smp::distance(r._id, b);
+        });
+        for (auto c : shards) {
+            _victims.push_back(&smp::_reactors[c]->_stealable_work);
+        }
+    }
+    virtual bool poll() final override {
+        // Our own tasks come first; only an idle shard steals.
+        if (_r.have_more_tasks()) {
+            return false;
+        }
+        for (auto q : _victims) {
+            if (auto wi = q->steal()) {
+                ++_r._task_queues[internal::scheduling_group_index(wi->_sg)]->_tasks_stolen;
+                _r.add_task(make_task(wi->_sg, [wi] { wi->process(); }));
+                return true;
+            }
+        }
+        return false;
+    }
+    virtual bool pure_poll() final override {
+        if (_r.have_more_tasks()) {
+            return false;
+        }
+        return std::any_of(_victims.begin(), _victims.end(), [] (auto q) { return !q->empty(); });
+    }
+    virtual bool try_enter_interrupt_mode() override {
+        // Shards queueing stealable work do not wake us up; that is fine,
+        // they can always run it themselves. We will look again when we
+        // wake up for another reason.
+        return true;
+    }
+    virtual void exit_interrupt_mode() override final {
+    }
+};
+
 class reactor::execution_stage_pollfn final : public reactor::pollfn {
     internal::execution_stage_manager& _esm;
 public:
@@ -3063,16 +3416,23 @@ int reactor::run() {
     std::experimental::optional<poller> io_poller = {};
     std::experimental::optional<poller> aio_poller = {};
     std::experimental::optional<poller> smp_poller = {};
+    std::experimental::optional<poller> work_stealing_poller = {};
 
     // I/O Performance greatly increases if the smp poller runs before the I/O poller. This is
     // because requests that were just added can be polled and processed by the I/O poller right
     // away.
     if (smp::count > 1) {
         smp_poller = poller(std::make_unique<smp_pollfn>(*this));
+        work_stealing_poller = poller(std::make_unique<work_stealing_pollfn>(*this));
     }
-    if (my_io_queue) {
+    if (!my_io_queues.empty()) {
 #ifndef HAVE_OSV
-        io_poller = poller(std::make_unique<io_pollfn>(*this));
+        if (_backend->handles_disk_io()) {
+            // Disk I/O is submitted and reaped by the backend's own poller.
+            start_epoll();
+        } else {
+            io_poller = poller(std::make_unique<io_pollfn>(*this));
+        }
 #endif
         aio_poller = poller(std::make_unique<aio_batch_submit_pollfn>(*this));
     }
@@ -3146,6 +3506,12 @@ int reactor::run() {
     });
     load_timer.arm_periodic(1s);
 
+    timer<lowres_clock> huge_page_check_timer([this] { check_huge_pages(); });
+    if (_check_huge_pages && _id == 0) {
+        check_huge_pages();
+        huge_page_check_timer.arm_periodic(1min);
+    }
+
     itimerspec its = seastar::posix::to_relative_itimerspec(_task_quota, _task_quota);
     _task_quota_timer.timerfd_settime(0, its);
     auto& task_quote_itimerspec = its;
@@ -3168,6 +3534,7 @@ int reactor::run() {
         run_some_tasks();
         if (_stopped) {
             load_timer.cancel();
+            huge_page_check_timer.cancel();
             // Final tasks may include sending the last response to cpu 0, so run them
             while (have_more_tasks()) {
                 run_some_tasks();
@@ -3231,7 +3598,7 @@ int reactor::run() {
     // This is needed because the reactor is destroyed from the thread_local destructors. If
     // the I/O queue happens to use any other infrastructure that is also kept this way (for
     // instance, collectd), we will not have any way to guarantee who is destroyed first.
-    my_io_queue.reset(nullptr);
+    my_io_queues.clear();
     return _return;
 }
 
@@ -3384,10 +3751,12 @@ reactor_backend_epoll::wait_and_process(int timeout, const sigset_t* active_sigm
     for (int i = 0; i < nr; ++i) {
         auto& evt = eevt[i];
         auto pfd = reinterpret_cast<pollable_fd_state*>(evt.data.ptr);
-        auto events = evt.events & (EPOLLIN | EPOLLOUT);
-        auto events_to_remove = events & ~pfd->events_requested;
+        auto events = evt.events & (EPOLLIN | EPOLLOUT | EPOLLERR);
+        // EPOLLERR is reported even when not registered for.
+        auto events_to_remove = events & ~pfd->events_requested & pfd->events_epoll;
         complete_epoll_event(*pfd, &pollable_fd_state::pollin, events, EPOLLIN);
         complete_epoll_event(*pfd, &pollable_fd_state::pollout, events, EPOLLOUT);
+        complete_epoll_event(*pfd, &pollable_fd_state::pollerr, events, EPOLLERR);
         if (events_to_remove) {
             pfd->events_epoll &= ~events_to_remove;
             evt.events = pfd->events_epoll;
@@ -3426,10 +3795,13 @@ unsigned syscall_work_queue::complete() {
     return nr;
 }
 
-smp_message_queue::smp_message_queue(reactor* from, reactor* to)
-    : _pending(to)
-    , _completed(from)
+smp_message_queue::smp_message_queue(reactor* from, reactor* to, config cfg)
+    : _queue_length(cfg.queue_length)
+    , _pending(to, cfg.queue_length)
+    , _completed(from, cfg.queue_length)
+    , _max_backlog(cfg.max_backlog)
 {
+    assert(_queue_length <= max_queue_length);
 }
 
 smp_message_queue::~smp_message_queue()
@@ -3456,6 +3828,7 @@ void smp_message_queue::move_pending() {
     _current_queue_length += nr;
     _last_snt_batch = nr;
     _sent += nr;
+    _queue_depth.add(_current_queue_length + _tx.a.pending_fifo.size());
 }
 
 bool smp_message_queue::pure_poll_tx() const {
@@ -3464,17 +3837,17 @@ bool smp_message_queue::pure_poll_tx() const {
     return !const_cast<lf_queue&>(_completed).empty();
 }
 
-void smp_message_queue::submit_item(std::unique_ptr<smp_message_queue::work_item> item) {
-    _tx.a.pending_fifo.push_back(item.get());
-    item.release();
-    if (_tx.a.pending_fifo.size() >= batch_size) {
+void smp_message_queue::submit_item(smp_message_queue::work_item* item) {
+    item->_submitted = clock_type::now();
+    _tx.a.pending_fifo.push_back(item);
+    if (_tx.a.pending_fifo.size() >= _batch_size) {
         move_pending();
     }
 }
 
 void smp_message_queue::respond(work_item* item) {
     _completed_fifo.push_back(item);
-    if (_completed_fifo.size() >= batch_size || engine()._stopped) {
+    if (_completed_fifo.size() >= default_batch_size || engine()._stopped) {
         flush_response_batch();
     }
 }
@@ -3523,7 +3896,7 @@ template<size_t PrefetchCnt, typename Func>
 size_t smp_message_queue::process_queue(lf_queue& q, Func process) {
     // copy batch to local memory in order to minimize
     // time in which cross-cpu data is accessed
-    work_item* items[queue_length + PrefetchCnt];
+    work_item* items[max_queue_length + PrefetchCnt];
     work_item* wi;
     if (!q.pop(wi))
         return 0;
@@ -3542,18 +3915,57 @@ size_t smp_message_queue::process_queue(lf_queue& q, Func process) {
     return nr + 1;
 }
 
+void smp_message_queue::dispose(work_item* wi) {
+    if (_tx.a.backlog) {
+        _tx.a.backlog->signal(1);
+    }
+    if (wi->_pooled) {
+        wi->~work_item();
+        _tx.a.pool.deallocate(wi);
+    } else {
+        delete wi;
+    }
+}
+
 size_t smp_message_queue::process_completions() {
-    auto nr = process_queue<prefetch_cnt*2>(_completed, [] (work_item* wi) {
+    auto now = clock_type::now();
+    clock_type::duration total_queueing{};
+    auto nr = process_queue<prefetch_cnt*2>(_completed, [this, now, &total_queueing] (work_item* wi) {
+        // Only the wait for the remote shard says anything about batching;
+        // the time the function itself takes does not.
+        total_queueing += wi->_picked_up - wi->_submitted;
+        _latency_us.add(std::chrono::duration_cast<std::chrono::microseconds>(now - wi->_submitted).count());
         wi->complete();
-        delete wi;
+        dispose(wi);
     });
     _current_queue_length -= nr;
     _compl += nr;
     _last_cmpl_batch = nr;
+    if (nr) {
+        auto avg_us = std::chrono::duration<double, std::micro>(total_queueing).count() / nr;
+        _avg_queueing_us = _avg_queueing_us * 0.9 + avg_us * 0.1;
+        adapt_batch_size();
+    }
 
     return nr;
 }
 
+void smp_message_queue::adapt_batch_size() {
+    auto max_batch_size = _queue_length / 4;
+    auto task_quota_us = std::chrono::duration<double, std::micro>(engine()._task_quota).count();
+    if (_current_queue_length > _queue_length / 2) {
+        // The remote shard is falling behind; handing it messages in larger
+        // batches costs it nothing and saves cross-CPU index updates.
+        _batch_size = std::min(_batch_size * 2, max_batch_size);
+    } else if (_avg_queueing_us > task_quota_us && _batch_size > 1) {
+        // The ring is mostly empty, yet messages wait long to be picked up:
+        // they are waiting in pending_fifo for a batch to fill up. Flush sooner.
+        _batch_size /= 2;
+    } else if (_current_queue_length == 0 && _batch_size < default_batch_size) {
+        _batch_size = std::min(_batch_size + 1, default_batch_size);
+    }
+}
+
 void smp_message_queue::flush_request_batch() {
     if (!_tx.a.pending_fifo.empty()) {
         move_pending();
@@ -3561,7 +3973,13 @@ void smp_message_queue::flush_request_batch() {
 }
 
 size_t smp_message_queue::process_incoming() {
-    auto nr = process_queue<prefetch_cnt>(_pending, [this] (work_item* wi) {
+    // Read the clock once per batch, and not at all when polling finds none
+    clock_type::time_point now;
+    auto nr = process_queue<prefetch_cnt>(_pending, [this, &now] (work_item* wi) {
+        if (now == clock_type::time_point()) {
+            now = clock_type::now();
+        }
+        wi->_picked_up = now;
         wi->process();
     });
     _received += nr;
@@ -3570,7 +3988,10 @@ size_t smp_message_queue::process_incoming() {
 }
 
 void smp_message_queue::start(unsigned cpuid) {
-    _tx.init();
+    _tx.init(_queue_length * 4);
+    if (_max_backlog) {
+        _tx.a.backlog.emplace(_max_backlog);
+    }
     namespace sm = seastar::metrics;
     char instance[10];
     std::snprintf(instance, sizeof(instance), "%u-%u", engine().cpu_id(), cpuid);
@@ -3586,7 +4007,11 @@ void smp_message_queue::start(unsigned cpuid) {
             // total_operations value:DERIVE:0:U
             sm::make_derive("total_sent_messages", _sent, sm::description("Total number of sent messages"), {sm::shard_label(instance)})(sm::metric_disabled),
             // total_operations value:DERIVE:0:U
-            sm::make_derive("total_completed_messages", _compl, sm::description("Total number of messages completed"), {sm::shard_label(instance)})(sm::metric_disabled)
+            sm::make_derive("total_completed_messages", _compl, sm::description("Total number of messages completed"), {sm::shard_label(instance)})(sm::metric_disabled),
+            sm::make_gauge("send_batch_size", _batch_size, sm::description("Number of pending messages that triggers an immediate send"), {sm::shard_label(instance)})(sm::metric_disabled),
+            sm::make_derive("total_throttled_messages", _throttled, sm::description("Total number of messages that waited for the backlog to drain"), {sm::shard_label(instance)})(sm::metric_disabled),
+            sm::make_histogram("queue_depth", [this] { return _queue_depth.get(); }, sm::description("Messages in flight or pending, sampled on every send"), {sm::shard_label(instance)})(sm::metric_disabled),
+            sm::make_histogram("message_latency", [this] { return _latency_us.get(); }, sm::description("Time from submit to completion, in microseconds"), {sm::shard_label(instance)})(sm::metric_disabled)
     });
 }
 
@@ -3728,10 +4153,17 @@ reactor::get_options_description(std::chrono::duration<double> default_task_quot
     namespace bpo = boost::program_options;
     bpo::options_description opts("Core options");
     auto net_stack_names = network_stack_registry::list();
+    std::vector<std::string> backend_names;
+    for (auto&& rbs : reactor_backend_selector::available()) {
+        backend_names.push_back(rbs.name());
+    }
     opts.add_options()
         ("network-stack", bpo::value<std::string>(),
                 sprint("select network stack (valid values: %s)",
                         format_separated(net_stack_names.begin(), net_stack_names.end(), ", ")).c_str())
+        ("reactor-backend", bpo::value<std::string>()->default_value(reactor_backend_selector::default_backend().name()),
+                sprint("internal reactor implementation (valid values: %s)",
+                        format_separated(backend_names.begin(), backend_names.end(), ", ")).c_str())
         ("no-handle-interrupt", "ignore SIGINT (for gdb)")
         ("poll-mode", "poll continuously (100% cpu use)")
         ("idle-poll-time-us", bpo::value<unsigned>()->default_value(calculate_poll_time() / 1us),
@@ -3768,14 +4200,24 @@ smp::get_options_description()
         ("lock-memory", bpo::value<bool>(), "lock all memory (prevents swapping)")
         ("thread-affinity", bpo::value<bool>()->default_value(true), "pin threads to their cpus (disable for overprovisioning)")
 #ifdef SEASTAR_HAVE_HWLOC
-        ("num-io-queues", bpo::value<unsigned>(), "Number of IO queues. Each IO unit will be responsible for a fraction of the IO requests. Defaults to the number of threads")
-        ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of IO queues")
+        ("num-io-queues", bpo::value<unsigned>(), "Deprecated, ignored. Each shard has its own IO queues, sharing the disk's capacity with the others")
+        ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of processors")
 #else
         ("max-io-requests", bpo::value<unsigned>(), "Maximum amount of concurrent requests to be sent to the disk. Defaults to 128 times the number of processors")
 #endif
         ("io-properties-file", bpo::value<std::string>(), "path to a YAML file describing the chraracteristics of the I/O Subsystem")
         ("io-properties", bpo::value<std::string>(), "a YAML string describing the chraracteristics of the I/O Subsystem")
         ("mbind", bpo::value<bool>()->default_value(true), "enable mbind")
+        ("prefault-memory", bpo::value<bool>()->default_value(false),
+                "fault in each shard's memory at startup, in parallel, and monitor its huge page coverage")
+        ("heap-sampling-interval", bpo::value<size_t>()->default_value(0),
+                "sample one allocation per this many bytes allocated, on average, for the /heap_profile endpoint (0 to disable)")
+        ("smp-queue-length", bpo::value<unsigned>()->default_value(smp_message_queue::default_queue_length),
+                sprint("capacity of each cross-shard message queue (at most %d)", smp_message_queue::max_queue_length).c_str())
+        ("smp-max-backlog", bpo::value<unsigned>()->default_value(0),
+                "maximum number of cross-shard messages in flight per shard pair before submitters wait (0 for unlimited)")
+        ("smp-relay-broadcasts", bpo::value<bool>()->default_value(false),
+                "route invoke_on_all() to remote sockets through one shard per socket, instead of directly to every shard")
 #ifndef SEASTAR_NO_EXCEPTION_HACK
         ("enable-glibc-exception-scaling-workaround", bpo::value<bool>()->default_value(true), "enable workaround for glibc/gcc c++ exception scalablity problem")
 #endif
@@ -3806,6 +4248,36 @@ std::unique_ptr<smp_message_queue*[], smp::qs_deleter> smp::_qs;
 std::thread::id smp::_tmain;
 unsigned smp::count = 1;
 bool smp::_using_dpdk;
+smp_message_queue::config smp::_queue_config;
+smp::topology smp::_topology;
+
+void smp::init_topology(const std::vector<resource::cpu>& allocations, bool relay_broadcasts) {
+    _topology = topology{};
+    std::unordered_map<unsigned, unsigned> socket_index;
+    for (auto&& a : allocations) {
+        auto i = socket_index.emplace(a.socket_id, socket_index.size()).first->second;
+        if (i == _topology.socket_shards.size()) {
+            _topology.socket_shards.emplace_back();
+        }
+        _topology.socket_shards[i].push_back(_topology.shard_socket.size());
+        _topology.shard_socket.push_back(i);
+        _topology.shard_core.push_back(a.core_id);
+    }
+    // With a single socket, relaying would only add a hop.
+    _topology.relay_broadcasts = relay_broadcasts && _topology.socket_shards.size() > 1;
+}
+
+smp::shard_distance smp::distance(unsigned a, unsigned b) {
+    if (a == b) {
+        return shard_distance::same_shard;
+    } else if (_topology.shard_socket[a] != _topology.shard_socket[b]) {
+        return shard_distance::remote_socket;
+    } else if (_topology.shard_core[a] == _topology.shard_core[b]) {
+        return shard_distance::sibling;
+    } else {
+        return shard_distance::same_socket;
+    }
+}
 
 void smp::start_all_queues()
 {
@@ -3854,7 +4326,7 @@ void smp::arrive_at_event_loop_end() {
     }
 }
 
-void smp::allocate_reactor(unsigned id) {
+void smp::allocate_reactor(unsigned id, reactor_backend_selector rbs) {
     assert(!reactor_holder);
 
     // we cannot just write "local_engin = new reactor" since reactor's constructor
@@ -3863,7 +4335,7 @@ void smp::allocate_reactor(unsigned id) {
     int r = posix_memalign(&buf, cache_line_size, sizeof(reactor));
     assert(r == 0);
     local_engine = reinterpret_cast<reactor*>(buf);
-    new (buf) reactor(id);
+    new (buf) reactor(id, std::move(rbs));
     reactor_holder.reset(local_engine);
 }
 
@@ -3938,21 +4410,14 @@ void smp::qs_deleter::operator()(smp_message_queue** qs) const {
 
 class disk_config_params {
 public:
-    unsigned _num_io_queues = smp::count;
     unsigned _capacity = std::numeric_limits<unsigned>::max();
-    uint64_t _read_bytes_rate = std::numeric_limits<uint64_t>::max();
-    uint64_t _write_bytes_rate = std::numeric_limits<uint64_t>::max();
-    uint64_t _read_req_rate = std::numeric_limits<uint64_t>::max();
-    uint64_t _write_req_rate = std::numeric_limits<uint64_t>::max();
+    // With a single mountpoint, its properties apply to all files, as the
+    // default queue. With several, each gets a queue of its own, keyed by
+    // device, and the default queue serves the remaining files unthrottled.
+    mountpoint_params _default_disk;
+    std::vector<std::pair<dev_t, mountpoint_params>> _disks;
     std::chrono::duration<double> _latency_goal;
-
-    uint64_t per_io_queue(uint64_t qty) const {
-        return std::max(qty / _num_io_queues, 1ul);
-    }
 public:
-    unsigned num_io_queues() const {
-        return _num_io_queues;
-    }
 
     void parse_config(boost::program_options::variables_map& configuration) {
         if (configuration.count("max-io-requests")) {
@@ -3960,8 +4425,9 @@ class disk_config_params {
         }
 
         if (configuration.count("num-io-queues")) {
-            _num_io_queues = configuration["num-io-queues"].as<unsigned>();
+            seastar_logger.warn("--num-io-queues is deprecated and has no effect: each shard has IO queues of its own");
         }
+
         if (configuration.count("io-properties-file") && configuration.count("io-properties")) {
             throw std::runtime_error("Both io-properties and io-properties-file specified. Don't know which to trust!");
         }
@@ -3979,32 +4445,55 @@ class disk_config_params {
                     throw std::runtime_error(fmt::format("While parsing I/O options: section {} currently unsupported.", sec_name));
                 }
                 auto disks = section.second.as<std::vector<mountpoint_params>>();
-                if (disks.size() != 1) {
-                    throw std::runtime_error(fmt::format("while parsing I/O options: currently only one mountpoint is supported. Specified {}", disks.size()));
+                if (disks.size() == 1) {
+                    _default_disk = disks[0];
+                    continue;
+                }
+                for (auto&& disk : disks) {
+                    struct stat st;
+                    if (::stat(disk.mountpoint.c_str(), &st) == -1) {
+                        throw std::system_error(errno, std::system_category(), fmt::format("While parsing I/O options: cannot stat mountpoint {}", disk.mountpoint));
+                    }
+                    auto same_device = [&st] (auto& d) { return d.first == st.st_dev; };
+                    if (std::any_of(_disks.begin(), _disks.end(), same_device)) {
+                        throw std::runtime_error(fmt::format("While parsing I/O options: mountpoint {} is on the same device as another one", disk.mountpoint));
+                    }
+                    _disks.emplace_back(st.st_dev, disk);
                 }
-                _read_bytes_rate = disks[0].read_bytes_rate;
-                _read_req_rate = disks[0].read_req_rate;
-                _write_bytes_rate = disks[0].write_bytes_rate;
-                _write_req_rate = disks[0].write_req_rate;
             }
         }
         _latency_goal = std::chrono::duration_cast<std::chrono::duration<double>>(configuration["task-quota-ms"].as<double>() * 1.5 * 1ms);
     }
 
+    const std::vector<std::pair<dev_t, mountpoint_params>>& disks() const {
+        return _disks;
+    }
+
     struct io_queue::config generate_config() const {
+        return generate_config(_default_disk);
+    }
+
+    struct io_queue::config generate_config(dev_t devid, const mountpoint_params& disk) const {
+        auto cfg = generate_config(disk);
+        cfg.devid = devid;
+        cfg.mountpoint = disk.mountpoint;
+        return cfg;
+    }
+private:
+    struct io_queue::config generate_config(const mountpoint_params& disk) const {
         struct io_queue::config cfg;
-        uint64_t max_bandwidth = std::max(_read_bytes_rate, _write_bytes_rate);
-        uint64_t max_iops = std::max(_read_req_rate, _write_req_rate);
+        uint64_t max_bandwidth = std::max(disk.read_bytes_rate, disk.write_bytes_rate);
+        uint64_t max_iops = std::max(disk.read_req_rate, disk.write_req_rate);
 
-        cfg.capacity = per_io_queue(_capacity);
-        cfg.disk_bytes_write_to_read_multiplier = (io_queue::read_request_base_count * _read_bytes_rate) / _write_bytes_rate;
-        cfg.disk_req_write_to_read_multiplier = (io_queue::read_request_base_count * _read_req_rate) / _write_req_rate;
+        cfg.capacity = _capacity;
+        cfg.disk_bytes_write_to_read_multiplier = (io_queue::read_request_base_count * disk.read_bytes_rate) / disk.write_bytes_rate;
+        cfg.disk_req_write_to_read_multiplier = (io_queue::read_request_base_count * disk.read_req_rate) / disk.write_req_rate;
         cfg.max_req_count = max_bandwidth == std::numeric_limits<uint64_t>::max()
             ? std::numeric_limits<unsigned>::max()
-            : io_queue::read_request_base_count * per_io_queue(max_iops * _latency_goal.count());
+            : io_queue::read_request_base_count * uint64_t(max_iops * _latency_goal.count());
         cfg.max_bytes_count = max_iops == std::numeric_limits<uint64_t>::max()
             ? std::numeric_limits<unsigned>::max()
-            : io_queue::read_request_base_count * per_io_queue(max_bandwidth * _latency_goal.count());
+            : io_queue::read_request_base_count * uint64_t(max_bandwidth * _latency_goal.count());
         return cfg;
     }
 };
@@ -4048,6 +4537,7 @@ void smp::configure(boost::program_options::variables_map configuration)
     if (!thread_affinity) {
         mbind = false;
     }
+    auto prefault = configuration["prefault-memory"].as<bool>();
 
     smp::count = 1;
     smp::_tmain = std::this_thread::get_id();
@@ -4065,6 +4555,11 @@ void smp::configure(boost::program_options::variables_map configuration)
     }
     smp::count = nr_cpus;
     _reactors.resize(nr_cpus);
+    _queue_config.queue_length = configuration["smp-queue-length"].as<unsigned>();
+    if (_queue_config.queue_length < 16 || _queue_config.queue_length > smp_message_queue::max_queue_length) {
+        throw std::invalid_argument(sprint("--smp-queue-length must be between 16 and %d", smp_message_queue::max_queue_length));
+    }
+    _queue_config.max_backlog = configuration["smp-max-backlog"].as<unsigned>();
     resource::configuration rc;
     if (configuration.count("memory")) {
         rc.total_memory = parse_memory_size(configuration["memory"].as<std::string>());
@@ -4113,10 +4608,10 @@ void smp::configure(boost::program_options::variables_map configuration)
 
     disk_config_params disk_config;
     disk_config.parse_config(configuration);
-    rc.io_queues =  disk_config.num_io_queues();
 
     auto resources = resource::allocate(rc);
     std::vector<resource::cpu> allocations = std::move(resources.cpus);
+    init_topology(allocations, configuration["smp-relay-broadcasts"].as<bool>());
     if (thread_affinity) {
         smp::pin(allocations[0].cpu_id);
     }
@@ -4128,6 +4623,10 @@ void smp::configure(boost::program_options::variables_map configuration)
 
     bool heapprof_enabled = configuration.count("heapprof");
     memory::set_heap_profiling_enabled(heapprof_enabled);
+    auto heap_sampling_interval = configuration["heap-sampling-interval"].as<size_t>();
+    memory::set_heap_sampling_interval(heap_sampling_interval);
+
+    auto reactor_backend = reactor_backend_selector::from_name(configuration["reactor-backend"].as<std::string>());
 
 #ifdef SEASTAR_HAVE_DPDK
     if (smp::_using_dpdk) {
@@ -4145,37 +4644,36 @@ void smp::configure(boost::program_options::variables_map configuration)
     static boost::barrier smp_queues_constructed(smp::count);
     static boost::barrier inited(smp::count);
 
-    auto io_info = std::move(resources.io_queues);
-
-    std::vector<io_queue*> all_io_queues;
-    all_io_queues.resize(io_info.coordinators.size());
+    // The default queue's config followed by one per configured device. All shards get a
+    // queue for each, sharing the device's capacity through its group.
+    std::vector<struct io_queue::config> io_configs;
+    io_configs.push_back(disk_config.generate_config());
+    for (auto&& disk : disk_config.disks()) {
+        io_configs.push_back(disk_config.generate_config(disk.first, disk.second));
+    }
+    for (auto& cfg : io_configs) {
+        cfg.group = std::make_shared<fair_group>(fair_group::config{cfg.capacity, cfg.max_req_count, cfg.max_bytes_count, io_queue::_max_classes});
+    }
+    std::vector<std::vector<io_queue*>> all_io_queues;
+    all_io_queues.resize(smp::count);
     io_queue::fill_shares_array();
 
-    auto alloc_io_queue = [io_info, &all_io_queues, &disk_config] (unsigned shard) {
-        auto cid = io_info.shard_to_coordinator[shard];
-        int vec_idx = 0;
-        for (auto& coordinator: io_info.coordinators) {
-            if (coordinator != cid) {
-                vec_idx++;
-                continue;
-            }
-            if (shard == cid) {
-                struct io_queue::config cfg = disk_config.generate_config();
-                cfg.coordinator = coordinator;
-                cfg.io_topology = io_info.shard_to_coordinator;
-                all_io_queues[vec_idx] = new io_queue(std::move(cfg));
-            }
-            return vec_idx;
+    auto alloc_io_queue = [&io_configs, &all_io_queues] (unsigned shard) {
+        for (auto& cfg : io_configs) {
+            all_io_queues[shard].push_back(new io_queue(cfg));
         }
-        assert(0); // Impossible
+        return shard;
     };
 
     auto assign_io_queue = [&all_io_queues] (shard_id id, int queue_idx) {
-        if (all_io_queues[queue_idx]->coordinator() == id) {
-            engine().my_io_queue.reset(all_io_queues[queue_idx]);
+        auto& queues = all_io_queues[queue_idx];
+        for (auto q : queues) {
+            engine().my_io_queues.emplace_back(q);
+        }
+        engine()._io_queue = queues.front();
+        for (unsigned i = 1; i < queues.size(); ++i) {
+            engine()._io_queues.emplace(queues[i]->devid(), queues[i]);
         }
-        engine()._io_queue = all_io_queues[queue_idx];
-        engine()._io_coordinator = all_io_queues[queue_idx]->coordinator();
     };
 
     _all_event_loops_done.emplace(smp::count);
@@ -4183,14 +4681,18 @@ void smp::configure(boost::program_options::variables_map configuration)
     unsigned i;
     for (i = 1; i < smp::count; i++) {
         auto allocation = allocations[i];
-        create_thread([configuration, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, heapprof_enabled, mbind] {
+        create_thread([configuration, hugepages_path, i, allocation, assign_io_queue, alloc_io_queue, thread_affinity, heapprof_enabled, heap_sampling_interval, mbind, prefault, reactor_backend] {
             auto thread_name = seastar::format("reactor-{}", i);
             pthread_setname_np(pthread_self(), thread_name.c_str());
             if (thread_affinity) {
                 smp::pin(allocation.cpu_id);
             }
             memory::configure(allocation.mem, mbind, hugepages_path);
+            if (prefault) {
+                memory::prefault();
+            }
             memory::set_heap_profiling_enabled(heapprof_enabled);
+            memory::set_heap_sampling_interval(heap_sampling_interval);
             sigset_t mask;
             sigfillset(&mask);
             for (auto sig : { SIGSEGV }) {
@@ -4198,7 +4700,7 @@ void smp::configure(boost::program_options::variables_map configuration)
             }
             auto r = ::pthread_sigmask(SIG_BLOCK, &mask, NULL);
             throw_pthread_error(r);
-            allocate_reactor(i);
+            allocate_reactor(i, reactor_backend);
             _reactors[i] = &engine();
             auto queue_idx = alloc_io_queue(i);
             reactors_registered.wait();
@@ -4211,7 +4713,11 @@ void smp::configure(boost::program_options::variables_map configuration)
         });
     }
 
-    allocate_reactor(0);
+    // Only now, so that we fault in our memory in parallel with the other shards.
+    if (prefault) {
+        memory::prefault();
+    }
+    allocate_reactor(0, reactor_backend);
     _reactors[0] = &engine();
     auto queue_idx = alloc_io_queue(0);
 
@@ -4229,7 +4735,7 @@ void smp::configure(boost::program_options::variables_map configuration)
     for(unsigned i = 0; i < smp::count; i++) {
         smp::_qs[i] = reinterpret_cast<smp_message_queue*>(operator new[] (sizeof(smp_message_queue) * smp::count));
         for (unsigned j = 0; j < smp::count; ++j) {
-            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i]);
+            new (&smp::_qs[i][j]) smp_message_queue(_reactors[j], _reactors[i], _queue_config);
         }
     }
     alien::smp::_qs = alien::smp::create_qs(_reactors);
@@ -4302,6 +4808,273 @@ reactor_backend_epoll::make_reactor_notifier() {
     return std::make_unique<reactor_notifier_epoll>();
 }
 
+#ifdef SEASTAR_HAVE_IO_URING
+
+reactor_backend_uring::reactor_backend_uring()
+    : _uring(queue_depth) {
+}
+
+::io_uring_sqe* reactor_backend_uring::get_sqe() {
+    auto sqe = _uring.get_sqe();
+    while (!sqe) {
+        // The submission queue is full; hand it over to the kernel. If the
+        // kernel refuses because completions are backing up, drain them.
+        auto r = _uring.enter(0);
+        if (r == -1) {
+            throw_system_error_on(errno != EINTR && errno != EAGAIN && errno != EBUSY, "io_uring_enter");
+            process_completions();
+        }
+        sqe = _uring.get_sqe();
+    }
+    return sqe;
+}
+
+uintptr_t reactor_backend_uring::poll_tag(int event) {
+    switch (event) {
+    case EPOLLIN: return tag_pollin;
+    case EPOLLOUT: return tag_pollout;
+    default: return tag_pollerr;
+    }
+}
+
+void reactor_backend_uring::arm_poll(pollable_fd_state& pfd, int event) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = pfd.fd.get();
+    sqe->poll_events = event;
+    sqe->user_data = reinterpret_cast<uintptr_t>(&pfd) | poll_tag(event);
+    pfd.events_epoll |= event;
+    engine().start_epoll();
+}
+
+void reactor_backend_uring::cancel_poll(pollable_fd_state& pfd, int event) {
+    auto sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = reinterpret_cast<uintptr_t>(&pfd) | poll_tag(event);
+    sqe->user_data = 0;
+}
+
+future<> reactor_backend_uring::get_poll_future(pollable_fd_state& pfd,
+        promise<> pollable_fd_state::*pr, int event) {
+    if (pfd.events_known & event) {
+        pfd.events_known &= ~event;
+        return make_ready_future();
+    }
+    pfd.events_requested |= event;
+    // events_epoll tracks poll requests still owned by the ring. One may be
+    // left over from an aborted wait; its completion re-arms it if needed.
+    if (!(pfd.events_epoll & event)) {
+        arm_poll(pfd, event);
+    }
+    pfd.*pr = promise<>();
+    return (pfd.*pr).get_future();
+}
+
+void reactor_backend_uring::complete_poll(pollable_fd_state& pfd, promise<> pollable_fd_state::*pr,
+        int event, int res) {
+    pfd.events_epoll &= ~event;
+    if (!(pfd.events_requested & event)) {
+        // Aborted, or forgotten; nobody is waiting.
+        return;
+    }
+    if (res == -ECANCELED) {
+        // An aborted wait was followed by a new one before the removal
+        // completed.
+        arm_poll(pfd, event);
+        return;
+    }
+    // Other errors are reported by the operation the waiter retries.
+    pfd.events_requested &= ~event;
+    pfd.events_known &= ~event;
+    (pfd.*pr).set_value();
+    pfd.*pr = promise<>();
+}
+
+void reactor_backend_uring::abort_fd(pollable_fd_state& pfd, std::exception_ptr ex,
+        promise<> pollable_fd_state::* pr, int event) {
+    if (pfd.events_epoll & event) {
+        cancel_poll(pfd, event);
+    }
+    if (pfd.events_requested & event) {
+        pfd.events_requested &= ~event;
+        (pfd.*pr).set_exception(std::move(ex));
+    }
+    pfd.events_known &= ~event;
+}
+
+future<> reactor_backend_uring::readable(pollable_fd_state& fd) {
+    return get_poll_future(fd, &pollable_fd_state::pollin, EPOLLIN);
+}
+
+future<> reactor_backend_uring::writeable(pollable_fd_state& fd) {
+    return get_poll_future(fd, &pollable_fd_state::pollout, EPOLLOUT);
+}
+
+future<> reactor_backend_uring::readable_errqueue(pollable_fd_state& fd) {
+    return get_poll_future(fd, &pollable_fd_state::pollerr, EPOLLERR);
+}
+
+void reactor_backend_uring::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollin, EPOLLIN);
+}
+
+void reactor_backend_uring::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollout, EPOLLOUT);
+}
+
+void reactor_backend_uring::abort_errqueue_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    abort_fd(fd, std::move(ex), &pollable_fd_state::pollerr, EPOLLERR);
+}
+
+void reactor_backend_uring::forget(pollable_fd_state& fd) {
+    fd.events_requested = 0;
+    for (auto event : { EPOLLIN, EPOLLOUT, EPOLLERR }) {
+        if (fd.events_epoll & event) {
+            cancel_poll(fd, event);
+        }
+    }
+    // Poll requests carry a pointer to fd, which is about to be destroyed,
+    // so wait here until the kernel has let go of them.
+    while (fd.events_epoll) {
+        auto r = _uring.enter(1);
+        throw_system_error_on(r == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY, "io_uring_enter");
+        process_completions();
+    }
+}
+
+void reactor_backend_uring::submit_disk_io(::iocb& iocb) {
+    auto sqe = get_sqe();
+    internal::prepare_sqe_from_iocb(*sqe, iocb);
+    sqe->user_data = reinterpret_cast<uintptr_t>(&iocb) | tag_disk_io;
+}
+
+unsigned reactor_backend_uring::process_completions() {
+    return _uring.reap([this] (const ::io_uring_cqe& cqe) {
+        auto ptr = cqe.user_data & ~uint64_t(tag_mask);
+        switch (cqe.user_data & tag_mask) {
+        case tag_pollin:
+            complete_poll(*reinterpret_cast<pollable_fd_state*>(ptr), &pollable_fd_state::pollin, EPOLLIN, cqe.res);
+            break;
+        case tag_pollout:
+            complete_poll(*reinterpret_cast<pollable_fd_state*>(ptr), &pollable_fd_state::pollout, EPOLLOUT, cqe.res);
+            break;
+        case tag_pollerr:
+            complete_poll(*reinterpret_cast<pollable_fd_state*>(ptr), &pollable_fd_state::pollerr, EPOLLERR, cqe.res);
+            break;
+        case tag_disk_io: {
+            auto iocb = reinterpret_cast<::iocb*>(ptr);
+            ::io_event ev{};
+            ev.data = iocb->aio_data;
+            ev.obj = ptr;
+            ev.res = cqe.res;
+            engine().complete_io(ev);
+            break;
+        }
+        case tag_timeout:
+            // Expired, or removed after an earlier wake-up
+            _timeout_armed = false;
+            break;
+        default:
+            break;
+        }
+    });
+}
+
+bool
+reactor_backend_uring::wait_and_process(int timeout, const sigset_t* active_sigmask) {
+    if (timeout > 0) {
+        _timeout.tv_sec = timeout / 1000;
+        _timeout.tv_nsec = (timeout % 1000) * 1000000;
+        auto sqe = get_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = reinterpret_cast<uintptr_t>(&_timeout);
+        sqe->len = 1;
+        sqe->user_data = tag_timeout;
+        _timeout_armed = true;
+    }
+    // When polling, a ring with nothing to submit costs no system call at
+    // all: completions are read straight from the shared mapping.
+    if (_uring.pending_submissions() || timeout != 0) {
+        auto r = timeout != 0 ? _uring.enter(1, active_sigmask) : _uring.enter(0);
+        // EINTR: gdb, or a signal woke us up from sleep
+        throw_system_error_on(r == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY, "io_uring_enter");
+    }
+    auto did_work = process_completions();
+    if (_timeout_armed) {
+        // Something else ended the sleep. Left armed, the timeout would
+        // later end the next sleep early. The kernel removes it, and posts
+        // its completion, while submitting the removal.
+        auto sqe = get_sqe();
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->addr = tag_timeout;
+        sqe->user_data = 0;
+        auto r = _uring.enter(0);
+        throw_system_error_on(r == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY, "io_uring_enter");
+        process_completions();
+    }
+    return did_work;
+}
+
+future<> reactor_backend_uring::notified(reactor_notifier *n) {
+    // Notifiers are eventfd based, same as with epoll.
+    std::cout << "reactor_backend_uring does not yet support notifiers!\n";
+    abort();
+}
+
+std::unique_ptr<reactor_notifier>
+reactor_backend_uring::make_reactor_notifier() {
+    return std::make_unique<reactor_notifier_epoll>();
+}
+
+#endif
+
+std::unique_ptr<reactor_backend> reactor_backend_selector::create() const {
+#ifdef HAVE_OSV
+    return std::make_unique<reactor_backend_osv>();
+#else
+#ifdef SEASTAR_HAVE_IO_URING
+    if (_name == "io_uring") {
+        return std::make_unique<reactor_backend_uring>();
+    }
+#endif
+    return std::make_unique<reactor_backend_epoll>();
+#endif
+}
+
+reactor_backend_selector reactor_backend_selector::default_backend() {
+#ifdef HAVE_OSV
+    return reactor_backend_selector("osv");
+#else
+    return reactor_backend_selector("epoll");
+#endif
+}
+
+std::vector<reactor_backend_selector> reactor_backend_selector::available() {
+    std::vector<reactor_backend_selector> ret;
+    ret.push_back(default_backend());
+#ifdef SEASTAR_HAVE_IO_URING
+    static const bool have_uring = internal::linux_uring::supported();
+    if (have_uring) {
+        ret.push_back(reactor_backend_selector("io_uring"));
+    }
+#endif
+    return ret;
+}
+
+reactor_backend_selector reactor_backend_selector::from_name(const std::string& name) {
+    auto backends = available();
+    for (auto&& rbs : backends) {
+        if (rbs.name() == name) {
+            return rbs;
+        }
+    }
+    if (name == "io_uring") {
+        seastar_logger.warn("io_uring is not supported by this build or kernel, using the {} reactor backend", default_backend().name());
+        return default_backend();
+    }
+    throw std::invalid_argument(sprint("unknown reactor backend: %s", name));
+}
+
 #ifdef HAVE_OSV
 class reactor_notifier_osv :
         public reactor_notifier, private osv::newpoll::pollable {
@@ -4401,12 +5174,36 @@ reactor_backend_osv::writeable(pollable_fd_state& fd) {
     abort();
 }
 
+future<>
+reactor_backend_osv::readable_errqueue(pollable_fd_state& fd) {
+    std::cout << "reactor_backend_osv does not support file descriptors - readable_errqueue() shouldn't have been called!\n";
+    abort();
+}
+
 void
 reactor_backend_osv::forget(pollable_fd_state& fd) {
     std::cout << "reactor_backend_osv does not support file descriptors - forget() shouldn't have been called!\n";
     abort();
 }
 
+void
+reactor_backend_osv::abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_reader() shouldn't have been called!\n";
+    abort();
+}
+
+void
+reactor_backend_osv::abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_writer() shouldn't have been called!\n";
+    abort();
+}
+
+void
+reactor_backend_osv::abort_errqueue_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+    std::cout << "reactor_backend_osv does not support file descriptors - abort_errqueue_reader() shouldn't have been called!\n";
+    abort();
+}
+
 void
 reactor_backend_osv::enable_timer(steady_clock_type::time_point when) {
     _poller.set_timer(when);
@@ -4660,9 +5457,43 @@ reactor::sched_clock::duration reactor::total_busy_time() {
 }
 
 void
-reactor::init_scheduling_group(seastar::scheduling_group sg, sstring name, float shares) {
+reactor::init_scheduling_group(seastar::scheduling_group sg, sstring name, float shares, bool stealable) {
     _task_queues.resize(std::max<size_t>(_task_queues.size(), sg._id + 1));
     _task_queues[sg._id] = std::make_unique<task_queue>(sg._id, name, shares);
+    _task_queues[sg._id]->_stealable = stealable;
+}
+
+void
+reactor::queue_stealable(internal::stealable_work_item* wi) {
+    auto sg = wi->_sg;
+    if (!_task_queues[sg._id]->_stealable || !_stealable_work.push(wi)) {
+        add_task(make_task(sg, [wi] { wi->process(); }));
+        return;
+    }
+    // One task per queued item, so we get through all of them even if
+    // nobody steals. Idle shards may take items before these tasks run, so
+    // a task can find a different item (possibly of another group), or none.
+    add_task(make_task(sg, [this] {
+        auto wi = _stealable_work.pop();
+        if (!wi) {
+            return;
+        }
+        if (wi->_sg == current_scheduling_group()) {
+            wi->process();
+        } else {
+            add_task(make_task(wi->_sg, [wi] { wi->process(); }));
+        }
+    }));
+}
+
+void
+internal::stealable_work_item::process() {
+    run();
+    if (engine().cpu_id() == _origin) {
+        complete();
+    } else {
+        smp::submit_to(_origin, [this] { complete(); });
+    }
 }
 
 const sstring&
@@ -4670,17 +5501,28 @@ scheduling_group::name() const {
     return engine()._task_queues[_id]->_name;
 }
 
+bool
+scheduling_group::is_stealable() const {
+    return engine()._task_queues[_id]->_stealable;
+}
+
 void
 scheduling_group::set_shares(float shares) {
     engine()._task_queues[_id]->set_shares(shares);
 }
 
-future<scheduling_group>
-create_scheduling_group(sstring name, float shares) {
+static
+scheduling_group
+allocate_scheduling_group() {
     static std::atomic<unsigned> last{2}; // 0=main, 1=atexit
     auto id = last.fetch_add(1);
     assert(id < max_scheduling_groups());
-    auto sg = scheduling_group(id);
+    return internal::scheduling_group_from_index(id);
+}
+
+future<scheduling_group>
+create_scheduling_group(sstring name, float shares) {
+    auto sg = allocate_scheduling_group();
     return smp::invoke_on_all([sg, name, shares] {
         engine().init_scheduling_group(sg, name, shares);
     }).then([sg] {
@@ -4688,6 +5530,16 @@ create_scheduling_group(sstring name, float shares) {
     });
 }
 
+future<scheduling_group>
+create_stealable_scheduling_group(sstring name, float shares) {
+    auto sg = allocate_scheduling_group();
+    return smp::invoke_on_all([sg, name, shares] {
+        engine().init_scheduling_group(sg, name, shares, true);
+    }).then([sg] {
+        return make_ready_future<scheduling_group>(sg);
+    });
+}
+
 
 
 namespace internal {
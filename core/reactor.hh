@@ -27,6 +27,7 @@
 #include "aligned_buffer.hh"
 #include "cacheline.hh"
 #include "circular_buffer_fixed_capacity.hh"
+#include "work_stealing_deque.hh"
 #include <memory>
 #include <type_traits>
 #include <sys/epoll.h>
@@ -56,6 +57,7 @@
 #include <boost/container/static_vector.hpp>
 #include <set>
 #include "linux-aio.hh"
+#include "linux-uring.hh"
 #include "util/eclipse.hh"
 #include "future.hh"
 #include "posix.hh"
@@ -77,7 +79,9 @@
 #include "lowres_clock.hh"
 #include "manual_clock.hh"
 #include "core/metrics_registration.hh"
+#include "core/metrics_types.hh"
 #include "scheduling.hh"
+#include "bitops.hh"
 
 #ifdef HAVE_OSV
 #include <osv/sched.hh>
@@ -95,9 +99,15 @@ using shard_id = unsigned;
 namespace alien {
 class message_queue;
 }
+namespace resource {
+struct cpu;
+}
 class reactor;
 class pollable_fd;
 class pollable_fd_state;
+namespace net {
+class zero_copy_tracker;
+}
 
 class pollable_fd_state {
 public:
@@ -117,6 +127,7 @@ class pollable_fd_state {
     int events_known = 0;     // returned from epoll
     promise<> pollin;
     promise<> pollout;
+    promise<> pollerr;
     friend class reactor;
     friend class pollable_fd;
 };
@@ -144,15 +155,29 @@ class pollable_fd {
     future<size_t> read_some(const std::vector<iovec>& iov);
     future<> write_all(const char* buffer, size_t size);
     future<> write_all(const uint8_t* buffer, size_t size);
-    future<size_t> write_some(net::packet& p);
+    // flags are passed on to sendmsg(2), in addition to MSG_NOSIGNAL.
+    future<size_t> write_some(net::packet& p, int flags = 0);
     future<> write_all(net::packet& p);
+    // Sends up to len bytes of the file in_fd, starting at pos, with sendfile(2).
+    future<size_t> sendfile(int in_fd, uint64_t pos, size_t len);
     future<> readable();
     future<> writeable();
+    // Resolves when the socket's error queue (read with MSG_ERRQUEUE) is
+    // not empty.
+    future<> readable_errqueue();
     void abort_reader(std::exception_ptr ex);
     void abort_writer(std::exception_ptr ex);
+    // Fails a pending readable_errqueue() with ex.
+    void abort_errqueue_reader(std::exception_ptr ex);
     future<pollable_fd, socket_address> accept();
+    // Accepts the pending connections, up to reactor::max_accept_batch of
+    // them, waiting for at least one.
+    future<std::vector<std::pair<pollable_fd, socket_address>>> accept_batch();
     future<size_t> sendmsg(struct msghdr *msg);
     future<size_t> recvmsg(struct msghdr *msg);
+    // Return the number of messages sent or received, at least one.
+    future<size_t> sendmmsg(mmsghdr* msgvec, unsigned vlen);
+    future<size_t> recvmmsg(mmsghdr* msgvec, unsigned vlen);
     future<size_t> sendto(socket_address addr, const void* buf, size_t len);
     file_desc& get_file_desc() const { return _s->fd; }
     void shutdown(int how) { _s->fd.shutdown(how); }
@@ -287,20 +312,53 @@ class syscall_work_queue {
 };
 
 class smp_message_queue {
-    static constexpr size_t queue_length = 128;
-    static constexpr size_t batch_size = 16;
+public:
+    static constexpr size_t default_queue_length = 128;
+    static constexpr size_t max_queue_length = 1024;
+    struct config {
+        // Capacity of the ring in each direction.
+        size_t queue_length = default_queue_length;
+        // Maximum number of messages submitted but not yet completed before
+        // submit() starts waiting for room; 0 means unlimited.
+        size_t max_backlog = 0;
+    };
+private:
+    static constexpr size_t default_batch_size = 16;
     static constexpr size_t prefetch_cnt = 2;
+    using clock_type = std::chrono::steady_clock;
     struct work_item;
     struct lf_queue_remote {
         reactor* remote;
     };
-    using lf_queue_base = boost::lockfree::spsc_queue<work_item*,
-                            boost::lockfree::capacity<queue_length>>;
+    using lf_queue_base = boost::lockfree::spsc_queue<work_item*>;
     // use inheritence to control placement order
     struct lf_queue : lf_queue_remote, lf_queue_base {
-        lf_queue(reactor* remote) : lf_queue_remote{remote} {}
+        lf_queue(reactor* remote, size_t capacity) : lf_queue_remote{remote}, lf_queue_base(capacity) {}
         void maybe_wakeup();
     };
+    // Counts samples in power-of-two buckets: [0, 1], (1, 2], (2, 4], ...
+    template <size_t Buckets>
+    struct log2_histogram {
+        std::array<uint64_t, Buckets> counts = {};
+        uint64_t sample_count = 0;
+        double sample_sum = 0;
+        void add(uint64_t v) {
+            auto b = v <= 1 ? 0 : log2ceil(v);
+            ++counts[std::min<size_t>(b, Buckets - 1)];
+            ++sample_count;
+            sample_sum += v;
+        }
+        metrics::histogram get() const {
+            metrics::histogram h;
+            h.sample_count = sample_count;
+            h.sample_sum = sample_sum;
+            for (size_t i = 0; i != Buckets; ++i) {
+                h.buckets.push_back(metrics::histogram_bucket{counts[i], double(uint64_t(1) << i)});
+            }
+            return h;
+        }
+    };
+    const size_t _queue_length;
     lf_queue _pending;
     lf_queue _completed;
     struct alignas(seastar::cache_line_size) {
@@ -309,7 +367,17 @@ class smp_message_queue {
         size_t _last_snt_batch = 0;
         size_t _last_cmpl_batch = 0;
         size_t _current_queue_length = 0;
+        // Number of pending messages that triggers an immediate flush, adapted
+        // by adapt_batch_size().
+        size_t _batch_size = default_batch_size;
+        // Moving average of the time messages wait, in pending_fifo and in
+        // the ring, until the remote shard picks them up, in microseconds.
+        double _avg_queueing_us = 0;
+        size_t _throttled = 0;
     };
+    // Also sender-side; the receiver's fields below start on a new cache line.
+    log2_histogram<12> _queue_depth;
+    log2_histogram<24> _latency_us;
     // keep this between two structures with statistics
     // this makes sure that they have at least one cache line
     // between them, so hw prefetcher will not accidentally prefetch
@@ -320,12 +388,60 @@ class smp_message_queue {
         size_t _last_rcv_batch = 0;
     };
     struct work_item {
+        bool _pooled = false; // allocated from _tx.a.pool rather than the heap
+        clock_type::time_point _submitted;
+        clock_type::time_point _picked_up; // set by the remote shard
         virtual ~work_item() {}
         virtual void process() = 0;
         virtual void complete() = 0;
     };
+    // Fixed-size slots for work items, owned by the sending shard. Items are
+    // both allocated (in submit()) and released (in process_completions())
+    // on the sending shard, so the pool needs no synchronization and saves a
+    // trip to the allocator for every cross-shard call. The cap scales with
+    // the queue's length (--smp-queue-length); items too large for a slot, or
+    // submitted while all _max_slots are in flight, use the heap.
+    class work_item_pool {
+    public:
+        static constexpr size_t slot_size = 256;
+        static constexpr size_t slot_align = alignof(std::max_align_t);
+    private:
+        static constexpr size_t slots_per_chunk = 16;
+        const size_t _max_slots;
+        union slot {
+            slot* next;
+            std::aligned_storage_t<slot_size, slot_align> storage;
+        };
+        std::vector<std::unique_ptr<slot[]>> _chunks;
+        slot* _free = nullptr;
+    public:
+        explicit work_item_pool(size_t max_slots) : _max_slots(max_slots) {}
+        void* allocate() {
+            if (!_free) {
+                if (_chunks.size() * slots_per_chunk >= _max_slots) {
+                    return nullptr;
+                }
+                _chunks.push_back(std::make_unique<slot[]>(slots_per_chunk));
+                auto chunk = _chunks.back().get();
+                for (size_t i = 0; i != slots_per_chunk; ++i) {
+                    chunk[i].next = _free;
+                    _free = &chunk[i];
+                }
+            }
+            auto s = _free;
+            _free = s->next;
+            return s;
+        }
+        void deallocate(void* p) {
+            auto s = static_cast<slot*>(p);
+            s->next = _free;
+            _free = s;
+        }
+    };
+    // Runs _func on the remote shard; what becomes of the result back on
+    // the sending shard is up to complete().
     template <typename Func>
-    struct async_work_item : work_item {
+    struct func_work_item : work_item {
         smp_message_queue& _queue;
         Func _func;
         using futurator = futurize<std::result_of_t<Func()>>;
@@ -333,8 +449,7 @@ class smp_message_queue {
         using value_type = typename future_type::value_type;
         std::experimental::optional<value_type> _result;
         std::exception_ptr _ex; // if !_result
-        typename futurator::promise_type _promise; // used on local side
-        async_work_item(smp_message_queue& queue, Func&& func) : _queue(queue), _func(std::move(func)) {}
+        func_work_item(smp_message_queue& queue, Func&& func) : _queue(queue), _func(std::move(func)) {}
         virtual void process() override {
             try {
                 futurator::apply(this->_func).then_wrapped([this] (auto f) {
@@ -350,34 +465,113 @@ class smp_message_queue {
                 _queue.respond(this);
             }
         }
+    };
+    template <typename Func>
+    struct async_work_item : func_work_item<Func> {
+        typename func_work_item<Func>::futurator::promise_type _promise; // used on local side
+        using func_work_item<Func>::func_work_item;
         virtual void complete() override {
-            if (_result) {
-                _promise.set_value(std::move(*_result));
+            if (this->_result) {
+                _promise.set_value(std::move(*this->_result));
             } else {
                 // FIXME: _ex was allocated on another cpu
-                _promise.set_exception(std::move(_ex));
+                _promise.set_exception(std::move(this->_ex));
             }
         }
-        future_type get_future() { return _promise.get_future(); }
+        typename func_work_item<Func>::future_type get_future() { return _promise.get_future(); }
+    };
+    // Instead of resolving a future of its own, hands the result to _done,
+    // as a ready future, on the sending shard. This lets a broadcast gather
+    // the results of all its messages without a continuation per message.
+    template <typename Func, typename Done>
+    struct notify_work_item : func_work_item<Func> {
+        using futurator = typename func_work_item<Func>::futurator;
+        Done _done;
+        notify_work_item(smp_message_queue& queue, Func&& func, Done&& done)
+            : func_work_item<Func>(queue, std::move(func)), _done(std::move(done)) {}
+        virtual void complete() override {
+            typename futurator::promise_type pr;
+            auto f = pr.get_future();
+            if (this->_result) {
+                pr.set_value(std::move(*this->_result));
+            } else {
+                // FIXME: _ex was allocated on another cpu
+                pr.set_exception(std::move(this->_ex));
+            }
+            _done(std::move(f));
+        }
     };
     union tx_side {
         tx_side() {}
         ~tx_side() {}
-        void init() { new (&a) aa; }
+        void init(size_t pool_slots) { new (&a) aa(pool_slots); }
         struct aa {
+            explicit aa(size_t pool_slots) : pool(pool_slots) {}
             std::deque<work_item*> pending_fifo;
+            work_item_pool pool;
+            // One unit per message in flight, when the backlog is bounded.
+            std::experimental::optional<semaphore> backlog;
         } a;
     } _tx;
     std::vector<work_item*> _completed_fifo;
+    const size_t _max_backlog;
 public:
-    smp_message_queue(reactor* from, reactor* to);
+    smp_message_queue(reactor* from, reactor* to, config cfg);
     ~smp_message_queue();
+    // If the backlog is bounded and full, the message is only queued once
+    // enough earlier ones complete, so the returned future also carries
+    // backpressure to the submitter.
     template <typename Func>
     futurize_t<std::result_of_t<Func()>> submit(Func&& func) {
-        auto wi = std::make_unique<async_work_item<Func>>(*this, std::forward<Func>(func));
-        auto fut = wi->get_future();
-        submit_item(std::move(wi));
-        return fut;
+        if (!_tx.a.backlog || _tx.a.backlog->try_wait()) {
+            return submit_now(std::forward<Func>(func));
+        }
+        ++_throttled;
+        // If func is a reference, the caller guarantees it outlives the call.
+        using holder = std::conditional_t<std::is_lvalue_reference<Func>::value,
+                std::reference_wrapper<std::remove_reference_t<Func>>, std::decay_t<Func>>;
+        return _tx.a.backlog->wait().then([this, func = holder(std::forward<Func>(func))] () mutable {
+            return submit_now(std::forward<Func>(unwrap(func)));
+        });
+    }
+    // Submits every function in \c funcs, and publishes them all to the
+    // remote shard with a single update of the queue's producer index
+    // (as far as they fit in the queue), instead of waiting for a batch to
+    // fill up. Returns the futures in the order of \c funcs.
+    template <typename Range, typename Func = std::decay_t<decltype(*std::begin(std::declval<Range&>()))>>
+    std::vector<futurize_t<std::result_of_t<Func()>>> submit_many(Range&& funcs) {
+        std::vector<futurize_t<std::result_of_t<Func()>>> ret;
+        auto now = clock_type::now();
+        for (auto&& func : funcs) {
+            auto wi = make_work_item(Func(std::move(func)));
+            wi->_submitted = now;
+            ret.push_back(wi->get_future());
+            _tx.a.pending_fifo.push_back(wi);
+            // A batch is not held back, but still counts against the backlog.
+            if (_tx.a.backlog) {
+                _tx.a.backlog->consume(1);
+            }
+        }
+        move_pending();
+        return ret;
+    }
+    // Like submit(), but passes the outcome of func, as a ready future, to
+    // done on this shard rather than returning a future for it.
+    template <typename Func, typename Done>
+    void submit_notify(Func func, Done done) {
+        using item_type = notify_work_item<Func, Done>;
+        if (!_tx.a.backlog || _tx.a.backlog->try_wait()) {
+            submit_item(make_item<item_type>(std::move(func), std::move(done)));
+            return;
+        }
+        ++_throttled;
+        _tx.a.backlog->wait().then_wrapped([this, func = std::move(func), done = std::move(done)] (future<> f) mutable {
+            if (f.failed()) {
+                done(item_type::futurator::make_exception_future(f.get_exception()));
+                return;
+            }
+            submit_item(make_item<item_type>(std::move(func), std::move(done)));
+        });
     }
     void start(unsigned cpuid);
     template<size_t PrefetchCnt, typename Func>
@@ -387,11 +581,44 @@ class smp_message_queue {
     void stop();
 private:
     void work();
-    void submit_item(std::unique_ptr<work_item> wi);
+    template <typename T>
+    static T& unwrap(std::reference_wrapper<T> r) { return r.get(); }
+    template <typename T>
+    static T& unwrap(T& x) { return x; }
+    template <typename Func>
+    futurize_t<std::result_of_t<Func()>> submit_now(Func&& func) {
+        auto wi = make_work_item(std::forward<Func>(func));
+        auto fut = wi->get_future();
+        submit_item(wi);
+        return fut;
+    }
+    template <typename Item, typename... Args>
+    Item* make_item(Args&&... args) {
+        if (sizeof(Item) <= work_item_pool::slot_size && alignof(Item) <= work_item_pool::slot_align) {
+            if (auto p = _tx.a.pool.allocate()) {
+                try {
+                    auto wi = new (p) Item(*this, std::forward<Args>(args)...);
+                    wi->_pooled = true;
+                    return wi;
+                } catch (...) {
+                    _tx.a.pool.deallocate(p);
+                    throw;
+                }
+            }
+        }
+        return new Item(*this, std::forward<Args>(args)...);
+    }
+    template <typename Func>
+    async_work_item<Func>* make_work_item(Func&& func) {
+        return make_item<async_work_item<Func>>(std::forward<Func>(func));
+    }
+    void dispose(work_item* wi);
+    void submit_item(work_item* wi);
     void respond(work_item* wi);
     void move_pending();
     void flush_request_batch();
     void flush_response_batch();
+    void adapt_batch_size();
     bool has_unflushed_responses() const;
     bool pure_poll_rx() const;
     bool pure_poll_tx() const;
@@ -399,6 +626,58 @@ class smp_message_queue {
     friend class smp;
 };
 
+namespace internal {
+
+// A function submitted with smp::submit_stealable(). It is queued on the
+// submitting (origin) shard and run either there or on an idle shard that
+// stole it; the result is always delivered on the origin shard.
+struct stealable_work_item {
+    unsigned _origin;
+    scheduling_group _sg;
+    stealable_work_item(unsigned origin, scheduling_group sg) : _origin(origin), _sg(sg) {}
+    virtual ~stealable_work_item() {}
+    // Runs the function and hands the item back to the origin shard, which
+    // calls complete(). May be called on any shard.
+    void process();
+    virtual void run() = 0;
+    // Fulfils the promise and destroys the item; origin shard only.
+    virtual void complete() = 0;
+};
+
+template <typename Func>
+struct stealable_work_item_for final : stealable_work_item {
+    Func _func;
+    using futurator = futurize<std::result_of_t<Func()>>;
+    using future_type = typename futurator::type;
+    using value_type = typename future_type::value_type;
+    std::experimental::optional<value_type> _result;
+    std::exception_ptr _ex; // if !_result
+    typename futurator::promise_type _promise; // used on the origin shard
+    stealable_work_item_for(unsigned origin, scheduling_group sg, Func&& func)
+            : stealable_work_item(origin, sg), _func(std::move(func)) {}
+    virtual void run() override {
+        // _func does not return a future, so this one is ready.
+        auto f = futurator::apply(_func);
+        if (f.failed()) {
+            _ex = f.get_exception();
+        } else {
+            _result = f.get();
+        }
+    }
+    virtual void complete() override {
+        if (_result) {
+            _promise.set_value(std::move(*_result));
+        } else {
+            // FIXME: _ex may have been allocated on another cpu
+            _promise.set_exception(std::move(_ex));
+        }
+        delete this;
+    }
+    future_type get_future() { return _promise.get_future(); }
+};
+
+}
+
 class thread_pool {
     uint64_t _aio_threaded_fallbacks = 0;
 #ifndef HAVE_OSV
@@ -442,7 +721,8 @@ class thread_pool {
 
 // The "reactor_backend" interface provides a method of waiting for various
 // basic events on one thread. We have one implementation based on epoll and
-// file-descriptors (reactor_backend_epoll) and one implementation based on
+// file-descriptors (reactor_backend_epoll), one based on io_uring that also
+// carries disk I/O (reactor_backend_uring), and one implementation based on
 // OSv-specific file-descriptor-less mechanisms (reactor_backend_osv).
 class reactor_backend {
 public:
@@ -458,7 +738,17 @@ class reactor_backend {
     // they are called (which is fine if no file descriptors are waited on):
     virtual future<> readable(pollable_fd_state& fd) = 0;
     virtual future<> writeable(pollable_fd_state& fd) = 0;
+    virtual future<> readable_errqueue(pollable_fd_state& fd) = 0;
     virtual void forget(pollable_fd_state& fd) = 0;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    virtual void abort_errqueue_reader(pollable_fd_state& fd, std::exception_ptr ex) = 0;
+    // Methods for disk I/O. A backend that returns true from
+    // handles_disk_io() accepts prepared iocbs through submit_disk_io()
+    // instead of the reactor submitting them with io_submit(), and reports
+    // their completion through reactor::complete_io().
+    virtual bool handles_disk_io() const { return false; }
+    virtual void submit_disk_io(::iocb& iocb) { abort(); }
     // Methods that allow polling on a reactor_notifier. This is currently
     // used only for reactor_backend_osv, but in the future it should really
     // replace the above functions.
@@ -486,11 +776,85 @@ class reactor_backend_epoll : public reactor_backend {
     virtual bool wait_and_process(int timeout, const sigset_t* active_sigmask) override;
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual future<> readable_errqueue(pollable_fd_state& fd) override;
     virtual void forget(pollable_fd_state& fd) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
-    void abort_reader(pollable_fd_state& fd, std::exception_ptr ex);
-    void abort_writer(pollable_fd_state& fd, std::exception_ptr ex);
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_errqueue_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+};
+
+#ifdef SEASTAR_HAVE_IO_URING
+// reactor backend using io_uring. File descriptor readiness is waited for
+// with one-shot poll requests, and disk I/O (prepared as linux-aio iocbs)
+// is translated into read/write requests on the same ring, so a single
+// io_uring_enter() per poll cycle both submits everything queued since the
+// last one and, when sleeping, waits for any of it to complete.
+class reactor_backend_uring : public reactor_backend {
+private:
+    // Sized to hold a full complement of disk I/O plus poll requests.
+    static constexpr unsigned queue_depth = 1024;
+    // The low bits of a request's user_data say what completed; the rest
+    // is a pointer to the pollable_fd_state or iocb (both 8-byte aligned).
+    // Zero is reserved for requests whose completion we ignore (poll and
+    // timeout removal). The sleep timeout carries no pointer.
+    enum tag : uintptr_t {
+        tag_pollin = 1,
+        tag_pollout = 2,
+        tag_disk_io = 3,
+        tag_pollerr = 4,
+        tag_timeout = 5,
+        tag_mask = 7,
+    };
+    internal::linux_uring _uring;
+    ::__kernel_timespec _timeout;
+    // A sleep timeout is queued and has not completed yet
+    bool _timeout_armed = false;
+    ::io_uring_sqe* get_sqe();
+    static uintptr_t poll_tag(int event);
+    void arm_poll(pollable_fd_state& fd, int event);
+    void cancel_poll(pollable_fd_state& fd, int event);
+    future<> get_poll_future(pollable_fd_state& fd,
+            promise<> pollable_fd_state::* pr, int event);
+    void complete_poll(pollable_fd_state& fd,
+            promise<> pollable_fd_state::* pr, int event, int res);
+    void abort_fd(pollable_fd_state& fd, std::exception_ptr ex,
+            promise<> pollable_fd_state::* pr, int event);
+    unsigned process_completions();
+public:
+    reactor_backend_uring();
+    virtual ~reactor_backend_uring() override { }
+    virtual bool wait_and_process(int timeout, const sigset_t* active_sigmask) override;
+    virtual future<> readable(pollable_fd_state& fd) override;
+    virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual future<> readable_errqueue(pollable_fd_state& fd) override;
+    virtual void forget(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_errqueue_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual bool handles_disk_io() const override { return true; }
+    virtual void submit_disk_io(::iocb& iocb) override;
+    virtual future<> notified(reactor_notifier *n) override;
+    virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
+};
+#endif
+
+// Selects which reactor_backend each reactor is created with, from the
+// --reactor-backend option.
+class reactor_backend_selector {
+    std::string _name;
+private:
+    explicit reactor_backend_selector(std::string name) : _name(std::move(name)) {}
+public:
+    std::unique_ptr<reactor_backend> create() const;
+    const std::string& name() const { return _name; }
+    static reactor_backend_selector default_backend();
+    // Backends supported by this build and by the running kernel.
+    static std::vector<reactor_backend_selector> available();
+    // Throws std::invalid_argument on an unknown name; falls back to the
+    // default backend with a warning if the named one is not supported here.
+    static reactor_backend_selector from_name(const std::string& name);
 };
 
 #ifdef HAVE_OSV
@@ -510,7 +874,11 @@ class reactor_backend_osv : public reactor_backend {
     virtual bool wait_and_process() override;
     virtual future<> readable(pollable_fd_state& fd) override;
     virtual future<> writeable(pollable_fd_state& fd) override;
+    virtual future<> readable_errqueue(pollable_fd_state& fd) override;
     virtual void forget(pollable_fd_state& fd) override;
+    virtual void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) override;
+    virtual void abort_errqueue_reader(pollable_fd_state& fd, std::exception_ptr ex) override;
     virtual future<> notified(reactor_notifier *n) override;
     virtual std::unique_ptr<reactor_notifier> make_reactor_notifier() override;
     void enable_timer(steady_clock_type::time_point when);
@@ -525,6 +893,7 @@ enum class open_flags {
     create = O_CREAT,
     truncate = O_TRUNC,
     exclusive = O_EXCL,
+    dsync = O_DSYNC,
 };
 
 inline open_flags operator|(open_flags a, open_flags b) {
@@ -540,7 +909,7 @@ class io_queue {
         uint32_t nr_queued;
         std::chrono::duration<double> queue_time;
         metrics::metric_groups _metric_groups;
-        priority_class_data(sstring name, priority_class_ptr ptr, shard_id owner);
+        priority_class_data(sstring name, sstring mountpoint, priority_class_ptr ptr, shard_id owner);
     };
 
     std::unordered_map<unsigned, lw_shared_ptr<priority_class_data>> _priority_classes;
@@ -549,10 +918,14 @@ class io_queue {
     static constexpr unsigned _max_classes = 2048;
     static std::array<std::atomic<uint32_t>, _max_classes> _registered_shares;
     static std::array<sstring, _max_classes> _registered_names;
+    static std::array<std::chrono::microseconds, _max_classes> _registered_latency_targets;
+    static std::array<std::atomic<uint64_t>, _max_classes> _registered_bytes_per_second;
+    static std::array<std::atomic<uint64_t>, _max_classes> _registered_ops_per_second;
 
-    static io_priority_class register_one_priority_class(sstring name, uint32_t shares);
+    static io_priority_class register_one_priority_class(sstring name, uint32_t shares, std::chrono::microseconds latency_target);
 
     priority_class_data& find_or_create_class(const io_priority_class& pc, shard_id owner);
+    void apply_rate_limits(priority_class_ptr pclass, unsigned id);
     static void fill_shares_array();
     friend smp;
 public:
@@ -568,21 +941,26 @@ class io_queue {
     static constexpr unsigned read_request_base_count = 128;
 
     struct config {
-        shard_id coordinator;
-        std::vector<shard_id> io_topology;
         unsigned capacity = std::numeric_limits<unsigned>::max();
         unsigned max_req_count = std::numeric_limits<unsigned>::max();
         unsigned max_bytes_count = std::numeric_limits<unsigned>::max();
         unsigned disk_req_write_to_read_multiplier = read_request_base_count;
         unsigned disk_bytes_write_to_read_multiplier = read_request_base_count;
+        // Files on this device (their file system's st_dev) are queued here;
+        // 0 for the queue of files on devices without a queue of their own.
+        dev_t devid = 0;
+        sstring mountpoint = "undefined";
+        // The capacity above is that of the whole device, shared with the
+        // queues of the other shards through this group.
+        std::shared_ptr<fair_group> group;
     };
 
     io_queue(config cfg);
     ~io_queue();
 
     template <typename Func>
-    static future<io_event>
-    queue_request(shard_id coordinator, const io_priority_class& pc, size_t len, request_type req_type, Func do_io);
+    future<io_event>
+    queue_request(const io_priority_class& pc, size_t len, request_type req_type, Func do_io);
 
     size_t capacity() const {
         return _config.capacity;
@@ -607,14 +985,20 @@ class io_queue {
         _fq.dispatch_requests();
     }
 
-    shard_id coordinator() const {
-        return _config.coordinator;
+    // When requests held back by rate limits may be dispatched, or time_point::max() if none are.
+    std::chrono::steady_clock::time_point next_refill() const {
+        return _fq.next_refill();
+    }
+
+    dev_t devid() const {
+        return _config.devid;
     }
-    shard_id coordinator_of_shard(shard_id shard) const {
-        return _config.io_topology[shard];
+    const sstring& mountpoint() const {
+        return _config.mountpoint;
     }
 
     future<> update_shares_for_class(io_priority_class pc, size_t new_shares);
+    void update_rate_limits_for_class(io_priority_class pc);
 
     friend class reactor;
 private:
@@ -664,6 +1048,7 @@ class reactor {
     class epoll_pollfn;
     class syscall_pollfn;
     class execution_stage_pollfn;
+    class work_stealing_pollfn;
     friend io_pollfn;
     friend signal_pollfn;
     friend aio_batch_submit_pollfn;
@@ -675,7 +1060,9 @@ class reactor {
     friend class epoll_pollfn;
     friend class syscall_pollfn;
     friend class execution_stage_pollfn;
+    friend class work_stealing_pollfn;
     friend class file_data_source_impl; // for fstream statistics
+    friend class net::zero_copy_tracker; // for zero-copy send statistics
     friend class internal::reactor_stall_sampler;
 public:
     class poller {
@@ -716,35 +1103,41 @@ class reactor {
         uint64_t fstream_read_bytes_blocked = 0;
         uint64_t fstream_read_aheads_discarded = 0;
         uint64_t fstream_read_ahead_discarded_bytes = 0;
+        uint64_t fstream_strided_read_aheads = 0;
+        uint64_t fstream_prefetches = 0;
+        uint64_t fstream_prefetch_hits = 0;
+        uint64_t fstream_prefetches_discarded = 0;
+        uint64_t zero_copy_sends = 0;
+        uint64_t zero_copy_completions = 0;
+        uint64_t zero_copy_copied = 0;
     };
 private:
-    // FIXME: make _backend a unique_ptr<reactor_backend>, not a compile-time #ifdef.
+    std::unique_ptr<reactor_backend> _backend;
 #ifdef HAVE_OSV
-    reactor_backend_osv _backend;
     sched::thread _timer_thread;
     sched::thread *_engine_thread;
     mutable mutex _timer_mutex;
     condvar _timer_cond;
     s64 _timer_due = 0;
-#else
-    reactor_backend_epoll _backend;
 #endif
     sigset_t _active_sigmask; // holds sigmask while sleeping with sig disabled
     std::vector<pollfn*> _pollers;
 
     static constexpr unsigned max_aio = 128;
-    // Not all reactors have IO queues. If the number of IO queues is less than the number of shards,
-    // some reactors will talk to foreign io_queues. If this reactor holds a valid IO queue, it will
-    // be stored here.
-    std::unique_ptr<io_queue> my_io_queue = {};
-
+    // Each reactor has its own IO queues, one per device that has its own I/O properties and
+    // the default one, sharing the devices' capacity with the queues of the other reactors.
+    std::vector<std::unique_ptr<io_queue>> my_io_queues;
 
-    // For submiting the actual IO, all we need is the coordinator id. So storing it
-    // separately saves us the pointer access.
-    shard_id _io_coordinator;
+    // The queues of my_io_queues by device, and _io_queue for files on any other device.
+    std::unordered_map<dev_t, io_queue*> _io_queues;
     io_queue* _io_queue;
     friend io_queue;
 
+    io_queue& io_queue_for(dev_t devid) {
+        auto i = _io_queues.find(devid);
+        return i != _io_queues.end() ? *i->second : *_io_queue;
+    }
+
     std::vector<std::function<future<> ()>> _exit_funcs;
     unsigned _id = 0;
     bool _stopping = false;
@@ -786,9 +1179,11 @@ class reactor {
         int64_t _reciprocal_shares_times_2_power_32;
         bool _current = false;
         bool _active = false;
+        bool _stealable = false;
         uint8_t _id;
         sched_clock::duration _runtime = {};
         uint64_t _tasks_processed = 0;
+        uint64_t _tasks_stolen = 0;
         circular_buffer<std::unique_ptr<task>> _q;
         sstring _name;
         int64_t to_vruntime(sched_clock::duration runtime) const;
@@ -801,6 +1196,9 @@ class reactor {
     task_queue_list _active_task_queues;
     task_queue_list _activating_task_queues;
     task_queue* _at_destroy_tasks;
+    // Stealable work submitted on this shard. We pop from the bottom; idle
+    // shards steal from the top.
+    internal::work_stealing_deque<internal::stealable_work_item, 1024> _stealable_work;
     sched_clock::duration _task_quota;
     /// Handler that will be called when there is no task to execute on cpu.
     /// It represents a low priority work.
@@ -828,6 +1226,15 @@ class reactor {
     pthread_t _thread_id alignas(seastar::cache_line_size) = pthread_self();
     bool _strict_o_direct = true;
     bool _bypass_fsync = false;
+    // With --prefault-memory, periodically re-measured for all shards by
+    // check_huge_pages() on shard 0.
+    bool _check_huge_pages = false;
+    bool _huge_page_check_in_progress = false;
+    memory::huge_page_usage _huge_page_usage;
+    // Shared by the memory metrics, and captured again only once the
+    // reactor has polled since (see fragmentation_report()).
+    memory::fragmentation_report _fragmentation_report;
+    uint64_t _fragmentation_report_polls = std::numeric_limits<uint64_t>::max();
     bool& _local_need_preempt{g_need_preempt}; // for access from the _task_quota_timer_thread
     std::thread _task_quota_timer_thread;
     std::atomic<bool> _dying{false};
@@ -893,36 +1300,67 @@ class reactor {
     void insert_activating_task_queues();
     void account_runtime(task_queue& tq, sched_clock::duration runtime);
     void account_idle(sched_clock::duration idletime);
-    void init_scheduling_group(scheduling_group sg, sstring name, float shares);
+    void check_huge_pages();
+    void update_huge_page_usage(memory::huge_page_usage usage);
+    const memory::fragmentation_report& fragmentation_report();
+    void init_scheduling_group(scheduling_group sg, sstring name, float shares, bool stealable = false);
+    void queue_stealable(internal::stealable_work_item* wi);
     uint64_t tasks_processed() const;
     uint64_t min_vruntime() const;
 public:
     static boost::program_options::options_description get_options_description(std::chrono::duration<double> default_task_quota);
-    explicit reactor(unsigned id);
+    explicit reactor(unsigned id, reactor_backend_selector rbs = reactor_backend_selector::default_backend());
     reactor(const reactor&) = delete;
     ~reactor();
     void operator=(const reactor&) = delete;
 
-    const io_queue& get_io_queue() const {
-        return *_io_queue;
+    /// Returns the I/O queue serving files on the given device (\c st_dev),
+    /// or the default queue if the device has none of its own.
+    const io_queue& get_io_queue(dev_t devid = 0) const {
+        auto i = _io_queues.find(devid);
+        return i != _io_queues.end() ? *i->second : *_io_queue;
     }
 
-    io_priority_class register_one_priority_class(sstring name, uint32_t shares) {
-        return io_queue::register_one_priority_class(std::move(name), shares);
+    /// \brief Registers a new I/O priority class
+    ///
+    /// \param name the name of the class, used in metrics
+    /// \param shares the share of disk capacity the class gets when it competes with others
+    /// \param latency_target if nonzero, the time requests of this class should spend
+    ///        in the I/O queue at most. As they approach it, they are dispatched ahead
+    ///        of other classes, regardless of shares. Meant for a few latency-sensitive
+    ///        classes, such as foreground reads; if they all saturate the disk,
+    ///        targets will be missed anyway.
+    io_priority_class register_one_priority_class(sstring name, uint32_t shares, std::chrono::microseconds latency_target = {}) {
+        return io_queue::register_one_priority_class(std::move(name), shares, latency_target);
     }
 
     /// \brief Updates the current amount of shares for a given priority class
     ///
-    /// This can involve a cross-shard call if the I/O Queue that is responsible for
-    /// this class lives in a foreign shard.
+    /// The shares apply to this shard's requests.
     ///
     /// \param pc the priority class handle
     /// \param shares the new shares value
     /// \return a future that is ready when the share update is applied
     future<> update_shares_for_class(io_priority_class pc, uint32_t shares) {
-        return _io_queue->update_shares_for_class(pc, shares);
+        return _io_queue->update_shares_for_class(pc, shares).then([this, pc, shares] {
+            return parallel_for_each(_io_queues, [pc, shares] (auto& q) {
+                return q.second->update_shares_for_class(pc, shares);
+            });
+        });
     }
 
+    /// \brief Caps the disk bandwidth and IOPS of a given priority class
+    ///
+    /// The limits are hard: requests of the class wait once it reaches them, even if
+    /// the disk has spare capacity. They apply to each device with an I/O queue of its
+    /// own, and to the remaining ones together, and to the requests of all shards together.
+    ///
+    /// \param pc the priority class handle
+    /// \param bytes_per_second the bandwidth limit, or 0 for none
+    /// \param ops_per_second the IOPS limit, or 0 for none
+    /// \return a future that is ready when the limits are applied on all shards
+    future<> update_rate_limits_for_class(io_priority_class pc, uint64_t bytes_per_second, uint64_t ops_per_second);
+
     void configure(boost::program_options::variables_map config);
 
     server_socket listen(socket_address sa, listen_options opts = {});
@@ -938,6 +1376,10 @@ class reactor {
     future<> posix_connect(lw_shared_ptr<pollable_fd> pfd, socket_address sa, socket_address local);
 
     future<pollable_fd, socket_address> accept(pollable_fd_state& listen_fd);
+    // A connection storm must not keep the reactor from polling its other
+    // file descriptors; connections beyond this are left for the next batch.
+    static constexpr unsigned max_accept_batch = 64;
+    future<std::vector<std::pair<pollable_fd, socket_address>>> accept_batch(pollable_fd_state& listen_fd);
 
     future<size_t> read_some(pollable_fd_state& fd, void* buffer, size_t size);
     future<size_t> read_some(pollable_fd_state& fd, const std::vector<iovec>& iov);
@@ -946,6 +1388,8 @@ class reactor {
 
     future<> write_all(pollable_fd_state& fd, const void* buffer, size_t size);
 
+    future<size_t> sendfile(pollable_fd_state& fd, int in_fd, uint64_t pos, size_t len);
+
     future<file> open_file_dma(sstring name, open_flags flags, file_open_options options = {});
     future<file> open_directory(sstring name);
     future<> make_directory(sstring name);
@@ -965,9 +1409,9 @@ class reactor {
     void submit_io(io_desc* desc, Func prepare_io);
 
     template <typename Func>
-    future<io_event> submit_io_read(const io_priority_class& priority_class, size_t len, Func prepare_io);
+    future<io_event> submit_io_read(dev_t devid, const io_priority_class& priority_class, size_t len, Func prepare_io);
     template <typename Func>
-    future<io_event> submit_io_write(const io_priority_class& priority_class, size_t len, Func prepare_io);
+    future<io_event> submit_io_write(dev_t devid, const io_priority_class& priority_class, size_t len, Func prepare_io);
 
     int run();
     void exit(int ret);
@@ -1060,6 +1504,7 @@ class reactor {
     future<> write_all_part(pollable_fd_state& fd, const void* buffer, size_t size, size_t completed);
 
     bool process_io();
+    void complete_io(const ::io_event& ev);
 
     void add_timer(timer<steady_clock_type>*);
     bool queue_timer(timer<steady_clock_type>*);
@@ -1084,38 +1529,46 @@ class reactor {
     friend class timer<manual_clock>;
     friend class smp;
     friend class smp_message_queue;
+    friend class reactor_backend_uring;
     friend class poller;
     friend class scheduling_group;
     friend void add_to_flush_poller(output_stream<char>* os);
     friend int ::_Unwind_RaiseException(void *h);
     metrics::metric_groups _metric_groups;
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares);
+    friend future<scheduling_group> create_stealable_scheduling_group(sstring name, float shares);
 public:
     bool wait_and_process(int timeout = 0, const sigset_t* active_sigmask = nullptr) {
-        return _backend.wait_and_process(timeout, active_sigmask);
+        return _backend->wait_and_process(timeout, active_sigmask);
     }
 
     future<> readable(pollable_fd_state& fd) {
-        return _backend.readable(fd);
+        return _backend->readable(fd);
     }
     future<> writeable(pollable_fd_state& fd) {
-        return _backend.writeable(fd);
+        return _backend->writeable(fd);
+    }
+    future<> readable_errqueue(pollable_fd_state& fd) {
+        return _backend->readable_errqueue(fd);
     }
     void forget(pollable_fd_state& fd) {
-        _backend.forget(fd);
+        _backend->forget(fd);
     }
     future<> notified(reactor_notifier *n) {
-        return _backend.notified(n);
+        return _backend->notified(n);
     }
     void abort_reader(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_reader(fd, std::move(ex));
+        return _backend->abort_reader(fd, std::move(ex));
     }
     void abort_writer(pollable_fd_state& fd, std::exception_ptr ex) {
-        return _backend.abort_writer(fd, std::move(ex));
+        return _backend->abort_writer(fd, std::move(ex));
+    }
+    void abort_errqueue_reader(pollable_fd_state& fd, std::exception_ptr ex) {
+        return _backend->abort_errqueue_reader(fd, std::move(ex));
     }
     void enable_timer(steady_clock_type::time_point when);
     std::unique_ptr<reactor_notifier> make_reactor_notifier() {
-        return _backend.make_reactor_notifier();
+        return _backend->make_reactor_notifier();
     }
     /// Sets the "Strict DMA" flag.
     ///
@@ -1173,6 +1626,14 @@ class smp {
     static std::unique_ptr<smp_message_queue*[], qs_deleter> _qs;
     static std::thread::id _tmain;
     static bool _using_dpdk;
+    static smp_message_queue::config _queue_config;
+    struct topology {
+        std::vector<unsigned> shard_core;
+        std::vector<unsigned> shard_socket; // dense, in [0, socket_shards.size())
+        std::vector<std::vector<unsigned>> socket_shards;
+        bool relay_broadcasts = false;
+    };
+    static topology _topology;
 
     template <typename Func>
     using returns_future = is_future<std::result_of_t<Func()>>;
@@ -1187,6 +1648,27 @@ class smp {
     static void join_all();
     static bool main_thread() { return std::this_thread::get_id() == _tmain; }
 
+    /// How far apart the cpus of two shards are, from nearest to farthest.
+    enum class shard_distance {
+        same_shard,
+        sibling,       ///< hyperthreads of the same core
+        same_socket,
+        remote_socket,
+    };
+    static shard_distance distance(unsigned a, unsigned b);
+    /// Number of sockets that have at least one shard.
+    static unsigned nr_sockets() {
+        return _topology.socket_shards.size();
+    }
+    /// The socket of shard \c t, in [0, nr_sockets()).
+    static unsigned socket_of(unsigned t) {
+        return _topology.shard_socket[t];
+    }
+    /// The shards running on \c socket, in increasing order.
+    static const std::vector<unsigned>& shards_on_socket(unsigned socket) {
+        return _topology.socket_shards[socket];
+    }
+
     /// Runs a function on a remote core.
     ///
     /// \param t designates the core to run the function on (may be a remote
@@ -1221,6 +1703,48 @@ class smp {
             return _qs[t][engine().cpu_id()].submit(std::forward<Func>(func));
         }
     }
+    /// Runs a batch of functions on a remote core.
+    ///
+    /// Equivalent to calling submit_to() for each element of \c funcs, but
+    /// hands them to core \c t all at once, which is cheaper than one at a time.
+    ///
+    /// \param t designates the core to run the functions on (may be a remote
+    ///          core or the local core).
+    /// \param funcs a range of callables; they are moved from.
+    /// \return a vector holding, for each function in \c funcs, the future
+    ///         submit_to() would have returned for it.
+    template <typename Range, typename Func = std::decay_t<decltype(*std::begin(std::declval<Range&>()))>>
+    static std::vector<futurize_t<std::result_of_t<Func()>>> submit_many_to(unsigned t, Range&& funcs) {
+        if (t == engine().cpu_id()) {
+            std::vector<futurize_t<std::result_of_t<Func()>>> ret;
+            for (auto&& func : funcs) {
+                ret.push_back(submit_to(t, Func(std::move(func))));
+            }
+            return ret;
+        } else {
+            return _qs[t][engine().cpu_id()].submit_many(std::forward<Range>(funcs));
+        }
+    }
+    /// Runs a CPU-bound function in a scheduling group, possibly on another shard.
+    ///
+    /// If \c sg was created with create_stealable_scheduling_group(), \c func
+    /// is queued on this shard and run by whichever shard gets to it first:
+    /// this one, in its turn in \c sg, or an idle shard. Otherwise it simply
+    /// runs here, in \c sg.
+    ///
+    /// \param sg the scheduling group to account \c func to.
+    /// \param func a callable that does not return a future. It may be moved
+    ///          to and run on another shard, so it must not refer to
+    ///          shard-local state.
+    /// \return whatever \c func returns, as a future<> resolved on this shard.
+    template <typename Func>
+    static futurize_t<std::result_of_t<Func()>> submit_stealable(scheduling_group sg, Func func) {
+        static_assert(!is_future<std::result_of_t<Func()>>::value, "stealable functions must not return a future");
+        auto wi = new internal::stealable_work_item_for<Func>(engine().cpu_id(), sg, std::move(func));
+        auto fut = wi->get_future();
+        engine().queue_stealable(wi);
+        return fut;
+    }
     static bool poll_queues();
     static bool pure_poll_queues();
     static boost::integer_range<unsigned> all_cpus() {
@@ -1230,20 +1754,102 @@ class smp {
     // The returned future resolves when all async invocations finish.
     // The func may return void or future<>.
     // Each async invocation will work with a separate copy of func.
+    // With --smp-relay-broadcasts, remote sockets are reached through one
+    // shard on each of them rather than directly.
     template<typename Func>
     static future<> invoke_on_all(Func&& func) {
         static_assert(std::is_same<future<>, typename futurize<std::result_of_t<Func()>>::type>::value, "bad Func signature");
-        return parallel_for_each(all_cpus(), [&func] (unsigned id) {
-            return smp::submit_to(id, Func(func));
+        if (_topology.relay_broadcasts) {
+            return invoke_on_all_relayed(std::decay_t<Func>(func));
+        }
+        struct state {
+            unsigned pending = count;
+            std::exception_ptr ex;
+            promise<> pr;
+        };
+        auto s = make_lw_shared<state>();
+        auto ret = s->pr.get_future();
+        submit_to_all(std::decay_t<Func>(func), [s] (future<> f) {
+            if (f.failed()) {
+                auto ex = f.get_exception();
+                if (!s->ex) {
+                    s->ex = std::move(ex);
+                }
+            }
+            if (--s->pending == 0) {
+                if (s->ex) {
+                    s->pr.set_exception(std::move(s->ex));
+                } else {
+                    s->pr.set_value();
+                }
+            }
         });
+        return ret;
+    }
+    /// Runs a copy of \c func on every core, and passes each outcome, as a
+    /// ready future, to \c done on this core.
+    ///
+    /// Unlike a submit_to() per core, this does not allocate a continuation
+    /// per core to collect the results, so a broadcast costs little more than
+    /// its (pooled) messages. \c done is copied for every core, and is called
+    /// exactly \c smp::count times, in order of completion.
+    template <typename Func, typename Done>
+    static void submit_to_all(const Func& func, const Done& done) {
+        for (auto id : all_cpus()) {
+            try {
+                if (id == engine().cpu_id()) {
+                    auto f = submit_to(id, Func(func));
+                    if (f.available()) {
+                        done(std::move(f));
+                    } else {
+                        f.then_wrapped(done);
+                    }
+                } else {
+                    _qs[id][engine().cpu_id()].submit_notify(Func(func), Done(done));
+                }
+            } catch (...) {
+                done(futurize<std::result_of_t<Func()>>::make_exception_future(std::current_exception()));
+            }
+        }
     }
 private:
+    // Sends a single message across each socket boundary, to the first shard
+    // of the remote socket, which passes func on to its neighbours. This keeps
+    // the queue indices a broadcast touches mostly socket-local.
+    //
+    // As with direct submissions, every shard's copy of func is made and
+    // destroyed here, on the calling shard; relays only pass pointers to the
+    // copies on, so func may hold shard-local state such as lw_shared_ptr.
+    template <typename Func>
+    static future<> invoke_on_all_relayed(Func func) {
+        auto funcs = std::make_unique<std::vector<Func>>(count, func);
+        auto ret = parallel_for_each(boost::irange(0u, nr_sockets()), [funcs = funcs.get()] (unsigned socket) {
+            if (socket == socket_of(engine().cpu_id())) {
+                return invoke_on_socket(socket, *funcs);
+            }
+            return smp::submit_to(shards_on_socket(socket).front(), [socket, funcs] {
+                return invoke_on_socket(socket, *funcs);
+            });
+        });
+        return ret.finally([funcs = std::move(funcs)] {});
+    }
+    template <typename Func>
+    static future<> invoke_on_socket(unsigned socket, std::vector<Func>& funcs) {
+        return parallel_for_each(shards_on_socket(socket), [&funcs] (unsigned id) {
+            return smp::submit_to(id, [func = &funcs[id]] {
+                return (*func)();
+            });
+        });
+    }
+    static void init_topology(const std::vector<resource::cpu>& allocations, bool relay_broadcasts);
     static void start_all_queues();
     static void pin(unsigned cpu_id);
-    static void allocate_reactor(unsigned id);
+    static void allocate_reactor(unsigned id, reactor_backend_selector rbs);
     static void create_thread(std::function<void ()> thread_loop);
 public:
     static unsigned count;
+
+    friend class reactor;
 };
 
 inline
@@ -1274,6 +1880,36 @@ reactor::accept(pollable_fd_state& listenfd) {
     });
 }
 
+inline
+future<std::vector<std::pair<pollable_fd, socket_address>>>
+reactor::accept_batch(pollable_fd_state& listenfd) {
+    using accepted = std::vector<std::pair<pollable_fd, socket_address>>;
+    return readable(listenfd).then([this, &listenfd] () mutable {
+        accepted ret;
+        try {
+            while (ret.size() < max_accept_batch) {
+                socket_address sa;
+                socklen_t sl = sizeof(sa.u.sas);
+                auto fd = listenfd.fd.try_accept(sa.u.sa, sl, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (!fd) {
+                    break;
+                }
+                ret.emplace_back(pollable_fd(std::move(*fd), pollable_fd::speculation(EPOLLOUT)), sa);
+            }
+        } catch (...) {
+            // Hand out what was accepted; the error (e.g. EMFILE) will
+            // recur on the next call.
+            if (ret.empty()) {
+                throw;
+            }
+        }
+        if (ret.empty()) {
+            return accept_batch(listenfd);
+        }
+        return make_ready_future<accepted>(std::move(ret));
+    });
+}
+
 inline
 future<size_t>
 reactor::read_some(pollable_fd_state& fd, void* buffer, size_t len) {
@@ -1368,8 +2004,8 @@ future<> pollable_fd::write_all(const uint8_t* buffer, size_t size) {
 }
 
 inline
-future<size_t> pollable_fd::write_some(net::packet& p) {
-    return engine().writeable(*_s).then([this, &p] () mutable {
+future<size_t> pollable_fd::write_some(net::packet& p, int flags) {
+    return engine().writeable(*_s).then([this, &p, flags] () mutable {
         static_assert(offsetof(iovec, iov_base) == offsetof(net::fragment, base) &&
             sizeof(iovec::iov_base) == sizeof(net::fragment::base) &&
             offsetof(iovec, iov_len) == offsetof(net::fragment, size) &&
@@ -1382,9 +2018,9 @@ future<size_t> pollable_fd::write_some(net::packet& p) {
         msghdr mh = {};
         mh.msg_iov = iov;
         mh.msg_iovlen = p.nr_frags();
-        auto r = get_file_desc().sendmsg(&mh, MSG_NOSIGNAL);
+        auto r = get_file_desc().sendmsg(&mh, MSG_NOSIGNAL | flags);
         if (!r) {
-            return write_some(p);
+            return write_some(p, flags);
         }
         if (size_t(*r) == p.len()) {
             _s->speculate_epoll(EPOLLOUT);
@@ -1404,6 +2040,11 @@ future<> pollable_fd::write_all(net::packet& p) {
     });
 }
 
+inline
+future<size_t> pollable_fd::sendfile(int in_fd, uint64_t pos, size_t len) {
+    return engine().sendfile(*_s, in_fd, pos, len);
+}
+
 inline
 future<> pollable_fd::readable() {
     return engine().readable(*_s);
@@ -1414,6 +2055,11 @@ future<> pollable_fd::writeable() {
     return engine().writeable(*_s);
 }
 
+inline
+future<> pollable_fd::readable_errqueue() {
+    return engine().readable_errqueue(*_s);
+}
+
 inline
 void
 pollable_fd::abort_reader(std::exception_ptr ex) {
@@ -1426,11 +2072,22 @@ pollable_fd::abort_writer(std::exception_ptr ex) {
     engine().abort_writer(*_s, std::move(ex));
 }
 
+inline
+void
+pollable_fd::abort_errqueue_reader(std::exception_ptr ex) {
+    engine().abort_errqueue_reader(*_s, std::move(ex));
+}
+
 inline
 future<pollable_fd, socket_address> pollable_fd::accept() {
     return engine().accept(*_s);
 }
 
+inline
+future<std::vector<std::pair<pollable_fd, socket_address>>> pollable_fd::accept_batch() {
+    return engine().accept_batch(*_s);
+}
+
 inline
 future<size_t> pollable_fd::recvmsg(struct msghdr *msg) {
     return engine().readable(*_s).then([this, msg] {
@@ -1467,6 +2124,37 @@ future<size_t> pollable_fd::sendmsg(struct msghdr* msg) {
     });
 }
 
+inline
+future<size_t> pollable_fd::recvmmsg(mmsghdr* msgvec, unsigned vlen) {
+    return engine().readable(*_s).then([this, msgvec, vlen] {
+        auto r = get_file_desc().recvmmsg(msgvec, vlen, 0);
+        if (!r) {
+            return recvmmsg(msgvec, vlen);
+        }
+        // Unlike recvmsg(), we know whether the queue was drained: only a
+        // full batch suggests that more messages are waiting.
+        if (*r == vlen) {
+            _s->speculate_epoll(EPOLLIN);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
+inline
+future<size_t> pollable_fd::sendmmsg(mmsghdr* msgvec, unsigned vlen) {
+    return engine().writeable(*_s).then([this, msgvec, vlen] () mutable {
+        auto r = get_file_desc().sendmmsg(msgvec, vlen, 0);
+        if (!r) {
+            return sendmmsg(msgvec, vlen);
+        }
+        // See the comment about speculation in sendmsg().
+        if (*r == vlen) {
+            _s->speculate_epoll(EPOLLOUT);
+        }
+        return make_ready_future<size_t>(*r);
+    });
+}
+
 inline
 future<size_t> pollable_fd::sendto(socket_address addr, const void* buf, size_t len) {
     return engine().writeable(*_s).then([this, buf, len, addr] () mutable {
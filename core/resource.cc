@@ -123,6 +123,13 @@ static unsigned find_memory_depth(hwloc_topology_t& topology) {
     return depth;
 }
 
+// Returns the logical index of pu's ancestor of the given type, or
+// fallback if the topology has no such level.
+static unsigned ancestor_index(hwloc_topology_t& topology, hwloc_obj_type_t type, hwloc_obj_t pu, unsigned fallback) {
+    auto obj = hwloc_get_ancestor_obj_by_type(topology, type, pu);
+    return obj ? obj->logical_index : fallback;
+}
+
 static size_t alloc_from_node(cpu& this_cpu, hwloc_obj_t node, std::unordered_map<hwloc_obj_t, size_t>& used_mem, size_t alloc) {
     auto taken = std::min(node->memory.local_memory - used_mem[node], alloc);
     if (taken) {
@@ -295,6 +302,8 @@ resources allocate(configuration c) {
         auto node = hwloc_get_ancestor_obj_by_depth(topology, depth, pu);
         cpu this_cpu;
         this_cpu.cpu_id = cpu_id;
+        this_cpu.core_id = ancestor_index(topology, HWLOC_OBJ_CORE, pu, cpu_id);
+        this_cpu.socket_id = ancestor_index(topology, HWLOC_OBJ_SOCKET, pu, 0);
         remain = mem_per_proc - alloc_from_node(this_cpu, node, topo_used_mem, mem_per_proc);
 
         remains.emplace_back(std::move(this_cpu), remain);
@@ -372,7 +381,8 @@ resources allocate(configuration c) {
     auto procs = c.cpus.value_or(cpuset_procs);
     ret.cpus.reserve(procs);
     for (unsigned i = 0; i < procs; ++i) {
-        ret.cpus.push_back(cpu{i, {{mem / procs, 0}}});
+        // Without hwloc, assume one socket and no hyperthreading.
+        ret.cpus.push_back(cpu{i, {{mem / procs, 0}}, i, 0});
     }
 
     ret.io_queues = allocate_io_queues(c, ret.cpus);
@@ -65,6 +65,10 @@ struct io_queue_topology {
 struct cpu {
     unsigned cpu_id;
     std::vector<memory> mem;
+    // Where the cpu sits in the machine. Cpus sharing a core_id are hyperthread
+    // siblings; ids are only meaningful for comparison with each other.
+    unsigned core_id = 0;
+    unsigned socket_id = 0;
 };
 
 struct resources {
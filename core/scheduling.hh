@@ -54,6 +54,20 @@ scheduling_group scheduling_group_from_index(unsigned index);
 /// \return a scheduling group that can be used on any shard
 future<scheduling_group> create_scheduling_group(sstring name, float shares);
 
+/// Creates a scheduling group whose work may be run by idle shards.
+///
+/// Functions submitted to the group with smp::submit_stealable() are queued
+/// on the submitting shard, but a shard that has nothing else to do may take
+/// them and run them in its own instance of the group. Results are always
+/// delivered on the submitting shard. Use it for CPU-bound batch work
+/// (compression, checksumming) that does not touch shard-local state.
+///
+/// \param name A name that identifiers the group; will be used as a label
+///             in the group's metrics
+/// \param shares number of shares of the CPU time allotted to the group
+/// \return a scheduling group that can be used on any shard
+future<scheduling_group> create_stealable_scheduling_group(sstring name, float shares);
+
 /// \brief Identifies function calls that are accounted as a group
 ///
 /// A `scheduling_group` is a tag that can be used to mark a function call.
@@ -70,6 +84,8 @@ class scheduling_group {
     bool operator==(scheduling_group x) const { return _id == x._id; }
     bool operator!=(scheduling_group x) const { return _id != x._id; }
     bool is_main() const { return _id == 0; }
+    /// Whether the group was created with create_stealable_scheduling_group().
+    bool is_stealable() const;
     /// Adjusts the number of shares allotted to the group.
     ///
     /// Dynamically adjust the number of shares allotted to the group, increasing or
@@ -84,6 +100,7 @@ class scheduling_group {
     ///               in the 1-1000 range.
     void set_shares(float shares);
     friend future<scheduling_group> create_scheduling_group(sstring name, float shares);
+    friend future<scheduling_group> create_stealable_scheduling_group(sstring name, float shares);
     friend class reactor;
     friend unsigned internal::scheduling_group_index(scheduling_group sg) {
         return sg._id;
@@ -263,16 +263,39 @@ class sharded {
     inline
     future<Initial>
     map_reduce0(Mapper map, Initial initial, Reduce reduce) {
-        auto wrapped_map = [this, map] (unsigned c) {
-            return smp::submit_to(c, [this, map] {
-                auto inst = get_local_service();
-                return map(*inst);
-            });
+        struct state {
+            unsigned pending;
+            Initial result;
+            Reduce reduce;
+            std::exception_ptr ex;
+            promise<Initial> pr;
         };
-        return ::seastar::map_reduce(smp::all_cpus().begin(), smp::all_cpus().end(),
-                            std::move(wrapped_map),
-                            std::move(initial),
-                            std::move(reduce));
+        auto s = make_lw_shared(state{smp::count, std::move(initial), std::move(reduce)});
+        auto ret = s->pr.get_future();
+        // Results are folded in on this shard as they arrive, as
+        // seastar::map_reduce() would, but without a continuation per shard.
+        smp::submit_to_all([this, map] {
+            auto inst = get_local_service();
+            return map(*inst);
+        }, [s] (auto f) {
+            try {
+                if (!s->ex) {
+                    s->result = s->reduce(std::move(s->result), f.get0());
+                } else {
+                    f.ignore_ready_future();
+                }
+            } catch (...) {
+                s->ex = std::current_exception();
+            }
+            if (--s->pending == 0) {
+                if (s->ex) {
+                    s->pr.set_exception(std::move(s->ex));
+                } else {
+                    s->pr.set_value(std::move(s->result));
+                }
+            }
+        });
+        return ret;
     }
 
     /// Applies a map function to all shards, and return a vector of the result.
@@ -481,11 +504,9 @@ template <typename... Args>
 inline
 future<>
 sharded<Service>::invoke_on_all(future<> (Service::*func)(Args...), Args... args) {
-    return parallel_for_each(boost::irange<unsigned>(0, _instances.size()), [this, func, args...] (unsigned c) {
-        return smp::submit_to(c, [this, func, args...] {
-            auto inst = get_local_service();
-            return ((*inst).*func)(args...);
-        });
+    return smp::invoke_on_all([this, func, args...] {
+        auto inst = get_local_service();
+        return ((*inst).*func)(args...);
     });
 }
 
@@ -494,11 +515,9 @@ template <typename... Args>
 inline
 future<>
 sharded<Service>::invoke_on_all(void (Service::*func)(Args...), Args... args) {
-    return parallel_for_each(boost::irange<unsigned>(0, _instances.size()), [this, func, args...] (unsigned c) {
-        return smp::submit_to(c, [this, func, args...] {
-            auto inst = get_local_service();
-            ((*inst).*func)(args...);
-        });
+    return smp::invoke_on_all([this, func, args...] {
+        auto inst = get_local_service();
+        ((*inst).*func)(args...);
     });
 }
 
@@ -509,11 +528,9 @@ future<>
 sharded<Service>::invoke_on_all(Func&& func) {
     static_assert(std::is_same<futurize_t<std::result_of_t<Func(Service&)>>, future<>>::value,
                   "invoke_on_all()'s func must return void or future<>");
-    return parallel_for_each(boost::irange<unsigned>(0, _instances.size()), [this, &func] (unsigned c) {
-        return smp::submit_to(c, [this, func] {
-            auto inst = get_local_service();
-            return func(*inst);
-        });
+    return smp::invoke_on_all([this, func] {
+        auto inst = get_local_service();
+        return func(*inst);
     });
 }
 
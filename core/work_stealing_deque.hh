@@ -0,0 +1,118 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+// A fixed capacity, lock-free work-stealing deque of pointers (Chase and Lev,
+// "Dynamic Circular Work-Stealing Deque", with the memory orderings from Le
+// et al., "Correct and Efficient Work-Stealing for Weak Memory Models").
+//
+// A single owner thread pushes and pops at the bottom end; any number of
+// other threads may concurrently steal from the top end. The owner only
+// contends with thieves when a single item is left.
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "cacheline.hh"
+
+namespace seastar {
+
+namespace internal {
+
+template <typename T, size_t Capacity>
+class work_stealing_deque {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    static constexpr size_t mask = Capacity - 1;
+    // Written by thieves; kept apart from the owner's end.
+    alignas(seastar::cache_line_size) std::atomic<int64_t> _top{0};
+    alignas(seastar::cache_line_size) std::atomic<int64_t> _bottom{0};
+    std::array<std::atomic<T*>, Capacity> _items;
+public:
+    work_stealing_deque() {
+        for (auto& i : _items) {
+            i.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+    work_stealing_deque(const work_stealing_deque&) = delete;
+    void operator=(const work_stealing_deque&) = delete;
+
+    // Owner only. Returns false if the deque is full.
+    bool push(T* item) {
+        auto b = _bottom.load(std::memory_order_relaxed);
+        auto t = _top.load(std::memory_order_acquire);
+        if (b - t >= int64_t(Capacity)) {
+            return false;
+        }
+        _items[b & mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Owner only. Returns the most recently pushed item, or nullptr if
+    // the deque is empty.
+    T* pop() {
+        auto b = _bottom.load(std::memory_order_relaxed) - 1;
+        _bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto t = _top.load(std::memory_order_relaxed);
+        if (t > b) {
+            _bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto item = _items[b & mask].load(std::memory_order_relaxed);
+        if (t == b) {
+            // Last item: race the thieves for it.
+            if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            _bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread. Returns the least recently pushed item, or nullptr if
+    // the deque is empty or another thread got to it first.
+    T* steal() {
+        auto t = _top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = _bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        auto item = _items[t & mask].load(std::memory_order_relaxed);
+        if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    // Any thread; only a hint when called concurrently with other operations.
+    bool empty() const {
+        return _bottom.load(std::memory_order_relaxed) <= _top.load(std::memory_order_relaxed);
+    }
+};
+
+}
+
+}
@@ -87,12 +87,32 @@ future<std::unique_ptr<reply>> file_interaction_handler::read(
     rep->write_body(extension, [req = std::move(req), extension, file_name, this] (output_stream<char>&& s) mutable {
         return do_with(output_stream<char>(get_stream(std::move(req), extension, std::move(s))),
                 [file_name] (output_stream<char>& os) {
-            return open_file_dma(file_name, open_flags::ro).then([&os] (file f) {
-                return do_with(input_stream<char>(make_file_input_stream(std::move(f))), [&os](input_stream<char>& is) {
-                    return copy(is, os).then([&os] {
-                        return os.close();
-                    }).then([&is] {
-                        return is.close();
+            // sendfile(2) needs a file that goes through the page cache, while
+            // copying through an input_stream wants O_DIRECT, so try the
+            // former first and reopen the file if the stream cannot take it.
+            file_open_options buffered;
+            buffered.buffered = true;
+            return open_file_dma(file_name, open_flags::ro, buffered).then([&os, file_name] (file f) mutable {
+                if (os.can_send_file(f)) {
+                    return do_with(std::move(f), [&os] (file& f) {
+                        return f.size().then([&os, &f] (uint64_t size) {
+                            return os.send_file(f, 0, size);
+                        }).then([&os] {
+                            return os.close();
+                        }).finally([&f] {
+                            return f.close();
+                        });
+                    });
+                }
+                return f.close().then([file_name] {
+                    return open_file_dma(file_name, open_flags::ro);
+                }).then([&os] (file f) {
+                    return do_with(input_stream<char>(make_file_input_stream(std::move(f))), [&os](input_stream<char>& is) {
+                        return copy(is, os).then([&os] {
+                            return os.close();
+                        }).then([&is] {
+                            return is.close();
+                        });
                     });
                 });
             });
@@ -123,6 +123,19 @@ class http_chunked_data_sink_impl : public data_sink_impl {
             return _out.write("\r\n", 2);
         });
     }
+    virtual bool can_send_file(const file& f) const override {
+        return _out.can_send_file(f);
+    }
+    virtual future<> send_file(const file& f, uint64_t pos, size_t len) override {
+        if (len == 0) {
+            return make_ready_future<>();
+        }
+        return write_size(len).then([this, &f, pos, len] {
+            return _out.send_file(f, pos, len);
+        }).then([this] {
+            return _out.write("\r\n", 2);
+        });
+    }
     virtual future<> close() {
         return  make_ready_future<>();
     }
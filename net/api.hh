@@ -134,6 +134,8 @@ class udp_channel {
     future<udp_datagram> receive();
     future<> send(ipv4_addr dst, const char* msg);
     future<> send(ipv4_addr dst, packet p);
+    /// Sends several datagrams, with as few system calls as the stack allows.
+    future<> send_batch(std::vector<std::pair<ipv4_addr, packet>> datagrams);
     bool is_closed() const;
     void close();
 };
@@ -186,6 +188,21 @@ class connected_socket {
     void set_keepalive_parameters(const net::keepalive_params& p);
     /// Get TCP keepalive parameters
     net::keepalive_params get_keepalive_parameters() const;
+    /// Sends packets containing a fragment of at least \c bytes without
+    /// copying them into the kernel (MSG_ZEROCOPY).
+    ///
+    /// The memory of such packets is held until the kernel reports that it
+    /// no longer references it, which is only worth it for large fragments.
+    /// Affects output streams obtained after the call. Zero (the default)
+    /// disables zero-copy sends; stacks that do not support them ignore it.
+    void set_zero_copy_threshold(size_t bytes);
+    /// Selects the congestion control algorithm of a TCP connection, by its
+    /// Linux name (e.g. "reno", "cubic", "bbr"), like TCP_CONGESTION.
+    ///
+    /// The native stack supports "reno", "cubic" and "bbr" and throws
+    /// std::invalid_argument for other names; the posix stack accepts the
+    /// algorithms available to the kernel. Ignored by SCTP sockets.
+    void set_congestion_control(const sstring& name);
 
     /// Disables output to the socket.
     ///
@@ -264,6 +281,15 @@ class server_socket {
     /// \see listen(socket_address sa, listen_options opts)
     future<connected_socket, socket_address> accept();
 
+    /// Accepts all connections that have already connected to this socket,
+    /// waiting for at least one.
+    ///
+    /// Servers that accept many short-lived connections save a readiness
+    /// wait per connection compared to \ref accept().
+    ///
+    /// \return the accepted connections, each with its remote endpoint.
+    future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch();
+
     /// Stops any \ref accept() in progress.
     ///
     /// Current and future \ref accept() calls will terminate immediately
@@ -26,6 +26,7 @@
 #include "core/shared_ptr.hh"
 #include "toeplitz.hh"
 #include "core/metrics.hh"
+#include <random>
 
 namespace seastar {
 
@@ -40,7 +41,9 @@ std::ostream& operator<<(std::ostream& os, ipv4_address a) {
             (ip >> 0) & 0xff);
 }
 
-constexpr std::chrono::seconds ipv4::_frag_timeout;
+constexpr uint16_t ipv4::_frag_max;
+constexpr uint16_t ipv4::_frag_index_size;
+constexpr uint16_t ipv4::_frag_none;
 constexpr uint32_t ipv4::_frag_low_thresh;
 constexpr uint32_t ipv4::_frag_high_thresh;
 
@@ -60,6 +63,8 @@ ipv4::ipv4(interface* netif)
     , _icmp(*this)
     , _udp(*this)
     , _l4({ { uint8_t(ip_protocol_num::tcp), &_tcp }, { uint8_t(ip_protocol_num::icmp), &_icmp }, { uint8_t(ip_protocol_num::udp), &_udp }})
+    , _frag_index(_frag_index_size, _frag_none)
+    , _frag_seed(std::random_device()())
 {
     namespace sm = seastar::metrics;
 
@@ -69,7 +74,19 @@ ipv4::ipv4(interface* netif)
         //
         sm::make_derive("linearizations", [] { return ipv4_packet_merger::linearizations(); },
                         sm::description("Counts a number of times a buffer linearization was invoked during buffers merge process. "
-                                        "Divide it by a total IPv4 receive packet rate to get an average number of lineraizations per packet."))
+                                        "Divide it by a total IPv4 receive packet rate to get an average number of lineraizations per packet.")),
+        //
+        // Fragment reassembly: DERIVE:0:u
+        //
+        sm::make_derive("reassembled", _frag_stats.reassembled,
+                        sm::description("Counts a number of datagrams reassembled from fragments.")),
+        sm::make_derive("reassembly_timeouts", _frag_stats.timed_out,
+                        sm::description("Counts a number of partially received datagrams dropped because their missing fragments did not arrive in time.")),
+        sm::make_derive("reassembly_evictions", _frag_stats.evicted,
+                        sm::description("Counts a number of partially received datagrams dropped to make room for newer ones. "
+                                        "A high value indicates that fragments arrive faster than they can be reassembled, or a fragment flood.")),
+        sm::make_gauge("reassembly_memory", [this] { return _frag_mem; },
+                        sm::description("Holds the amount of memory used by partially received datagrams."))
     });
     _frag_timer.set_callback([this] { frag_timeout(); });
 }
@@ -164,22 +181,20 @@ ipv4::handle_received_packet(packet p, ethernet_address from) {
     // Does this IP datagram need reassembly
     auto mf = h.mf();
     if (mf == true || offset != 0) {
-        frag_limit_mem();
         auto frag_id = ipv4_frag_id{h.src_ip, h.dst_ip, h.id, h.ip_proto};
-        auto& frag = _frags[frag_id];
+        auto idx = frag_find(frag_id);
+        if (idx == _frag_none) {
+            idx = frag_insert(frag_id);
+        }
+        auto& frag = _frags[idx];
         if (mf == false) {
             frag.last_frag_received = true;
         }
-        // This is a newly created frag_id
-        if (frag.mem_size == 0) {
-            _frags_age.push_back(frag_id);
-            frag.rx_time = clock_type::now();
-        }
         auto added_size = frag.merge(h, offset, std::move(p));
         _frag_mem += added_size;
         if (frag.is_complete()) {
             // All the fragments are received
-            auto dropped_size = frag.mem_size;
+            _frag_stats.reassembled++;
             auto& ip_data = frag.data.map.begin()->second;
             // Choose a cpu to forward this packet
             auto cpu_id = engine().cpu_id();
@@ -202,15 +217,10 @@ ipv4::handle_received_packet(packet p, ethernet_address from) {
                     }
                 }
             }
-
-            // Delete this frag from _frags and _frags_age
-            frag_drop(frag_id, dropped_size);
-            _frags_age.remove(frag_id);
+            frag_drop(idx);
         } else {
             // Some of the fragments are missing
-            if (!_frag_timer.armed()) {
-                frag_arm();
-            }
+            frag_limit_mem(idx);
         }
         return make_ready_future<>();
     }
@@ -348,61 +358,148 @@ void ipv4::set_packet_filter(ip_packet_filter * f) {
     _packet_filter = f;
 }
 
+void ipv4::set_frag_timeout(clock_type::duration timeout) {
+    _frag_timeout = timeout;
+    if (_frags_oldest != _frag_none) {
+        _frag_timer.rearm(_frags[_frags_oldest].rx_time + _frag_timeout);
+    }
+}
+
 ip_packet_filter * ipv4::packet_filter() const {
     return _packet_filter;
 }
 
-void ipv4::frag_limit_mem() {
+uint32_t ipv4::frag_hash(const ipv4_frag_id& id) const {
+    // Seeded, so that colliding ids cannot be picked from outside
+    uint64_t k = (uint64_t(id.src_ip.ip) << 32 | id.dst_ip.ip) ^ _frag_seed;
+    k ^= (uint64_t(id.identification) << 8 | id.protocol) * 0x9e3779b97f4a7c15;
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccd;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53;
+    k ^= k >> 33;
+    return k;
+}
+
+uint16_t ipv4::frag_find(const ipv4_frag_id& id) {
+    auto hash = frag_hash(id);
+    for (auto slot = hash % _frag_index_size; _frag_index[slot] != _frag_none; slot = (slot + 1) % _frag_index_size) {
+        auto& frag = _frags[_frag_index[slot]];
+        if (frag.hash == hash && frag.id == id) {
+            return _frag_index[slot];
+        }
+    }
+    return _frag_none;
+}
+
+uint16_t ipv4::frag_insert(const ipv4_frag_id& id) {
+    if (_nr_frags == _frag_max) {
+        // Make room by dropping the oldest datagram
+        frag_drop(_frags_oldest);
+        _frag_stats.evicted++;
+    }
+    uint16_t idx;
+    if (_frags_free != _frag_none) {
+        idx = _frags_free;
+        _frags_free = _frags[idx].newer;
+    } else {
+        idx = _frags.size();
+        _frags.emplace_back();
+    }
+    _nr_frags++;
+    auto& frag = _frags[idx];
+    frag.id = id;
+    frag.hash = frag_hash(id);
+    frag.rx_time = clock_type::now();
+    frag.older = _frags_newest;
+    frag.newer = _frag_none;
+    if (_frags_newest != _frag_none) {
+        _frags[_frags_newest].newer = idx;
+    } else {
+        _frags_oldest = idx;
+    }
+    _frags_newest = idx;
+    auto slot = frag.hash % _frag_index_size;
+    while (_frag_index[slot] != _frag_none) {
+        slot = (slot + 1) % _frag_index_size;
+    }
+    _frag_index[slot] = idx;
+    if (!_frag_timer.armed()) {
+        frag_arm(frag.rx_time);
+    }
+    return idx;
+}
+
+void ipv4::frag_limit_mem(uint16_t keep) {
     if (_frag_mem <= _frag_high_thresh) {
         return;
     }
-    auto drop = _frag_mem - _frag_low_thresh;
-    while (drop) {
-        if (_frags_age.empty()) {
-            return;
+    // Drop the oldest datagrams, but not the one being reassembled
+    auto idx = _frags_oldest;
+    while (idx != _frag_none && _frag_mem > _frag_low_thresh) {
+        auto newer = _frags[idx].newer;
+        if (idx != keep) {
+            frag_drop(idx);
+            _frag_stats.evicted++;
         }
-        // Drop the oldest frag (first element) from _frags_age
-        auto frag_id = _frags_age.front();
-        _frags_age.pop_front();
-
-        // Drop from _frags as well
-        auto& frag = _frags[frag_id];
-        auto dropped_size = frag.mem_size;
-        frag_drop(frag_id, dropped_size);
-
-        drop -= std::min(drop, dropped_size);
+        idx = newer;
     }
 }
 
 void ipv4::frag_timeout() {
-    if (_frags.empty()) {
-        return;
-    }
     auto now = clock_type::now();
-    for (auto it = _frags_age.begin(); it != _frags_age.end();) {
-        auto frag_id = *it;
-        auto& frag = _frags[frag_id];
-        if (now > frag.rx_time + _frag_timeout) {
-            auto dropped_size = frag.mem_size;
-            // Drop from _frags
-            frag_drop(frag_id, dropped_size);
-            // Drop from _frags_age
-            it = _frags_age.erase(it);
-        } else {
-            // The further items can only be younger
-            break;
-        }
+    // Datagrams time out in the order they arrived in
+    while (_frags_oldest != _frag_none && now > _frags[_frags_oldest].rx_time + _frag_timeout) {
+        frag_drop(_frags_oldest);
+        _frag_stats.timed_out++;
     }
-    if (_frags.size() != 0) {
-        frag_arm(now);
-    } else {
-        _frag_mem = 0;
+    if (_frags_oldest != _frag_none) {
+        frag_arm(_frags[_frags_oldest].rx_time);
     }
 }
 
-void ipv4::frag_drop(ipv4_frag_id frag_id, uint32_t dropped_size) {
-    _frags.erase(frag_id);
-    _frag_mem -= dropped_size;
+void ipv4::frag_drop(uint16_t idx) {
+    auto& frag = _frags[idx];
+    if (frag.older != _frag_none) {
+        _frags[frag.older].newer = frag.newer;
+    } else {
+        _frags_oldest = frag.newer;
+    }
+    if (frag.newer != _frag_none) {
+        _frags[frag.newer].older = frag.older;
+    } else {
+        _frags_newest = frag.older;
+    }
+    _frag_mem -= frag.mem_size;
+    frag.header = packet();
+    frag.data.map.clear();
+    frag.mem_size = 0;
+    frag.last_frag_received = false;
+    frag.newer = _frags_free;
+    _frags_free = idx;
+    _nr_frags--;
+
+    // Remove from the index, moving back the entries that probed past it
+    auto slot = frag.hash % _frag_index_size;
+    while (_frag_index[slot] != idx) {
+        slot = (slot + 1) % _frag_index_size;
+    }
+    auto next = slot;
+    for (;;) {
+        _frag_index[slot] = _frag_none;
+        uint32_t home;
+        // An entry can fill the hole unless its home slot lies cyclically
+        // in (slot, next]
+        do {
+            next = (next + 1) % _frag_index_size;
+            if (_frag_index[next] == _frag_none) {
+                return;
+            }
+            home = _frags[_frag_index[next]].hash % _frag_index_size;
+        } while (slot <= next ? (slot < home && home <= next) : (slot < home || home <= next));
+        _frag_index[slot] = _frag_index[next];
+        slot = next;
+    }
 }
 
 int32_t ipv4::frag::merge(ip_hdr &h, uint16_t offset, packet p) {
@@ -297,7 +297,6 @@ struct ip_packet_filter {
 };
 
 struct ipv4_frag_id {
-    struct hash;
     ipv4_address src_ip;
     ipv4_address dst_ip;
     uint16_t identification;
@@ -310,19 +309,6 @@ struct ipv4_frag_id {
     }
 };
 
-struct ipv4_frag_id::hash : private std::hash<ipv4_address>,
-    private std::hash<uint16_t>, private std::hash<uint8_t> {
-    size_t operator()(const ipv4_frag_id& id) const noexcept {
-        using h1 = std::hash<ipv4_address>;
-        using h2 = std::hash<uint16_t>;
-        using h3 = std::hash<uint8_t>;
-        return h1::operator()(id.src_ip) ^
-               h1::operator()(id.dst_ip) ^
-               h2::operator()(id.identification) ^
-               h3::operator()(id.protocol);
-    }
-};
-
 struct ipv4_tag {};
 using ipv4_packet_merger = packet_merger<uint32_t, ipv4_tag>;
 
@@ -349,23 +335,47 @@ class ipv4 {
     array_map<ip_protocol*, 256> _l4;
     ip_packet_filter * _packet_filter = nullptr;
     struct frag {
+        ipv4_frag_id id;
+        uint32_t hash;
         packet header;
         ipv4_packet_merger data;
         clock_type::time_point rx_time;
         uint32_t mem_size = 0;
         // fragment with MF == 0 inidates it is the last fragment
         bool last_frag_received = false;
+        // Neighbours in the age list, or next in the free list
+        uint16_t older;
+        uint16_t newer;
 
         packet get_assembled_packet(ethernet_address from, ethernet_address to);
         int32_t merge(ip_hdr &h, uint16_t offset, packet p);
         bool is_complete();
     };
-    std::unordered_map<ipv4_frag_id, frag, ipv4_frag_id::hash> _frags;
-    std::list<ipv4_frag_id> _frags_age;
-    static constexpr std::chrono::seconds _frag_timeout{30};
+    struct frag_stats {
+        uint64_t reassembled = 0;
+        uint64_t timed_out = 0;
+        uint64_t evicted = 0;
+    };
+    // Datagrams under reassembly live in _frags, which grows up to
+    // _frag_max entries and is then recycled through a free list.  They are
+    // found through _frag_index, an open-addressed (linear probing) table
+    // of indexes into _frags, and linked in arrival order, which is also the
+    // order they time out and are evicted in.
+    static constexpr uint16_t _frag_max{1024};
+    static constexpr uint16_t _frag_index_size{2 * _frag_max};
+    static constexpr uint16_t _frag_none{0xffff};
+    std::vector<frag> _frags;
+    std::vector<uint16_t> _frag_index;
+    uint16_t _frags_oldest{_frag_none};
+    uint16_t _frags_newest{_frag_none};
+    uint16_t _frags_free{_frag_none};
+    uint16_t _nr_frags{0};
+    uint64_t _frag_seed;
+    clock_type::duration _frag_timeout{std::chrono::seconds(30)};
     static constexpr uint32_t _frag_low_thresh{3 * 1024 * 1024};
     static constexpr uint32_t _frag_high_thresh{4 * 1024 * 1024};
     uint32_t _frag_mem{0};
+    frag_stats _frag_stats;
     timer<lowres_clock> _frag_timer;
     circular_buffer<l3_protocol::l3packet> _packetq;
     unsigned _pkt_provider_idx = 0;
@@ -375,16 +385,14 @@ class ipv4 {
     bool forward(forward_hash& out_hash_data, packet& p, size_t off);
     std::experimental::optional<l3_protocol::l3packet> get_packet();
     bool in_my_netmask(ipv4_address a) const;
-    void frag_limit_mem();
+    uint32_t frag_hash(const ipv4_frag_id& id) const;
+    uint16_t frag_find(const ipv4_frag_id& id);
+    uint16_t frag_insert(const ipv4_frag_id& id);
+    void frag_limit_mem(uint16_t keep);
     void frag_timeout();
-    void frag_drop(ipv4_frag_id frag_id, uint32_t dropped_size);
-    void frag_arm(clock_type::time_point now) {
-        auto tp = now + _frag_timeout;
-        _frag_timer.arm(tp);
-    }
-    void frag_arm() {
-        auto now = clock_type::now();
-        frag_arm(now);
+    void frag_drop(uint16_t idx);
+    void frag_arm(clock_type::time_point rx_time) {
+        _frag_timer.arm(rx_time + _frag_timeout);
     }
 public:
     explicit ipv4(interface* netif);
@@ -394,6 +402,9 @@ class ipv4 {
     ipv4_address gw_address() const;
     void set_netmask_address(ipv4_address ip);
     ipv4_address netmask_address() const;
+    // Partially received datagrams are dropped if their missing fragments
+    // do not arrive within the timeout (30 seconds by default).
+    void set_frag_timeout(clock_type::duration timeout);
     interface * netif() const {
         return _netif;
     }
@@ -0,0 +1,336 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "loopback.hh"
+#include "core/reactor.hh"
+#include "core/timer.hh"
+#include "core/metrics.hh"
+#include "core/print.hh"
+#include "ethernet.hh"
+#include "ip.hh"
+#include "offload.hh"
+#include "toeplitz.hh"
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace seastar {
+
+namespace net {
+
+namespace loopback {
+
+class device;
+
+class qp : public net::qp {
+    using clock_type = steady_clock_type;
+    // A frame on the simulated wire, waiting for its delivery time.
+    struct frame {
+        clock_type::time_point due;
+        uint64_t seq;       // keeps frames due at the same time in order
+        packet p;
+    };
+    struct later {
+        bool operator()(const frame& a, const frame& b) const {
+            return a.due > b.due || (a.due == b.due && a.seq > b.seq);
+        }
+    };
+    // Frames sent to other shards whose delivery has not completed yet;
+    // beyond that, frames are dropped as an overflowing rx ring would.
+    static constexpr unsigned max_cross_shard_frames = 1000;
+
+    device* _dev;
+    std::vector<frame> _wire;   // min-heap on (due, seq)
+    timer<> _wire_timer;
+    clock_type::time_point _link_free;
+    uint64_t _next_seq = 0;
+    std::default_random_engine _rnd{std::random_device()()};
+    std::uniform_real_distribution<double> _coin{0.0, 1.0};
+    std::vector<std::vector<packet>> _outgoing;   // per destination shard
+    unsigned _cross_shard_frames = 0;
+    uint64_t _dropped = 0;
+    bool _rx_started = false;
+public:
+    qp(device* dev, uint16_t qid);
+    virtual future<> send(packet p) override {
+        abort();
+    }
+    virtual uint32_t send(circular_buffer<packet>& p) override;
+    virtual void rx_start() override {
+        _rx_started = true;
+    }
+    void receive(std::vector<packet>& frames);
+private:
+    void segment(packet p, clock_type::time_point now);
+    void transmit(packet p, clock_type::time_point now);
+    void wire_timeout();
+    void route(packet p);
+    void flush();
+};
+
+class device : public net::device {
+    net::hw_features _hw_features;
+    std::chrono::microseconds _latency;
+    std::chrono::microseconds _reorder_delay;
+    double _loss;
+    double _reorder;
+    unsigned _bandwidth_mbps;
+public:
+    explicit device(boost::program_options::variables_map opts);
+    ethernet_address hw_address() override {
+        return { 0x12, 0x23, 0x34, 0x56, 0x67, 0x79 };
+    }
+    net::hw_features hw_features() override {
+        return _hw_features;
+    }
+    virtual uint16_t hw_queues_count() override {
+        return smp::count;
+    }
+    virtual std::unique_ptr<net::qp> init_local_queue(boost::program_options::variables_map opts, uint16_t qid) override {
+        return std::make_unique<qp>(this, qid);
+    }
+    qp& queue(unsigned cpu) {
+        return static_cast<qp&>(queue_for_cpu(cpu));
+    }
+    friend class qp;
+};
+
+static double probability_option(boost::program_options::variables_map& opts, const char* name) {
+    auto p = opts.count(name) ? opts[name].as<double>() : 0.0;
+    if (p < 0 || p > 1) {
+        throw std::invalid_argument(sprint("%s must be between 0 and 1", name));
+    }
+    return p;
+}
+
+device::device(boost::program_options::variables_map opts)
+    : _latency(opts.count("loopback-latency") ? opts["loopback-latency"].as<unsigned>() : 0)
+    , _loss(probability_option(opts, "loopback-loss"))
+    , _reorder(probability_option(opts, "loopback-reorder"))
+    , _bandwidth_mbps(opts.count("loopback-bandwidth") ? opts["loopback-bandwidth"].as<unsigned>() : 0) {
+    // A reordered frame is held back long enough to be overtaken by the
+    // frames sent after it.
+    _reorder_delay = std::max(_latency, std::chrono::microseconds(100));
+    // Both ends of the wire are this device, so checksums that are offloaded
+    // on transmit are also trusted on receive and never need computing.
+    auto csum = !(opts.count("csum-offload") && opts["csum-offload"].as<std::string>() == "off");
+    _hw_features.tx_csum_l4_offload = csum;
+    _hw_features.rx_csum_offload = csum;
+    _hw_features.tx_tso = csum && !(opts.count("tso") && opts["tso"].as<std::string>() == "off");
+    _hw_features.rx_lro = !(opts.count("lro") && opts["lro"].as<std::string>() == "off");
+    // Leave IP fragmentation to the stack, so that it gets exercised.
+    _hw_features.tx_ufo = false;
+}
+
+qp::qp(device* dev, uint16_t qid)
+    : net::qp(false, "network", qid)
+    , _dev(dev)
+    , _wire_timer([this] { wire_timeout(); })
+    , _link_free(clock_type::now())
+    , _outgoing(smp::count) {
+    namespace sm = metrics;
+    _metrics.add_group(_stats_plugin_name, {
+        sm::make_derive(_queue_name + "_loopback_dropped", _dropped,
+                        sm::description("Frames dropped by the loopback device, either on purpose (loopback-loss) or because the receiving shard was overloaded")),
+    });
+}
+
+uint32_t qp::send(circular_buffer<packet>& pkts) {
+    uint32_t sent = 0;
+    auto now = clock_type::now();
+    while (!pkts.empty()) {
+        auto p = std::move(pkts.front());
+        pkts.pop_front();
+        sent++;
+        _stats.tx.good.update_frags_stats(p.nr_frags(), p.len());
+        if (p.offload_info_ref().tso_seg_size && !_dev->_hw_features.rx_lro) {
+            segment(std::move(p), now);
+        } else {
+            // With LRO the receiver would coalesce the segments again, so a
+            // TSO frame is delivered as is.
+            transmit(std::move(p), now);
+        }
+    }
+    if (!_wire.empty()) {
+        _wire_timer.rearm(_wire.front().due);
+    }
+    flush();
+    return sent;
+}
+
+// Splits a TSO frame into MSS sized segments, as the sending NIC would.
+// Checksums are offloaded, and trusted on receive.
+void qp::segment(packet p, clock_type::time_point now) {
+    circular_buffer<packet> segments;
+    software_tso(std::move(p), true, segments);
+    for (auto&& seg : segments) {
+        transmit(std::move(seg), now);
+    }
+}
+
+void qp::transmit(packet p, clock_type::time_point now) {
+    if (_dev->_loss > 0 && _coin(_rnd) < _dev->_loss) {
+        _dropped++;
+        return;
+    }
+    auto due = now;
+    if (_dev->_bandwidth_mbps) {
+        // The queue's link serializes frames: one bit takes 1/Mbps microseconds.
+        auto start = std::max(now, _link_free);
+        _link_free = start + std::chrono::nanoseconds(uint64_t(p.len()) * 8 * 1000 / _dev->_bandwidth_mbps);
+        due = _link_free;
+    }
+    due += _dev->_latency;
+    if (_dev->_reorder > 0 && _coin(_rnd) < _dev->_reorder) {
+        due += _dev->_reorder_delay;
+    }
+    if (due <= now) {
+        route(std::move(p));
+        return;
+    }
+    _wire.push_back(frame{due, _next_seq++, std::move(p)});
+    std::push_heap(_wire.begin(), _wire.end(), later());
+}
+
+void qp::wire_timeout() {
+    auto now = clock_type::now();
+    while (!_wire.empty() && _wire.front().due <= now) {
+        std::pop_heap(_wire.begin(), _wire.end(), later());
+        route(std::move(_wire.back().p));
+        _wire.pop_back();
+    }
+    if (!_wire.empty()) {
+        _wire_timer.arm(_wire.front().due);
+    }
+    flush();
+}
+
+// Picks the receive queue the way an RSS capable NIC would, hashing the
+// same fields as the stack's software forwarding (ipv4::forward), so that
+// connections land on the shard that hash2cpu() predicts.
+void qp::route(packet p) {
+    unsigned dst = 0;
+    auto eh = p.get_header<eth_hdr>();
+    if (eh && ntoh(eh->eth_proto) == uint16_t(eth_protocol_num::ipv4)) {
+        auto iph = p.get_header<ip_hdr>(sizeof(eth_hdr));
+        if (iph) {
+            forward_hash data;
+            data.push_back(iph->src_ip.ip);
+            data.push_back(iph->dst_ip.ip);
+            auto h = ntoh(*iph);
+            if (!h.mf() && h.offset() == 0
+                    && (h.ip_proto == uint8_t(ip_protocol_num::tcp) || h.ip_proto == uint8_t(ip_protocol_num::udp))) {
+                // src_port, dst_port in network byte order, after any IP options
+                auto ports = p.get_header(sizeof(eth_hdr) + h.ihl * 4, 4);
+                if (ports) {
+                    for (unsigned i = 0; i < 4; i++) {
+                        data.push_back(uint8_t(ports[i]));
+                    }
+                }
+            }
+            auto hash = toeplitz_hash(_dev->rss_key(), data);
+            p.set_rss_hash(hash);
+            dst = _dev->hash2qid(hash);
+        }
+    }
+    // What the receiving NIC would report, not what the sender asked for.
+    p.set_offload_info(offload_info());
+    _outgoing[dst].push_back(std::move(p));
+}
+
+void qp::flush() {
+    auto src = engine().cpu_id();
+    for (unsigned cpu = 0; cpu < _outgoing.size(); cpu++) {
+        auto& frames = _outgoing[cpu];
+        if (frames.empty()) {
+            continue;
+        }
+        if (cpu == src) {
+            receive(frames);
+            frames.clear();
+            continue;
+        }
+        if (_cross_shard_frames >= max_cross_shard_frames) {
+            _dropped += frames.size();
+            frames.clear();
+            continue;
+        }
+        auto n = frames.size();
+        _cross_shard_frames += n;
+        smp::submit_to(cpu, [dev = _dev, src, frames = std::move(frames)] () mutable {
+            for (auto&& p : frames) {
+                p = p.free_on_cpu(src);
+            }
+            dev->queue(engine().cpu_id()).receive(frames);
+        }).then([this, n] {
+            _cross_shard_frames -= n;
+        });
+        frames = std::vector<packet>();
+    }
+}
+
+void qp::receive(std::vector<packet>& frames) {
+    if (!_rx_started) {
+        // No interface listens on this shard yet.
+        _dropped += frames.size();
+        return;
+    }
+    _stats.rx.good.update_pkts_bunch(frames.size());
+    for (auto&& p : frames) {
+        _stats.rx.good.update_frags_stats(p.nr_frags(), p.len());
+        _dev->l2receive(std::move(p));
+    }
+}
+
+}
+
+}
+
+boost::program_options::options_description
+get_loopback_net_options_description()
+{
+    boost::program_options::options_description opts(
+            "Loopback net options");
+    opts.add_options()
+        ("loopback-device",
+                "Use an in-process loopback device, whose sent frames are received back by the same host "
+                "(use with --dhcp 0 and a static address)")
+        ("loopback-latency",
+                boost::program_options::value<unsigned>()->default_value(0),
+                "One-way latency of the loopback device, in microseconds")
+        ("loopback-loss",
+                boost::program_options::value<double>()->default_value(0),
+                "Probability that the loopback device drops a frame")
+        ("loopback-reorder",
+                boost::program_options::value<double>()->default_value(0),
+                "Probability that the loopback device delays a frame behind the ones sent after it")
+        ("loopback-bandwidth",
+                boost::program_options::value<unsigned>()->default_value(0),
+                "Bandwidth of each loopback device queue, in Mbit/s (0 for unlimited)")
+        ;
+    return opts;
+}
+
+std::unique_ptr<net::device> create_loopback_net_device(boost::program_options::variables_map opts) {
+    return std::make_unique<net::loopback::device>(opts);
+}
+
+}
@@ -0,0 +1,39 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#ifndef LOOPBACK_HH_
+#define LOOPBACK_HH_
+
+#include <memory>
+#include "net.hh"
+
+namespace seastar {
+
+// An in-process device whose transmitted frames are received back by the
+// same device, on the queue an RSS capable NIC would pick for them.  It lets
+// the native stack run (e.g. in tests and benchmarks) without a vhost or
+// DPDK device, with optional latency, loss, reordering and bandwidth limits.
+std::unique_ptr<net::device> create_loopback_net_device(boost::program_options::variables_map opts = boost::program_options::variables_map());
+boost::program_options::options_description get_loopback_net_options_description();
+
+}
+
+#endif /* LOOPBACK_HH_ */
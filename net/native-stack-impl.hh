@@ -24,6 +24,7 @@
 
 #include "core/reactor.hh"
 #include "stack.hh"
+#include "tcp-congestion.hh"
 
 namespace seastar {
 
@@ -89,6 +90,7 @@ class native_connected_socket_impl : public connected_socket_impl {
     bool get_keepalive() const override;
     void set_keepalive_parameters(const keepalive_params&) override;
     keepalive_params get_keepalive_parameters() const override;
+    void set_congestion_control(const sstring& name) override;
 };
 
 template <typename Protocol>
@@ -229,6 +231,11 @@ keepalive_params native_connected_socket_impl<Protocol>::get_keepalive_parameter
     return tcp_keepalive_params {std::chrono::seconds(0), std::chrono::seconds(0), 0};
 }
 
+template <typename Protocol>
+void native_connected_socket_impl<Protocol>::set_congestion_control(const sstring& name) {
+    _conn->set_congestion_control(net::parse_tcp_congestion_algorithm(name));
+}
+
 }
 
 }
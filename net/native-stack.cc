@@ -27,6 +27,7 @@
 #include "tcp.hh"
 #include "udp.hh"
 #include "virtio.hh"
+#include "loopback.hh"
 #include "dpdk.hh"
 #include "proxy.hh"
 #include "dhcp.hh"
@@ -67,6 +68,9 @@ void create_native_net_device(boost::program_options::variables_map opts) {
     std::unique_ptr<device> dev;
 
     if ( deprecated_config_used) {
+        if (opts.count("loopback-device")) {
+            dev = create_loopback_net_device(opts);
+        } else
 #ifdef SEASTAR_HAVE_DPDK
         if ( opts.count("dpdk-pmd")) {
              dev = create_dpdk_net_device(opts["dpdk-port-index"].as<unsigned>(), smp::count,
@@ -176,6 +180,7 @@ native_network_stack::make_udp_channel(ipv4_addr addr) {
 void
 add_native_net_options_description(boost::program_options::options_description &opts) {
     opts.add(get_virtio_net_options_description());
+    opts.add(get_loopback_net_options_description());
 #ifdef SEASTAR_HAVE_DPDK
     opts.add(get_dpdk_net_options_description());
 #endif
@@ -184,7 +189,11 @@ add_native_net_options_description(boost::program_options::options_description &
 native_network_stack::native_network_stack(boost::program_options::variables_map opts, std::shared_ptr<device> dev)
     : _netif(std::move(dev))
     , _inet(&_netif) {
+    _netif.enable_software_offloads(opts["gso"].as<std::string>() == "on", opts["gro"].as<std::string>() == "on");
     _inet.get_udp().set_queue_size(opts["udpv4-queue-size"].as<int>());
+    _inet.get_tcp().set_congestion_control(parse_tcp_congestion_algorithm(opts["tcp-congestion-control"].as<std::string>()));
+    _inet.get_tcp().set_rto_min(std::chrono::milliseconds(opts["tcp-rto-min"].as<unsigned>()));
+    _inet.get_tcp().set_connection_metrics(opts["tcp-connection-metrics"].as<bool>());
     _dhcp = opts["host-ipv4-addr"].defaulted()
             && opts["gw-ipv4-addr"].defaulted()
             && opts["netmask-ipv4-addr"].defaulted() && opts["dhcp"].as<bool>();
@@ -307,6 +316,15 @@ boost::program_options::options_description nns_options() {
         ("udpv4-queue-size",
                 boost::program_options::value<int>()->default_value(ipv4_udp::default_queue_size),
                 "Default size of the UDPv4 per-channel packet queue")
+        ("tcp-congestion-control",
+                boost::program_options::value<std::string>()->default_value("reno"),
+                "TCP congestion control algorithm (reno, cubic, bbr)")
+        ("tcp-rto-min",
+                boost::program_options::value<unsigned>()->default_value(1000),
+                "Lower bound of the TCP retransmission timeout, in milliseconds")
+        ("tcp-connection-metrics",
+                boost::program_options::value<bool>()->default_value(false),
+                "Export congestion control metrics (cwnd, RTT, RTO, ...) of every TCP connection")
         ("dhcp",
                 boost::program_options::value<bool>()->default_value(true),
                         "Use DHCP discovery")
@@ -319,6 +337,12 @@ boost::program_options::options_description nns_options() {
         ("lro",
                 boost::program_options::value<std::string>()->default_value("on"),
                 "Enable LRO")
+        ("gso",
+                boost::program_options::value<std::string>()->default_value("on"),
+                "Segment TCP in software when the device has no TSO (on / off)")
+        ("gro",
+                boost::program_options::value<std::string>()->default_value("on"),
+                "Coalesce received TCP segments in software when the device has no LRO (on / off)")
         ;
 
     add_native_net_options_description(opts);
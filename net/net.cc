@@ -68,8 +68,8 @@ bool qp::poll_tx() {
                 auto p = pr();
                 if (p) {
                     work++;
-                    _tx_packetq.push_back(std::move(p.value()));
-                    if (_tx_packetq.size() == 128) {
+                    queue_tx(std::move(p.value()));
+                    if (_tx_packetq.size() >= 128) {
                         break;
                     }
                 }
@@ -84,6 +84,62 @@ bool qp::poll_tx() {
     return false;
 }
 
+void qp::queue_tx(packet p) {
+    if (_sw_tso && p.offload_info_ref().tso_seg_size) {
+        auto queued = _tx_packetq.size();
+        software_tso(std::move(p), !_sw_l4_csum, _tx_packetq);
+        _stats.tx.gso_segments += _tx_packetq.size() - queued;
+        return;
+    }
+    if (_sw_l4_csum) {
+        software_l4_csum(p);
+    }
+    _tx_packetq.push_back(std::move(p));
+}
+
+void qp::l2receive(packet p) {
+    if (!_gro) {
+        _rx_stream.produce(std::move(p));
+        return;
+    }
+    _stats.rx.gro_merged += _gro->add(std::move(p));
+    if (_gro->full()) {
+        flush_gro();
+    }
+}
+
+bool qp::flush_gro() {
+    if (_gro->empty()) {
+        return false;
+    }
+    _gro->flush([this] (packet p) {
+        _rx_stream.produce(std::move(p));
+    });
+    return true;
+}
+
+void qp::enable_software_offloads(bool tso, bool l4_csum, bool gro) {
+    namespace sm = metrics;
+    _sw_tso = tso;
+    _sw_l4_csum = l4_csum;
+    if (tso) {
+        _metrics.add_group(_stats_plugin_name, {
+            sm::make_derive(_queue_name + "_tx_gso_segments", _stats.tx.gso_segments,
+                        sm::description("Counts a number of packets produced by splitting TSO packets in software.")),
+        });
+    }
+    if (gro && !_gro) {
+        _gro.emplace();
+        // Frames received in one poll are coalesced, and handed to the
+        // stack once the device has nothing more to deliver right away.
+        _gro_poller = reactor::poller::simple([this] { return flush_gro(); });
+        _metrics.add_group(_stats_plugin_name, {
+            sm::make_derive(_queue_name + "_rx_gro_merged", _stats.rx.gro_merged,
+                        sm::description(format("Counts a number of received packets that software GRO appended to a previous one. Compare this value to a {} to get the coalescing ratio.", _queue_name + "_rx_packets"))),
+        });
+    }
+}
+
 qp::qp(bool register_copy_stats,
        const std::string stats_plugin_name, uint8_t qid)
         : _tx_poller(reactor::poller::simple([this] { return poll_tx(); }))
@@ -261,6 +317,22 @@ interface::interface(std::shared_ptr<device> dev)
         });
 }
 
+void interface::enable_software_offloads(bool gso, bool gro) {
+    gso = gso && !_hw_features.tx_tso;
+    // Coalesced segments cannot have their checksums verified anymore, so
+    // GRO relies on the device having done it.
+    gro = gro && !_hw_features.rx_lro && _hw_features.rx_csum_offload;
+    if (!gso && !gro) {
+        return;
+    }
+    _dev->local_queue().enable_software_offloads(gso, gso && !_hw_features.tx_csum_l4_offload, gro);
+    if (gso) {
+        // The upper layers only build TSO frames with checksum offload
+        _hw_features.tx_tso = true;
+        _hw_features.tx_csum_l4_offload = true;
+    }
+}
+
 subscription<packet, ethernet_address>
 interface::register_l3(eth_protocol_num proto_num,
         std::function<future<> (packet p, ethernet_address from)> next,
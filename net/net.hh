@@ -31,6 +31,7 @@
 #include "ethernet.hh"
 #include "packet.hh"
 #include "const.hh"
+#include "offload.hh"
 #include <unordered_map>
 
 namespace seastar {
@@ -135,6 +136,8 @@ class interface {
     }
     uint16_t hw_queues_count();
     const rss_key_type& rss_key() const;
+    // Makes up in software for TSO (gso) and LRO (gro) the device lacks.
+    void enable_software_offloads(bool gso, bool gro);
     friend class l3_protocol;
 };
 
@@ -203,11 +206,13 @@ struct qp_stats {
             uint64_t total;        // total number of erroneous packets
             uint64_t csum;         // packets with bad checksum
         } bad;
+        uint64_t gro_merged;       // packets coalesced by software GRO
     } rx;
 
     struct {
         struct qp_stats_good good;
         uint64_t linearized;       // number of packets that were linearized
+        uint64_t gso_segments;     // packets produced by software TSO
     } tx;
 };
 
@@ -219,6 +224,11 @@ class qp {
     stream<packet> _rx_stream;
     reactor::poller _tx_poller;
     circular_buffer<packet> _tx_packetq;
+    // Software offloads, for what the device lacks
+    bool _sw_tso = false;
+    bool _sw_l4_csum = false;
+    std::experimental::optional<software_gro> _gro;
+    std::experimental::optional<reactor::poller> _gro_poller;
 
 protected:
     const std::string _stats_plugin_name;
@@ -252,6 +262,13 @@ class qp {
         _pkt_providers.push_back(std::move(func));
     }
     bool poll_tx();
+    // Segments TSO frames (and computes their TCP checksums if l4_csum) on
+    // transmit, and coalesces received TCP segments if gro.
+    void enable_software_offloads(bool tso, bool l4_csum, bool gro);
+    void l2receive(packet p);
+private:
+    void queue_tx(packet p);
+    bool flush_gro();
     friend class device;
 };
 
@@ -266,7 +283,7 @@ class device {
     virtual ~device() {};
     qp& queue_for_cpu(unsigned cpu) { return *_queues[cpu]; }
     qp& local_queue() { return queue_for_cpu(engine().cpu_id()); }
-    void l2receive(packet p) { _queues[engine().cpu_id()]->_rx_stream.produce(std::move(p)); }
+    void l2receive(packet p) { _queues[engine().cpu_id()]->l2receive(std::move(p)); }
     subscription<packet> receive(std::function<future<> (packet)> next_packet);
     virtual ethernet_address hw_address() = 0;
     virtual net::hw_features hw_features() = 0;
@@ -0,0 +1,252 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "offload.hh"
+#include "core/byteorder.hh"
+#include "ethernet.hh"
+#include "ip.hh"
+#include "ip_checksum.hh"
+#include "tcp.hh"
+#include <algorithm>
+#include <array>
+
+namespace seastar {
+
+namespace net {
+
+constexpr unsigned software_gro::max_flows;
+constexpr unsigned software_gro::max_entries;
+
+static constexpr size_t ip_off = sizeof(eth_hdr);
+static constexpr uint8_t tcp_fin = 0x01;
+static constexpr uint8_t tcp_psh = 0x08;
+static constexpr uint8_t tcp_ack = 0x10;
+
+// Sums the packet from offset on.
+static uint16_t checksum_from(const packet& p, size_t offset) {
+    checksummer csum;
+    for (auto&& f : p.fragments()) {
+        if (offset >= f.size) {
+            offset -= f.size;
+            continue;
+        }
+        csum.sum(f.base + offset, f.size - offset);
+        offset = 0;
+    }
+    return csum.get();
+}
+
+static void write_ip_checksum(char* iph) {
+    write_be<uint16_t>(iph + 10, 0);
+    auto csum = ip_checksum(iph, (uint8_t(iph[0]) & 0xf) * 4);
+    std::copy_n(reinterpret_cast<const char*>(&csum), sizeof(csum), iph + 10);
+}
+
+void software_tso(packet p, bool l4_csum_offload, circular_buffer<packet>& out) {
+    auto mss = p.offload_info_ref().tso_seg_size;
+    p.offload_info_ref().tso_seg_size = 0;
+    auto iph = p.get_header<ip_hdr>(ip_off);
+    if (!iph) {
+        out.push_back(std::move(p));
+        return;
+    }
+    size_t ip_len = iph->ihl * 4;
+    auto th = p.get_header(ip_off + ip_len, tcp_hdr::len);
+    if (!th) {
+        out.push_back(std::move(p));
+        return;
+    }
+    size_t tcp_len = (uint8_t(th[12]) >> 4) * 4;
+    size_t hdr_len = ip_off + ip_len + tcp_len;
+    auto hdr = p.get_header(0, hdr_len);
+    if (!hdr) {
+        out.push_back(std::move(p));
+        return;
+    }
+    std::array<char, sizeof(eth_hdr) + 60 + 60> headers;
+    std::copy_n(hdr, hdr_len, headers.begin());
+    auto tcp_off = ip_off + ip_len;
+    auto id = read_be<uint16_t>(hdr + ip_off + 4);
+    auto seq = read_be<uint32_t>(hdr + tcp_off + 4);
+    auto flags = uint8_t(hdr[tcp_off + 13]);
+
+    auto payload = p.len() - hdr_len;
+    for (size_t off = 0; off < payload; off += mss) {
+        auto len = std::min<size_t>(mss, payload - off);
+        auto seg = p.share(hdr_len + off, len);
+        auto h = seg.prepend_uninitialized_header(hdr_len);
+        std::copy_n(headers.begin(), hdr_len, h);
+        write_be<uint16_t>(h + ip_off + 2, ip_len + tcp_len + len);
+        write_be<uint16_t>(h + ip_off + 4, id++);
+        write_ip_checksum(h + ip_off);
+        write_be<uint32_t>(h + tcp_off + 4, seq + off);
+        if (off + len < payload) {
+            h[tcp_off + 13] = flags & ~(tcp_fin | tcp_psh);
+        }
+        // The checksum of the TSO frame covers a pseudo header with a zero
+        // length; each segment needs one with its own length.
+        checksummer csum;
+        csum.sum(h + ip_off + 12, 8);
+        csum.sum_many(uint8_t(0), uint8_t(ip_protocol_num::tcp), uint16_t(tcp_len + len));
+        uint16_t pseudo = ~csum.get();
+        std::copy_n(reinterpret_cast<const char*>(&pseudo), sizeof(pseudo), h + tcp_off + 16);
+        seg.offload_info_ref().needs_csum = true;
+        if (!l4_csum_offload) {
+            software_l4_csum(seg);
+        }
+        out.push_back(std::move(seg));
+    }
+}
+
+void software_l4_csum(packet& p) {
+    auto& oi = p.offload_info_ref();
+    if (!oi.needs_csum) {
+        return;
+    }
+    oi.needs_csum = false;
+    size_t csum_off;
+    if (oi.protocol == ip_protocol_num::tcp) {
+        csum_off = 16;
+    } else if (oi.protocol == ip_protocol_num::udp) {
+        csum_off = 6;
+    } else {
+        return;
+    }
+    auto iph = p.get_header<ip_hdr>(ip_off);
+    if (!iph) {
+        return;
+    }
+    auto l4_off = ip_off + iph->ihl * 4;
+    auto field = p.get_header(l4_off + csum_off, sizeof(uint16_t));
+    if (!field) {
+        return;
+    }
+    // The field holds the sum of the pseudo header, so summing the whole
+    // l4 packet gives the checksum.
+    auto csum = checksum_from(p, l4_off);
+    if (oi.protocol == ip_protocol_num::udp && csum == 0) {
+        // A zero UDP checksum means "no checksum"
+        csum = 0xffff;
+    }
+    std::copy_n(reinterpret_cast<const char*>(&csum), sizeof(csum), field);
+}
+
+software_gro::entry software_gro::make_entry(packet p) {
+    entry e;
+    e.p = std::move(p);
+    auto eh = e.p.get_header(0, sizeof(eth_hdr));
+    if (!eh || read_be<uint16_t>(eh + 12) != uint16_t(eth_protocol_num::ipv4)) {
+        return e;
+    }
+    // Only plain IPv4 headers, so that frames can be compared byte by byte
+    auto iph = e.p.get_header(ip_off, ipv4_hdr_len_min);
+    if (!iph || uint8_t(iph[0]) != 0x45 || uint8_t(iph[9]) != uint8_t(ip_protocol_num::tcp)) {
+        return e;
+    }
+    auto tcp_off = ip_off + ipv4_hdr_len_min;
+    auto th = e.p.get_header(tcp_off, tcp_hdr::len);
+    if (!th) {
+        return e;
+    }
+    size_t hdr_len = tcp_off + (uint8_t(th[12]) >> 4) * 4;
+    auto hdr = e.p.get_header(0, hdr_len);
+    if (!hdr) {
+        return e;
+    }
+    e.hdr_len = hdr_len;
+    auto ip_len = read_be<uint16_t>(hdr + ip_off + 2);
+    auto flags = uint8_t(hdr[tcp_off + 13]);
+    bool fragment = read_be<uint16_t>(hdr + ip_off + 6) & 0x3fff;
+    // Frames padded to the Ethernet minimum are left alone as well
+    if (fragment || ip_off + ip_len != e.p.len() || ip_off + ip_len <= hdr_len
+            || (flags & ~tcp_psh) != tcp_ack) {
+        return e;
+    }
+    e.seg_size = e.p.len() - hdr_len;
+    e.next_seq = read_be<uint32_t>(hdr + tcp_off + 4) + e.seg_size;
+    e.open = !(flags & tcp_psh);
+    return e;
+}
+
+static bool same_flow(const char* a, const char* b) {
+    constexpr auto tcp_off = ip_off + ipv4_hdr_len_min;
+    return std::equal(a, a + sizeof(eth_hdr), b)
+            && std::equal(a + ip_off + 12, a + ip_off + 20, b + ip_off + 12)
+            && std::equal(a + tcp_off, a + tcp_off + 4, b + tcp_off);
+}
+
+bool software_gro::merge(entry& e, entry& seg) {
+    constexpr auto tcp_off = ip_off + ipv4_hdr_len_min;
+    auto len = seg.p.len() - seg.hdr_len;
+    if (!e.open || !seg.seg_size || seg.hdr_len != e.hdr_len || len > e.seg_size
+            || e.p.len() - ip_off + len > ip_packet_len_max) {
+        return false;
+    }
+    auto h = e.p.get_header(0, e.hdr_len);
+    auto sh = seg.p.get_header(0, seg.hdr_len);
+    // Everything but the IP id and checksums, the sequence number and PSH
+    // must match: same TOS, TTL, ACK, window and TCP options.
+    if (read_be<uint32_t>(sh + tcp_off + 4) != e.next_seq
+            || !std::equal(h + ip_off, h + ip_off + 2, sh + ip_off)
+            || !std::equal(h + ip_off + 8, h + ip_off + 10, sh + ip_off + 8)
+            || !std::equal(h + tcp_off + 8, h + tcp_off + 13, sh + tcp_off + 8)
+            || !std::equal(h + tcp_off + 14, h + tcp_off + 16, sh + tcp_off + 14)
+            || !std::equal(h + tcp_off + 18, h + e.hdr_len, sh + tcp_off + 18)) {
+        return false;
+    }
+    auto flags = uint8_t(sh[tcp_off + 13]);
+    seg.p.trim_front(seg.hdr_len);
+    e.p.append(std::move(seg.p));
+    // append() may have moved the headers
+    h = e.p.get_header(0, e.hdr_len);
+    write_be<uint16_t>(h + ip_off + 2, e.p.len() - ip_off);
+    write_ip_checksum(h + ip_off);
+    h[tcp_off + 13] |= flags & tcp_psh;
+    e.next_seq += len;
+    e.open = !(flags & tcp_psh) && len == e.seg_size;
+    return true;
+}
+
+bool software_gro::add(packet p) {
+    auto seg = make_entry(std::move(p));
+    if (seg.hdr_len) {
+        auto sh = seg.p.get_header(0, seg.hdr_len);
+        auto n = std::min<size_t>(_entries.size(), max_flows);
+        for (auto i = _entries.end(); n--;) {
+            auto& e = *--i;
+            if (!e.hdr_len || !same_flow(e.p.get_header(0, e.hdr_len), sh)) {
+                continue;
+            }
+            if (merge(e, seg)) {
+                return true;
+            }
+            // Later segments of the flow must not overtake this one
+            e.open = false;
+            break;
+        }
+    }
+    _entries.push_back(std::move(seg));
+    return false;
+}
+
+}
+
+}
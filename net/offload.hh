@@ -0,0 +1,91 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include "core/circular_buffer.hh"
+#include "packet.hh"
+#include <vector>
+
+namespace seastar {
+
+namespace net {
+
+// Software versions of the offloads a NIC may lack, working on Ethernet
+// frames at the queue boundary, so the stack above can behave as if the
+// NIC had them.
+
+// Splits a TSO frame (offload_info::tso_seg_size) into frames of at most
+// tso_seg_size bytes of TCP payload, which share the payload with the
+// original one.  With l4_csum_offload the TCP checksum of the frames is
+// left for the NIC to compute, otherwise it is computed here.
+void software_tso(packet p, bool l4_csum_offload, circular_buffer<packet>& out);
+
+// Computes the TCP or UDP checksum a frame asks the NIC for
+// (offload_info::needs_csum).
+void software_l4_csum(packet& p);
+
+// Coalesces the in-order TCP segments of a flow received in one batch into
+// a single frame, as LRO would.  Checksums are not verified, so it is only
+// correct for frames whose checksums the NIC has verified.
+class software_gro {
+    struct entry {
+        packet p;
+        // Length of the Ethernet, IP and TCP headers; 0 if p is not a TCP
+        // segment over IPv4
+        uint16_t hdr_len = 0;
+        // Payload size of the first segment; a shorter one ends the frame
+        uint16_t seg_size = 0;
+        uint32_t next_seq = 0;
+        // Whether the following segment of the flow may be appended
+        bool open = false;
+    };
+    // Entries searched for the flow of a segment, from the latest one
+    static constexpr unsigned max_flows = 8;
+    // Entries held before the batch must be flushed
+    static constexpr unsigned max_entries = 64;
+    std::vector<entry> _entries;
+public:
+    // Holds a received frame, appending its payload to the frame of the
+    // previous segment of its flow when possible.  Returns whether it was
+    // merged.  The order of the frames of a flow is preserved.
+    bool add(packet p);
+    bool empty() const {
+        return _entries.empty();
+    }
+    bool full() const {
+        return _entries.size() >= max_entries;
+    }
+    template <typename Func>
+    void flush(Func&& func) {
+        for (auto& e : _entries) {
+            func(std::move(e.p));
+        }
+        _entries.clear();
+    }
+private:
+    static entry make_entry(packet p);
+    static bool merge(entry& e, entry& seg);
+};
+
+}
+
+}
@@ -23,8 +23,10 @@
 #include "net.hh"
 #include "packet.hh"
 #include "api.hh"
+#include "core/file-impl.hh"
 #include <netinet/tcp.h>
 #include <netinet/sctp.h>
+#include <linux/errqueue.h>
 
 namespace seastar {
 
@@ -63,6 +65,9 @@ class posix_connected_socket_operations<transport::TCP> {
             _fd.getsockopt<unsigned>(IPPROTO_TCP, TCP_KEEPCNT)
         };
     }
+    void set_congestion_control(file_desc& _fd, const sstring& name) {
+        _fd.setsockopt(IPPROTO_TCP, TCP_CONGESTION, name.c_str());
+    }
 };
 
 template <>
@@ -100,6 +105,9 @@ class posix_connected_socket_operations<transport::SCTP> {
             params.spp_pathmaxrxt
         };
     }
+    void set_congestion_control(file_desc& _fd, const sstring& name) {
+        // SCTP has no pluggable congestion control
+    }
 };
 
 template <transport Transport>
@@ -107,6 +115,8 @@ class posix_connected_socket_impl final : public connected_socket_impl, posix_co
     lw_shared_ptr<pollable_fd> _fd;
     using _ops = posix_connected_socket_operations<Transport>;
     conntrack::handle _handle;
+    lw_shared_ptr<zero_copy_tracker> _zero_copy;
+    size_t _zero_copy_threshold = 0;
 private:
     explicit posix_connected_socket_impl(lw_shared_ptr<pollable_fd> fd) : _fd(std::move(fd)) {}
     explicit posix_connected_socket_impl(lw_shared_ptr<pollable_fd> fd, conntrack::handle&& handle)
@@ -116,6 +126,9 @@ class posix_connected_socket_impl final : public connected_socket_impl, posix_co
         return data_source(std::make_unique< posix_data_source_impl>(_fd));
     }
     virtual data_sink sink() override {
+        if (_zero_copy_threshold) {
+            return data_sink(std::make_unique<posix_data_sink_impl>(_fd, _zero_copy, _zero_copy_threshold));
+        }
         return data_sink(std::make_unique< posix_data_sink_impl>(_fd));
     }
     virtual void shutdown_input() override {
@@ -142,6 +155,24 @@ class posix_connected_socket_impl final : public connected_socket_impl, posix_co
     keepalive_params get_keepalive_parameters() const override {
         return _ops::get_keepalive_parameters(_fd->get_file_desc());
     }
+    void set_congestion_control(const sstring& name) override {
+        return _ops::set_congestion_control(_fd->get_file_desc(), name);
+    }
+    void set_zero_copy_threshold(size_t bytes) override {
+        if (Transport != transport::TCP) {
+            return;
+        }
+        if (bytes && !_zero_copy) {
+            try {
+                _fd->get_file_desc().setsockopt(SOL_SOCKET, SO_ZEROCOPY, 1);
+            } catch (std::system_error&) {
+                // Not supported by the kernel; keep copying.
+                return;
+            }
+            _zero_copy = make_lw_shared<zero_copy_tracker>(_fd);
+        }
+        _zero_copy_threshold = bytes;
+    }
     friend class posix_server_socket_impl<Transport>;
     friend class posix_ap_server_socket_impl<Transport>;
     friend class posix_reuseport_server_socket_impl<Transport>;
@@ -203,6 +234,31 @@ posix_server_socket_impl<Transport>::accept() {
     });
 }
 
+template <transport Transport>
+future<std::vector<std::pair<connected_socket, socket_address>>>
+posix_server_socket_impl<Transport>::accept_batch() {
+    return _lfd.accept_batch().then([this] (std::vector<std::pair<pollable_fd, socket_address>> fds) {
+        std::vector<std::pair<connected_socket, socket_address>> ret;
+        for (auto&& c : fds) {
+            auto cth = _conntrack.get_handle();
+            auto cpu = cth.cpu();
+            if (cpu == engine().cpu_id()) {
+                std::unique_ptr<connected_socket_impl> csi(
+                        new posix_connected_socket_impl<Transport>(make_lw_shared(std::move(c.first)), std::move(cth)));
+                ret.emplace_back(connected_socket(std::move(csi)), c.second);
+            } else {
+                smp::submit_to(cpu, [ssa = _sa, fd = std::move(c.first.get_file_desc()), sa = c.second, cth = std::move(cth)] () mutable {
+                    posix_ap_server_socket_impl<Transport>::move_connected_socket(ssa, pollable_fd(std::move(fd)), sa, std::move(cth));
+                });
+            }
+        }
+        if (ret.empty()) {
+            return accept_batch();
+        }
+        return make_ready_future<std::vector<std::pair<connected_socket, socket_address>>>(std::move(ret));
+    });
+}
+
 template <transport Transport>
 void
 posix_server_socket_impl<Transport>::abort_accept() {
@@ -233,6 +289,26 @@ future<connected_socket, socket_address> posix_ap_server_socket_impl<Transport>:
     }
 }
 
+template <transport Transport>
+future<std::vector<std::pair<connected_socket, socket_address>>>
+posix_ap_server_socket_impl<Transport>::accept_batch() {
+    return accept().then([this] (connected_socket cs, socket_address sa) {
+        std::vector<std::pair<connected_socket, socket_address>> ret;
+        ret.emplace_back(std::move(cs), sa);
+        // Take whatever other shards have handed over in the meantime.
+        auto conni = conn_q.find(_sa.as_posix_sockaddr_in());
+        while (conni != conn_q.end()) {
+            connection c = std::move(conni->second);
+            conn_q.erase(conni);
+            std::unique_ptr<connected_socket_impl> csi(
+                    new posix_connected_socket_impl<Transport>(make_lw_shared(std::move(c.fd))));
+            ret.emplace_back(connected_socket(std::move(csi)), std::move(c.addr));
+            conni = conn_q.find(_sa.as_posix_sockaddr_in());
+        }
+        return ret;
+    });
+}
+
 template <transport Transport>
 void
 posix_ap_server_socket_impl<Transport>::abort_accept() {
@@ -255,6 +331,21 @@ posix_reuseport_server_socket_impl<Transport>::accept() {
     });
 }
 
+template <transport Transport>
+future<std::vector<std::pair<connected_socket, socket_address>>>
+posix_reuseport_server_socket_impl<Transport>::accept_batch() {
+    return _lfd.accept_batch().then([] (std::vector<std::pair<pollable_fd, socket_address>> fds) {
+        std::vector<std::pair<connected_socket, socket_address>> ret;
+        ret.reserve(fds.size());
+        for (auto&& c : fds) {
+            std::unique_ptr<connected_socket_impl> csi(
+                    new posix_connected_socket_impl<Transport>(make_lw_shared(std::move(c.first))));
+            ret.emplace_back(connected_socket(std::move(csi)), c.second);
+        }
+        return ret;
+    });
+}
+
 template <transport Transport>
 void
 posix_reuseport_server_socket_impl<Transport>::abort_accept() {
@@ -311,23 +402,208 @@ std::vector<iovec> to_iovec(std::vector<temporary_buffer<char>>& buf_vec) {
     return v;
 }
 
+void zero_copy_tracker::hold(packet p) {
+    _held.push_back(std::move(p));
+    ++_outstanding;
+    ++engine()._io_stats.zero_copy_sends;
+    if (!_reaping) {
+        _reaping = true;
+        reap();
+    }
+}
+
+void zero_copy_tracker::reap() {
+    // Runs in the background, until every send has completed; the sink's
+    // close() waits for it through _reaper, and stop() cuts it short.
+    with_gate(_reaper, [self = shared_from_this()] {
+        return repeat([self] {
+            if (self->_stopped) {
+                self->release_all();
+            }
+            self->drain_errqueue();
+            if (!self->_outstanding) {
+                self->_reaping = false;
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return self->_fd->readable_errqueue().then([] {
+                return stop_iteration::no;
+            });
+        }).handle_exception([self] (std::exception_ptr ep) {
+            self->release_all();
+            self->_reaping = false;
+        });
+    });
+}
+
+future<> zero_copy_tracker::close() {
+    if (_reaper.is_closed()) {
+        return make_ready_future<>();
+    }
+    return _reaper.close();
+}
+
+void zero_copy_tracker::stop() {
+    _stopped = true;
+    _fd->abort_errqueue_reader(std::make_exception_ptr(std::system_error(ECONNABORTED, std::system_category())));
+}
+
+void zero_copy_tracker::release_all() {
+    // The kernel pins the pages it sends from, so letting go of them
+    // early cannot corrupt memory; at worst it sends reused contents
+    // on a socket that is failing or abandoned anyway.
+    while (!_held.empty()) {
+        _held.pop_front();
+        ++_first_id;
+    }
+    _outstanding = 0;
+}
+
+void zero_copy_tracker::drain_errqueue() {
+    while (_outstanding) {
+        char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+        msghdr mh = {};
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        if (!_fd->get_file_desc().recvmsg(&mh, MSG_ERRQUEUE)) {
+            return;
+        }
+        for (auto cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            auto ee = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+            if (ee->ee_errno == 0 && ee->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                // A range of send numbers; the kernel may also have fallen
+                // back to copying (e.g. over loopback), which only matters
+                // for tuning.
+                if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    engine()._io_stats.zero_copy_copied += ee->ee_data - ee->ee_info + 1;
+                }
+                release(ee->ee_info, ee->ee_data);
+            }
+        }
+    }
+}
+
+void zero_copy_tracker::release(uint32_t first, uint32_t last) {
+    for (uint32_t id = first; ; ++id) {
+        uint32_t idx = id - _first_id;
+        if (idx < _held.size() && _held[idx]) {
+            _held[idx].reset();
+            --_outstanding;
+            ++engine()._io_stats.zero_copy_completions;
+        }
+        if (id == last) {
+            break;
+        }
+    }
+    // Completions usually arrive in order; keep the ones that did not
+    // until the sends before them complete.
+    while (!_held.empty() && !_held.front()) {
+        _held.pop_front();
+        ++_first_id;
+    }
+}
+
+bool
+posix_data_sink_impl::wants_zero_copy(const packet& p) const {
+    if (!_zero_copy) {
+        return false;
+    }
+    auto frags = p.fragments();
+    return std::any_of(frags.begin(), frags.end(), [this] (const fragment& f) {
+        return f.size >= _zero_copy_threshold;
+    });
+}
+
+future<>
+posix_data_sink_impl::put_zero_copy() {
+    return _fd->write_some(_p, MSG_ZEROCOPY).then_wrapped([this] (future<size_t> f) {
+        size_t n;
+        try {
+            n = f.get0();
+        } catch (std::system_error& e) {
+            if (e.code().value() != ENOBUFS) {
+                throw;
+            }
+            // Too many notifications are pending; copy this one instead.
+            return _fd->write_all(_p);
+        }
+        _zero_copy->hold(_p.share());
+        if (n == _p.len()) {
+            return make_ready_future<>();
+        }
+        _p.trim_front(n);
+        return put_zero_copy();
+    });
+}
+
 future<>
 posix_data_sink_impl::put(temporary_buffer<char> buf) {
+    if (_zero_copy && buf.size() >= _zero_copy_threshold) {
+        return put(packet(std::move(buf)));
+    }
     return _fd->write_all(buf.get(), buf.size()).then([d = buf.release()] {});
 }
 
 future<>
 posix_data_sink_impl::put(packet p) {
     _p = std::move(p);
+    if (wants_zero_copy(_p)) {
+        return put_zero_copy().then([this] { _p.reset(); });
+    }
     return _fd->write_all(_p).then([this] { _p.reset(); });
 }
 
+// Only files backed by a file descriptor can be handed to sendfile(2), and
+// not O_DIRECT ones: sendfile(2) reads through the page cache, which
+// O_DIRECT files bypass, and rejects or mishandles their unaligned tails.
+bool
+posix_data_sink_impl::can_send_file(const file& f) const {
+    auto impl = posix_file_impl::from_file(f);
+    if (!impl) {
+        return false;
+    }
+    auto flags = ::fcntl(impl->_fd, F_GETFL);
+    return flags != -1 && !(flags & O_DIRECT);
+}
+
+future<>
+posix_data_sink_impl::send_file(const file& f, uint64_t pos, size_t len) {
+    auto in_fd = posix_file_impl::from_file(f)->_fd;
+    return do_with(pos, len, [this, in_fd] (uint64_t& pos, size_t& len) {
+        return do_until([&len] { return len == 0; }, [this, in_fd, &pos, &len] {
+            return _fd->sendfile(in_fd, pos, len).then([&pos, &len] (size_t n) {
+                if (!n) {
+                    throw std::system_error(EINVAL, std::system_category(), "send_file: range extends past the end of the file");
+                }
+                pos += n;
+                len -= n;
+            });
+        });
+    });
+}
+
 future<>
 posix_data_sink_impl::close() {
     _fd->shutdown(SHUT_WR);
+    if (_zero_copy) {
+        // The data is acknowledged, and the sends complete, after the FIN
+        // has been queued.
+        return _zero_copy->close();
+    }
     return make_ready_future<>();
 }
 
+posix_data_sink_impl::~posix_data_sink_impl() {
+    // Unless close() already waited for them, the sends are not waited for,
+    // so that the socket does not outlive its users.
+    if (_zero_copy) {
+        _zero_copy->stop();
+    }
+}
+
 server_socket
 posix_network_stack::listen(socket_address sa, listen_options opt) {
     if (opt.proto == transport::TCP) {
@@ -375,28 +651,54 @@ struct cmsg_with_pktinfo {
 class posix_udp_channel : public udp_channel_impl {
 private:
     static constexpr int MAX_DATAGRAM_SIZE = 65507;
+    // Datagrams read by a single recvmmsg(), at most.
+    static constexpr unsigned RECV_BATCH = 8;
     struct recv_ctx {
-        struct msghdr _hdr;
-        struct iovec _iov;
-        socket_address _src_addr;
-        char* _buffer;
-        cmsg_with_pktinfo _cmsg;
+        std::array<struct mmsghdr, RECV_BATCH> _hdrs;
+        std::array<struct iovec, RECV_BATCH> _iovs;
+        std::array<socket_address, RECV_BATCH> _src_addrs;
+        std::array<char*, RECV_BATCH> _buffers;
+        std::array<cmsg_with_pktinfo, RECV_BATCH> _cmsgs;
+        // Each slot holds a buffer for the largest datagram, so the batch
+        // starts with a single one and only grows on channels that receive
+        // datagrams faster than they are read.
+        unsigned _batch = 1;
 
         recv_ctx() {
-            memset(&_hdr, 0, sizeof(_hdr));
-            _hdr.msg_iov = &_iov;
-            _hdr.msg_iovlen = 1;
-            _hdr.msg_name = &_src_addr.u.sa;
-            _hdr.msg_namelen = sizeof(_src_addr.u.sas);
-            memset(&_cmsg, 0, sizeof(_cmsg));
-            _hdr.msg_control = &_cmsg;
-            _hdr.msg_controllen = sizeof(_cmsg);
+            memset(_hdrs.data(), 0, sizeof(_hdrs));
+            memset(_cmsgs.data(), 0, sizeof(_cmsgs));
+            _buffers.fill(nullptr);
+            for (unsigned i = 0; i < RECV_BATCH; ++i) {
+                auto& hdr = _hdrs[i].msg_hdr;
+                hdr.msg_iov = &_iovs[i];
+                hdr.msg_iovlen = 1;
+                hdr.msg_name = &_src_addrs[i].u.sa;
+                hdr.msg_control = &_cmsgs[i];
+            }
+        }
+        ~recv_ctx() {
+            for (auto buffer : _buffers) {
+                delete[] buffer;
+            }
         }
 
+        // Buffers of received datagrams are handed over with them, so only
+        // those need replacing.
         void prepare() {
-            _buffer = new char[MAX_DATAGRAM_SIZE];
-            _iov.iov_base = _buffer;
-            _iov.iov_len = MAX_DATAGRAM_SIZE;
+            for (unsigned i = 0; i < _batch; ++i) {
+                if (!_buffers[i]) {
+                    _buffers[i] = new char[MAX_DATAGRAM_SIZE];
+                    _iovs[i].iov_base = _buffers[i];
+                    _iovs[i].iov_len = MAX_DATAGRAM_SIZE;
+                }
+                _hdrs[i].msg_hdr.msg_namelen = sizeof(_src_addrs[i].u.sas);
+                _hdrs[i].msg_hdr.msg_controllen = sizeof(_cmsgs[i]);
+            }
+        }
+        void received(unsigned n) {
+            if (n == _batch && _batch < RECV_BATCH) {
+                _batch *= 2;
+            }
         }
     };
     struct send_ctx {
@@ -422,6 +724,7 @@ class posix_udp_channel : public udp_channel_impl {
     std::unique_ptr<pollable_fd> _fd;
     ipv4_addr _address;
     recv_ctx _recv;
+    circular_buffer<udp_datagram> _received;
     send_ctx _send;
     bool _closed;
 public:
@@ -441,6 +744,7 @@ class posix_udp_channel : public udp_channel_impl {
     virtual future<udp_datagram> receive() override;
     virtual future<> send(ipv4_addr dst, const char *msg);
     virtual future<> send(ipv4_addr dst, packet p);
+    virtual future<> send_batch(std::vector<std::pair<ipv4_addr, packet>> datagrams) override;
     virtual void close() override {
         _closed = true;
         _fd->abort_reader(std::make_exception_ptr(std::system_error(EPIPE, std::system_category())));
@@ -463,6 +767,37 @@ future<> posix_udp_channel::send(ipv4_addr dst, packet p) {
             .then([len] (size_t size) { assert(size == len); });
 }
 
+future<> posix_udp_channel::send_batch(std::vector<std::pair<ipv4_addr, packet>> datagrams) {
+    struct batch {
+        std::vector<std::pair<ipv4_addr, packet>> datagrams;
+        std::vector<socket_address> dsts;
+        std::vector<std::vector<struct iovec>> iovecs;
+        std::vector<struct mmsghdr> hdrs;
+        size_t sent = 0;
+    };
+    auto b = std::make_unique<batch>();
+    auto n = datagrams.size();
+    b->datagrams = std::move(datagrams);
+    b->dsts.reserve(n);
+    b->iovecs.reserve(n);
+    b->hdrs.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        b->dsts.push_back(make_ipv4_address(b->datagrams[i].first));
+        b->iovecs.push_back(to_iovec(b->datagrams[i].second));
+        auto& hdr = b->hdrs[i].msg_hdr;
+        hdr.msg_name = &b->dsts[i].u.sa;
+        hdr.msg_namelen = sizeof(b->dsts[i].u.sas);
+        hdr.msg_iov = b->iovecs[i].data();
+        hdr.msg_iovlen = b->iovecs[i].size();
+    }
+    auto& br = *b;
+    return do_until([&br] { return br.sent == br.hdrs.size(); }, [this, &br] {
+        return _fd->sendmmsg(br.hdrs.data() + br.sent, br.hdrs.size() - br.sent).then([&br] (size_t sent) {
+            br.sent += sent;
+        });
+    }).finally([b = std::move(b)] {});
+}
+
 udp_channel
 posix_network_stack::make_udp_channel(ipv4_addr addr) {
     return udp_channel(std::make_unique<posix_udp_channel>(addr));
@@ -483,14 +818,23 @@ class posix_datagram : public udp_datagram_impl {
 
 future<udp_datagram>
 posix_udp_channel::receive() {
+    if (!_received.empty()) {
+        auto dgram = std::move(_received.front());
+        _received.pop_front();
+        return make_ready_future<udp_datagram>(std::move(dgram));
+    }
     _recv.prepare();
-    return _fd->recvmsg(&_recv._hdr).then([this] (size_t size) {
-        auto dst = ipv4_addr(_recv._cmsg.pktinfo.ipi_addr.s_addr, _address.port);
-        return make_ready_future<udp_datagram>(udp_datagram(std::make_unique<posix_datagram>(
-            _recv._src_addr, dst, packet(fragment{_recv._buffer, size}, make_deleter([buf = _recv._buffer] { delete[] buf; })))));
-    }).handle_exception([p = _recv._buffer](auto ep) {
-        delete[] p;
-        return make_exception_future<udp_datagram>(std::move(ep));
+    return _fd->recvmmsg(_recv._hdrs.data(), _recv._batch).then([this] (size_t n) {
+        for (unsigned i = 0; i < n; ++i) {
+            auto dst = ipv4_addr(_recv._cmsgs[i].pktinfo.ipi_addr.s_addr, _address.port);
+            auto buf = _recv._buffers[i];
+            auto d = make_deleter([buf] { delete[] buf; });
+            _recv._buffers[i] = nullptr;
+            _received.push_back(udp_datagram(std::make_unique<posix_datagram>(
+                _recv._src_addrs[i], dst, packet(fragment{buf, _recv._hdrs[i].msg_len}, std::move(d)))));
+        }
+        _recv.received(n);
+        return receive();
     });
 }
 
@@ -24,6 +24,8 @@
 
 #include "core/reactor.hh"
 #include "core/sharded.hh"
+#include "core/circular_buffer.hh"
+#include "core/gate.hh"
 #include "stack.hh"
 #include <boost/program_options.hpp>
 
@@ -106,14 +108,52 @@ class posix_data_source_impl final : public data_source_impl {
     future<> close() override;
 };
 
+// Holds the packets sent on a socket with MSG_ZEROCOPY until the kernel
+// reports, through the socket's error queue, that it no longer references
+// their memory. Shared by all sinks of the socket, since the kernel numbers
+// zero-copy sends per socket.
+class zero_copy_tracker : public enable_lw_shared_from_this<zero_copy_tracker> {
+    lw_shared_ptr<pollable_fd> _fd;
+    circular_buffer<packet> _held; // by send number, starting at _first_id
+    uint32_t _first_id = 0;
+    size_t _outstanding = 0;
+    bool _reaping = false;
+    bool _stopped = false;
+    gate _reaper; // held by the background fiber reading the error queue
+public:
+    explicit zero_copy_tracker(lw_shared_ptr<pollable_fd> fd) : _fd(std::move(fd)) {}
+    // Holds p until the kernel completes the zero-copy send just made.
+    void hold(packet p);
+    // Resolves once all sends made so far have completed.
+    future<> close();
+    // Lets go of the held packets without waiting for their sends to
+    // complete, and ends the background fiber.
+    void stop();
+private:
+    void reap();
+    void drain_errqueue();
+    void release(uint32_t first, uint32_t last);
+    void release_all();
+};
+
 class posix_data_sink_impl : public data_sink_impl {
     lw_shared_ptr<pollable_fd> _fd;
     packet _p;
+    lw_shared_ptr<zero_copy_tracker> _zero_copy;
+    size_t _zero_copy_threshold = 0;
 public:
     explicit posix_data_sink_impl(lw_shared_ptr<pollable_fd> fd) : _fd(std::move(fd)) {}
+    posix_data_sink_impl(lw_shared_ptr<pollable_fd> fd, lw_shared_ptr<zero_copy_tracker> zero_copy, size_t zero_copy_threshold)
+        : _fd(std::move(fd)), _zero_copy(std::move(zero_copy)), _zero_copy_threshold(zero_copy_threshold) {}
+    ~posix_data_sink_impl();
     future<> put(packet p) override;
     future<> put(temporary_buffer<char> buf) override;
+    bool can_send_file(const file& f) const override;
+    future<> send_file(const file& f, uint64_t pos, size_t len) override;
     future<> close() override;
+private:
+    bool wants_zero_copy(const packet& p) const;
+    future<> put_zero_copy();
 };
 
 template <transport Transport>
@@ -129,6 +169,7 @@ class posix_ap_server_socket_impl : public server_socket_impl {
 public:
     explicit posix_ap_server_socket_impl(socket_address sa) : _sa(sa) {}
     virtual future<connected_socket, socket_address> accept() override;
+    virtual future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch() override;
     virtual void abort_accept() override;
     static void move_connected_socket(socket_address sa, pollable_fd fd, socket_address addr, conntrack::handle handle);
 };
@@ -143,6 +184,7 @@ class posix_server_socket_impl : public server_socket_impl {
 public:
     explicit posix_server_socket_impl(socket_address sa, pollable_fd lfd) : _sa(sa), _lfd(std::move(lfd)) {}
     virtual future<connected_socket, socket_address> accept();
+    virtual future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch() override;
     virtual void abort_accept() override;
 };
 using posix_server_tcp_socket_impl = posix_server_socket_impl<transport::TCP>;
@@ -155,6 +197,7 @@ class posix_reuseport_server_socket_impl : public server_socket_impl {
 public:
     explicit posix_reuseport_server_socket_impl(socket_address sa, pollable_fd lfd) : _sa(sa), _lfd(std::move(lfd)) {}
     virtual future<connected_socket, socket_address> accept();
+    virtual future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch() override;
     virtual void abort_accept() override;
 };
 using posix_reuseport_server_tcp_socket_impl = posix_reuseport_server_socket_impl<transport::TCP>;
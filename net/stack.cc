@@ -48,6 +48,18 @@ future<> net::udp_channel::send(ipv4_addr dst, packet p) {
     return _impl->send(std::move(dst), std::move(p));
 }
 
+future<> net::udp_channel::send_batch(std::vector<std::pair<ipv4_addr, packet>> datagrams) {
+    return _impl->send_batch(std::move(datagrams));
+}
+
+future<> net::udp_channel_impl::send_batch(std::vector<std::pair<ipv4_addr, packet>> datagrams) {
+    return do_with(std::move(datagrams), [this] (std::vector<std::pair<ipv4_addr, packet>>& datagrams) {
+        return do_for_each(datagrams, [this] (std::pair<ipv4_addr, packet>& d) {
+            return send(d.first, std::move(d.second));
+        });
+    });
+}
+
 bool net::udp_channel::is_closed() const {
     return _impl->is_closed();
 }
@@ -98,6 +110,12 @@ void connected_socket::set_keepalive_parameters(const net::keepalive_params& p)
 net::keepalive_params connected_socket::get_keepalive_parameters() const {
     return _csi->get_keepalive_parameters();
 }
+void connected_socket::set_zero_copy_threshold(size_t bytes) {
+    _csi->set_zero_copy_threshold(bytes);
+}
+void connected_socket::set_congestion_control(const sstring& name) {
+    _csi->set_congestion_control(name);
+}
 
 void connected_socket::shutdown_output() {
     _csi->shutdown_output();
@@ -145,6 +163,21 @@ future<connected_socket, socket_address> server_socket::accept() {
     return _ssi->accept();
 }
 
+future<std::vector<std::pair<connected_socket, socket_address>>> server_socket::accept_batch() {
+    if (_aborted) {
+        return make_exception_future<std::vector<std::pair<connected_socket, socket_address>>>(std::system_error(ECONNABORTED, std::system_category()));
+    }
+    return _ssi->accept_batch();
+}
+
+future<std::vector<std::pair<connected_socket, socket_address>>> net::server_socket_impl::accept_batch() {
+    return accept().then([] (connected_socket cs, socket_address sa) {
+        std::vector<std::pair<connected_socket, socket_address>> ret;
+        ret.emplace_back(std::move(cs), sa);
+        return ret;
+    });
+}
+
 void server_socket::abort_accept() {
     _ssi->abort_accept();
     _aborted = true;
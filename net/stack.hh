@@ -41,6 +41,9 @@ class connected_socket_impl {
     virtual bool get_keepalive() const = 0;
     virtual void set_keepalive_parameters(const keepalive_params&) = 0;
     virtual keepalive_params get_keepalive_parameters() const = 0;
+    // Only stacks that send from userspace memory implement zero-copy.
+    virtual void set_zero_copy_threshold(size_t bytes) {}
+    virtual void set_congestion_control(const sstring& name) {}
 };
 
 class socket_impl {
@@ -54,6 +57,8 @@ class server_socket_impl {
 public:
     virtual ~server_socket_impl() {}
     virtual future<connected_socket, socket_address> accept() = 0;
+    // Defaults to a batch of one accept().
+    virtual future<std::vector<std::pair<connected_socket, socket_address>>> accept_batch();
     virtual void abort_accept() = 0;
 };
 
@@ -63,6 +68,8 @@ class udp_channel_impl {
     virtual future<udp_datagram> receive() = 0;
     virtual future<> send(ipv4_addr dst, const char* msg) = 0;
     virtual future<> send(ipv4_addr dst, packet p) = 0;
+    // Defaults to one send() after another.
+    virtual future<> send_batch(std::vector<std::pair<ipv4_addr, packet>> datagrams);
     virtual bool is_closed() const = 0;
     virtual void close() = 0;
 };
@@ -0,0 +1,424 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "tcp-congestion.hh"
+#include "core/print.hh"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+
+namespace seastar {
+
+namespace net {
+
+tcp_congestion_algorithm parse_tcp_congestion_algorithm(const sstring& name) {
+    if (name == "reno") {
+        return tcp_congestion_algorithm::reno;
+    } else if (name == "cubic") {
+        return tcp_congestion_algorithm::cubic;
+    } else if (name == "bbr") {
+        return tcp_congestion_algorithm::bbr;
+    }
+    throw std::invalid_argument(sprint("unknown TCP congestion control algorithm: %s", name));
+}
+
+std::ostream& operator<<(std::ostream& os, tcp_congestion_algorithm algo) {
+    switch (algo) {
+    case tcp_congestion_algorithm::reno: return os << "reno";
+    case tcp_congestion_algorithm::cubic: return os << "cubic";
+    case tcp_congestion_algorithm::bbr: return os << "bbr";
+    }
+    abort();
+}
+
+void tcp_congestion_control::on_recovery_exit(tcp_congestion_window& w, uint32_t flight_size) {
+    // RFC6582 Step 3: set cwnd to min (ssthresh, max(FlightSize, SMSS) + SMSS)
+    uint32_t smss = w.mss;
+    w.cwnd = std::min(w.ssthresh, std::max(flight_size, smss) + smss);
+}
+
+void tcp_congestion_control::on_timeout(tcp_congestion_window& w, uint32_t flight_size, bool first, clock_type::time_point now) {
+    // According to RFC5681, update ssthresh only for the first retransmit
+    if (first) {
+        w.ssthresh = ssthresh_after_loss(w, flight_size, now);
+    }
+    // Start the slow start process
+    w.cwnd = w.mss;
+}
+
+// NewReno (RFC 5681), with byte counting in congestion avoidance.
+class reno_congestion_control final : public tcp_congestion_control {
+    uint32_t _bytes_acked = 0;
+public:
+    virtual tcp_congestion_algorithm algorithm() const override {
+        return tcp_congestion_algorithm::reno;
+    }
+    virtual void on_ack(tcp_congestion_window& w, const tcp_ack_sample& s) override {
+        if (s.in_recovery) {
+            return;
+        }
+        uint32_t smss = w.mss;
+        if (w.cwnd < w.ssthresh) {
+            // In slow start phase, counting bytes so that stretch ACKs (and
+            // ACKs of TSO segments) grow the window as much as the data
+            // they acknowledge
+            w.cwnd += std::min(s.acked, w.ssthresh - w.cwnd);
+            _bytes_acked = 0;
+        } else {
+            // In congestion avoidance phase: one SMSS per window acked
+            _bytes_acked += s.acked;
+            if (_bytes_acked >= w.cwnd) {
+                _bytes_acked -= w.cwnd;
+                w.cwnd += smss;
+            }
+        }
+    }
+    virtual uint32_t ssthresh_after_loss(const tcp_congestion_window& w, uint32_t flight_size, clock_type::time_point now) override {
+        // RFC5681 Step 3.2
+        _bytes_acked = 0;
+        return std::max(flight_size / 2, 2 * uint32_t(w.mss));
+    }
+};
+
+// CUBIC (RFC 8312).  Window sizes are computed in segments.
+class cubic_congestion_control final : public tcp_congestion_control {
+    static constexpr double c = 0.4;
+    static constexpr double beta = 0.7;
+    // Window size just before the last reduction
+    double _w_max = 0;
+    // Time the cubic function takes to grow back to _w_max, in seconds
+    double _k = 0;
+    // Window size the cubic function is centered on
+    double _origin = 0;
+    // Window size Reno would have reached in this epoch
+    double _w_est = 0;
+    std::experimental::optional<clock_type::time_point> _epoch_start;
+    std::chrono::microseconds _min_rtt = std::chrono::microseconds::max();
+public:
+    virtual tcp_congestion_algorithm algorithm() const override {
+        return tcp_congestion_algorithm::cubic;
+    }
+    virtual void on_ack(tcp_congestion_window& w, const tcp_ack_sample& s) override {
+        if (s.rtt) {
+            _min_rtt = std::min(_min_rtt, *s.rtt);
+        }
+        if (s.in_recovery) {
+            return;
+        }
+        if (w.cwnd < w.ssthresh) {
+            // In slow start phase
+            w.cwnd += std::min(s.acked, w.ssthresh - w.cwnd);
+            return;
+        }
+        double mss = w.mss;
+        double cwnd = w.cwnd / mss;
+        if (!_epoch_start) {
+            _epoch_start = s.now;
+            if (cwnd < _w_max) {
+                _k = std::cbrt((_w_max - cwnd) / c);
+                _origin = _w_max;
+            } else {
+                _k = 0;
+                _origin = cwnd;
+            }
+            _w_est = cwnd;
+        }
+        auto rtt = _min_rtt == std::chrono::microseconds::max() ? 0 : _min_rtt.count() / 1e6;
+        auto t = std::chrono::duration<double>(s.now - *_epoch_start).count() + rtt;
+        auto target = _origin + c * std::pow(t - _k, 3);
+        // Do not grow by more than half the window in one round trip
+        target = std::min(target, cwnd * 1.5);
+        auto acked = s.acked / mss;
+        // TCP-friendly region: Reno's growth with CUBIC's beta
+        _w_est += 3 * (1 - beta) / (1 + beta) * acked / cwnd;
+        double next;
+        if (target > cwnd) {
+            // Concave and convex regions
+            next = cwnd + (target - cwnd) / cwnd * acked;
+        } else {
+            next = cwnd + 0.01 * acked / cwnd;
+        }
+        next = std::max(next, _w_est);
+        w.cwnd = std::max(w.cwnd, uint32_t(next * mss));
+    }
+    virtual uint32_t ssthresh_after_loss(const tcp_congestion_window& w, uint32_t flight_size, clock_type::time_point now) override {
+        double cwnd = double(w.cwnd) / w.mss;
+        _epoch_start = {};
+        // Fast convergence: release bandwidth for new flows when the
+        // window did not reach its previous maximum
+        if (cwnd < _w_max) {
+            _w_max = cwnd * (1 + beta) / 2;
+        } else {
+            _w_max = cwnd;
+        }
+        return std::max(uint32_t(w.cwnd * beta), 2 * uint32_t(w.mss));
+    }
+};
+
+// BBR version 1 (draft-cardwell-iccrg-bbr-congestion-control-00).
+//
+// Without a pacer in the stack, BBR's model only bounds the window; the
+// pacing rate is reported for observability.
+class bbr_congestion_control final : public tcp_congestion_control {
+    enum class mode { startup, drain, probe_bw, probe_rtt };
+    static constexpr double high_gain = 2.885;      // 2/ln(2)
+    static constexpr double drain_gain = 1 / high_gain;
+    static constexpr double probe_bw_cwnd_gain = 2;
+    static constexpr unsigned gain_cycle_length = 8;
+    static constexpr std::array<double, gain_cycle_length> pacing_gains{{1.25, 0.75, 1, 1, 1, 1, 1, 1}};
+    static constexpr unsigned bw_window_rounds = 10;
+    static constexpr unsigned min_cwnd_segments = 4;
+    static constexpr std::chrono::seconds min_rtt_window{10};
+    static constexpr std::chrono::milliseconds probe_rtt_duration{200};
+    // Full pipe detection: the bandwidth must grow by 25% every round...
+    static constexpr double full_bw_threshold = 1.25;
+    // ... or stop growing for this many rounds
+    static constexpr unsigned full_bw_rounds = 3;
+
+    mode _mode = mode::startup;
+    double _pacing_gain = high_gain;
+    double _cwnd_gain = high_gain;
+    // Windowed max filter of the delivery rate, one slot per round trip
+    std::array<double, bw_window_rounds> _max_bw{};
+    uint64_t _round = 0;
+    uint64_t _next_round_delivered = 0;
+    bool _round_start = false;
+    std::chrono::microseconds _min_rtt = std::chrono::microseconds::max();
+    clock_type::time_point _min_rtt_stamp;
+    double _full_bw = 0;
+    unsigned _full_bw_count = 0;
+    bool _full_bw_reached = false;
+    unsigned _cycle_index = 0;
+    clock_type::time_point _cycle_stamp;
+    std::experimental::optional<clock_type::time_point> _probe_rtt_done;
+    bool _probe_rtt_round_done = false;
+    uint32_t _prior_cwnd = 0;
+    std::default_random_engine _rnd{std::random_device()()};
+private:
+    double bw() const {
+        return *std::max_element(_max_bw.begin(), _max_bw.end());
+    }
+    bool has_model() const {
+        return _min_rtt != std::chrono::microseconds::max() && bw() > 0;
+    }
+    // Bytes in flight that keep the pipe full with the given gain; without
+    // a model yet, there is no bound.
+    uint32_t inflight(double gain) const {
+        if (!has_model()) {
+            return std::numeric_limits<uint32_t>::max();
+        }
+        return std::min(bw() * _min_rtt.count() / 1e6 * gain, double(std::numeric_limits<uint32_t>::max()));
+    }
+    void update_round(const tcp_ack_sample& s) {
+        _round_start = false;
+        if (s.interval.count() && s.prior_delivered >= _next_round_delivered) {
+            _next_round_delivered = s.delivered;
+            _round++;
+            _round_start = true;
+            _max_bw[_round % bw_window_rounds] = 0;
+        }
+    }
+    void update_bw(const tcp_ack_sample& s) {
+        // Intervals shorter than the minimum RTT come from ACK compression
+        // and overestimate the delivery rate
+        if (!s.interval.count() || (_min_rtt != std::chrono::microseconds::max() && s.interval < _min_rtt)) {
+            return;
+        }
+        auto rate = (s.delivered - s.prior_delivered) * 1e6 / s.interval.count();
+        // An application limited sample only tells that the bandwidth is
+        // at least that much
+        if (!s.app_limited || rate >= bw()) {
+            auto& slot = _max_bw[_round % bw_window_rounds];
+            slot = std::max(slot, rate);
+        }
+    }
+    void enter_probe_bw(clock_type::time_point now) {
+        _mode = mode::probe_bw;
+        _cwnd_gain = probe_bw_cwnd_gain;
+        // Start anywhere but in the draining phase
+        _cycle_index = std::uniform_int_distribution<unsigned>(0, gain_cycle_length - 2)(_rnd);
+        if (_cycle_index >= 1) {
+            _cycle_index++;
+        }
+        _pacing_gain = pacing_gains[_cycle_index];
+        _cycle_stamp = now;
+    }
+    void update_gain_cycle(const tcp_ack_sample& s) {
+        if (_mode != mode::probe_bw) {
+            return;
+        }
+        bool full_length = s.now - _cycle_stamp > _min_rtt;
+        bool advance;
+        if (_pacing_gain > 1) {
+            advance = full_length && s.flight_size >= inflight(_pacing_gain);
+        } else if (_pacing_gain < 1) {
+            advance = full_length || s.flight_size <= inflight(1);
+        } else {
+            advance = full_length;
+        }
+        if (advance) {
+            _cycle_index = (_cycle_index + 1) % gain_cycle_length;
+            _pacing_gain = pacing_gains[_cycle_index];
+            _cycle_stamp = s.now;
+        }
+    }
+    void check_full_bw(const tcp_ack_sample& s) {
+        if (_full_bw_reached || !_round_start || s.app_limited) {
+            return;
+        }
+        if (bw() >= _full_bw * full_bw_threshold) {
+            _full_bw = bw();
+            _full_bw_count = 0;
+        } else if (++_full_bw_count >= full_bw_rounds) {
+            _full_bw_reached = true;
+        }
+    }
+    void check_drain(const tcp_ack_sample& s) {
+        if (_mode == mode::startup && _full_bw_reached) {
+            _mode = mode::drain;
+            _pacing_gain = drain_gain;
+            _cwnd_gain = high_gain;
+        }
+        if (_mode == mode::drain && s.flight_size <= inflight(1)) {
+            enter_probe_bw(s.now);
+        }
+    }
+    void update_min_rtt(tcp_congestion_window& w, const tcp_ack_sample& s) {
+        // The first sample starts the window rather than expiring it
+        bool expired = _min_rtt != std::chrono::microseconds::max() && s.now > _min_rtt_stamp + min_rtt_window;
+        if (s.rtt && (*s.rtt <= _min_rtt || expired)) {
+            _min_rtt = *s.rtt;
+            _min_rtt_stamp = s.now;
+        }
+        uint32_t min_cwnd = min_cwnd_segments * w.mss;
+        if (expired && _mode != mode::probe_rtt) {
+            // Drain the queue to measure the path's round-trip time again
+            _mode = mode::probe_rtt;
+            _pacing_gain = 1;
+            _cwnd_gain = 1;
+            _prior_cwnd = std::max(_prior_cwnd, w.cwnd);
+            _probe_rtt_done = {};
+        }
+        if (_mode != mode::probe_rtt) {
+            return;
+        }
+        if (!_probe_rtt_done) {
+            if (s.flight_size <= min_cwnd) {
+                _probe_rtt_done = s.now + probe_rtt_duration;
+                _probe_rtt_round_done = false;
+                _next_round_delivered = s.delivered;
+            }
+        } else {
+            if (_round_start) {
+                _probe_rtt_round_done = true;
+            }
+            if (_probe_rtt_round_done && s.now > *_probe_rtt_done) {
+                _min_rtt_stamp = s.now;
+                w.cwnd = std::max(w.cwnd, _prior_cwnd);
+                _prior_cwnd = 0;
+                if (_full_bw_reached) {
+                    enter_probe_bw(s.now);
+                } else {
+                    _mode = mode::startup;
+                    _pacing_gain = high_gain;
+                    _cwnd_gain = high_gain;
+                }
+            }
+        }
+    }
+    void set_cwnd(tcp_congestion_window& w, const tcp_ack_sample& s) {
+        uint32_t min_cwnd = min_cwnd_segments * w.mss;
+        if (has_model()) {
+            // Leave room for delayed and stretched ACKs
+            auto target = std::min(uint64_t(inflight(_cwnd_gain)) + 3 * w.mss, uint64_t(std::numeric_limits<uint32_t>::max()));
+            if (_full_bw_reached) {
+                w.cwnd = std::min(uint64_t(w.cwnd) + s.acked, target);
+            } else if (w.cwnd < target) {
+                w.cwnd += s.acked;
+            }
+        } else {
+            w.cwnd += s.acked;
+        }
+        w.cwnd = std::max(w.cwnd, min_cwnd);
+        if (_mode == mode::probe_rtt) {
+            w.cwnd = std::min(w.cwnd, min_cwnd);
+        }
+    }
+public:
+    virtual tcp_congestion_algorithm algorithm() const override {
+        return tcp_congestion_algorithm::bbr;
+    }
+    virtual void on_ack(tcp_congestion_window& w, const tcp_ack_sample& s) override {
+        update_round(s);
+        update_bw(s);
+        update_gain_cycle(s);
+        check_full_bw(s);
+        check_drain(s);
+        update_min_rtt(w, s);
+        if (!s.in_recovery) {
+            set_cwnd(w, s);
+        }
+    }
+    virtual uint32_t ssthresh_after_loss(const tcp_congestion_window& w, uint32_t flight_size, clock_type::time_point now) override {
+        // BBR does not treat loss as a congestion signal; remember the
+        // window to restore once recovery is over, and conserve packets
+        // meanwhile (the tcb sets cwnd to ssthresh + 3 * SMSS).
+        _prior_cwnd = std::max(_prior_cwnd, w.cwnd);
+        return std::max(flight_size, min_cwnd_segments * uint32_t(w.mss));
+    }
+    virtual void on_recovery_exit(tcp_congestion_window& w, uint32_t flight_size) override {
+        w.cwnd = std::max(w.cwnd, _prior_cwnd);
+        _prior_cwnd = 0;
+    }
+    virtual void on_timeout(tcp_congestion_window& w, uint32_t flight_size, bool first, clock_type::time_point now) override {
+        // Grow back from one segment towards the model's window, without
+        // touching ssthresh, which BBR does not use.
+        _prior_cwnd = 0;
+        w.cwnd = w.mss;
+    }
+    virtual uint64_t pacing_rate() const override {
+        return bw() * _pacing_gain;
+    }
+    virtual uint64_t bandwidth() const override {
+        return bw();
+    }
+};
+
+constexpr std::array<double, bbr_congestion_control::gain_cycle_length> bbr_congestion_control::pacing_gains;
+constexpr std::chrono::seconds bbr_congestion_control::min_rtt_window;
+constexpr std::chrono::milliseconds bbr_congestion_control::probe_rtt_duration;
+
+std::unique_ptr<tcp_congestion_control> make_tcp_congestion_control(tcp_congestion_algorithm algo) {
+    switch (algo) {
+    case tcp_congestion_algorithm::reno: return std::make_unique<reno_congestion_control>();
+    case tcp_congestion_algorithm::cubic: return std::make_unique<cubic_congestion_control>();
+    case tcp_congestion_algorithm::bbr: return std::make_unique<bbr_congestion_control>();
+    }
+    abort();
+}
+
+}
+
+}
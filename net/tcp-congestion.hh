@@ -0,0 +1,109 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#pragma once
+
+#include "core/sstring.hh"
+#include "core/timer.hh"
+#include <chrono>
+#include <cstdint>
+#include <experimental/optional>
+#include <iosfwd>
+#include <memory>
+
+namespace seastar {
+
+namespace net {
+
+enum class tcp_congestion_algorithm { reno, cubic, bbr };
+
+// Accepts the Linux names: "reno", "cubic" and "bbr".
+tcp_congestion_algorithm parse_tcp_congestion_algorithm(const sstring& name);
+std::ostream& operator<<(std::ostream& os, tcp_congestion_algorithm algo);
+
+// The part of the sender state that congestion control is in charge of.
+struct tcp_congestion_window {
+    // Sender maximum segment size
+    uint16_t mss;
+    // Congestion window
+    uint32_t cwnd;
+    // Slow start threshold
+    uint32_t ssthresh;
+};
+
+// What an ACK that advanced SND.UNA tells about the path.
+struct tcp_ack_sample {
+    using clock_type = steady_clock_type;
+    clock_type::time_point now;
+    // Bytes newly acknowledged
+    uint32_t acked = 0;
+    // Bytes still outstanding after this ACK
+    uint32_t flight_size = 0;
+    // Whether fast recovery is in progress, in which case the window is
+    // managed by the recovery procedure (RFC 6582)
+    bool in_recovery = false;
+    // Round-trip time measured by this ACK
+    std::experimental::optional<std::chrono::microseconds> rtt;
+    // Bytes delivered over the connection's lifetime, including this ACK
+    uint64_t delivered = 0;
+    // Delivery rate sample: the value of delivered when the newest acked
+    // segment was sent, and the time it took to deliver the difference.
+    // A zero interval means there is no sample.
+    uint64_t prior_delivered = 0;
+    std::chrono::microseconds interval{0};
+    // The sample was taken while the application did not keep the
+    // connection busy, so it may underestimate the bandwidth
+    bool app_limited = false;
+};
+
+// A sender-side congestion control algorithm of one connection.
+//
+// The tcb keeps the loss detection and recovery mechanics of RFC 5681 and
+// RFC 6582 (duplicate ACK counting, fast retransmit, window inflation during
+// fast recovery), and asks the algorithm how to grow the window and how far
+// to reduce it.
+class tcp_congestion_control {
+public:
+    using clock_type = tcp_ack_sample::clock_type;
+    virtual ~tcp_congestion_control() {}
+    virtual tcp_congestion_algorithm algorithm() const = 0;
+    // Called on every ACK that advances SND.UNA.
+    virtual void on_ack(tcp_congestion_window& w, const tcp_ack_sample& s) = 0;
+    // Loss detected by duplicate ACKs: returns the slow start threshold to
+    // enter fast recovery with.
+    virtual uint32_t ssthresh_after_loss(const tcp_congestion_window& w, uint32_t flight_size, clock_type::time_point now) = 0;
+    // Fast recovery completed (full ACK).
+    virtual void on_recovery_exit(tcp_congestion_window& w, uint32_t flight_size);
+    // Retransmission timeout; first is false when the same segment has
+    // already timed out.
+    virtual void on_timeout(tcp_congestion_window& w, uint32_t flight_size, bool first, clock_type::time_point now);
+    // Rate the algorithm would pace the transmissions at, in bytes per
+    // second, or 0 if it is purely window based.
+    virtual uint64_t pacing_rate() const { return 0; }
+    // Bottleneck bandwidth estimate in bytes per second, or 0 if none.
+    virtual uint64_t bandwidth() const { return 0; }
+};
+
+std::unique_ptr<tcp_congestion_control> make_tcp_congestion_control(tcp_congestion_algorithm algo);
+
+}
+
+}
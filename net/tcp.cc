@@ -30,6 +30,9 @@ namespace seastar {
 
 namespace net {
 
+constexpr uint8_t tcp_option::max_size;
+constexpr unsigned tcp_option::max_sack_blocks;
+
 void tcp_option::parse(uint8_t* beg1, uint8_t* end1) {
     const char* beg = reinterpret_cast<const char*>(beg1);
     const char* end = reinterpret_cast<const char*>(end1);
@@ -59,6 +62,11 @@ void tcp_option::parse(uint8_t* beg1, uint8_t* end1) {
             _sack_received = true;
             beg += option_len::sack;
             break;
+        case option_kind::timestamps:
+            _timestamps_received = true;
+            _ts_recent = timestamps::read(beg).t1;
+            beg += option_len::timestamps;
+            break;
         case option_kind::nop:
             beg += option_len::nop;
             break;
@@ -77,6 +85,40 @@ void tcp_option::parse(uint8_t* beg1, uint8_t* end1) {
     }
 }
 
+tcp_option::segment_options tcp_option::parse_segment(const uint8_t* beg1, const uint8_t* end1) {
+    const char* beg = reinterpret_cast<const char*>(beg1);
+    const char* end = reinterpret_cast<const char*>(end1);
+    segment_options opts;
+    while (beg < end) {
+        auto kind = option_kind(*beg);
+        if (kind == option_kind::eol) {
+            break;
+        }
+        if (kind == option_kind::nop) {
+            beg += option_len::nop;
+            continue;
+        }
+        if (beg + 1 == end) {
+            break;
+        }
+        auto len = uint8_t(beg[1]);
+        if (len == 0 || beg + len > end) {
+            break;
+        }
+        if (kind == option_kind::timestamps && len == uint8_t(option_len::timestamps)) {
+            opts.ts = timestamps::read(beg);
+        } else if (kind == option_kind::sack_blocks && len > uint8_t(option_len::sack_blocks)) {
+            auto nr = std::min<unsigned>((len - uint8_t(option_len::sack_blocks)) / uint8_t(option_len::sack_block), max_sack_blocks);
+            for (opts.nr_sack_blocks = 0; opts.nr_sack_blocks < nr; opts.nr_sack_blocks++) {
+                auto off = uint8_t(option_len::sack_blocks) + opts.nr_sack_blocks * uint8_t(option_len::sack_block);
+                opts.sack_blocks[opts.nr_sack_blocks] = sack_block::read(beg + off);
+            }
+        }
+        beg += len;
+    }
+    return opts;
+}
+
 uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
     auto hdr = reinterpret_cast<char*>(h);
     auto off = hdr + tcp_hdr::len;
@@ -99,6 +141,31 @@ uint8_t tcp_option::fill(void* h, const tcp_hdr* th, uint8_t options_size) {
             off += win_scale.len;
             size += win_scale.len;
         }
+        if (_sack_received || !ack_on) {
+            auto sack = tcp_option::sack();
+            sack.write(off);
+            off += sack.len;
+            size += sack.len;
+        }
+    }
+    if (_timestamps_received || (syn_on && !ack_on)) {
+        // RFC7323: offered on our SYN, used afterwards only if the peer
+        // offered it too
+        auto ts = tcp_option::timestamps();
+        ts.t1 = _ts_val;
+        ts.t2 = ack_on ? _ts_recent : 0;
+        ts.write(off);
+        off += ts.len;
+        size += ts.len;
+    }
+    if (_nr_sack_blocks) {
+        auto len = uint8_t(option_len::sack_blocks) + _nr_sack_blocks * uint8_t(option_len::sack_block);
+        tcp_option::write(off, option_kind::sack_blocks, option_len(len));
+        for (unsigned i = 0; i < _nr_sack_blocks; i++) {
+            _sack_blocks[i].write(off + uint8_t(option_len::sack_blocks) + i * uint8_t(option_len::sack_block));
+        }
+        off += len;
+        size += len;
     }
     if (size > 0) {
         // Insert NOP option
@@ -127,6 +194,16 @@ uint8_t tcp_option::get_size(bool syn_on, bool ack_on) {
         if (_win_scale_received || !ack_on) {
             size += option_len::win_scale;
         }
+        if (_sack_received || !ack_on) {
+            size += option_len::sack;
+        }
+    }
+    if (_timestamps_received || (syn_on && !ack_on)) {
+        size += option_len::timestamps;
+    }
+    if (_nr_sack_blocks) {
+        size += option_len::sack_blocks;
+        size += _nr_sack_blocks * uint8_t(option_len::sack_block);
     }
     if (size > 0) {
         size += option_len::eol;
@@ -33,8 +33,10 @@
 #include "ip.hh"
 #include "const.hh"
 #include "packet-util.hh"
+#include "tcp-congestion.hh"
 #include <unordered_map>
 #include <map>
+#include <array>
 #include <functional>
 #include <deque>
 #include <chrono>
@@ -97,8 +99,10 @@ void tcp_debug(const char* fmt, Args&&... args) {
 
 struct tcp_option {
     // The kind and len field are fixed and defined in TCP protocol
-    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, timestamps = 8,  nop = 1, eol = 0 };
-    enum class option_len:  uint8_t { mss = 4, win_scale = 3, sack = 2, timestamps = 10, nop = 1, eol = 1 };
+    // sack is SACK-permitted, sack_blocks carries the blocks, whose length
+    // is sack_blocks plus sack_block for each of them
+    enum class option_kind: uint8_t { mss = 2, win_scale = 3, sack = 4, sack_blocks = 5, timestamps = 8,  nop = 1, eol = 0 };
+    enum class option_len:  uint8_t { mss = 4, win_scale = 3, sack = 2, sack_blocks = 2, sack_block = 8, timestamps = 10, nop = 1, eol = 1 };
     static void write(char* p, option_kind kind, option_len len) {
         p[0] = static_cast<uint8_t>(kind);
         if (static_cast<uint8_t>(len) > 1) {
@@ -143,6 +147,20 @@ struct tcp_option {
             tcp_option::write(p, kind, len);
         }
     };
+    struct sack_block {
+        uint32_t left;
+        uint32_t right;
+        static tcp_option::sack_block read(const char* p) {
+            tcp_option::sack_block b;
+            b.left = read_be<uint32_t>(p);
+            b.right = read_be<uint32_t>(p + 4);
+            return b;
+        }
+        void write(char* p) const {
+            write_be<uint32_t>(p, left);
+            write_be<uint32_t>(p + 4, right);
+        }
+    };
     struct timestamps {
         static constexpr option_kind kind = option_kind::timestamps;
         static constexpr option_len len = option_len::timestamps;
@@ -175,8 +193,22 @@ struct tcp_option {
         }
     };
     static const uint8_t align = 4;
+    // Room taken by the timestamps option in segments other than SYNs,
+    // padding included
+    static constexpr uint8_t timestamps_space = 12;
+    // Room for options in the TCP header
+    static constexpr uint8_t max_size = 40;
+    static constexpr unsigned max_sack_blocks = 4;
+
+    // The options of a segment other than a SYN that the tcb acts upon
+    struct segment_options {
+        std::experimental::optional<timestamps> ts;
+        std::array<sack_block, max_sack_blocks> sack_blocks;
+        unsigned nr_sack_blocks = 0;
+    };
 
     void parse(uint8_t* beg, uint8_t* end);
+    static segment_options parse_segment(const uint8_t* beg, const uint8_t* end);
     uint8_t fill(void* h, const tcp_hdr* th, uint8_t option_size);
     uint8_t get_size(bool syn_on, bool ack_on);
 
@@ -191,6 +223,13 @@ struct tcp_option {
     uint16_t _local_mss;
     uint8_t _remote_win_scale = 0;
     uint8_t _local_win_scale = 0;
+    // TSval to send in the next segment
+    uint32_t _ts_val = 0;
+    // Latest TSval received from the remote, echoed back in TSecr
+    uint32_t _ts_recent = 0;
+    // SACK blocks to send in the next segment
+    std::array<sack_block, max_sack_blocks> _sack_blocks;
+    unsigned _nr_sack_blocks = 0;
 };
 inline char*& operator+=(char*& x, tcp_option::option_len len) { x += uint8_t(len); return x; }
 inline const char*& operator+=(const char*& x, tcp_option::option_len len) { x += uint8_t(len); return x; }
@@ -303,6 +342,8 @@ class tcp {
 
     class tcb : public enable_lw_shared_from_this<tcb> {
         using clock_type = lowres_clock;
+        // Round-trip times are too short for the lowres clock
+        using rtt_clock_type = steady_clock_type;
         static constexpr tcp_state CLOSED         = tcp_state::CLOSED;
         static constexpr tcp_state LISTEN         = tcp_state::LISTEN;
         static constexpr tcp_state SYN_SENT       = tcp_state::SYN_SENT;
@@ -326,14 +367,25 @@ class tcp {
             packet p;
             uint16_t data_len;
             unsigned nr_transmits;
-            clock_type::time_point tx_time;
+            rtt_clock_type::time_point tx_time;
+            // Delivery rate sampling state when the segment was sent
+            uint64_t delivered;
+            rtt_clock_type::time_point delivered_time;
+            rtt_clock_type::time_point first_tx_time;
+            bool app_limited;
+            tcp_seq seq;
+            // SACK scoreboard (RFC6675)
+            bool sacked = false;
+            bool lost = false;
+            // Retransmitted since it was deemed lost
+            bool retransmitted = false;
         };
-        struct send {
+        // mss, cwnd and ssthresh come from tcp_congestion_window
+        struct send : tcp_congestion_window {
             tcp_seq unacknowledged;
             tcp_seq next;
             uint32_t window;
             uint8_t window_scale;
-            uint16_t mss;
             tcp_seq urgent;
             tcp_seq wl1;
             tcp_seq wl2;
@@ -341,6 +393,8 @@ class tcp {
             std::deque<unacked_segment> data;
             std::deque<packet> unsent;
             uint32_t unsent_len = 0;
+            // RFC6675 pipe, kept up to date with the scoreboard
+            uint32_t pipe = 0;
             bool closed = false;
             promise<> _window_opened;
             // Wait for all data are acked
@@ -351,15 +405,22 @@ class tcp {
             // wait for there is at least one byte available in the queue
             std::experimental::optional<promise<>> _send_available_promise;
             // Round-trip time variation
-            std::chrono::milliseconds rttvar;
+            std::chrono::microseconds rttvar{0};
             // Smoothed round-trip time
-            std::chrono::milliseconds srtt;
+            std::chrono::microseconds srtt{0};
+            // Latest and lowest round-trip time samples
+            std::chrono::microseconds latest_rtt{0};
+            std::chrono::microseconds min_rtt = std::chrono::microseconds::max();
             bool first_rto_sample = true;
-            clock_type::time_point syn_tx_time;
-            // Congestion window
-            uint32_t cwnd;
-            // Slow start threshold
-            uint32_t ssthresh;
+            rtt_clock_type::time_point syn_tx_time;
+            // Bytes acknowledged so far, and when the latest were; used to
+            // sample the delivery rate
+            uint64_t delivered = 0;
+            rtt_clock_type::time_point delivered_time;
+            // Send time of the oldest segment of the current sampling interval
+            rtt_clock_type::time_point first_tx_time;
+            // Number of segments retransmitted
+            uint64_t retransmits = 0;
             // Duplicated ACKs
             uint16_t dupacks = 0;
             unsigned syn_retransmit = 0;
@@ -367,6 +428,10 @@ class tcp {
             uint32_t limited_transfer = 0;
             uint32_t partial_ack = 0;
             tcp_seq recover;
+            // Segments retransmitted from the SACK scoreboard during the
+            // current recovery, and whether a timeout interrupted it
+            uint32_t recovery_retransmits = 0;
+            bool recovery_timed_out = false;
             bool window_probe = false;
             uint8_t zero_window_probing_out = 0;
         } _snd;
@@ -381,6 +446,9 @@ class tcp {
             // The total size of data stored in std::deque<packet> data
             size_t data_size = 0;
             tcp_packet_merger out_of_order;
+            // Where the latest out of order segment started, whose block
+            // is reported first (RFC2018)
+            tcp_seq last_out_of_order;
             std::experimental::optional<promise<>> _data_received_promise;
             // The maximun memory buffer size allowed for receiving
             // Currently, it is the same as default receive window size when window scaling is enabled
@@ -391,13 +459,14 @@ class tcp {
         // Retransmission timeout
         std::chrono::milliseconds _rto{1000};
         std::chrono::milliseconds _persist_time_out{1000};
-        static constexpr std::chrono::milliseconds _rto_min{1000};
         static constexpr std::chrono::milliseconds _rto_max{60000};
         // Clock granularity
         static constexpr std::chrono::milliseconds _rto_clk_granularity{1};
         static constexpr uint16_t _max_nr_retransmit{5};
         timer<lowres_clock> _retransmit;
         timer<lowres_clock> _persist;
+        std::unique_ptr<tcp_congestion_control> _cc;
+        metrics::metric_groups _metrics;
         uint16_t _nr_full_seg_received = 0;
         struct isn_secret {
             // 512 bits secretkey for ISN generating
@@ -430,7 +499,7 @@ class tcp {
         void input_handle_listen_state(tcp_hdr* th, packet p);
         void input_handle_syn_sent_state(tcp_hdr* th, packet p);
         void input_handle_other_state(tcp_hdr* th, packet p);
-        void output_one(bool data_retransmit = false);
+        void output_one(unacked_segment* retransmit_seg = nullptr);
         future<> wait_for_data();
         void abort_reader();
         future<> wait_for_all_data_acked();
@@ -470,6 +539,9 @@ class tcp {
         tcp_state& state() {
             return _state;
         }
+        void set_congestion_control(tcp_congestion_algorithm algo) {
+            _cc = make_tcp_congestion_control(algo);
+        }
     private:
         void respond_with_reset(tcp_hdr* th);
         bool merge_out_of_order();
@@ -478,9 +550,9 @@ class tcp {
         bool should_send_ack(uint16_t seg_len);
         void clear_delayed_ack();
         packet get_transmit_packet();
-        void retransmit_one() {
-            bool data_retransmit = true;
-            output_one(data_retransmit);
+        void retransmit_one(unacked_segment& seg) {
+            _snd.retransmits++;
+            output_one(&seg);
         }
         void start_retransmit_timer() {
             auto now = clock_type::now();
@@ -507,8 +579,8 @@ class tcp {
         void persist();
         void retransmit();
         void fast_retransmit();
-        void update_rto(clock_type::time_point tx_time);
-        void update_cwnd(uint32_t acked_bytes);
+        void update_rto(std::chrono::microseconds rtt);
+        void register_metrics();
         void cleanup();
         uint32_t can_send() {
             if (_snd.window_probe) {
@@ -538,6 +610,10 @@ class tcp {
                 auto max = _snd.cwnd + 2 * _snd.mss;
                 x = flight <= max ? std::min(x, max - flight) : 0;
                 _snd.limited_transfer += x;
+            } else if (_snd.dupacks >= 3 && sack_enabled()) {
+                // RFC6675 Section 5 (C): send while pipe leaves room for a segment
+                auto pipe = this->pipe();
+                x = _snd.cwnd >= pipe + _snd.mss ? std::min(x, _snd.cwnd - pipe) : 0;
             } else if (_snd.dupacks >= 3) {
                 // RFC5681 Step 3.5
                 // Sent 1 full-sized segment at most
@@ -545,6 +621,39 @@ class tcp {
             }
             return x;
         }
+        bool sack_enabled() const {
+            return _option._sack_received;
+        }
+        // RFC6675 SetPipe(): bytes the sender thinks are in the network
+        uint32_t pipe() const {
+            return _snd.pipe;
+        }
+        // What seg contributes to pipe()
+        static uint32_t in_pipe(const unacked_segment& seg) {
+            if (seg.sacked) {
+                return 0;
+            }
+            return (unsigned(!seg.lost) + unsigned(seg.retransmitted)) * seg.p.len();
+        }
+        // Changes seg's packet or scoreboard state, keeping pipe() in sync
+        template <typename Func>
+        void update_segment(unacked_segment& seg, Func&& func) {
+            _snd.pipe -= in_pipe(seg);
+            func(seg);
+            _snd.pipe += in_pipe(seg);
+        }
+        bool update_scoreboard(tcp_seq seg_ack, const tcp_option::segment_options& opts);
+        void split_unacked_segment(size_t idx, uint32_t offset);
+        void update_lost();
+        void clear_scoreboard() {
+            for (auto& seg : _snd.data) {
+                seg.sacked = seg.lost = seg.retransmitted = false;
+            }
+            _snd.pipe = flight_size();
+        }
+        void sack_retransmit();
+        void enter_fast_recovery();
+        void fill_sack_blocks(bool syn_on, bool ack_on, uint16_t len);
         uint32_t flight_size() {
             uint32_t size = 0;
             std::for_each(_snd.data.begin(), _snd.data.end(), [&] (unacked_segment& seg) { size += seg.p.len(); });
@@ -576,19 +685,25 @@ class tcp {
         }
         void do_syn_sent() {
             _state = SYN_SENT;
-            _snd.syn_tx_time = clock_type::now();
+            _snd.syn_tx_time = rtt_clock_type::now();
             // Send <SYN> to remote
             output();
         }
         void do_syn_received() {
             _state = SYN_RECEIVED;
-            _snd.syn_tx_time = clock_type::now();
+            _snd.syn_tx_time = rtt_clock_type::now();
             // Send <SYN,ACK> to remote
             output();
         }
         void do_established() {
             _state = ESTABLISHED;
-            update_rto(_snd.syn_tx_time);
+            // Karn's algorithm: a retransmitted SYN gives no RTT sample
+            if (!_snd.syn_retransmit) {
+                update_rto(std::chrono::duration_cast<std::chrono::microseconds>(rtt_clock_type::now() - _snd.syn_tx_time));
+            }
+            if (_tcp._connection_metrics) {
+                register_metrics();
+            }
             _connect_done.set_value();
         }
         void do_reset() {
@@ -647,7 +762,11 @@ class tcp {
             _snd.limited_transfer = 0;
             _snd.partial_ack = 0;
         }
-        uint32_t data_segment_acked(tcp_seq seg_ack);
+        uint32_t data_segment_acked(tcp_seq seg_ack, tcp_ack_sample& sample);
+        static uint32_t timestamp_now() {
+            // RFC7323 timestamp clock, ticking every millisecond
+            return std::chrono::duration_cast<std::chrono::milliseconds>(rtt_clock_type::now().time_since_epoch()).count();
+        }
         bool segment_acceptable(tcp_seq seg_seq, unsigned seg_len);
         void init_from_options(tcp_hdr* th, uint8_t* opt_start, uint8_t* opt_end);
         friend class connection;
@@ -662,7 +781,20 @@ class tcp {
     // queue for packets that do not belong to any tcb
     circular_buffer<ipv4_traits::l4packet> _packetq;
     semaphore _queue_space = {212992};
+    // Loss recovery counters, for all connections
+    struct stats {
+        uint64_t timeouts = 0;
+        uint64_t sack_recoveries = 0;
+        uint64_t sack_blocks_sent = 0;
+        uint64_t timestamp_rtt_samples = 0;
+    } _stats;
     metrics::metric_groups _metrics;
+    // Settings of new connections
+    tcp_congestion_algorithm _congestion_algorithm = tcp_congestion_algorithm::reno;
+    std::chrono::milliseconds _rto_min{1000};
+    bool _connection_metrics = false;
+    // Tells apart connections with the same addresses in their metrics
+    uint64_t _next_connection_id = 0;
 public:
     class connection {
         lw_shared_ptr<tcb> _tcb;
@@ -696,6 +828,9 @@ class tcp {
         ipaddr foreign_ip() {
             return _tcb->_foreign_ip;
         }
+        void set_congestion_control(tcp_congestion_algorithm algo) {
+            _tcb->set_congestion_control(algo);
+        }
         uint16_t foreign_port() {
             return _tcb->_foreign_port;
         }
@@ -744,6 +879,13 @@ class tcp {
     listener listen(uint16_t port, size_t queue_length = 100);
     connection connect(socket_address sa);
     const net::hw_features& hw_features() const { return _inet._inet.hw_features(); }
+    // Congestion control algorithm of the connections created from now on
+    void set_congestion_control(tcp_congestion_algorithm algo) { _congestion_algorithm = algo; }
+    // Lower bound of the retransmission timeout (RFC6298 recommends 1s)
+    void set_rto_min(std::chrono::milliseconds rto_min) { _rto_min = rto_min; }
+    // Export the congestion window and round-trip time of each connection
+    // established from now on as metrics
+    void set_connection_metrics(bool enable) { _connection_metrics = enable; }
     future<> poll_tcb(ipaddr to, lw_shared_ptr<tcb> tcb);
     void add_connected_tcb(lw_shared_ptr<tcb> tcbp, uint16_t local_port) {
         auto it = _listening.find(local_port);
@@ -767,7 +909,17 @@ tcp<InetTraits>::tcp(inet_type& inet)
     _metrics.add_group("tcp", {
         sm::make_derive("linearizations", [] { return tcp_packet_merger::linearizations(); },
                         sm::description("Counts a number of times a buffer linearization was invoked during the buffers merge process. "
-                                        "Divide it by a total TCP receive packet rate to get an everage number of lineraizations per TCP packet."))
+                                        "Divide it by a total TCP receive packet rate to get an everage number of lineraizations per TCP packet.")),
+        sm::make_derive("timeouts", _stats.timeouts,
+                        sm::description("Counts a number of times the retransmission timer expired.")),
+        sm::make_derive("sack_recoveries", _stats.sack_recoveries,
+                        sm::description("Counts a number of fast recoveries that repaired more than one lost segment with the help of SACK, "
+                                        "without waiting for the retransmission timer.")),
+        sm::make_derive("sack_blocks_sent", _stats.sack_blocks_sent,
+                        sm::description("Counts a number of SACK blocks sent to report out of order data.")),
+        sm::make_derive("timestamp_rtt_samples", _stats.timestamp_rtt_samples,
+                        sm::description("Counts a number of round-trip time samples taken from echoed timestamps, "
+                                        "when the acknowledged data was retransmitted."))
     });
 
     _inet.register_packet_provider([this, tcb_polled = 0u] () mutable {
@@ -949,7 +1101,8 @@ tcp<InetTraits>::tcb::tcb(tcp& t, connid id)
     , _foreign_port(id.foreign_port)
     , _delayed_ack([this] { _nr_full_seg_received = 0; output(); })
     , _retransmit([this] { retransmit(); })
-    , _persist([this] { persist(); }) {
+    , _persist([this] { persist(); })
+    , _cc(make_tcp_congestion_control(t._congestion_algorithm)) {
 }
 
 template <typename InetTraits>
@@ -1002,34 +1155,59 @@ void tcp<InetTraits>::respond_with_reset(tcp_hdr* rth, ipaddr local_ip, ipaddr f
 }
 
 template <typename InetTraits>
-uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack) {
+uint32_t tcp<InetTraits>::tcb::data_segment_acked(tcp_seq seg_ack, tcp_ack_sample& sample) {
+    using namespace std::chrono;
+    auto now = rtt_clock_type::now();
     uint32_t total_acked_bytes = 0;
+    // State of the most recently sent segment acked by this ACK, which the
+    // RTT and delivery rate samples are taken from
+    bool have_sample = false;
+    rtt_clock_type::time_point tx_time, first_tx_time, delivered_time;
     // Full ACK of segment
     while (!_snd.data.empty()
             && (_snd.unacknowledged + _snd.data.front().p.len() <= seg_ack)) {
-        auto acked_bytes = _snd.data.front().p.len();
+        auto& seg = _snd.data.front();
+        auto acked_bytes = seg.p.len();
         _snd.unacknowledged += acked_bytes;
-        // Ignore retransmitted segments when setting the RTO
-        if (_snd.data.front().nr_transmits == 0) {
-            update_rto(_snd.data.front().tx_time);
+        // Ignore retransmitted segments when measuring the RTT (Karn's algorithm)
+        if (seg.nr_transmits == 0) {
+            have_sample = true;
+            tx_time = seg.tx_time;
+            first_tx_time = seg.first_tx_time;
+            delivered_time = seg.delivered_time;
+            sample.rtt = duration_cast<microseconds>(now - seg.tx_time);
+            sample.prior_delivered = seg.delivered;
+            sample.app_limited = seg.app_limited;
         }
-        update_cwnd(acked_bytes);
         total_acked_bytes += acked_bytes;
         _snd.current_queue_space -= _snd.data.front().data_len;
         signal_send_available();
+        _snd.pipe -= in_pipe(seg);
         _snd.data.pop_front();
     }
     // Partial ACK of segment
     if (_snd.unacknowledged < seg_ack) {
         auto acked_bytes = seg_ack - _snd.unacknowledged;
         if (!_snd.data.empty()) {
-            auto& unacked_seg = _snd.data.front();
-            unacked_seg.p.trim_front(acked_bytes);
+            update_segment(_snd.data.front(), [&] (unacked_segment& seg) {
+                seg.p.trim_front(acked_bytes);
+                seg.seq = seg_ack;
+            });
         }
         _snd.unacknowledged = seg_ack;
-        update_cwnd(acked_bytes);
         total_acked_bytes += acked_bytes;
     }
+    _snd.delivered += total_acked_bytes;
+    _snd.delivered_time = now;
+    if (have_sample) {
+        // The data was delivered at the slower of the rates it was sent
+        // and acknowledged at (draft-cheng-iccrg-delivery-rate-estimation)
+        sample.interval = duration_cast<microseconds>(std::max(tx_time - first_tx_time, now - delivered_time));
+        _snd.first_tx_time = tx_time;
+    }
+    sample.now = now;
+    sample.acked = total_acked_bytes;
+    sample.delivered = _snd.delivered;
     return total_acked_bytes;
 }
 
@@ -1064,10 +1242,16 @@ void tcp<InetTraits>::tcb::init_from_options(tcp_hdr* th, uint8_t* opt_start, ui
     // Local receive window scale factor
     _rcv.window_scale = _option._local_win_scale;
 
-    // Maximum segment size remote can receive
-    _snd.mss = _option._remote_mss;
+    // Maximum segment size remote can receive, and our link can carry
+    _snd.mss = std::min(_option._remote_mss, local_mss());
     // Maximum segment size local can receive
     _rcv.mss = _option._local_mss = local_mss();
+    if (_option._timestamps_received) {
+        // Every segment carries the timestamps option from now on, which
+        // comes out of the segment size (RFC6691)
+        _snd.mss -= tcp_option::timestamps_space;
+        _rcv.mss -= tcp_option::timestamps_space;
+    }
 
     _rcv.window = get_default_receive_window_size();
     _snd.window = th->window << _snd.window_scale;
@@ -1191,6 +1375,15 @@ void tcp<InetTraits>::tcb::input_handle_syn_sent_state(tcp_hdr* th, packet p) {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
+    tcp_option::segment_options seg_opts;
+    if ((_option._timestamps_received || sack_enabled()) && th->data_offset * 4 > tcp_hdr::len) {
+        auto hdr = p.get_header(0, th->data_offset * 4);
+        if (hdr) {
+            auto opt_start = reinterpret_cast<uint8_t*>(hdr) + tcp_hdr::len;
+            seg_opts = tcp_option::parse_segment(opt_start, opt_start + th->data_offset * 4 - tcp_hdr::len);
+        }
+    }
+    auto& seg_ts = seg_opts.ts;
     p.trim_front(th->data_offset * 4);
     bool do_output = false;
     bool do_output_data = false;
@@ -1204,6 +1397,11 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
         return output();
     }
 
+    // RFC7323: remember the timestamp to echo, from in-sequence segments only
+    if (seg_ts && seg_seq <= _rcv.next && int32_t(seg_ts->t1 - _option._ts_recent) >= 0) {
+        _option._ts_recent = seg_ts->t1;
+    }
+
     // In the following it is assumed that the segment is the idealized
     // segment that begins at RCV.NXT and does not exceed the window.
     if (seg_seq < _rcv.next) {
@@ -1216,6 +1414,7 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
     // FIXME: We should trim data outside the right edge of the receive window as well
 
     if (seg_seq != _rcv.next) {
+        _rcv.last_out_of_order = seg_seq;
         insert_out_of_order(seg_seq, std::move(p));
         // A TCP receiver SHOULD send an immediate duplicate ACK
         // when an out-of-order segment arrives.
@@ -1310,10 +1509,27 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
         if (in_state(ESTABLISHED | CLOSE_WAIT)){
             // When we are in zero window probing phase and packets_out = 0 we bypass "duplicated ack" check
             auto packets_out = _snd.next - _snd.unacknowledged - _snd.zero_window_probing_out;
+            if (seg_opts.nr_sack_blocks && sack_enabled() && seg_ack <= _snd.next) {
+                update_scoreboard(seg_ack, seg_opts);
+            }
             // If SND.UNA < SEG.ACK =< SND.NXT then, set SND.UNA <- SEG.ACK.
             if (_snd.unacknowledged < seg_ack && seg_ack <= _snd.next) {
                 // Remote ACKed data we sent
-                auto acked_bytes = data_segment_acked(seg_ack);
+                tcp_ack_sample sample;
+                auto acked_bytes = data_segment_acked(seg_ack, sample);
+                if (!sample.rtt && acked_bytes && seg_ts && seg_ts->t2
+                        && int32_t(timestamp_now() - seg_ts->t2) >= 0) {
+                    // RFC7323: the echoed timestamp measures the RTT even
+                    // when the acked data was retransmitted
+                    sample.rtt = std::chrono::milliseconds(timestamp_now() - seg_ts->t2);
+                    _tcp._stats.timestamp_rtt_samples++;
+                }
+                if (sample.rtt) {
+                    update_rto(*sample.rtt);
+                }
+                sample.flight_size = _snd.next - _snd.unacknowledged;
+                sample.in_recovery = _snd.dupacks >= 3;
+                _cc->on_ack(_snd, sample);
 
                 // If SND.UNA < SEG.ACK =< SND.NXT, the send window should be updated.
                 if (_snd.wl1 < seg_seq || (_snd.wl1 == seg_seq && _snd.wl2 <= seg_ack)) {
@@ -1340,11 +1556,21 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                     uint32_t smss = _snd.mss;
                     if (seg_ack > _snd.recover) {
                         tcp_debug("ack: full_ack\n");
-                        // Set cwnd to min (ssthresh, max(FlightSize, SMSS) + SMSS)
-                        _snd.cwnd = std::min(_snd.ssthresh, std::max(flight_size(), smss) + smss);
+                        _cc->on_recovery_exit(_snd, flight_size());
+                        if (!_snd.recovery_timed_out && _snd.recovery_retransmits > 1) {
+                            _tcp._stats.sack_recoveries++;
+                        }
                         // Exit the fast recovery procedure
                         exit_fast_recovery();
                         set_retransmit_timer();
+                    } else if (sack_enabled()) {
+                        tcp_debug("ack: partial_ack\n");
+                        // RFC6675: retransmit what the scoreboard shows lost,
+                        // pipe keeps the window without inflating it
+                        sack_retransmit();
+                        if (++_snd.partial_ack == 1) {
+                            start_retransmit_timer();
+                        }
                     } else {
                         tcp_debug("ack: partial_ack\n");
                         // Retransmit the first unacknowledged segment
@@ -1375,6 +1601,12 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                     // SND.UNA.
                     exit_fast_recovery();
                     set_retransmit_timer();
+                    // RFC6675 Section 5: SACKs alone can show the next
+                    // segment lost
+                    if (sack_enabled() && !_snd.data.empty() && _snd.data.front().lost) {
+                        _snd.dupacks = 3;
+                        enter_fast_recovery();
+                    }
                 }
             } else if ((packets_out > 0) && !_snd.data.empty() && seg_len == 0 &&
                 th->f_fin == 0 && th->f_syn == 0 &&
@@ -1389,26 +1621,25 @@ void tcp<InetTraits>::tcb::input_handle_other_state(tcp_hdr* th, packet p) {
                 // Here, We follow RFC5681.
                 _snd.dupacks++;
                 uint32_t smss = _snd.mss;
+                if (_snd.dupacks < 3 && sack_enabled() && _snd.data.front().lost) {
+                    // RFC6675 Section 5: the SACKs already show the first
+                    // segment lost, no need to wait for the third dupack
+                    _snd.dupacks = 3;
+                }
                 // 3 duplicated ACKs trigger a fast retransmit
                 if (_snd.dupacks == 1 || _snd.dupacks == 2) {
                     // RFC5681 Step 3.1
                     // Send cwnd + 2 * smss per RFC3042
                     do_output_data = true;
                 } else if (_snd.dupacks == 3) {
-                    // RFC6582 Step 3.2
-                    if (seg_ack - 1 > _snd.recover) {
-                        _snd.recover = _snd.next - 1;
-                        // RFC5681 Step 3.2
-                        _snd.ssthresh = std::max((flight_size() - _snd.limited_transfer) / 2, 2 * smss);
-                        fast_retransmit();
+                    enter_fast_recovery();
+                } else if (_snd.dupacks > 3) {
+                    if (sack_enabled()) {
+                        sack_retransmit();
                     } else {
-                        // Do not enter fast retransmit and do not reset ssthresh
+                        // RFC5681 Step 3.4
+                        _snd.cwnd += smss;
                     }
-                    // RFC5681 Step 3.3
-                    _snd.cwnd = _snd.ssthresh + 3 * smss;
-                } else if (_snd.dupacks > 3) {
-                    // RFC5681 Step 3.4
-                    _snd.cwnd += smss;
                     // RFC5681 Step 3.5
                     do_output_data = true;
                 }
@@ -1598,17 +1829,19 @@ packet tcp<InetTraits>::tcb::get_transmit_packet() {
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
+void tcp<InetTraits>::tcb::output_one(unacked_segment* retransmit_seg) {
     if (in_state(CLOSED)) {
         return;
     }
 
-    packet p = data_retransmit ? _snd.data.front().p.share() : get_transmit_packet();
+    bool data_retransmit = retransmit_seg;
+    packet p = data_retransmit ? retransmit_seg->p.share() : get_transmit_packet();
     packet clone = p.share();  // early clone to prevent share() from calling packet::unuse_internal_data() on header.
     uint16_t len = p.len();
     bool syn_on = syn_needs_on();
     bool ack_on = ack_needs_on();
 
+    fill_sack_blocks(syn_on, ack_on, len);
     auto options_size = _option.get_size(syn_on, ack_on);
     auto th = p.prepend_uninitialized_header(tcp_hdr::len + options_size);
     auto h = tcp_hdr{};
@@ -1626,7 +1859,7 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
 
     tcp_seq seq;
     if (data_retransmit) {
-        seq = _snd.unacknowledged;
+        seq = retransmit_seg->seq;
     } else {
         seq = syn_on ? _snd.initial : _snd.next;
         _snd.next += len;
@@ -1638,10 +1871,12 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
     h.checksum = 0;
 
     // FIXME: does the FIN have to fit in the window?
-    bool fin_on = fin_needs_on();
+    // A retransmitted segment only carries the FIN if it ends the stream.
+    bool fin_on = fin_needs_on() && (!data_retransmit || seq + len == _snd.next);
     h.f_fin = fin_on;
 
     // Add tcp options
+    _option._ts_val = timestamp_now();
     _option.fill(th, &h, options_size);
     h.write(th);
 
@@ -1692,9 +1927,19 @@ void tcp<InetTraits>::tcb::output_one(bool data_retransmit) {
     if (!data_retransmit && (len || syn_on || fin_on)) {
         auto now = clock_type::now();
         if (len) {
+            auto tx_time = rtt_clock_type::now();
+            if (_snd.data.empty()) {
+                // Nothing in flight: start a new delivery rate sampling interval
+                _snd.first_tx_time = _snd.delivered_time = tx_time;
+            }
             unsigned nr_transmits = 0;
+            // With nothing left to send, the application limits the rate
+            bool app_limited = _snd.unsent_len == 0;
             _snd.data.emplace_back(unacked_segment{std::move(clone),
-                                   len, nr_transmits, now});
+                                   len, nr_transmits, tx_time,
+                                   _snd.delivered, _snd.delivered_time, _snd.first_tx_time, app_limited,
+                                   seq});
+            _snd.pipe += len;
         }
         if (!_retransmit.armed()) {
             start_retransmit_timer(now);
@@ -1918,6 +2163,7 @@ void tcp<InetTraits>::tcb::persist() {
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::retransmit() {
+    _tcp._stats.timeouts++;
     auto output_update_rto = [this] {
         output();
         // According to RFC6298, Update RTO <- RTO * 2 to perform binary exponential back-off
@@ -1953,19 +2199,15 @@ void tcp<InetTraits>::tcb::retransmit() {
 
     // If there are unacked data, retransmit the earliest segment
     auto& unacked_seg = _snd.data.front();
+    _snd.recovery_timed_out = true;
 
-    // According to RFC5681
-    // Update ssthresh only for the first retransmit
-    uint32_t smss = _snd.mss;
-    if (unacked_seg.nr_transmits == 0) {
-        _snd.ssthresh = std::max(flight_size() / 2, 2 * smss);
-    }
+    _cc->on_timeout(_snd, flight_size(), unacked_seg.nr_transmits == 0, rtt_clock_type::now());
     // RFC6582 Step 4
     _snd.recover = _snd.next - 1;
-    // Start the slow start process
-    _snd.cwnd = smss;
     // End fast recovery
     exit_fast_recovery();
+    // RFC2018 Section 8: the receiver may have reneged on what it SACKed
+    clear_scoreboard();
 
     if (unacked_seg.nr_transmits < _max_nr_retransmit) {
         unacked_seg.nr_transmits++;
@@ -1974,7 +2216,7 @@ void tcp<InetTraits>::tcb::retransmit() {
         cleanup();
         return;
     }
-    retransmit_one();
+    retransmit_one(unacked_seg);
 
     output_update_rto();
 }
@@ -1984,15 +2226,191 @@ void tcp<InetTraits>::tcb::fast_retransmit() {
     if (!_snd.data.empty()) {
         auto& unacked_seg = _snd.data.front();
         unacked_seg.nr_transmits++;
-        retransmit_one();
+        retransmit_one(unacked_seg);
         output();
     }
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
+void tcp<InetTraits>::tcb::enter_fast_recovery() {
+    uint32_t smss = _snd.mss;
+    // RFC6582 Step 3.2
+    if (_snd.unacknowledged - 1 > _snd.recover) {
+        _snd.recover = _snd.next - 1;
+        // RFC5681 Step 3.2
+        _snd.ssthresh = _cc->ssthresh_after_loss(_snd, flight_size() - _snd.limited_transfer, rtt_clock_type::now());
+        if (sack_enabled()) {
+            // RFC6675 Section 5 (4): retransmit the first segment and let
+            // pipe, rather than window inflation, clock out the rest
+            _snd.recovery_retransmits = 0;
+            _snd.recovery_timed_out = false;
+            _snd.cwnd = _snd.ssthresh;
+            update_segment(_snd.data.front(), [] (unacked_segment& seg) { seg.lost = true; });
+            sack_retransmit();
+            return;
+        }
+        fast_retransmit();
+    } else if (sack_enabled()) {
+        // Already recovering from a timeout: fill the holes within cwnd
+        sack_retransmit();
+        return;
+    } else {
+        // Do not enter fast retransmit and do not reset ssthresh
+    }
+    // RFC5681 Step 3.3
+    _snd.cwnd = _snd.ssthresh + 3 * smss;
+}
+
+template <typename InetTraits>
+bool tcp<InetTraits>::tcb::update_scoreboard(tcp_seq seg_ack, const tcp_option::segment_options& opts) {
+    bool newly_sacked = false;
+    auto una = std::max(_snd.unacknowledged, seg_ack);
+    for (unsigned b = 0; b < opts.nr_sack_blocks; b++) {
+        auto left = std::max(tcp_seq{opts.sack_blocks[b].left}, una);
+        auto right = tcp_seq{opts.sack_blocks[b].right};
+        // Ignore blocks below SND.UNA (D-SACK, RFC2883) and bogus ones
+        if (right <= left || _snd.next < right) {
+            continue;
+        }
+        for (size_t i = 0; i < _snd.data.size(); i++) {
+            auto beg = _snd.data[i].seq;
+            auto end = beg + _snd.data[i].p.len();
+            if (end <= left || _snd.data[i].sacked) {
+                continue;
+            }
+            if (right <= beg) {
+                break;
+            }
+            // Segments are SACKed whole; split those the block covers
+            // only part of (e.g. TSO segments)
+            if (beg < left) {
+                split_unacked_segment(i, left - beg);
+                continue;
+            }
+            if (right < end) {
+                split_unacked_segment(i, right - beg);
+            }
+            update_segment(_snd.data[i], [] (unacked_segment& seg) { seg.sacked = true; });
+            newly_sacked = true;
+        }
+    }
+    if (newly_sacked) {
+        update_lost();
+    }
+    return newly_sacked;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::split_unacked_segment(size_t idx, uint32_t offset) {
+    auto& seg = _snd.data[idx];
+    auto tail_len = seg.p.len() - offset;
+    auto tail = unacked_segment{seg.p.share(offset, tail_len), uint16_t(tail_len), seg.nr_transmits, seg.tx_time,
+                                seg.delivered, seg.delivered_time, seg.first_tx_time, seg.app_limited,
+                                seg.seq + offset, seg.sacked, seg.lost, seg.retransmitted};
+    seg.p.trim_back(tail_len);
+    // The head keeps the queue space of data acked before the split
+    seg.data_len -= tail_len;
+    _snd.data.insert(_snd.data.begin() + idx + 1, std::move(tail));
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_lost() {
+    // RFC6675 IsLost(): DupThresh SACKed ranges, or more than
+    // (DupThresh - 1) * SMSS SACKed bytes, above the segment
+    constexpr unsigned dup_thresh = 3;
+    uint32_t sacked_above = 0;
+    unsigned ranges_above = 0;
+    bool prev_sacked = false;
+    for (auto it = _snd.data.rbegin(); it != _snd.data.rend(); ++it) {
+        if (it->sacked) {
+            sacked_above += it->p.len();
+            ranges_above += !prev_sacked;
+            prev_sacked = true;
+            continue;
+        }
+        prev_sacked = false;
+        if (ranges_above >= dup_thresh || sacked_above > (dup_thresh - 1) * _snd.mss) {
+            update_segment(*it, [] (unacked_segment& seg) { seg.lost = true; });
+        }
+    }
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::sack_retransmit() {
+    // RFC6675 Section 5 (C): while cwnd - pipe >= 1 SMSS, send NextSeg()
+    auto pipe = this->pipe();
+    bool sent = false;
+    auto send = [&] (unacked_segment& seg) {
+        update_segment(seg, [] (unacked_segment& seg) { seg.retransmitted = true; });
+        seg.nr_transmits++;
+        _snd.recovery_retransmits++;
+        retransmit_one(seg);
+        pipe = this->pipe();
+        sent = true;
+    };
+    // Rule (1): unSACKed data deemed lost
+    for (auto& seg : _snd.data) {
+        if (_snd.cwnd < pipe + _snd.mss) {
+            break;
+        }
+        if (seg.lost && !seg.sacked && !seg.retransmitted) {
+            send(seg);
+        }
+    }
+    // Rule (2), new data, is left to output().  Rule (3): with nothing new
+    // to send, retransmit unSACKed data below SACKed data while recovering
+    if (_snd.dupacks >= 3 && !_snd.unsent_len) {
+        auto last_sacked = std::find_if(_snd.data.rbegin(), _snd.data.rend(), [] (auto& seg) { return seg.sacked; });
+        for (auto it = _snd.data.begin(); it != last_sacked.base() && _snd.cwnd >= pipe + _snd.mss; ++it) {
+            if (!it->sacked && !it->retransmitted) {
+                send(*it);
+            }
+        }
+    }
+    if (sent) {
+        output();
+    }
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::fill_sack_blocks(bool syn_on, bool ack_on, uint16_t len) {
+    _option._nr_sack_blocks = 0;
+    auto& blocks = _rcv.out_of_order.map;
+    if (!sack_enabled() || syn_on || !ack_on || blocks.empty()) {
+        return;
+    }
+    auto base_size = _option.get_size(syn_on, ack_on);
+    auto add = [this] (auto it) {
+        _option._sack_blocks[_option._nr_sack_blocks++] = {it->first.raw, (it->first + it->second.len()).raw};
+    };
+    // RFC2018: the first block holds the latest segment received, the
+    // others follow from the highest down
+    auto latest = blocks.upper_bound(_rcv.last_out_of_order);
+    if (latest != blocks.begin()) {
+        add(std::prev(latest));
+    }
+    for (auto it = blocks.rbegin(); it != blocks.rend() && _option._nr_sack_blocks < tcp_option::max_sack_blocks; ++it) {
+        if (latest == blocks.begin() || it->first != std::prev(latest)->first) {
+            add(it);
+        }
+    }
+    // Keep within the option space, and the MTU, which the MSS only
+    // leaves room for the timestamps option in
+    auto fits = [&] {
+        auto size = _option.get_size(syn_on, ack_on);
+        return size <= tcp_option::max_size && std::min(len, _snd.mss) + size - base_size <= _snd.mss;
+    };
+    while (_option._nr_sack_blocks && !fits()) {
+        _option._nr_sack_blocks--;
+    }
+    _tcp._stats.sack_blocks_sent += _option._nr_sack_blocks;
+}
+
+template <typename InetTraits>
+void tcp<InetTraits>::tcb::update_rto(std::chrono::microseconds R) {
+    _snd.latest_rtt = R;
+    _snd.min_rtt = std::min(_snd.min_rtt, R);
     // Update RTO according to RFC6298
-    auto R = std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - tx_time);
     if (_snd.first_rto_sample) {
         _snd.first_rto_sample = false;
         // RTTVAR <- R/2
@@ -2007,31 +2425,54 @@ void tcp<InetTraits>::tcb::update_rto(clock_type::time_point tx_time) {
         _snd.rttvar = _snd.rttvar * 3 / 4 + delta / 4;
         _snd.srtt = _snd.srtt * 7 / 8 +  R / 8;
     }
-    // RTO <- SRTT + max(G, K * RTTVAR)
-    _rto =  _snd.srtt + std::max(_rto_clk_granularity, 4 * _snd.rttvar);
+    // RTO <- SRTT + max(G, K * RTTVAR), rounded up to the timer's unit
+    auto rto = _snd.srtt + std::max<std::chrono::microseconds>(_rto_clk_granularity, 4 * _snd.rttvar);
+    _rto = std::chrono::duration_cast<std::chrono::milliseconds>(rto + std::chrono::milliseconds(1) - std::chrono::microseconds(1));
 
-    // Make sure 1 sec << _rto << 60 sec
-    _rto = std::max(_rto, _rto_min);
+    // Make sure rto_min <= _rto <= 60 sec
+    _rto = std::max(_rto, _tcp._rto_min);
     _rto = std::min(_rto, _rto_max);
 }
 
 template <typename InetTraits>
-void tcp<InetTraits>::tcb::update_cwnd(uint32_t acked_bytes) {
-    uint32_t smss = _snd.mss;
-    if (_snd.cwnd < _snd.ssthresh) {
-        // In slow start phase
-        _snd.cwnd += std::min(acked_bytes, smss);
-    } else {
-        // In congestion avoidance phase
-        uint32_t round_up = 1;
-        _snd.cwnd += std::max(round_up, smss * smss / _snd.cwnd);
-    }
+void tcp<InetTraits>::tcb::register_metrics() {
+    namespace sm = metrics;
+    static auto connection_label = sm::label("connection");
+    static auto id_label = sm::label("id");
+    std::vector<sm::label_instance> labels{connection_label(sprint("%s:%d-%s:%d", _local_ip, _local_port, _foreign_ip, _foreign_port)),
+                                           id_label(_tcp._next_connection_id++)};
+    _metrics.add_group("tcp_connection", {
+        sm::make_gauge("mss", [this] { return _snd.mss; },
+                       sm::description("Maximum segment size sent, in bytes, options excluded"), labels),
+        sm::make_gauge("timestamps", [this] { return _option._timestamps_received; },
+                       sm::description("Whether the connection uses the timestamps option"), labels),
+        sm::make_gauge("cwnd", [this] { return _snd.cwnd; },
+                       sm::description("Congestion window, in bytes"), labels),
+        sm::make_gauge("ssthresh", [this] { return _snd.ssthresh; },
+                       sm::description("Slow start threshold, in bytes"), labels),
+        sm::make_gauge("srtt_us", [this] { return _snd.srtt.count(); },
+                       sm::description("Smoothed round-trip time, in microseconds"), labels),
+        sm::make_gauge("rttvar_us", [this] { return _snd.rttvar.count(); },
+                       sm::description("Round-trip time variation, in microseconds"), labels),
+        sm::make_gauge("min_rtt_us", [this] { return _snd.first_rto_sample ? 0 : _snd.min_rtt.count(); },
+                       sm::description("Lowest round-trip time measured, in microseconds"), labels),
+        sm::make_gauge("rto_ms", [this] { return _rto.count(); },
+                       sm::description("Retransmission timeout, in milliseconds"), labels),
+        sm::make_gauge("bandwidth", [this] { return _cc->bandwidth(); },
+                       sm::description("Bottleneck bandwidth estimated by the congestion control algorithm, in bytes per second (0 if it does not estimate it)"), labels),
+        sm::make_gauge("pacing_rate", [this] { return _cc->pacing_rate(); },
+                       sm::description("Rate the congestion control algorithm would pace transmissions at, in bytes per second (0 if it does not pace)"), labels),
+        sm::make_derive("retransmits", [this] { return _snd.retransmits; },
+                        sm::description("Number of segments retransmitted"), labels),
+    });
 }
 
 template <typename InetTraits>
 void tcp<InetTraits>::tcb::cleanup() {
+    _metrics.clear();
     _snd.unsent.clear();
     _snd.data.clear();
+    _snd.pipe = 0;
     _rcv.out_of_order.map.clear();
     _rcv.data_size = 0;
     _rcv.data.clear();
@@ -2074,10 +2515,11 @@ std::experimental::optional<typename InetTraits::l4packet> tcp<InetTraits>::tcb:
 
     auto p = std::move(_packetq.front());
     _packetq.pop_front();
-    if (!_packetq.empty() || (_snd.dupacks < 3 && can_send() > 0 && (_snd.window > 0))) {
+    if (!_packetq.empty() || ((_snd.dupacks < 3 || sack_enabled()) && can_send() > 0 && (_snd.window > 0))) {
         // If there are packets to send in the queue or tcb is allowed to send
         // more add tcp back to polling set to keep sending. In addition, dupacks >= 3
-        // is an indication that an segment is lost, stop sending more in this case.
+        // is an indication that an segment is lost, stop sending more in this case,
+        // unless SACK tells how much is still in the network (RFC6675).
         // Finally - we can't send more until window is opened again.
         output();
     }
@@ -2108,9 +2550,6 @@ void tcp<InetTraits>::connection::shutdown_connect() {
 template <typename InetTraits>
 constexpr uint16_t tcp<InetTraits>::tcb::_max_nr_retransmit;
 
-template <typename InetTraits>
-constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_min;
-
 template <typename InetTraits>
 constexpr std::chrono::milliseconds tcp<InetTraits>::tcb::_rto_max;
 
@@ -42,6 +42,9 @@ boost_tests = [
     'weak_ptr_test',
     'file_io_test',
     'packet_test',
+    'offload_test',
+    'ipv4_frag_test',
+    'tcp_congestion_test',
     'tls_test',
     'rpc_test',
     'connect_test',
@@ -63,6 +66,12 @@ other_tests = [
     'alien_test',
 ]
 
+# Boost tests also run with the io_uring reactor backend, where available
+io_uring_tests = [
+    'file_io_test',
+    'connect_test',
+]
+
 last_len = 0
 
 def print_status_short(msg):
@@ -81,6 +90,15 @@ def alarm_handler(signum, frame):
 def make_build_path(mode, *suffixes):
     return os.path.join('build', mode, *suffixes)
 
+def reactor_backends(test_path):
+    """The reactor backends a boost test can use on this machine, as listed by its --help."""
+    try:
+        out = subprocess.run([test_path, '--', '--help'], stdout=subprocess.PIPE, stderr=subprocess.STDOUT).stdout.decode()
+    except OSError:
+        return []
+    m = re.search(r'internal\s+reactor\s+implementation\s*\(valid\s+values:([^)]*)\)', out)
+    return [b.strip() for b in m.group(1).split(',')] if m else []
+
 if __name__ == "__main__":
     all_modes = ['debug', 'release']
 
@@ -143,9 +161,20 @@ if __name__ == "__main__":
             test_to_run.append((os.path.join(prefix, test),'other'))
         for test in boost_tests:
             test_to_run.append((os.path.join(prefix, test),'boost'))
+        for test in io_uring_tests:
+            path = os.path.join(prefix, test)
+            if 'io_uring' in reactor_backends(path):
+                test_to_run.append((path + ' -- --reactor-backend io_uring','boost'))
+            else:
+                print('Skipping {} with the io_uring reactor backend: not supported here'.format(path))
         memcached_path = make_build_path(mode, 'apps', 'memcached', 'memcached')
         test_to_run.append(('tests/memcached/test.py --memcached ' + memcached_path + (' --fast' if args.fast else ''),'other'))
         test_to_run.append((os.path.join(prefix, 'distributed_test'),'other'))
+        test_to_run.append((os.path.join(prefix, 'smp_test') + ' --smp-relay-broadcasts 1','other'))
+        test_to_run.append((os.path.join(prefix, 'smp_test') + ' --smp-queue-length 16 --smp-max-backlog 32','other'))
+        test_to_run.append((os.path.join(prefix, 'loopback_test') + ' --network-stack native --loopback-device --dhcp 0'
+                            + ' --loopback-loss 0.02 --loopback-reorder 0.02'
+                            + ' --tcp-connection-metrics 1 --tcp-rto-min 300','other'))
 
 
         allocator_test_path = os.path.join(prefix, 'allocator_test')
@@ -176,8 +205,12 @@ if __name__ == "__main__":
            mode = 'release'
            if test[0].startswith(os.path.join('build','debug')):
               mode = 'debug'
-           xmlout = args.jenkins+"."+mode+"."+os.path.basename(test[0])+".boost.xml"
-           path = path + " --output_format=XML --log_level=all --report_level=no --log_sink=" + xmlout
+           binary, _, seastar_args = test[0].partition(' -- ')
+           name = os.path.basename(binary) + ('.io_uring' if 'io_uring' in seastar_args else '')
+           xmlout = args.jenkins+"."+mode+"."+name+".boost.xml"
+           path = binary + " --output_format=XML --log_level=all --report_level=no --log_sink=" + xmlout
+           if seastar_args:
+               path = path + " -- " + seastar_args
            print(path)
         if os.path.isfile('tmp.out'):
            os.remove('tmp.out')
@@ -185,7 +218,7 @@ if __name__ == "__main__":
 
         # Limit shards count
         if test[1] == 'boost':
-            path = path + " -- --smp={}".format(cpu_count)
+            path = path + (" --smp={}" if ' -- ' in path else " -- --smp={}").format(cpu_count)
         else:
             if not re.search("tests/memcached/test.py", path):
                 if re.search("allocator_test", path) or re.search("fair_queue_test", path):
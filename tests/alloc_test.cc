@@ -23,6 +23,8 @@
 #include "core/memory.hh"
 #include "core/reactor.hh"
 #include <vector>
+#include <sstream>
+#include <boost/algorithm/string/predicate.hpp>
 
 using namespace seastar;
 
@@ -67,3 +69,101 @@ SEASTAR_TEST_CASE(test_live_objects_counter_with_cross_cpu_free) {
         BOOST_REQUIRE(memory::stats().live_objects() < std::numeric_limits<size_t>::max() / 2);
     });
 }
+
+SEASTAR_TEST_CASE(test_fragmentation_report) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    std::vector<std::unique_ptr<char[]>> objs;
+    for (int i = 0; i < 10000; ++i) {
+        objs.emplace_back(new char[100]);
+    }
+    auto r = memory::get_fragmentation_report();
+    BOOST_REQUIRE_EQUAL(r.total_memory, memory::stats().total_memory());
+    BOOST_REQUIRE_EQUAL(r.free_memory, memory::stats().free_memory());
+    BOOST_REQUIRE(r.largest_free_span() <= r.free_memory);
+    size_t free_span_memory = 0;
+    for (unsigned i = 0; i < r.free_spans.size(); ++i) {
+        free_span_memory += r.free_spans[i] * (size_t(1) << i) * memory::page_size;
+    }
+    BOOST_REQUIRE_EQUAL(free_span_memory, r.free_memory);
+    size_t small_pool_memory = 0;
+    size_t used_objects = 0;
+    for (auto& sp : r.small_pools) {
+        BOOST_REQUIRE(sp.used_objects * sp.object_size <= sp.memory);
+        small_pool_memory += sp.memory;
+        if (sp.object_size >= 100) {
+            used_objects += sp.used_objects;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(small_pool_memory, r.small_pool_memory);
+    BOOST_REQUIRE(used_objects >= objs.size());
+#endif
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_free_batch_with_cross_cpu_objects) {
+    return smp::submit_to(1, [] {
+        std::vector<void*> objs;
+        for (int i = 0; i < 10000; ++i) {
+            objs.push_back(malloc(i % 3 ? 64 : 1000));
+        }
+        return objs;
+    }).then([] (std::vector<void*> objs) {
+        // Mix in local objects and holes.
+        for (int i = 0; i < 1000; ++i) {
+            objs.push_back(malloc(64));
+            objs.push_back(nullptr);
+        }
+        auto before = memory::stats();
+        memory::free_batch(objs.data(), objs.size());
+        auto after = memory::stats();
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+        BOOST_REQUIRE_EQUAL(after.cross_cpu_frees() - before.cross_cpu_frees(), 10000u);
+        BOOST_REQUIRE_EQUAL(after.frees() - before.frees(), 1000u);
+#endif
+        std::vector<void*> sized;
+        for (int i = 0; i < 1000; ++i) {
+            sized.push_back(malloc(100));
+        }
+        memory::free_batch(sized.data(), sized.size(), 100);
+        return smp::submit_to(1, [] {
+            // Make sure the cross-cpu frees were taken back.
+            memory::drain_cross_cpu_freelist();
+            BOOST_REQUIRE(memory::stats().live_objects() < std::numeric_limits<size_t>::max() / 2);
+        });
+    });
+}
+
+SEASTAR_TEST_CASE(test_heap_sampling) {
+#ifndef SEASTAR_DEFAULT_ALLOCATOR
+    std::vector<void*> objs;
+    objs.reserve(10000);
+    memory::set_heap_sampling_interval(1024);
+    for (int i = 0; i < 10000; ++i) {
+        objs.push_back(malloc(i % 2 ? 64 : 100000));
+    }
+    auto samples = memory::get_heap_samples();
+    BOOST_REQUIRE(!samples.empty());
+    size_t count = 0;
+    for (auto& s : samples) {
+        BOOST_REQUIRE(!s.backtrace.empty());
+        count += s.count;
+    }
+    BOOST_REQUIRE(count > 0 && count <= objs.size());
+    {
+        std::ostringstream os;
+        memory::write_heap_profile(os, samples, memory::get_heap_sampling_interval());
+        BOOST_REQUIRE(boost::starts_with(os.str(), "heap profile: "));
+    }
+    for (auto obj : objs) {
+        free(obj);
+    }
+    // Freed objects leave the profile; only unrelated live allocations may remain.
+    size_t remaining = 0;
+    for (auto& s : memory::get_heap_samples()) {
+        remaining += s.count;
+    }
+    BOOST_REQUIRE(remaining < count);
+    memory::set_heap_sampling_interval(0);
+#endif
+    return make_ready_future<>();
+}
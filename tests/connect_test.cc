@@ -1,6 +1,7 @@
 #include "tests/test-utils.hh"
 
 #include "net/ip.hh"
+#include "core/thread.hh"
 
 #include <random>
 
@@ -71,3 +72,89 @@ SEASTAR_TEST_CASE(test_accept_after_abort) {
         });
     });
 }
+
+SEASTAR_TEST_CASE(test_zero_copy_send) {
+    std::random_device rnd;
+    auto distr = std::uniform_int_distribution<uint16_t>(12000, 65000);
+    auto sa = make_ipv4_address({"127.0.0.1", distr(rnd)});
+    return seastar::async([sa] {
+        auto listener = engine().net().listen(sa, listen_options());
+        auto accepted = listener.accept();
+        auto client = engine().net().connect(sa).get0();
+        auto server = std::get<0>(accepted.get());
+        client.set_zero_copy_threshold(4096);
+
+        sstring received;
+        auto in = server.input();
+        auto reader = repeat([&in, &received] {
+            return in.read().then([&received] (temporary_buffer<char> buf) {
+                received += sstring(buf.get(), buf.size());
+                return buf.empty() ? stop_iteration::yes : stop_iteration::no;
+            });
+        });
+
+        // Large buffers go out zero-copy, small ones are copied.
+        auto& stats = engine().get_io_stats();
+        auto sends = stats.zero_copy_sends;
+        auto completions = stats.zero_copy_completions;
+        sstring expected;
+        auto out = client.output();
+        for (size_t size : { 100, 1 << 20, 10, 64 << 10 }) {
+            temporary_buffer<char> buf(size);
+            std::fill_n(buf.get_write(), size, char('a' + expected.size() % 26));
+            expected += sstring(buf.get(), buf.size());
+            out.write(std::move(buf)).get();
+        }
+        // Waits for the kernel to be done with every zero-copy send
+        out.close().get();
+        BOOST_REQUIRE_GE(stats.zero_copy_sends - sends, 2u);
+        BOOST_REQUIRE_EQUAL(stats.zero_copy_completions - completions, stats.zero_copy_sends - sends);
+
+        reader.get();
+        BOOST_REQUIRE(received == expected);
+    });
+}
+
+SEASTAR_TEST_CASE(test_accept_batch) {
+    std::random_device rnd;
+    auto distr = std::uniform_int_distribution<uint16_t>(12000, 65000);
+    auto sa = make_ipv4_address({"127.0.0.1", distr(rnd)});
+    return seastar::async([sa] {
+        auto listener = engine().net().listen(sa, listen_options());
+        std::vector<connected_socket> clients;
+        // More than a batch takes
+        for (unsigned i = 0; i < reactor::max_accept_batch + 16; ++i) {
+            clients.push_back(engine().net().connect(sa).get0());
+        }
+        size_t accepted = 0;
+        while (accepted < clients.size()) {
+            auto batch = listener.accept_batch().get0();
+            BOOST_REQUIRE(!batch.empty());
+            BOOST_REQUIRE_LE(batch.size(), reactor::max_accept_batch);
+            accepted += batch.size();
+        }
+        BOOST_REQUIRE_EQUAL(accepted, clients.size());
+    });
+}
+
+SEASTAR_TEST_CASE(test_udp_batch) {
+    std::random_device rnd;
+    auto distr = std::uniform_int_distribution<uint16_t>(12000, 65000);
+    auto server_addr = ipv4_addr("127.0.0.1", distr(rnd));
+    return seastar::async([server_addr] {
+        auto server = engine().net().make_udp_channel(server_addr);
+        auto client = engine().net().make_udp_channel();
+        static const char data[] = "0123456789abcdefghij";
+        std::vector<std::pair<ipv4_addr, packet>> datagrams;
+        for (int i = 0; i < 20; ++i) {
+            datagrams.emplace_back(server_addr, packet::from_static_data(&data[i], 1));
+        }
+        client.send_batch(std::move(datagrams)).get();
+        for (int i = 0; i < 20; ++i) {
+            auto dgram = server.receive().get0();
+            auto& p = dgram.get_data();
+            BOOST_REQUIRE_EQUAL(p.len(), 1u);
+            BOOST_REQUIRE_EQUAL(*p.get_header<char>(), data[i]);
+        }
+    });
+}
@@ -70,9 +70,9 @@ struct test_env {
     test_env(unsigned capacity) : fq(capacity)
     {}
 
-    size_t register_priority_class(uint32_t shares) {
+    size_t register_priority_class(uint32_t shares, std::chrono::microseconds latency_target = {}) {
         results.push_back(0);
-        classes.push_back(fq.register_priority_class(shares));
+        classes.push_back(fq.register_priority_class(shares, latency_target));
         return classes.size() - 1;
     }
 
@@ -377,3 +377,180 @@ SEASTAR_TEST_CASE(test_fair_queue_random_run) {
        return env->verify(sprint("random_run (%d msec)", reqs / 10), {1, 1}, expected_error);
     }).then([env] {});
 }
+
+// Class2 has almost no shares, but a latency target. Expected its requests to be
+// served as they approach the target, instead of after class1's.
+SEASTAR_TEST_CASE(test_fair_queue_latency_target) {
+    auto env = make_lw_shared<test_env>(1);
+
+    auto a = env->register_priority_class(1000);
+    auto b = env->register_priority_class(1, 1ms);
+
+    for (int i = 0; i < 200; ++i) {
+        env->do_op(a, 1);
+    }
+    for (int i = 0; i < 10; ++i) {
+        env->do_op(b, 1);
+    }
+    return sleep(10ms).then([env, a, b] {
+        std::cout << "latency_target: r[0] = " << env->results[a] << " r[1] = " << env->results[b] << std::endl;
+        BOOST_REQUIRE_EQUAL(env->results[b], 10);
+        // The first one may have been served by shares alone.
+        BOOST_REQUIRE(env->classes[b]->deadline_dispatches() >= 9);
+        return env->wait_on_pending();
+    }).then([env] {
+        for (auto& p: env->classes) {
+            env->fq.unregister_priority_class(p);
+        }
+    });
+}
+
+// Class1 is capped at 1000 IOPS, class2 is not. Expected class1 to stay within
+// its rate (plus the initial burst), and class2 to use the remaining capacity.
+// Time is simulated, by passing the dispatches the time they happen at.
+SEASTAR_TEST_CASE(test_fair_queue_rate_limit) {
+    return seastar::async([] {
+        auto env = make_lw_shared<test_env>(1000);
+
+        auto a = env->register_priority_class(100);
+        auto b = env->register_priority_class(1);
+        // Ahead of the real clock, which the dispatches of do_op() use, so that
+        // class1 only gets going in simulated time.
+        auto start = std::chrono::steady_clock::now() + 1h;
+        env->fq.set_rate_limits(env->classes[a], 0, 1000, start);
+
+        for (int i = 0; i < 200; ++i) {
+            env->do_op(a, 1);
+            env->do_op(b, 1);
+        }
+        BOOST_REQUIRE_EQUAL(env->results[a], 0);
+        BOOST_REQUIRE_EQUAL(env->results[b], 200);
+        BOOST_REQUIRE(env->classes[a]->throttled_dispatches() > 0);
+
+        // The 10 requests worth of burst, and one that takes the bucket into debt.
+        env->fq.dispatch_requests(start);
+        BOOST_REQUIRE_EQUAL(env->results[a], 11);
+
+        // Then 1 per ms.
+        auto now = start;
+        for (int ms = 1; ms <= 50; ++ms) {
+            now = start + std::chrono::milliseconds(ms);
+            env->fq.dispatch_requests(now);
+        }
+        std::cout << "rate_limit: r[0] = " << env->results[a] << " r[1] = " << env->results[b] << std::endl;
+        BOOST_REQUIRE_EQUAL(env->results[a], 11 + 50);
+
+        // The next request may go once the bucket is out of debt, 1ms after the last one.
+        auto next = env->fq.next_refill();
+        BOOST_REQUIRE(next == now + 1ms);
+        env->fq.dispatch_requests(next - 1us);
+        BOOST_REQUIRE_EQUAL(env->results[a], 11 + 50);
+        env->fq.dispatch_requests(next);
+        BOOST_REQUIRE_EQUAL(env->results[a], 11 + 51);
+
+        env->fq.set_rate_limits(env->classes[a], 0, 0);
+        BOOST_REQUIRE(env->fq.next_refill() == std::chrono::steady_clock::time_point::max());
+        env->fq.dispatch_requests();
+        env->wait_on_pending().get();
+        BOOST_REQUIRE_EQUAL(env->results[a], 200);
+        for (auto& p: env->classes) {
+            env->fq.unregister_priority_class(p);
+        }
+    });
+}
+
+// Two queues of a group, each with a class sharing a limit of 1000 IOPS. Expected
+// them to stay within it together, and either to use what the other leaves.
+SEASTAR_TEST_CASE(test_fair_queue_shared_rate_limit) {
+    return seastar::async([] {
+        fair_group group(fair_group::config{1000, 1000, std::numeric_limits<unsigned>::max(), 1});
+        fair_queue::config cfg;
+        cfg.group = &group;
+        fair_queue fq1(cfg);
+        fair_queue fq2(cfg);
+        auto pc1 = fq1.register_priority_class(1);
+        auto pc2 = fq2.register_priority_class(1);
+        fq1.share_rate_limits(pc1, 0);
+        fq2.share_rate_limits(pc2, 0);
+        auto start = std::chrono::steady_clock::now() + 1h;
+        fq1.set_rate_limits(pc1, 0, 1000, start);
+        BOOST_REQUIRE_EQUAL(pc2->ops_per_second(), 1000u);
+
+        unsigned done1 = 0;
+        unsigned done2 = 0;
+        for (int i = 0; i < 100; ++i) {
+            fq1.queue(pc1, fair_queue_request_descriptor{}, [&] { ++done1; });
+            fq2.queue(pc2, fair_queue_request_descriptor{}, [&] { ++done2; });
+        }
+        // One burst for both.
+        fq1.dispatch_requests(start);
+        fq2.dispatch_requests(start);
+        BOOST_REQUIRE_EQUAL(done1, 11u);
+        BOOST_REQUIRE_EQUAL(done2, 0u);
+
+        // Then 1 per ms for both.
+        for (int ms = 1; ms <= 20; ++ms) {
+            auto now = start + std::chrono::milliseconds(ms);
+            fq2.dispatch_requests(now);
+            fq1.dispatch_requests(now);
+        }
+        BOOST_REQUIRE_EQUAL(done1 + done2, 11u + 20u);
+        BOOST_REQUIRE_EQUAL(done2, 20u);
+
+        fq1.set_rate_limits(pc1, 0, 0);
+        fq1.dispatch_requests();
+        fq2.dispatch_requests();
+        BOOST_REQUIRE_EQUAL(done1, 100u);
+        BOOST_REQUIRE_EQUAL(done2, 100u);
+        fair_queue_request_descriptor desc;
+        for (int i = 0; i < 100; ++i) {
+            fq1.notify_requests_finished(desc);
+            fq2.notify_requests_finished(desc);
+        }
+        fq1.unregister_priority_class(pc1);
+        fq2.unregister_priority_class(pc2);
+    });
+}
+
+// Two queues sharing a group of capacity 2. Expected the group's capacity
+// never to be exceeded, and both queues to make progress.
+SEASTAR_TEST_CASE(test_fair_queue_group) {
+    return seastar::async([] {
+        fair_group group(fair_group::config{2});
+        fair_queue::config cfg;
+        cfg.group = &group;
+        fair_queue fq1(cfg);
+        fair_queue fq2(cfg);
+        auto pc1 = fq1.register_priority_class(1);
+        auto pc2 = fq2.register_priority_class(1);
+
+        std::vector<std::pair<fair_queue*, fair_queue_request_descriptor>> executing;
+        unsigned done1 = 0;
+        unsigned done2 = 0;
+        for (int i = 0; i < 10; ++i) {
+            fq1.queue(pc1, fair_queue_request_descriptor{}, [&] { executing.emplace_back(&fq1, fair_queue_request_descriptor{}); ++done1; });
+            fq2.queue(pc2, fair_queue_request_descriptor{}, [&] { executing.emplace_back(&fq2, fair_queue_request_descriptor{}); ++done2; });
+        }
+        for (unsigned round = 0; done1 + done2 < 20; ++round) {
+            // Shards poll in no particular order.
+            auto& first = round % 2 ? fq1 : fq2;
+            auto& second = round % 2 ? fq2 : fq1;
+            first.dispatch_requests();
+            second.dispatch_requests();
+            BOOST_REQUIRE_LE(executing.size(), 2u);
+            BOOST_REQUIRE_EQUAL(group.requests_currently_executing(), executing.size());
+            BOOST_REQUIRE(!executing.empty());
+            // Finish the oldest request.
+            executing.front().first->notify_requests_finished(executing.front().second);
+            executing.erase(executing.begin());
+        }
+        BOOST_REQUIRE_EQUAL(done1, 10u);
+        BOOST_REQUIRE_EQUAL(done2, 10u);
+        for (auto& e : executing) {
+            e.first->notify_requests_finished(e.second);
+        }
+        BOOST_REQUIRE_EQUAL(group.requests_currently_executing(), 0u);
+        fq1.unregister_priority_class(pc1);
+        fq2.unregister_priority_class(pc2);
+    });
+}
@@ -24,6 +24,7 @@
 #include "core/semaphore.hh"
 #include "core/condition-variable.hh"
 #include "core/file.hh"
+#include "core/cached_file.hh"
 #include "core/reactor.hh"
 #include "core/thread.hh"
 #include "core/stall_sampler.hh"
@@ -128,3 +129,98 @@ SEASTAR_TEST_CASE(parallel_write_fsync) {
         std::cout << "parallel_write_fsync: " << sr << "\n";
     });
 }
+
+SEASTAR_TEST_CASE(test_cached_file) {
+    return async([] {
+        auto fname = "testfile.tmp";
+        auto block = 4096;
+        file f = open_file_dma(fname, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), 4 * block);
+        for (auto i = 0; i < 4; ++i) {
+            std::fill(wbuf.get_write() + i * block, wbuf.get_write() + (i + 1) * block, 'a' + i);
+        }
+        f.dma_write(0, wbuf.get(), wbuf.size()).get();
+        f.close().get();
+
+        auto f1 = make_cached_file(open_file_dma(fname, open_flags::rw).get0()).get0();
+        auto f2 = make_cached_file(open_file_dma(fname, open_flags::ro).get0()).get0();
+        auto before = get_block_cache_stats();
+
+        // Concurrent reads of the same blocks through two files go to disk once.
+        auto r1 = f1.dma_read<char>(0, 2 * block);
+        auto r2 = f2.dma_read<char>(block / 2, block);
+        auto b1 = r1.get0();
+        auto b2 = r2.get0();
+        BOOST_REQUIRE(std::equal(b1.begin(), b1.end(), wbuf.get()));
+        BOOST_REQUIRE(std::equal(b2.begin(), b2.end(), wbuf.get() + block / 2));
+        auto after = get_block_cache_stats();
+        BOOST_REQUIRE_EQUAL(after.misses - before.misses, 2u);
+        BOOST_REQUIRE_EQUAL(after.joins - before.joins, 2u);
+
+        // Writes invalidate the blocks they touch.
+        std::fill(wbuf.get_write(), wbuf.get_write() + block, 'z');
+        f1.dma_write(0, wbuf.get(), block).get();
+        auto b3 = f2.dma_read<char>(0, 3 * block).get0();
+        BOOST_REQUIRE(std::equal(b3.begin(), b3.end(), wbuf.get()));
+        auto last = get_block_cache_stats();
+        BOOST_REQUIRE_EQUAL(last.misses - after.misses, 2u);
+        BOOST_REQUIRE_EQUAL(last.hits - after.hits, 1u);
+
+        f1.close().get();
+        f2.close().get();
+        remove_file(fname).get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_dma_read_ranges) {
+    return async([] {
+        auto fname = "testfile.tmp";
+        size_t size = 1024 * 1024 + 4096;
+        file f = open_file_dma(fname, open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto wbuf = temporary_buffer<char>::aligned(f.memory_dma_alignment(), size);
+        for (size_t i = 0; i < size; ++i) {
+            wbuf.get_write()[i] = char(i * 7);
+        }
+        f.dma_write(0, wbuf.get(), wbuf.size()).get();
+
+        std::vector<file_read_range> ranges = {
+            {1024 * 1024, 100},     // alone
+            {5000, 100},            // merged with the two below, out of order
+            {100, 100},
+            {150, 1000},            // overlapping
+            {1024 * 1024 + 4000, 1000}, // crosses EOF
+            {7, 0},
+        };
+        auto reads_before = engine().get_io_stats().aio_reads;
+        auto bufs = f.dma_read_ranges<char>(ranges, 8192).get0();
+        // One read for the ranges near the start, one for those near the end,
+        // and one to find EOF.
+        BOOST_REQUIRE_LE(engine().get_io_stats().aio_reads - reads_before, 3u);
+        BOOST_REQUIRE_EQUAL(bufs.size(), ranges.size());
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            auto expected = std::min<size_t>(ranges[i].len, size - std::min<size_t>(ranges[i].pos, size));
+            BOOST_REQUIRE_EQUAL(bufs[i].size(), expected);
+            BOOST_REQUIRE(std::equal(bufs[i].begin(), bufs[i].end(), wbuf.get() + ranges[i].pos));
+        }
+
+        // Ranges all within max_gap of each other are still not merged
+        // into reads longer than the device takes.
+        ranges.clear();
+        for (size_t pos = 0; pos + 4096 <= 1024 * 1024; pos += 8192) {
+            ranges.push_back({pos, 4096});
+        }
+        auto max_length = f.disk_read_max_length();
+        reads_before = engine().get_io_stats().aio_reads;
+        bufs = f.dma_read_ranges<char>(ranges, 8192).get0();
+        auto reads = engine().get_io_stats().aio_reads - reads_before;
+        BOOST_REQUIRE_GE(reads, 1024 * 1024 / max_length);
+        BOOST_REQUIRE_LE(reads, 1024 * 1024 / max_length + 1);
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            BOOST_REQUIRE_EQUAL(bufs[i].size(), ranges[i].len);
+            BOOST_REQUIRE(std::equal(bufs[i].begin(), bufs[i].end(), wbuf.get() + ranges[i].pos));
+        }
+
+        f.close().get();
+        remove_file(fname).get();
+    });
+}
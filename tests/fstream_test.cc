@@ -506,3 +506,238 @@ SEASTAR_TEST_CASE(test_fstream_slow_start) {
         read_while_file_at_full_speed(make_fstream());
     });
 }
+
+SEASTAR_TEST_CASE(test_fstream_strided_read_ahead) {
+    return seastar::async([] {
+        static constexpr size_t file_size = 16 * 1024 * 1024;
+        static constexpr size_t buffer_size = 8192;
+        static constexpr size_t stride = 64 * 1024;
+
+        auto mock_file = make_shared<mock_read_only_file>(file_size);
+        mock_file->set_expected_read_size(buffer_size);
+
+        file_input_stream_options options{};
+        options.buffer_size = buffer_size;
+        options.read_ahead = 1;
+        options.adaptive_read_ahead = true;
+        auto fstr = make_file_input_stream(file(mock_file), 0, file_size, options);
+        auto strided_before = engine().get_io_stats().fstream_strided_read_aheads;
+
+        // Learning the pattern: the read-ahead gets discarded.
+        for (int i = 0; i < 3; ++i) {
+            mock_file->set_allowed_read_requests(2);
+            BOOST_REQUIRE_EQUAL(fstr.read_exactly(1000).get0().size(), 1000u);
+            fstr.skip(stride - 1000).get();
+        }
+        // Then only what will be consumed is read, one buffer per stride.
+        for (int i = 0; i < 100; ++i) {
+            mock_file->set_allowed_read_requests(1);
+            BOOST_REQUIRE_EQUAL(fstr.read_exactly(1000).get0().size(), 1000u);
+            fstr.skip(stride - 1000).get();
+        }
+        BOOST_REQUIRE_GE(engine().get_io_stats().fstream_strided_read_aheads - strided_before, 100u);
+
+        // Reading contiguously again breaks the pattern.
+        mock_file->set_allowed_read_requests(std::numeric_limits<size_t>::max());
+        BOOST_REQUIRE_EQUAL(fstr.read_exactly(3 * buffer_size).get0().size(), 3 * buffer_size);
+        fstr.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_reverse_scan_prefetch) {
+    return seastar::async([] {
+        static constexpr size_t file_size = 16 * 1024 * 1024;
+        static constexpr size_t buffer_size = 8192;
+        static constexpr size_t stride = 64 * 1024;
+
+        auto mock_file = make_shared<mock_read_only_file>(file_size);
+        mock_file->set_expected_read_size(buffer_size);
+        mock_file->set_allowed_read_requests(std::numeric_limits<size_t>::max());
+
+        file_input_stream_options options{};
+        options.buffer_size = buffer_size;
+        options.read_ahead = 1;
+        options.adaptive_read_ahead = true;
+        options.dynamic_adjustments = make_lw_shared<file_input_stream_history>();
+        auto hits_before = engine().get_io_stats().fstream_prefetch_hits;
+
+        // It takes three streams to see them open at a constant distance, so
+        // streams 4 to 10 find their first buffer prefetched by their predecessor.
+        for (int i = 20; i > 10; --i) {
+            auto fstr = make_file_input_stream(file(mock_file), i * stride, buffer_size, options);
+            BOOST_REQUIRE_EQUAL(fstr.read_exactly(buffer_size).get0().size(), buffer_size);
+            fstr.close().get();
+        }
+        BOOST_REQUIRE_EQUAL(engine().get_io_stats().fstream_prefetch_hits - hits_before, 7u);
+
+        // The last stream prefetched for an eleventh one, which is not opened before
+        // the history is closed. Closing it waits for that read and drops it, and
+        // stops prefetching.
+        options.dynamic_adjustments->close().get();
+        auto prefetches = engine().get_io_stats().fstream_prefetches;
+        auto hits = engine().get_io_stats().fstream_prefetch_hits;
+        mock_file->set_allowed_read_requests(0);
+        auto fstr = make_file_input_stream(file(mock_file), 10 * stride, 0, options);
+        fstr.close().get();
+        BOOST_REQUIRE_EQUAL(engine().get_io_stats().fstream_prefetches, prefetches);
+        BOOST_REQUIRE_EQUAL(engine().get_io_stats().fstream_prefetch_hits, hits);
+    });
+}
+
+// The consumer keeps waiting for the only buffer read ahead. Expected the buffers
+// to grow instead, until the read-ahead would exceed the budget.
+SEASTAR_TEST_CASE(test_fstream_read_ahead_budget) {
+    return seastar::async([] {
+        static constexpr size_t file_size = 4 * 1024 * 1024;
+        static constexpr size_t buffer_size = 8192;
+        static constexpr size_t budget = 128 * 1024;
+
+        auto mock_file = make_shared<mock_read_only_file>(file_size);
+        mock_file->set_allowed_read_requests(std::numeric_limits<size_t>::max());
+        mock_file->set_deferred_reads(true);
+        size_t max_read = 0;
+        mock_file->set_read_size_verifier([&max_read] (size_t length) {
+            max_read = std::max(max_read, length);
+        });
+
+        file_input_stream_options options{};
+        options.buffer_size = buffer_size;
+        options.read_ahead = 1;
+        options.read_ahead_budget = budget;
+        auto fstr = make_file_input_stream(file(mock_file), 0, file_size, options);
+        size_t total = 0;
+        while (auto buf = fstr.read().get0()) {
+            total += buf.size();
+        }
+        fstr.close().get();
+        BOOST_REQUIRE_EQUAL(total, file_size);
+        // The buffer doubles while the one being consumed and the one read ahead
+        // fit twice in the budget: 8k, 16k, 32k, then 64k.
+        BOOST_REQUIRE_EQUAL(max_read, budget / 2);
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_coalesced_writes) {
+    return seastar::async([] {
+        static constexpr size_t record_size = 1000;
+        static constexpr size_t records = 5000;
+
+        auto f = open_file_dma("testfile.tmp",
+                open_flags::rw | open_flags::create | open_flags::truncate | open_flags::dsync).get0();
+        file_output_stream_options options;
+        options.buffer_size = 4096;
+        options.write_behind = 4;
+        options.max_write_size = 64 * 1024;
+        options.preallocation_size = 256 * 1024;
+        options.dsync = true;
+        auto out = make_file_output_stream(std::move(f), options);
+        sstring record(record_size, '\0');
+        for (size_t i = 0; i < records; ++i) {
+            std::fill(record.begin(), record.end(), 'a' + i % 26);
+            out.write(record).get();
+        }
+        out.flush().get();
+        out.close().get();
+
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), record_size * records);
+        auto in = make_file_input_stream(std::move(f));
+        for (size_t i = 0; i < records; ++i) {
+            auto buf = in.read_exactly(record_size).get0();
+            BOOST_REQUIRE_EQUAL(buf.size(), record_size);
+            BOOST_REQUIRE(std::all_of(buf.begin(), buf.end(), [i] (char c) { return c == char('a' + i % 26); }));
+        }
+        in.close().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_write_coalescing) {
+    return seastar::async([] {
+        static constexpr size_t buffer_size = 4096;
+        static constexpr size_t max_write_size = 64 * 1024;
+        static constexpr size_t buffers = 1000;
+
+        auto mock_file = make_shared<mock_write_file>();
+        file_output_stream_options options;
+        options.buffer_size = buffer_size;
+        options.write_behind = 2;
+        options.max_write_size = max_write_size;
+        auto out = make_file_output_stream(file(mock_file), options);
+        sstring buf(buffer_size, '\0');
+        for (size_t i = 0; i < buffers; ++i) {
+            std::fill(buf.begin(), buf.end(), 'a' + i % 26);
+            out.write(buf).get();
+        }
+        out.close().get();
+
+        // Buffers written while both slots were busy went out together.
+        auto& writes = mock_file->writes();
+        BOOST_REQUIRE_LT(writes.size(), buffers / 4);
+        for (auto& w : writes) {
+            BOOST_REQUIRE_LE(w.len, max_write_size);
+        }
+        auto& data = mock_file->data();
+        BOOST_REQUIRE_EQUAL(data.size(), buffers * buffer_size);
+        for (size_t i = 0; i < buffers; ++i) {
+            BOOST_REQUIRE(std::all_of(data.begin() + i * buffer_size, data.begin() + (i + 1) * buffer_size,
+                    [i] (char c) { return c == char('a' + i % 26); }));
+        }
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_preallocation_past_end_only) {
+    return seastar::async([] {
+        static constexpr size_t chunk = 64 * 1024;
+        static constexpr size_t initial_size = 100 * 1024;
+
+        auto mock_file = seastar::make_shared<mock_write_file>(std::vector<char>(initial_size, 'x'));
+        file_output_stream_options options;
+        options.buffer_size = 4096;
+        options.preallocation_size = chunk;
+        auto out = make_file_output_stream(file(mock_file), options);
+        out.write(sstring(200 * 1024 + 100, 'y')).get();
+        out.close().get();
+
+        // Nothing holding data was preallocated, and what was preallocated
+        // past the final end of the file was given back.
+        size_t final_size = 200 * 1024 + 100;
+        BOOST_REQUIRE_EQUAL(mock_file->data().size(), final_size);
+        BOOST_REQUIRE(!mock_file->allocations().empty());
+        uint64_t preallocated = 0;
+        for (auto& a : mock_file->allocations()) {
+            BOOST_REQUIRE_GE(a.pos, initial_size);
+            preallocated = std::max(preallocated, a.pos + a.len);
+        }
+        BOOST_REQUIRE_EQUAL(mock_file->discards().size(), 1u);
+        BOOST_REQUIRE_EQUAL(mock_file->discards().front().pos, final_size);
+        BOOST_REQUIRE_EQUAL(mock_file->discards().front().pos + mock_file->discards().front().len, preallocated);
+    });
+}
+
+SEASTAR_TEST_CASE(test_fstream_overwrite_prefix_keeps_tail) {
+    return seastar::async([] {
+        static constexpr size_t file_size = 2 * 1024 * 1024;
+        static constexpr size_t prefix_size = 4096;
+
+        auto f = open_file_dma("testfile.tmp", open_flags::rw | open_flags::create | open_flags::truncate).get0();
+        auto out = make_file_output_stream(std::move(f));
+        out.write(sstring(file_size, 'x')).get();
+        out.close().get();
+
+        f = open_file_dma("testfile.tmp", open_flags::rw).get0();
+        file_output_stream_options options;
+        options.preallocation_size = 1024 * 1024;
+        out = make_file_output_stream(std::move(f), options);
+        out.write(sstring(prefix_size, 'y')).get();
+        out.close().get();
+
+        f = open_file_dma("testfile.tmp", open_flags::ro).get0();
+        BOOST_REQUIRE_EQUAL(f.size().get0(), file_size);
+        auto in = make_file_input_stream(std::move(f));
+        auto buf = in.read_exactly(file_size).get0();
+        BOOST_REQUIRE_EQUAL(buf.size(), file_size);
+        BOOST_REQUIRE(std::all_of(buf.begin(), buf.begin() + prefix_size, [] (char c) { return c == 'y'; }));
+        BOOST_REQUIRE(std::all_of(buf.begin() + prefix_size, buf.end(), [] (char c) { return c == 'x'; }));
+        in.close().get();
+    });
+}
@@ -18,6 +18,8 @@
 #include "util/noncopyable_function.hh"
 #include "http/json_path.hh"
 #include <sstream>
+#include <fstream>
+#include <random>
 
 using namespace seastar;
 using namespace httpd;
@@ -579,6 +581,49 @@ SEASTAR_TEST_CASE(test_http_client_server_full) {
     return test_client_server::run(tests);
 }
 
+// Serves a file over a real socket, so that the file handler takes the
+// sendfile(2) path.  The size is not a multiple of the 4096 byte block size,
+// which sendfile(2) on an O_DIRECT file would trip over.
+SEASTAR_TEST_CASE(test_file_handler_send_file) {
+    return seastar::async([] {
+        const size_t file_size = 3 * 4096 + 1000;
+        std::string content;
+        for (size_t i = 0; i < file_size; i++) {
+            content.push_back('a' + i % 26);
+        }
+        sstring filename = sprint("/tmp/httpd_test_send_file.%d", ::getpid());
+        {
+            std::ofstream out(filename.c_str(), std::ios::binary);
+            out << content;
+        }
+
+        std::random_device rnd;
+        auto port = std::uniform_int_distribution<uint16_t>(12000, 65000)(rnd);
+        http_server server("test");
+        server._routes.put(GET, "/file", new file_handler(filename, nullptr, false));
+        server.listen(ipv4_addr("127.0.0.1", port)).get();
+
+        connected_socket c_socket = engine().net().connect(make_ipv4_address(ipv4_addr("127.0.0.1", port))).get0();
+        input_stream<char> input(c_socket.input());
+        output_stream<char> output(c_socket.output());
+        output.write(sstring("GET /file HTTP/1.1\r\nHost: localhost\r\n\r\n")).get();
+        output.flush().get();
+        http_consumer htp;
+        repeat([&input, &htp] {
+            return input.read().then([&htp] (const temporary_buffer<char>& b) {
+                return (b.size() == 0 || htp.read(b)) ? stop_iteration::yes : stop_iteration::no;
+            });
+        }).get();
+        BOOST_REQUIRE_EQUAL(htp._size, file_size);
+        BOOST_REQUIRE(htp._body == content);
+
+        output.close().get();
+        input.close().get();
+        server.stop().get();
+        ::unlink(filename.c_str());
+    });
+}
+
 /*
  * return string in the given size
  * The string size takes the quotes into consideration.
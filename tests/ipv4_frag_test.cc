@@ -0,0 +1,320 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+#include "test-utils.hh"
+#include "core/metrics_api.hh"
+#include "core/reactor.hh"
+#include "core/sleep.hh"
+#include "core/thread.hh"
+#include "core/byteorder.hh"
+#include "net/ip.hh"
+#include "net/ip_checksum.hh"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace seastar;
+using namespace net;
+
+// A device that drops whatever the stack sends; the tests hand it the
+// fragments to receive.
+class test_device : public net::device {
+    class test_qp : public net::qp {
+    public:
+        virtual future<> send(packet p) override {
+            return make_ready_future<>();
+        }
+    };
+public:
+    ethernet_address hw_address() override {
+        return { 0x12, 0x23, 0x34, 0x56, 0x67, 0x78 };
+    }
+    net::hw_features hw_features() override {
+        return net::hw_features();
+    }
+    virtual std::unique_ptr<net::qp> init_local_queue(boost::program_options::variables_map opts, uint16_t qid) override {
+        return std::make_unique<test_qp>();
+    }
+};
+
+// Collects the reassembled datagrams.
+struct test_protocol : public ip_protocol {
+    std::vector<packet> datagrams;
+    virtual void received(packet p, ipv4_address from, ipv4_address to) override {
+        datagrams.push_back(std::move(p));
+    }
+};
+
+// Reserved for experimentation (RFC 3692)
+static constexpr uint8_t test_proto = 253;
+static const ipv4_address src_addr("10.0.0.1");
+static const ipv4_address host_addr("10.0.0.2");
+
+// As in ipv4
+static constexpr uint32_t frag_low_thresh = 3 * 1024 * 1024;
+static constexpr uint32_t frag_high_thresh = 4 * 1024 * 1024;
+static constexpr unsigned frag_max = 1024;
+
+struct test_stack {
+    std::shared_ptr<test_device> dev;
+    interface netif;
+    ipv4 inet;
+    test_protocol proto;
+
+    test_stack()
+        : dev(make_device())
+        , netif(dev)
+        , inet(&netif) {
+        inet.set_host_address(host_addr);
+        inet.register_l4(test_proto, &proto);
+    }
+    static std::shared_ptr<test_device> make_device() {
+        auto dev = std::make_shared<test_device>();
+        dev->set_local_queue(dev->init_local_queue({}, 0));
+        return dev;
+    }
+};
+
+static test_stack& stack() {
+    // The device queue lives until the reactor is destroyed, and keeps
+    // polling the stack, so the stack is never destroyed either.
+    static test_stack* s = new test_stack;
+    return *s;
+}
+
+static char payload_byte(uint16_t id, unsigned off) {
+    return char(id * 13 + off * 7);
+}
+
+static void receive_fragment(uint16_t id, unsigned offset, unsigned len, bool mf, ipv4_address src = src_addr) {
+    std::vector<char> buf(sizeof(eth_hdr) + ipv4_hdr_len_min + len);
+    auto h = buf.data();
+    write_be<uint16_t>(h + 12, uint16_t(eth_protocol_num::ipv4));
+    auto ih = h + sizeof(eth_hdr);
+    ih[0] = 0x45;
+    write_be<uint16_t>(ih + 2, ipv4_hdr_len_min + len);
+    write_be<uint16_t>(ih + 4, id);
+    write_be<uint16_t>(ih + 6, (mf << uint8_t(ip_hdr::frag_bits::mf)) | offset / 8);
+    ih[8] = 64;
+    ih[9] = test_proto;
+    write_be<uint32_t>(ih + 12, src.ip);
+    write_be<uint32_t>(ih + 16, host_addr.ip);
+    auto csum = ip_checksum(ih, ipv4_hdr_len_min);
+    std::copy_n(reinterpret_cast<const char*>(&csum), sizeof(csum), ih + 10);
+    for (unsigned i = 0; i < len; i++) {
+        ih[ipv4_hdr_len_min + i] = payload_byte(id, offset + i);
+    }
+    stack().dev->l2receive(packet(buf.data(), buf.size()));
+}
+
+static void check_datagram(packet& p, uint16_t id, unsigned len) {
+    BOOST_REQUIRE_EQUAL(p.len(), len);
+    p.linearize();
+    auto data = p.get_header(0, len);
+    for (unsigned i = 0; i < len; i++) {
+        BOOST_REQUIRE_EQUAL(data[i], payload_byte(id, i));
+    }
+}
+
+static double metric(sstring name) {
+    auto& values = metrics::impl::get_value_map();
+    auto family = values.find("ipv4_" + name);
+    BOOST_REQUIRE(family != values.end());
+    double ret = 0;
+    for (auto&& instance : family->second) {
+        ret += (*instance.second)().d();
+    }
+    return ret;
+}
+
+// Drops the datagrams the previous tests left incomplete.
+static void start_empty() {
+    auto& s = stack();
+    s.inet.set_frag_timeout(std::chrono::milliseconds(1));
+    sleep(std::chrono::milliseconds(50)).get();
+    s.inet.set_frag_timeout(std::chrono::seconds(30));
+    s.proto.datagrams.clear();
+    BOOST_REQUIRE_EQUAL(metric("reassembly_memory"), 0);
+}
+
+SEASTAR_TEST_CASE(test_out_of_order_reassembly) {
+    return seastar::async([] {
+        start_empty();
+        auto& datagrams = stack().proto.datagrams;
+        auto reassembled = metric("reassembled");
+        const ipv4_address other_src("10.0.0.3");
+
+        // Two datagrams with the same identification but from different
+        // hosts, their fragments interleaved, shuffled and duplicated.
+        receive_fragment(1, 2960, 1480, true);
+        receive_fragment(1, 4440, 1000, false, other_src);
+        receive_fragment(1, 5920, 1000, false);
+        receive_fragment(1, 0, 1480, true, other_src);
+        receive_fragment(1, 0, 1480, true);
+        receive_fragment(1, 2960, 1480, true);
+        receive_fragment(1, 4440, 1480, true);
+        receive_fragment(1, 2960, 1480, true, other_src);
+        BOOST_REQUIRE(datagrams.empty());
+        receive_fragment(1, 1480, 1480, true);
+        BOOST_REQUIRE_EQUAL(datagrams.size(), 1u);
+        check_datagram(datagrams[0], 1, 6920);
+        receive_fragment(1, 1480, 1480, true, other_src);
+        BOOST_REQUIRE_EQUAL(datagrams.size(), 2u);
+        check_datagram(datagrams[1], 1, 5440);
+
+        BOOST_REQUIRE_EQUAL(metric("reassembled"), reassembled + 2);
+        BOOST_REQUIRE_EQUAL(metric("reassembly_memory"), 0);
+    });
+}
+
+SEASTAR_TEST_CASE(test_reassembly_timeout) {
+    return seastar::async([] {
+        start_empty();
+        auto& s = stack();
+        auto timeouts = metric("reassembly_timeouts");
+
+        s.inet.set_frag_timeout(std::chrono::milliseconds(200));
+        receive_fragment(2, 0, 1480, true);
+        sleep(std::chrono::milliseconds(150)).get();
+        receive_fragment(3, 0, 1480, true);
+        sleep(std::chrono::milliseconds(100)).get();
+        // Only the older datagram timed out
+        BOOST_REQUIRE_EQUAL(metric("reassembly_timeouts"), timeouts + 1);
+        receive_fragment(3, 1480, 100, false);
+        BOOST_REQUIRE_EQUAL(s.proto.datagrams.size(), 1u);
+        check_datagram(s.proto.datagrams[0], 3, 1580);
+        // The fragments of the timed out one start over
+        receive_fragment(2, 1480, 100, false);
+        BOOST_REQUIRE_EQUAL(s.proto.datagrams.size(), 1u);
+        BOOST_REQUIRE(metric("reassembly_memory") > 0);
+        sleep(std::chrono::milliseconds(300)).get();
+        BOOST_REQUIRE_EQUAL(metric("reassembly_timeouts"), timeouts + 2);
+        BOOST_REQUIRE_EQUAL(metric("reassembly_memory"), 0);
+        s.inet.set_frag_timeout(std::chrono::seconds(30));
+    });
+}
+
+SEASTAR_TEST_CASE(test_full_pool_evicts_oldest) {
+    return seastar::async([] {
+        start_empty();
+        auto& datagrams = stack().proto.datagrams;
+        auto evictions = metric("reassembly_evictions");
+
+        for (unsigned id = 0; id <= frag_max; id++) {
+            receive_fragment(id, 0, 8, true);
+        }
+        BOOST_REQUIRE_EQUAL(metric("reassembly_evictions"), evictions + 1);
+        for (unsigned id = 1; id <= frag_max; id++) {
+            receive_fragment(id, 8, 8, false);
+            BOOST_REQUIRE_EQUAL(datagrams.size(), id);
+            check_datagram(datagrams.back(), id, 16);
+        }
+        // The first one was evicted
+        receive_fragment(0, 8, 8, false);
+        BOOST_REQUIRE_EQUAL(datagrams.size(), frag_max);
+        BOOST_REQUIRE_EQUAL(metric("reassembly_evictions"), evictions + 1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_memory_limit_keeps_datagram_in_progress) {
+    return seastar::async([] {
+        start_empty();
+        auto& datagrams = stack().proto.datagrams;
+        auto evictions = metric("reassembly_evictions");
+        const unsigned frag_len = 1480;
+
+        // The datagram to complete is the oldest one, first in line for eviction.
+        const uint16_t kept = 100;
+        receive_fragment(kept, frag_len, frag_len, true);
+        // Fill up to just below the limit with datagrams missing their first
+        // and last fragments.
+        uint16_t id = kept + 1;
+        while (metric("reassembly_memory") + 16 * 1024 <= frag_high_thresh) {
+            for (unsigned i = 1; i <= 10; i++) {
+                receive_fragment(id, i * frag_len, frag_len, true);
+            }
+            id++;
+        }
+        BOOST_REQUIRE_EQUAL(metric("reassembly_evictions"), evictions);
+        const uint16_t newest = id - 1;
+
+        unsigned offset = 2 * frag_len;
+        while (metric("reassembly_evictions") == evictions) {
+            BOOST_REQUIRE(offset + frag_len < ip_packet_len_max - ipv4_hdr_len_min);
+            receive_fragment(kept, offset, frag_len, true);
+            offset += frag_len;
+        }
+        BOOST_REQUIRE(metric("reassembly_memory") <= frag_low_thresh);
+
+        receive_fragment(kept, 0, frag_len, true);
+        receive_fragment(kept, offset, 100, false);
+        BOOST_REQUIRE_EQUAL(datagrams.size(), 1u);
+        check_datagram(datagrams[0], kept, offset + 100);
+
+        // The newest datagrams were not evicted
+        receive_fragment(newest, 0, frag_len, true);
+        receive_fragment(newest, 11 * frag_len, 100, false);
+        BOOST_REQUIRE_EQUAL(datagrams.size(), 2u);
+        check_datagram(datagrams[1], newest, 11 * frag_len + 100);
+    });
+}
+
+SEASTAR_TEST_CASE(test_index_deletion_under_collisions) {
+    return seastar::async([] {
+        start_empty();
+        auto& datagrams = stack().proto.datagrams;
+        auto reassembled = metric("reassembled");
+        auto evictions = metric("reassembly_evictions");
+        std::default_random_engine rnd;
+
+        // With this many datagrams in the index, whatever its hash seed,
+        // probe sequences are long, and entries get removed from their
+        // middle.  A datagram whose entry got lost would never complete.
+        std::vector<uint16_t> ids;
+        auto add = [&] (unsigned n) {
+            for (unsigned i = 0; i < n; i++) {
+                auto id = 1000 + ids.size();
+                receive_fragment(id, 0, 8, true);
+                ids.push_back(id);
+            }
+            std::shuffle(ids.begin(), ids.end(), rnd);
+        };
+        auto complete = [&] (unsigned n) {
+            for (unsigned i = 0; i < n; i++) {
+                auto id = ids.back();
+                ids.pop_back();
+                receive_fragment(id, 8, 8, false);
+                BOOST_REQUIRE_EQUAL(datagrams.size(), 1u);
+                check_datagram(datagrams[0], id, 16);
+                datagrams.clear();
+            }
+        };
+        add(1000);
+        complete(500);
+        // Reuses the freed entries and holes in the index
+        add(500);
+        complete(1000);
+
+        BOOST_REQUIRE_EQUAL(metric("reassembled"), reassembled + 1500);
+        BOOST_REQUIRE_EQUAL(metric("reassembly_evictions"), evictions);
+        BOOST_REQUIRE_EQUAL(metric("reassembly_memory"), 0);
+    });
+}
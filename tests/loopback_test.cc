@@ -0,0 +1,324 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+// Exercises the native stack over the loopback device, talking to itself.
+// Meant to run with a lossy device, e.g.:
+//
+//   loopback_test --network-stack native --loopback-device --dhcp 0 --loopback-loss 0.02 --loopback-reorder 0.02 --tcp-connection-metrics 1
+
+#include "core/app-template.hh"
+#include "core/distributed.hh"
+#include "core/future-util.hh"
+#include "core/metrics_api.hh"
+#include "core/print.hh"
+#include "core/reactor.hh"
+#include "core/sleep.hh"
+#include "core/thread.hh"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+using namespace seastar;
+using namespace net;
+using namespace std::chrono_literals;
+
+static constexpr uint16_t tcp_port = 10000;
+static constexpr uint16_t udp_server_port = 10001;
+static constexpr uint16_t udp_client_port = 10002;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        throw std::runtime_error(what);
+    }
+}
+
+static char pattern(size_t pos, unsigned seed) {
+    return 'a' + (pos + seed) % 26;
+}
+
+// Sums a metric over all its instances on all shards.
+static double metric_total(sstring name) {
+    auto cpus = smp::all_cpus();
+    return map_reduce(cpus.begin(), cpus.end(), [name] (unsigned cpu) {
+        return smp::submit_to(cpu, [name] {
+            auto& values = metrics::impl::get_value_map();
+            auto family = values.find(name);
+            double total = 0;
+            if (family != values.end()) {
+                for (auto&& instance : family->second) {
+                    total += (*instance.second)().d();
+                }
+            }
+            return total;
+        });
+    }, 0.0, std::plus<double>()).get0();
+}
+
+// Returns the values of all instances of a metric on all shards.
+static std::vector<double> metric_values(sstring name) {
+    std::vector<double> ret;
+    for (auto cpu : smp::all_cpus()) {
+        auto values = smp::submit_to(cpu, [name] {
+            auto& values = metrics::impl::get_value_map();
+            auto family = values.find(name);
+            std::vector<double> ret;
+            if (family != values.end()) {
+                for (auto&& instance : family->second) {
+                    ret.push_back((*instance.second)().d());
+                }
+            }
+            return ret;
+        }).get0();
+        ret.insert(ret.end(), values.begin(), values.end());
+    }
+    return ret;
+}
+
+// Echoes every TCP connection on tcp_port, and every UDP datagram on
+// udp_server_port.  Replies to udp_client_port are checked here, on whichever
+// shard they arrive, and recorded on shard 0.
+class echo_service {
+    server_socket _listener;
+    udp_channel _udp_server;
+    udp_channel _udp_client;
+    future<> _accepting = make_ready_future<>();
+    future<> _udp_serving = make_ready_future<>();
+    future<> _udp_receiving = make_ready_future<>();
+public:
+    static thread_local std::set<unsigned> udp_replies;
+    static thread_local unsigned udp_bad_replies;
+    static constexpr size_t udp_datagram_size = 4000;
+
+    future<> start() {
+        listen_options lo;
+        lo.reuse_address = true;
+        _listener = engine().listen(make_ipv4_address({tcp_port}), lo);
+        _accepting = keep_doing([this] {
+            return _listener.accept().then([] (connected_socket s, socket_address) {
+                // In the background; a connection ends when its peer closes it
+                serve(std::move(s));
+            });
+        }).handle_exception([] (auto ep) {});
+        _udp_server = engine().net().make_udp_channel(ipv4_addr{udp_server_port});
+        _udp_serving = keep_doing([this] {
+            return _udp_server.receive().then([this] (udp_datagram dgram) {
+                return _udp_server.send(dgram.get_src(), std::move(dgram.get_data()));
+            });
+        }).handle_exception([] (auto ep) {});
+        _udp_client = engine().net().make_udp_channel(ipv4_addr{udp_client_port});
+        _udp_receiving = keep_doing([this] {
+            return _udp_client.receive().then([] (udp_datagram dgram) {
+                auto& p = dgram.get_data();
+                p.linearize();
+                auto data = p.frag(0).base;
+                auto seq = p.len() >= sizeof(unsigned) ? *reinterpret_cast<const unsigned*>(data) : 0;
+                bool ok = p.len() == udp_datagram_size;
+                for (size_t i = sizeof(unsigned); ok && i < p.len(); i++) {
+                    ok = data[i] == pattern(i, seq);
+                }
+                return smp::submit_to(0, [seq, ok] {
+                    if (ok) {
+                        udp_replies.insert(seq);
+                    } else {
+                        udp_bad_replies++;
+                    }
+                });
+            });
+        }).handle_exception([] (auto ep) {});
+        return make_ready_future<>();
+    }
+    future<> stop() {
+        _listener.abort_accept();
+        _udp_server.close();
+        _udp_client.close();
+        return when_all(std::move(_accepting), std::move(_udp_serving), std::move(_udp_receiving)).discard_result();
+    }
+    future<> send_datagram(ipv4_addr to, unsigned seq) {
+        temporary_buffer<char> buf(udp_datagram_size);
+        *reinterpret_cast<unsigned*>(buf.get_write()) = seq;
+        for (size_t i = sizeof(unsigned); i < buf.size(); i++) {
+            buf.get_write()[i] = pattern(i, seq);
+        }
+        return _udp_client.send(to, packet(fragment{buf.get_write(), buf.size()}, buf.release()));
+    }
+private:
+    static void serve(connected_socket s) {
+        auto in = s.input();
+        auto out = s.output();
+        do_with(std::move(s), std::move(in), std::move(out), [] (auto& s, auto& in, auto& out) {
+            return copy(in, out).then([&out] {
+                return out.close();
+            }).then([&in] {
+                return in.close();
+            });
+        }).handle_exception([] (auto ep) {
+            print("echo connection failed: %s\n", ep);
+        });
+    }
+};
+
+thread_local std::set<unsigned> echo_service::udp_replies;
+thread_local unsigned echo_service::udp_bad_replies;
+constexpr size_t echo_service::udp_datagram_size;
+
+// Sends size bytes over a connection to the echo service, and checks that
+// the same bytes come back.
+static void test_tcp_echo(ipv4_addr server, size_t size, unsigned seed) {
+    auto s = engine().net().connect(make_ipv4_address(server)).get0();
+    auto in = s.input();
+    auto out = s.output();
+    auto writer = seastar::async([&out, size, seed] {
+        const size_t chunk = 10000;
+        for (size_t pos = 0; pos < size; pos += chunk) {
+            temporary_buffer<char> buf(std::min(chunk, size - pos));
+            for (size_t i = 0; i < buf.size(); i++) {
+                buf.get_write()[i] = pattern(pos + i, seed);
+            }
+            out.write(std::move(buf)).get();
+        }
+        out.close().get();
+    });
+    size_t received = 0;
+    while (true) {
+        auto buf = in.read().get0();
+        if (buf.empty()) {
+            break;
+        }
+        for (size_t i = 0; i < buf.size(); i++) {
+            check(buf[i] == pattern(received + i, seed), "TCP echo: corrupted data");
+        }
+        received += buf.size();
+    }
+    writer.get();
+    in.close().get();
+    check(received == size, "TCP echo: short reply");
+}
+
+// Sends data until a window loses several segments, and checks that SACK
+// repairs them in one recovery, without waiting for a retransmission timeout.
+static void test_sack_recovery(ipv4_addr server) {
+    auto recoveries = metric_total("tcp_sack_recoveries");
+    auto blocks = metric_total("tcp_sack_blocks_sent");
+    for (unsigned round = 1; metric_total("tcp_sack_recoveries") == recoveries; round++) {
+        check(round <= 20, "SACK: no loss of several segments was recovered without a timeout");
+        test_tcp_echo(server, 1024 * 1024, round);
+    }
+    check(metric_total("tcp_sack_blocks_sent") > blocks, "SACK: no SACK blocks were sent");
+}
+
+// Checks the per-connection metrics of both ends of an open connection: they
+// negotiated timestamps, which come out of the MSS, and the RTO is no lower
+// than --tcp-rto-min. Then checks the metrics go away with the connection.
+static void test_connection_metrics(ipv4_addr server, unsigned rto_min) {
+    auto s = engine().net().connect(make_ipv4_address(server)).get0();
+    auto in = s.input();
+    auto out = s.output();
+    out.write("x").get();
+    out.flush().get();
+    // Echoed, so both ends are established and have measured the RTT.
+    check(in.read_exactly(1).get0().size() == 1, "connection metrics: no echo");
+
+    // Connections of the previous tests may still be closing; they are checked too.
+    auto mss = metric_values("tcp_connection_mss");
+    check(mss.size() >= 2, "connection metrics: not exported");
+    const unsigned expected_mss = 1500 - 20 - 20 - 12;
+    for (auto v : mss) {
+        check(v == expected_mss, "connection metrics: the MSS does not leave room for timestamps");
+    }
+    for (auto v : metric_values("tcp_connection_timestamps")) {
+        check(v == 1, "connection metrics: timestamps not negotiated");
+    }
+    auto rto = metric_values("tcp_connection_rto_ms");
+    for (auto v : rto) {
+        check(v >= rto_min, "connection metrics: RTO below --tcp-rto-min");
+    }
+    // Over the loopback device, the RTT is far below it.
+    check(*std::min_element(rto.begin(), rto.end()) == rto_min, "connection metrics: RTO not clamped to --tcp-rto-min");
+
+    out.close().get();
+    check(in.read().get0().empty(), "connection metrics: no FIN");
+    in.close().get();
+    for (unsigned attempt = 0; !metric_values("tcp_connection_mss").empty(); attempt++) {
+        check(attempt < 1000, "connection metrics: not removed with the connection");
+        sleep(10ms).get();
+    }
+}
+
+// Sends data until an ACK covers only retransmitted data, which gives no RTT
+// sample by Karn's algorithm, and checks the RTT was then measured from the
+// echoed timestamp.
+static void test_timestamp_rtt(ipv4_addr server) {
+    auto samples = metric_total("tcp_timestamp_rtt_samples");
+    for (unsigned round = 1; metric_total("tcp_timestamp_rtt_samples") == samples; round++) {
+        check(round <= 50, "timestamps: no RTT measured from retransmitted data");
+        test_tcp_echo(server, 1024 * 1024, round);
+    }
+}
+
+// Round trips datagrams larger than the MTU, so that they are fragmented both
+// ways, resending the ones whose fragments the device dropped.
+static void test_udp_fragments(distributed<echo_service>& service, ipv4_addr server) {
+    auto reassembled = metric_total("ipv4_reassembled");
+    const unsigned nr_datagrams = 20;
+    for (unsigned seq = 0; seq < nr_datagrams; seq++) {
+        for (unsigned attempt = 0; !echo_service::udp_replies.count(seq); attempt++) {
+            check(attempt < 100, "UDP: no reply");
+            service.local().send_datagram(server, seq).get();
+            sleep(10ms).get();
+        }
+    }
+    check(!echo_service::udp_bad_replies, "UDP: corrupted reply");
+    // Each reply, at least, was reassembled
+    check(metric_total("ipv4_reassembled") - reassembled >= nr_datagrams, "UDP: datagrams were not fragmented");
+}
+
+int main(int ac, char** av) {
+    app_template app;
+    return app.run(ac, av, [&app] {
+        return seastar::async([&app] {
+            auto& opts = app.configuration();
+            check(opts.count("loopback-device"), "run with --network-stack native --loopback-device --dhcp 0");
+            check(opts["tcp-connection-metrics"].as<bool>(), "run with --tcp-connection-metrics 1");
+            auto host = opts["host-ipv4-addr"].as<std::string>();
+            distributed<echo_service> service;
+            service.start().get();
+            service.invoke_on_all(&echo_service::start).get();
+            int ret = 0;
+            try {
+                test_tcp_echo(ipv4_addr(host, tcp_port), 256 * 1024, 0);
+                print("PASS: TCP echo\n");
+                test_sack_recovery(ipv4_addr(host, tcp_port));
+                print("PASS: SACK recovery\n");
+                test_timestamp_rtt(ipv4_addr(host, tcp_port));
+                print("PASS: RTT from timestamps\n");
+                test_connection_metrics(ipv4_addr(host, tcp_port), opts["tcp-rto-min"].as<unsigned>());
+                print("PASS: connection metrics\n");
+                test_udp_fragments(service, ipv4_addr(host, udp_server_port));
+                print("PASS: fragmented UDP round trip\n");
+            } catch (std::exception& e) {
+                print("FAIL: %s\n", e.what());
+                ret = 1;
+            }
+            service.stop().get();
+            return ret;
+        });
+    });
+}
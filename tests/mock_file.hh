@@ -25,6 +25,8 @@
 
 #include "test-utils.hh"
 #include "core/file.hh"
+#include "core/future-util.hh"
+#include <vector>
 
 namespace seastar {
 
@@ -32,6 +34,7 @@ class mock_read_only_file final : public file_impl {
     bool _closed = false;
     uint64_t _total_file_size;
     size_t _allowed_read_requests = 0;
+    bool _deferred_reads = false;
     std::function<void(size_t)> _verify_length;
 private:
     size_t verify_read(uint64_t position, size_t length) {
@@ -63,6 +66,10 @@ class mock_read_only_file final : public file_impl {
     void set_allowed_read_requests(size_t requests) {
         _allowed_read_requests = requests;
     }
+    // Complete reads in a later task, as a real disk would, instead of right away.
+    void set_deferred_reads(bool deferred) {
+        _deferred_reads = deferred;
+    }
 
     virtual future<size_t> write_dma(uint64_t, const void*, size_t, const io_priority_class&) override {
         throw std::bad_function_call();
@@ -71,12 +78,20 @@ class mock_read_only_file final : public file_impl {
         throw std::bad_function_call();
     }
     virtual future<size_t> read_dma(uint64_t pos, void*, size_t len, const io_priority_class&) override {
-        return make_ready_future<size_t>(verify_read(pos, len));
+        auto ret = make_ready_future<size_t>(verify_read(pos, len));
+        if (_deferred_reads) {
+            return later().then([ret = std::move(ret)] () mutable { return std::move(ret); });
+        }
+        return ret;
     }
     virtual future<size_t> read_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class&) override {
         auto length = boost::accumulate(iov | boost::adaptors::transformed([] (auto&& iov) { return iov.iov_len; }),
                                         size_t(0), std::plus<size_t>());
-        return make_ready_future<size_t>(verify_read(pos, length));
+        auto ret = make_ready_future<size_t>(verify_read(pos, length));
+        if (_deferred_reads) {
+            return later().then([ret = std::move(ret)] () mutable { return std::move(ret); });
+        }
+        return ret;
     }
     virtual future<> flush() override {
         return make_ready_future<>();
@@ -110,4 +125,100 @@ class mock_read_only_file final : public file_impl {
     }
 };
 
+// An in-memory file that records the writes, allocations and discards
+// made to it.  Writes complete on the next task, as real ones would not
+// complete immediately.
+class mock_write_file final : public file_impl {
+public:
+    struct range {
+        uint64_t pos;
+        uint64_t len;
+    };
+private:
+    std::vector<char> _data;
+    std::vector<range> _writes;
+    std::vector<range> _allocations;
+    std::vector<range> _discards;
+    bool _closed = false;
+    future<size_t> write(uint64_t pos, std::vector<iovec> iov) {
+        BOOST_CHECK(!_closed);
+        size_t len = 0;
+        for (auto& v : iov) {
+            len += v.iov_len;
+        }
+        if (_data.size() < pos + len) {
+            _data.resize(pos + len);
+        }
+        auto p = _data.begin() + pos;
+        for (auto& v : iov) {
+            p = std::copy_n(static_cast<const char*>(v.iov_base), v.iov_len, p);
+        }
+        _writes.push_back(range{pos, len});
+        return later().then([len] {
+            return len;
+        });
+    }
+public:
+    explicit mock_write_file(std::vector<char> data = {})
+        : _data(std::move(data)) {
+    }
+    const std::vector<char>& data() const {
+        return _data;
+    }
+    const std::vector<range>& writes() const {
+        return _writes;
+    }
+    const std::vector<range>& allocations() const {
+        return _allocations;
+    }
+    const std::vector<range>& discards() const {
+        return _discards;
+    }
+
+    virtual future<size_t> write_dma(uint64_t pos, const void* buffer, size_t len, const io_priority_class&) override {
+        return write(pos, { iovec{const_cast<void*>(buffer), len} });
+    }
+    virtual future<size_t> write_dma(uint64_t pos, std::vector<iovec> iov, const io_priority_class&) override {
+        return write(pos, std::move(iov));
+    }
+    virtual future<size_t> read_dma(uint64_t, void*, size_t, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+    virtual future<size_t> read_dma(uint64_t, std::vector<iovec>, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+    virtual future<> flush() override {
+        return make_ready_future<>();
+    }
+    virtual future<struct stat> stat() override {
+        throw std::bad_function_call();
+    }
+    virtual future<> truncate(uint64_t length) override {
+        _data.resize(length);
+        return make_ready_future<>();
+    }
+    virtual future<> discard(uint64_t offset, uint64_t length) override {
+        _discards.push_back(range{offset, length});
+        return make_ready_future<>();
+    }
+    virtual future<> allocate(uint64_t position, uint64_t length) override {
+        _allocations.push_back(range{position, length});
+        return make_ready_future<>();
+    }
+    virtual future<uint64_t> size() override {
+        return make_ready_future<uint64_t>(_data.size());
+    }
+    virtual future<> close() override {
+        BOOST_CHECK(!_closed);
+        _closed = true;
+        return make_ready_future<>();
+    }
+    virtual subscription<directory_entry> list_directory(std::function<future<> (directory_entry de)>) override {
+        throw std::bad_function_call();
+    }
+    virtual future<temporary_buffer<uint8_t>> dma_read_bulk(uint64_t, size_t, const io_priority_class&) override {
+        throw std::bad_function_call();
+    }
+};
+
 }
@@ -0,0 +1,250 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE net
+
+#include <boost/test/included/unit_test.hpp>
+#include "net/offload.hh"
+#include "net/ip_checksum.hh"
+#include "core/byteorder.hh"
+#include <vector>
+
+using namespace seastar;
+using namespace net;
+
+static constexpr size_t ip_off = 14;
+static constexpr size_t tcp_off = ip_off + 20;
+// NOP, NOP, timestamps
+static constexpr size_t tcp_len = 20 + 12;
+static constexpr size_t hdr_len = tcp_off + tcp_len;
+
+static constexpr uint8_t fin = 0x01;
+static constexpr uint8_t psh = 0x08;
+static constexpr uint8_t ack = 0x10;
+
+struct segment {
+    uint32_t seq;
+    size_t len;
+    uint8_t flags = ack;
+    uint16_t src_port = 1000;
+    uint32_t ack_seq = 77;
+    uint32_t tsval = 1;
+    // The MSS to split the frame at, if it is a TSO frame
+    uint16_t tso_seg_size = 0;
+};
+
+static char payload_byte(uint32_t seq) {
+    return char(seq * 7);
+}
+
+// Builds an Ethernet frame holding a TCP segment over IPv4, as the stack
+// hands them to the device.
+static packet make_frame(const segment& s) {
+    std::vector<char> buf(hdr_len + s.len);
+    auto h = buf.data();
+    write_be<uint16_t>(h + 12, 0x0800);
+    h[ip_off] = 0x45;
+    write_be<uint16_t>(h + ip_off + 2, 20 + tcp_len + s.len);
+    write_be<uint16_t>(h + ip_off + 4, 100);
+    h[ip_off + 8] = 64;
+    h[ip_off + 9] = 6;
+    write_be<uint32_t>(h + ip_off + 12, 0x0a000001);
+    write_be<uint32_t>(h + ip_off + 16, 0x0a000002);
+    auto csum = ip_checksum(h + ip_off, 20);
+    std::copy_n(reinterpret_cast<const char*>(&csum), sizeof(csum), h + ip_off + 10);
+    write_be<uint16_t>(h + tcp_off, s.src_port);
+    write_be<uint16_t>(h + tcp_off + 2, 2000);
+    write_be<uint32_t>(h + tcp_off + 4, s.seq);
+    write_be<uint32_t>(h + tcp_off + 8, s.ack_seq);
+    h[tcp_off + 12] = (tcp_len / 4) << 4;
+    h[tcp_off + 13] = s.flags;
+    write_be<uint16_t>(h + tcp_off + 14, 500);
+    h[tcp_off + 20] = 1;
+    h[tcp_off + 21] = 1;
+    h[tcp_off + 22] = 8;
+    h[tcp_off + 23] = 10;
+    write_be<uint32_t>(h + tcp_off + 24, s.tsval);
+    for (size_t i = 0; i < s.len; i++) {
+        h[hdr_len + i] = payload_byte(s.seq + i);
+    }
+    packet p(buf.data(), buf.size());
+    auto& oi = p.offload_info_ref();
+    oi.protocol = ip_protocol_num::tcp;
+    oi.tso_seg_size = s.tso_seg_size;
+    if (s.tso_seg_size) {
+        oi.needs_csum = true;
+    }
+    return p;
+}
+
+static const char* headers(packet& p) {
+    return p.get_header(0, hdr_len);
+}
+
+static uint32_t seq_of(packet& p) {
+    return read_be<uint32_t>(headers(p) + tcp_off + 4);
+}
+
+static uint8_t flags_of(packet& p) {
+    return headers(p)[tcp_off + 13];
+}
+
+// Checks the lengths and checksums of the frame, and that its payload is
+// what was sent at its sequence number.
+static void check_frame(packet& p) {
+    p.linearize();
+    auto h = p.get_header(0, p.len());
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(h + ip_off + 2), p.len() - ip_off);
+    BOOST_REQUIRE_EQUAL(ip_checksum(h + ip_off, 20), 0);
+    checksummer csum;
+    csum.sum(h + ip_off + 12, 8);
+    csum.sum_many(uint8_t(0), uint8_t(6), uint16_t(p.len() - tcp_off));
+    csum.sum(h + tcp_off, p.len() - tcp_off);
+    BOOST_REQUIRE_EQUAL(csum.get(), 0);
+    auto seq = read_be<uint32_t>(h + tcp_off + 4);
+    for (size_t i = hdr_len; i < p.len(); i++) {
+        BOOST_REQUIRE_EQUAL(h[i], payload_byte(seq + i - hdr_len));
+    }
+}
+
+static std::vector<packet> flush(software_gro& gro) {
+    std::vector<packet> ret;
+    gro.flush([&ret] (packet p) {
+        ret.push_back(std::move(p));
+    });
+    return ret;
+}
+
+BOOST_AUTO_TEST_CASE(test_tso_splits_64k_frame) {
+    const uint16_t mss = 1448;
+    const size_t len = 65536 - hdr_len;
+    circular_buffer<packet> out;
+    software_tso(make_frame({1000, len, ack | psh | fin, 1000, 77, 1, mss}), false, out);
+    BOOST_REQUIRE_EQUAL(out.size(), (len + mss - 1) / mss);
+    uint32_t seq = 1000;
+    uint16_t id = 100;
+    for (size_t i = 0; i < out.size(); i++) {
+        auto& p = out[i];
+        bool last = i + 1 == out.size();
+        BOOST_REQUIRE_EQUAL(seq_of(p), seq);
+        BOOST_REQUIRE_EQUAL(p.len() - hdr_len, last ? len - i * mss : mss);
+        BOOST_REQUIRE_EQUAL(read_be<uint16_t>(headers(p) + ip_off + 4), id++);
+        // Only the last segment ends the data
+        BOOST_REQUIRE_EQUAL(flags_of(p), last ? ack | psh | fin : ack);
+        BOOST_REQUIRE(!p.offload_info_ref().needs_csum);
+        BOOST_REQUIRE_EQUAL(p.offload_info_ref().tso_seg_size, 0);
+        check_frame(p);
+        seq += p.len() - hdr_len;
+    }
+    BOOST_REQUIRE_EQUAL(seq, 1000 + len);
+}
+
+BOOST_AUTO_TEST_CASE(test_tso_leaves_checksum_to_device) {
+    circular_buffer<packet> out;
+    software_tso(make_frame({1000, 3000, ack | psh, 1000, 77, 1, 1448}), true, out);
+    BOOST_REQUIRE_EQUAL(out.size(), 3u);
+    for (auto& p : out) {
+        // The field holds the pseudo header of the segment, as the device expects.
+        BOOST_REQUIRE(p.offload_info_ref().needs_csum);
+        software_l4_csum(p);
+        check_frame(p);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_gro_merges_in_order_segments) {
+    software_gro gro;
+    BOOST_REQUIRE(!gro.add(make_frame({1000, 1448})));
+    BOOST_REQUIRE(gro.add(make_frame({2448, 1448})));
+    BOOST_REQUIRE(gro.add(make_frame({3896, 1448})));
+    BOOST_REQUIRE(gro.add(make_frame({5344, 1448, ack | psh})));
+    auto frames = flush(gro);
+    BOOST_REQUIRE(gro.empty());
+    BOOST_REQUIRE_EQUAL(frames.size(), 1u);
+    BOOST_REQUIRE_EQUAL(seq_of(frames[0]), 1000u);
+    BOOST_REQUIRE_EQUAL(frames[0].len() - hdr_len, 4 * 1448u);
+    BOOST_REQUIRE_EQUAL(flags_of(frames[0]), ack | psh);
+    // The merged frame's TCP checksum is not recomputed, so only check the IP header.
+    auto h = headers(frames[0]);
+    BOOST_REQUIRE_EQUAL(read_be<uint16_t>(h + ip_off + 2), frames[0].len() - ip_off);
+    BOOST_REQUIRE_EQUAL(ip_checksum(h + ip_off, 20), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_gro_stops_at_psh) {
+    software_gro gro;
+    gro.add(make_frame({1000, 1448}));
+    BOOST_REQUIRE(gro.add(make_frame({2448, 1448, ack | psh})));
+    BOOST_REQUIRE(!gro.add(make_frame({3896, 1448})));
+    auto frames = flush(gro);
+    BOOST_REQUIRE_EQUAL(frames.size(), 2u);
+    BOOST_REQUIRE_EQUAL(frames[0].len() - hdr_len, 2 * 1448u);
+    BOOST_REQUIRE_EQUAL(seq_of(frames[1]), 3896u);
+}
+
+BOOST_AUTO_TEST_CASE(test_gro_stops_at_short_segment) {
+    software_gro gro;
+    gro.add(make_frame({1000, 1448}));
+    BOOST_REQUIRE(gro.add(make_frame({2448, 500})));
+    BOOST_REQUIRE(!gro.add(make_frame({2948, 1448})));
+    auto frames = flush(gro);
+    BOOST_REQUIRE_EQUAL(frames.size(), 2u);
+    BOOST_REQUIRE_EQUAL(frames[0].len() - hdr_len, 1448u + 500u);
+    BOOST_REQUIRE_EQUAL(seq_of(frames[1]), 2948u);
+}
+
+BOOST_AUTO_TEST_CASE(test_gro_stops_at_header_changes) {
+    software_gro gro;
+    gro.add(make_frame({1000, 1448}));
+    // Another timestamp
+    BOOST_REQUIRE(!gro.add(make_frame({2448, 1448, ack, 1000, 77, 2})));
+    // Another acknowledgment number
+    BOOST_REQUIRE(!gro.add(make_frame({3896, 1448, ack, 1000, 78, 2})));
+    // Not a bare ACK
+    BOOST_REQUIRE(!gro.add(make_frame({5344, 1448, ack | fin, 1000, 78, 2})));
+    BOOST_REQUIRE_EQUAL(flush(gro).size(), 4u);
+}
+
+BOOST_AUTO_TEST_CASE(test_gro_keeps_flow_order) {
+    software_gro gro;
+    gro.add(make_frame({1000, 1448}));
+    // A gap: the segment must not be merged, nor later ones overtake it.
+    BOOST_REQUIRE(!gro.add(make_frame({3896, 1448})));
+    BOOST_REQUIRE(!gro.add(make_frame({2448, 1448})));
+    auto frames = flush(gro);
+    BOOST_REQUIRE_EQUAL(frames.size(), 3u);
+    BOOST_REQUIRE_EQUAL(seq_of(frames[0]), 1000u);
+    BOOST_REQUIRE_EQUAL(seq_of(frames[1]), 3896u);
+    BOOST_REQUIRE_EQUAL(seq_of(frames[2]), 2448u);
+}
+
+BOOST_AUTO_TEST_CASE(test_gro_interleaved_flows) {
+    software_gro gro;
+    gro.add(make_frame({1000, 1448, ack, 1000}));
+    gro.add(make_frame({5000, 1448, ack, 1001}));
+    BOOST_REQUIRE(gro.add(make_frame({2448, 1448, ack, 1000})));
+    BOOST_REQUIRE(gro.add(make_frame({6448, 1448, ack, 1001})));
+    auto frames = flush(gro);
+    BOOST_REQUIRE_EQUAL(frames.size(), 2u);
+    BOOST_REQUIRE_EQUAL(seq_of(frames[0]), 1000u);
+    BOOST_REQUIRE_EQUAL(frames[0].len() - hdr_len, 2 * 1448u);
+    BOOST_REQUIRE_EQUAL(seq_of(frames[1]), 5000u);
+    BOOST_REQUIRE_EQUAL(frames[1].len() - hdr_len, 2 * 1448u);
+}
@@ -22,8 +22,13 @@
 #include "core/reactor.hh"
 #include "core/app-template.hh"
 #include "core/print.hh"
+#include "core/future-util.hh"
+#include "core/sharded.hh"
+#include "core/sleep.hh"
+#include <atomic>
 
 using namespace seastar;
+using namespace std::chrono_literals;
 
 future<bool> test_smp_call() {
     return smp::submit_to(1, [] {
@@ -57,6 +62,207 @@ future<bool> test_smp_exception() {
     });
 }
 
+future<bool> test_smp_submit_many() {
+    auto make_func = [] (int i) {
+        return [i] { return make_ready_future<int>(i * 2); };
+    };
+    // More than fits in the queue at once, to exercise the overflow path.
+    std::vector<decltype(make_func(0))> funcs;
+    for (int i = 0; i < 200; ++i) {
+        funcs.push_back(make_func(i));
+    }
+    auto futs = smp::submit_many_to(1, std::move(funcs));
+    return when_all(futs.begin(), futs.end()).then([] (std::vector<future<int>> results) {
+        for (int i = 0; i < 200; ++i) {
+            if (results[i].get0() != i * 2) {
+                return make_ready_future<bool>(false);
+            }
+        }
+        return make_ready_future<bool>(true);
+    });
+}
+
+// Messages from test_smp_backlog() running on shard 1
+static thread_local unsigned backlog_running;
+static thread_local unsigned backlog_max_running;
+
+// Saturates the queue to shard 1 with messages that keep running there for a
+// while. Each holds its place in the backlog until it completes, so with
+// --smp-max-backlog the submitter must wait rather than queue more of them.
+future<bool> test_smp_backlog(unsigned max_backlog) {
+    std::vector<future<>> futs;
+    for (int i = 0; i < 200; ++i) {
+        futs.push_back(smp::submit_to(1, [] {
+            backlog_max_running = std::max(backlog_max_running, ++backlog_running);
+            return sleep(10ms).then([] {
+                --backlog_running;
+            });
+        }));
+    }
+    return when_all(futs.begin(), futs.end()).then([max_backlog] (std::vector<future<>> results) {
+        bool ok = true;
+        for (auto& f : results) {
+            if (f.failed()) {
+                f.ignore_ready_future();
+                ok = false;
+            }
+        }
+        return smp::submit_to(1, [] { return backlog_max_running; }).then([ok, max_backlog] (unsigned max_running) {
+            return ok && (!max_backlog || max_running <= max_backlog);
+        });
+    });
+}
+
+future<bool> test_smp_topology() {
+    // Every shard belongs to exactly one socket, and distances are symmetric.
+    unsigned seen = 0;
+    for (unsigned socket = 0; socket < smp::nr_sockets(); ++socket) {
+        for (auto shard : smp::shards_on_socket(socket)) {
+            if (smp::socket_of(shard) != socket) {
+                return make_ready_future<bool>(false);
+            }
+            ++seen;
+        }
+    }
+    for (auto a : smp::all_cpus()) {
+        for (auto b : smp::all_cpus()) {
+            if (smp::distance(a, b) != smp::distance(b, a)
+                    || (smp::distance(a, b) == smp::shard_distance::same_shard) != (a == b)) {
+                return make_ready_future<bool>(false);
+            }
+        }
+    }
+    return make_ready_future<bool>(seen == smp::count);
+}
+
+future<bool> test_smp_invoke_on_all() {
+    static thread_local unsigned calls;
+    return smp::invoke_on_all([] { ++calls; }).then([] {
+        auto cpus = smp::all_cpus();
+        return map_reduce(cpus.begin(), cpus.end(), [] (unsigned id) {
+            return smp::submit_to(id, [] { return calls; });
+        }, 0u, std::plus<unsigned>());
+    }).then([] (unsigned total) {
+        return total == smp::count;
+    });
+}
+
+future<bool> test_smp_invoke_on_all_exception() {
+    static thread_local unsigned calls;
+    return smp::invoke_on_all([] {
+        ++calls;
+        if (engine().cpu_id() == smp::count - 1) {
+            throw nasty_exception();
+        }
+    }).then_wrapped([] (future<> f) {
+        if (!f.failed()) {
+            return make_ready_future<bool>(false);
+        }
+        f.ignore_ready_future();
+        // The failure on one shard does not keep the others from running.
+        auto cpus = smp::all_cpus();
+        return map_reduce(cpus.begin(), cpus.end(), [] (unsigned id) {
+            return smp::submit_to(id, [] { return calls; });
+        }, 0u, std::plus<unsigned>()).then([] (unsigned total) {
+            return total == smp::count;
+        });
+    });
+}
+
+// Counts being copied or destroyed on a shard other than the one it was
+// made on, which would race with that shard on shard-local state.
+struct shard_bound_func {
+    static std::atomic<unsigned> foreign_uses;
+    static thread_local unsigned calls;
+    unsigned owner = engine().cpu_id();
+    shard_bound_func() = default;
+    shard_bound_func(const shard_bound_func& other) {
+        foreign_uses += other.owner != engine().cpu_id();
+    }
+    ~shard_bound_func() {
+        foreign_uses += owner != engine().cpu_id();
+    }
+    void operator()() const {
+        ++calls;
+    }
+};
+
+std::atomic<unsigned> shard_bound_func::foreign_uses;
+thread_local unsigned shard_bound_func::calls;
+
+future<bool> test_smp_invoke_on_all_copies() {
+    return smp::invoke_on_all(shard_bound_func()).then([] {
+        auto cpus = smp::all_cpus();
+        return map_reduce(cpus.begin(), cpus.end(), [] (unsigned id) {
+            return smp::submit_to(id, [] { return shard_bound_func::calls; });
+        }, 0u, std::plus<unsigned>());
+    }).then([] (unsigned total) {
+        return total == smp::count && shard_bound_func::foreign_uses == 0;
+    });
+}
+
+struct counter_service {
+    unsigned calls = 0;
+    void add(unsigned n) {
+        calls += n;
+    }
+    future<> stop() {
+        return make_ready_future<>();
+    }
+};
+
+future<bool> test_sharded_invoke_on_all() {
+    auto s = make_lw_shared<sharded<counter_service>>();
+    return s->start().then([s] {
+        return s->invoke_on_all([] (counter_service& c) { c.calls++; });
+    }).then([s] {
+        return s->invoke_on_all(&counter_service::add, 2u);
+    }).then([s] {
+        return s->map_reduce0([] (counter_service& c) { return c.calls; }, 0u, std::plus<unsigned>());
+    }).then([s] (unsigned total) {
+        return s->stop().then([total] {
+            return total == 3 * smp::count;
+        });
+    });
+}
+
+future<bool> test_smp_submit_stealable() {
+    return create_stealable_scheduling_group("stealable", 100).then([] (scheduling_group sg) {
+        // Functions that ran on a shard other than the one they were submitted on
+        static std::atomic<unsigned> stolen;
+        auto origin = engine().cpu_id();
+        std::vector<future<int>> futs;
+        for (int i = 0; i < 2000; ++i) {
+            futs.push_back(smp::submit_stealable(sg, [i, origin] {
+                stolen += engine().cpu_id() != origin;
+                // Keep the origin shard busy long enough for others to steal
+                auto end = std::chrono::steady_clock::now() + 100us;
+                while (std::chrono::steady_clock::now() < end) {
+                }
+                if (i == 1000) {
+                    throw nasty_exception();
+                }
+                return i * 2;
+            }));
+        }
+        // Idle shards look for work to steal only while awake, so wake one up.
+        smp::submit_to((origin + 1) % smp::count, [] {});
+        return when_all(futs.begin(), futs.end()).then([sg] (std::vector<future<int>> results) {
+            for (int i = 0; i < 2000; ++i) {
+                if (i == 1000) {
+                    if (!results[i].failed()) {
+                        return false;
+                    }
+                    results[i].ignore_ready_future();
+                } else if (results[i].get0() != i * 2) {
+                    return false;
+                }
+            }
+            return sg.is_stealable() && (smp::count == 1 || stolen > 0);
+        });
+    });
+}
+
 int tests, fails;
 
 future<>
@@ -69,9 +275,27 @@ report(sstring msg, future<bool>&& result) {
 }
 
 int main(int ac, char** av) {
-    return app_template().run_deprecated(ac, av, [] {
+    app_template app;
+    return app.run_deprecated(ac, av, [&app] {
+       auto max_backlog = app.configuration()["smp-max-backlog"].as<unsigned>();
        return report("smp call", test_smp_call()).then([] {
            return report("smp exception", test_smp_exception());
+       }).then([] {
+           return report("smp submit many", test_smp_submit_many());
+       }).then([max_backlog] {
+           return report("smp backlog", test_smp_backlog(max_backlog));
+       }).then([] {
+           return report("smp topology", test_smp_topology());
+       }).then([] {
+           return report("smp invoke on all", test_smp_invoke_on_all());
+       }).then([] {
+           return report("smp invoke on all exception", test_smp_invoke_on_all_exception());
+       }).then([] {
+           return report("smp invoke on all copies", test_smp_invoke_on_all_copies());
+       }).then([] {
+           return report("sharded invoke on all", test_sharded_invoke_on_all());
+       }).then([] {
+           return report("smp submit stealable", test_smp_submit_stealable());
        }).then([] {
            print("\n%d tests / %d failures\n", tests, fails);
            engine().exit(fails ? 1 : 0);
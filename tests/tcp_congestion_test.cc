@@ -0,0 +1,202 @@
+/*
+ * This file is open source software, licensed to you under the terms
+ * of the Apache License, Version 2.0 (the "License").  See the NOTICE file
+ * distributed with this work for additional information regarding copyright
+ * ownership.  You may not use this file except in compliance with the License.
+ *
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+/*
+ * Copyright (C) 2018 ScyllaDB
+ */
+
+
+#define BOOST_TEST_MODULE core
+
+#include <boost/test/included/unit_test.hpp>
+#include "net/tcp-congestion.hh"
+
+using namespace seastar;
+using namespace net;
+using namespace std::chrono_literals;
+
+static tcp_ack_sample ack(steady_clock_type::time_point now, uint32_t acked, uint32_t flight_size) {
+    tcp_ack_sample s;
+    s.now = now;
+    s.acked = acked;
+    s.flight_size = flight_size;
+    s.rtt = 10ms;
+    return s;
+}
+
+BOOST_AUTO_TEST_CASE(test_parse_algorithm) {
+    BOOST_REQUIRE(parse_tcp_congestion_algorithm("reno") == tcp_congestion_algorithm::reno);
+    BOOST_REQUIRE(parse_tcp_congestion_algorithm("cubic") == tcp_congestion_algorithm::cubic);
+    BOOST_REQUIRE(parse_tcp_congestion_algorithm("bbr") == tcp_congestion_algorithm::bbr);
+    BOOST_REQUIRE_THROW(parse_tcp_congestion_algorithm("vegas"), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(test_reno_counts_bytes) {
+    auto cc = make_tcp_congestion_control(tcp_congestion_algorithm::reno);
+    auto now = steady_clock_type::now();
+    tcp_congestion_window w{1000, 10000, 15000};
+    // A stretch ACK grows the window by what it acknowledges, up to ssthresh
+    cc->on_ack(w, ack(now, 4000, 0));
+    BOOST_REQUIRE_EQUAL(w.cwnd, 14000u);
+    cc->on_ack(w, ack(now, 4000, 0));
+    BOOST_REQUIRE_EQUAL(w.cwnd, 15000u);
+    // Congestion avoidance: one segment per window acknowledged
+    cc->on_ack(w, ack(now, 10000, 0));
+    BOOST_REQUIRE_EQUAL(w.cwnd, 15000u);
+    cc->on_ack(w, ack(now, 5000, 0));
+    BOOST_REQUIRE_EQUAL(w.cwnd, 16000u);
+    BOOST_REQUIRE_EQUAL(cc->ssthresh_after_loss(w, 16000, now), 8000u);
+    BOOST_REQUIRE_EQUAL(cc->ssthresh_after_loss(w, 1000, now), 2000u);
+}
+
+BOOST_AUTO_TEST_CASE(test_cubic_regrows_to_last_maximum) {
+    auto cc = make_tcp_congestion_control(tcp_congestion_algorithm::cubic);
+    auto now = steady_clock_type::now();
+    tcp_congestion_window w{1000, 100000, 50000};
+    w.ssthresh = cc->ssthresh_after_loss(w, w.cwnd, now);
+    BOOST_REQUIRE_EQUAL(w.ssthresh, 70000u);
+    w.cwnd = w.ssthresh;
+    // K = cbrt(30 / 0.4) ~ 4.2s: slow growth at first, back to the
+    // previous maximum after K, and beyond it afterwards
+    for (auto t = 0ms; t < 8s; t += 10ms) {
+        cc->on_ack(w, ack(now + t, w.cwnd / 100, w.cwnd));
+        if (t == 1s) {
+            BOOST_REQUIRE_LT(w.cwnd, 95000u);
+        }
+    }
+    BOOST_REQUIRE_GT(w.cwnd, 100000u);
+}
+
+BOOST_AUTO_TEST_CASE(test_bbr_restores_window_after_recovery) {
+    auto cc = make_tcp_congestion_control(tcp_congestion_algorithm::bbr);
+    auto now = steady_clock_type::now();
+    tcp_congestion_window w{1000, 40000, 0};
+    auto ssthresh = cc->ssthresh_after_loss(w, 30000, now);
+    BOOST_REQUIRE_EQUAL(ssthresh, 30000u);
+    w.cwnd = ssthresh;
+    cc->on_recovery_exit(w, 20000);
+    BOOST_REQUIRE_EQUAL(w.cwnd, 40000u);
+    cc->on_timeout(w, 40000, true, now);
+    BOOST_REQUIRE_EQUAL(w.cwnd, 1000u);
+}
+
+// A sender limited by BBR's window and pacing rate, over a path with a 10ms
+// round trip and a 10MB/s bottleneck, whose queue stretches the round trip
+// once more than the bandwidth-delay product is in flight.
+struct bbr_path {
+    static constexpr uint16_t mss = 1000;
+    static constexpr double bottleneck = 10e6;
+    std::unique_ptr<tcp_congestion_control> cc = make_tcp_congestion_control(tcp_congestion_algorithm::bbr);
+    tcp_congestion_window w{mss, 10 * mss, 0};
+    // Well past the clock's epoch, as on any host that has been up a while
+    steady_clock_type::time_point now = steady_clock_type::time_point() + 24h;
+    // When a sample last measured the path's minimum round trip
+    steady_clock_type::time_point last_min_rtt;
+    uint64_t delivered = 0;
+
+    // Sends what the window and the pacing rate allow in a round trip, and
+    // acknowledges it a segment at a time, calling check() after each ACK.
+    template <typename Func>
+    void round(std::chrono::microseconds extra_delay, Func&& check) {
+        uint64_t flight = w.cwnd;
+        if (auto rate = cc->pacing_rate()) {
+            flight = std::min(flight, rate / 100);
+        }
+        auto n = std::max<uint64_t>(flight / mss, 1);
+        flight = n * mss;
+        auto rtt = std::max<std::chrono::microseconds>(10ms, std::chrono::microseconds(uint64_t(flight * 1e6 / bottleneck))) + extra_delay;
+        for (uint64_t i = 0; i < n; i++) {
+            now += rtt / n;
+            delivered += mss;
+            tcp_ack_sample s = ack(now, mss, flight);
+            s.rtt = rtt;
+            s.delivered = delivered;
+            s.prior_delivered = delivered > flight ? delivered - flight : 0;
+            s.interval = rtt;
+            if (rtt == 10ms) {
+                last_min_rtt = now;
+            }
+            cc->on_ack(w, s);
+            check();
+        }
+    }
+    enum class phase { startup, drain, probe_bw };
+    // Tells the state by the pacing gain
+    phase current_phase() const {
+        auto gain = double(cc->pacing_rate()) / cc->bandwidth();
+        return gain > 2 ? phase::startup : gain < 0.5 ? phase::drain : phase::probe_bw;
+    }
+    // Runs until the model moves to PROBE_BW, returning the phases seen.
+    std::vector<phase> run_to_probe_bw() {
+        std::vector<phase> phases{phase::startup};
+        for (unsigned i = 0; i < 50 && phases.back() != phase::probe_bw; i++) {
+            round(0us, [this, &phases] {
+                if (cc->bandwidth() && current_phase() != phases.back()) {
+                    phases.push_back(current_phase());
+                }
+            });
+        }
+        return phases;
+    }
+};
+
+constexpr uint16_t bbr_path::mss;
+constexpr double bbr_path::bottleneck;
+
+BOOST_AUTO_TEST_CASE(test_bbr_startup_grows_window) {
+    bbr_path p;
+    // No PROBE_RTT on the first ACK, nor anything else shrinking the window
+    p.round(0us, [&p] {
+        BOOST_REQUIRE_GE(p.w.cwnd, 10 * p.mss);
+    });
+    for (unsigned i = 0; i < 3; i++) {
+        auto cwnd = p.w.cwnd;
+        p.round(0us, [&p] {
+            BOOST_REQUIRE(p.current_phase() == bbr_path::phase::startup);
+        });
+        // Slow start like growth while the pipe is not full
+        BOOST_REQUIRE_GE(p.w.cwnd, 2 * cwnd);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_bbr_drains_after_full_pipe) {
+    bbr_path p;
+    auto phases = p.run_to_probe_bw();
+    BOOST_REQUIRE_EQUAL(phases.size(), 3u);
+    BOOST_REQUIRE(phases[1] == bbr_path::phase::drain);
+    BOOST_REQUIRE(phases[2] == bbr_path::phase::probe_bw);
+    // The bandwidth estimate is the bottleneck's
+    BOOST_REQUIRE_CLOSE(double(p.cc->bandwidth()), bbr_path::bottleneck, 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_bbr_probes_rtt_after_window) {
+    bbr_path p;
+    p.run_to_probe_bw();
+    // A standing queue hides the path's minimum round trip from now on
+    auto expiry = p.last_min_rtt + 10s;
+    std::experimental::optional<steady_clock_type::time_point> probe_rtt;
+    while (!probe_rtt) {
+        p.round(2ms, [&p, &probe_rtt, expiry] {
+            if (p.now <= expiry) {
+                BOOST_REQUIRE_GT(p.w.cwnd, 4 * p.mss);
+            } else if (!probe_rtt && p.w.cwnd == 4 * p.mss) {
+                probe_rtt = p.now;
+            }
+        });
+    }
+    BOOST_REQUIRE(*probe_rtt - expiry < 100ms);
+}